@@ -5,24 +5,79 @@
 
 #include "AbstractService.hpp"
 #include "Exceptions.hpp"
+#include "Log.hpp"
 
+#include "QtDicom/AcceptorAssociation.hpp"
 #include "QtDicom/Association.hpp"
 #include "QtDicom/Dataset.hpp"
 
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcostrmb.h>
+#include <dcmtk/dcmdata/dcxfer.h>
 #include <dcmtk/dcmnet/assoc.h>
+#include <dcmtk/dcmnet/dcmtrans.h>
 #include <dcmtk/dcmnet/dimse.h>
+#include <dcmtk/dcmnet/dul.h>
+
+
+/**
+ * The PDU length used when the peer doesn't limit it.
+ */
+static const Uint32 DefaultMaxPdu = 64 * 1024;
+
+
+/**
+ * The length of a PDU header: its type, a reserved byte and 4 bytes of length.
+ */
+static const int PduHeader = 6;
+
+
+/**
+ * Appends the \a value to the \a buffer in big endian order, as PDUs are
+ * encoded.
+ */
+static void appendUint32( QByteArray & buffer, quint32 value ) {
+	buffer.append( static_cast< char >( value >> 24 ) );
+	buffer.append( static_cast< char >( value >> 16 ) );
+	buffer.append( static_cast< char >( value >> 8 ) );
+	buffer.append( static_cast< char >( value ) );
+}
+
+
+/**
+ * Returns the \a dataset encoded in the \a syntax.
+ */
+static QByteArray encoded( DcmDataset & dataset, E_TransferSyntax syntax ) {
+	QByteArray buffer(
+		static_cast< int >( dataset.getLength( syntax, EET_ExplicitLength ) ), '\0'
+	);
+	DcmOutputBufferStream stream( buffer.data(), buffer.size() );
+
+	dataset.transferInit();
+	const OFCondition Result = dataset.write( stream, syntax, EET_ExplicitLength, 0 );
+	dataset.transferEnd();
+
+	if ( Result.bad() ) {
+		throw OperationFailedException(
+			QString( "Failed to encode a Data Set. %1." ).arg( Result.text() )
+		);
+	}
+	return buffer;
+}
 
 
 namespace Dicom {
 
 AbstractService::AbstractService() :
-	association_( 0 )
+	association_( 0 ),
+	peerAssociation_( 0 )
 {
 }
 
 
 AbstractService::AbstractService( Association * association ) :
-	association_( association )
+	association_( association ),
+	peerAssociation_( 0 )
 {
 }
 
@@ -31,6 +86,45 @@ AbstractService::~AbstractService() {
 }
 
 
+void AbstractService::appendPdvs(
+	QByteArray & stream, int & pdu, quint32 maxPdu,
+	const QByteArray & Data, unsigned char id, bool command
+) {
+	// Each PDV item takes 4 bytes of length, the context ID and the header
+	static const int PdvHeader = 6;
+
+	int offset = 0;
+	bool last = false;
+	while ( ! last ) {
+		if ( pdu < 0 ) {
+			pdu = stream.size();
+			stream.append( '\x04' );
+			stream.append( QByteArray( PduHeader - 1, '\0' ) );
+		}
+
+		const int Room =
+			static_cast< int >( maxPdu ) - ( stream.size() - pdu - PduHeader ) -
+			PdvHeader
+		;
+		if ( Room <= 0 ) {
+			closePdu( stream, pdu );
+			continue;
+		}
+
+		const int Length = qMin( Room, Data.size() - offset );
+		last = offset + Length == Data.size();
+
+		appendUint32( stream, Length + 2 );
+		stream.append( static_cast< char >( id ) );
+		stream.append( static_cast< char >(
+			( command ? 0x01 : 0x00 ) | ( last ? 0x02 : 0x00 )
+		) );
+		stream.append( Data.constData() + offset, Length );
+		offset += Length;
+	}
+}
+
+
 Association * AbstractService::association() {
 	return association_;
 }
@@ -47,6 +141,20 @@ void AbstractService::clearErrorStatus() {
 }
 
 
+void AbstractService::closePdu( QByteArray & stream, int & pdu ) {
+	if ( pdu < 0 ) {
+		return;
+	}
+
+	const quint32 Length = stream.size() - pdu - PduHeader;
+	stream[ pdu + 2 ] = static_cast< char >( Length >> 24 );
+	stream[ pdu + 3 ] = static_cast< char >( Length >> 16 );
+	stream[ pdu + 4 ] = static_cast< char >( Length >> 8 );
+	stream[ pdu + 5 ] = static_cast< char >( Length );
+	pdu = -1;
+}
+
+
 const QString & AbstractService::commandName( int command ) {
 	switch ( command ) {
 #define CASE( VALUE, NAME ) \
@@ -54,10 +162,13 @@ const QString & AbstractService::commandName( int command ) {
 			static const QString TheName( NAME ); \
 			return TheName; \
 		}
+		CASE( DIMSE_C_CANCEL_RQ,  "C-CANCEL-RQ"  );
 		CASE( DIMSE_C_ECHO_RQ,    "C-ECHO-RQ"    );
 		CASE( DIMSE_C_ECHO_RSP,   "C-ECHO-RSP"   );
 		CASE( DIMSE_C_FIND_RQ,    "C-FIND-RQ"    );
 		CASE( DIMSE_C_FIND_RSP,   "C-FIND-RSP"   );
+		CASE( DIMSE_C_GET_RQ,     "C-GET-RQ"     );
+		CASE( DIMSE_C_GET_RSP,    "C-GET-RSP"    );
 		CASE( DIMSE_C_MOVE_RQ,    "C-MOVE-RQ"    );
 		CASE( DIMSE_C_MOVE_RSP,   "C-MOVE-RSP"   );
 		CASE( DIMSE_C_STORE_RQ,   "C-STORE-RQ"   );
@@ -98,7 +209,7 @@ void AbstractService::ignoreDataset() {
 		&bytes, &count
 	);
 	if ( Result.good() ) {
-		qDebug( "Ignoring a dataset (%d bytes in %d units).", bytes, count );
+		QDICOM_LOG( Dimse, Debug, "Ignoring a dataset (%d bytes in %d units).", bytes, count );
 	}
 	else {
 		throw OperationFailedException(
@@ -112,6 +223,38 @@ void AbstractService::ignoreDataset() {
 }
 
 
+QString AbstractService::peerAeTitle() const {
+	if ( ! association() || ! association()->tAscAssociation() ) {
+		return QString( "" );
+	}
+
+	// Metrics label every command with the title, it is read only once per
+	// DCMTK association
+	T_ASC_Association * const Current = association()->tAscAssociation();
+	if ( Current == peerAssociation_ ) {
+		return peerAeTitle_;
+	}
+
+	// Acceptors are called by their peers, requestors call them
+	QByteArray ae( 32, '\0' );
+	if ( qobject_cast< const AcceptorAssociation * >( association() ) ) {
+		ASC_getAPTitles( Current->params, ae.data(), 0, 0 );
+	}
+	else {
+		ASC_getAPTitles( Current->params, 0, ae.data(), 0 );
+	}
+
+	peerAssociation_ = Current;
+	peerAeTitle_ = QString( ae.simplified() );
+	return peerAeTitle_;
+}
+
+
+const QPresentationContextTable & AbstractService::presentationContextTable() const {
+	return contextTable_;
+}
+
+
 void AbstractService::raiseError( const QString & Message ) {
 	errorFlag_ = true;
 	errorMessage_ = Message;
@@ -131,7 +274,7 @@ T_DIMSE_Message AbstractService::receiveCommand(
 	;
 	const QString & ExpectedCommandName = commandName( ExpectedCommand );	
 
-	qDebug( "Receiving a %s", qPrintable( ExpectedCommandName ) );
+	QDICOM_LOG( Dimse, Debug, "Receiving a %s", qPrintable( ExpectedCommandName ) );
 
 	T_DIMSE_Message message;
 	bzero( ( char * )& message, sizeof( message ) );
@@ -144,8 +287,10 @@ T_DIMSE_Message AbstractService::receiveCommand(
 	);
 
 	if ( Result.good() ) {
+		recordCommand( Metrics::Received, message.CommandField );
+
 		if ( ExpectedCommand == DIMSE_NOTHING  ) {
-			qDebug(
+			QDICOM_LOG( Dimse, Debug,
 				"A %s received",
 				qPrintable( commandName( message.CommandField ) )
 			);
@@ -217,7 +362,11 @@ T_DIMSE_Message AbstractService::receiveCommand(
 
 
 Dataset AbstractService::receiveDataset( unsigned char & id ) {
-	qDebug( "Retrieving a dataset." );
+	QDICOM_LOG( Dimse, Debug, "Retrieving a dataset." );
+
+	QElapsedTimer timer;
+	timer.start();
+	quint64 bytes = 0;
 
 	DcmDataset dataset, * tmp = &dataset;
 	OFCondition result = DIMSE_receiveDataSetInMemory(
@@ -226,7 +375,7 @@ Dataset AbstractService::receiveDataset( unsigned char & id ) {
 		association()->connectionParameters().timeout(),
 		&id,
 		& tmp,
-		0, 0
+		&AbstractService::saveProgress, &bytes
 	);
 	if ( result.bad() ) {
 		throw OperationFailedException(
@@ -234,11 +383,176 @@ Dataset AbstractService::receiveDataset( unsigned char & id ) {
 			.arg( result.text() )
 		);
 	}
+	recordTransfer( Metrics::Received, bytes, timer );
 
 	return Dataset( dataset );
 }
 
 
+void AbstractService::recordCommand(
+	Metrics::Direction direction, int command
+) {
+	const QString Peer = peerAeTitle();
+	const QString & Name = commandName( command );
+
+	Metrics::instance().addCommand( direction, Name, Peer );
+
+	// Responses have the high bit set; cancels don't start a round trip
+	if ( command & 0x8000 ) {
+		if ( ! pendingRequest_.isEmpty() ) {
+			Metrics::instance().addLatency(
+				Metrics::CommandRoundTrip, pendingRequest_, Peer,
+				requestTimer_.nsecsElapsed() / 1000
+			);
+			pendingRequest_.clear();
+		}
+	}
+	else if ( command != DIMSE_C_CANCEL_RQ ) {
+		pendingRequest_ = Name;
+		requestTimer_.start();
+	}
+}
+
+
+void AbstractService::recordTransfer(
+	Metrics::Direction direction,
+	quint64 bytes,
+	const QElapsedTimer & Timer
+) {
+	const QString Peer = peerAeTitle();
+
+	Metrics::instance().addBytes( direction, Peer, bytes );
+	Metrics::instance().addLatency(
+		Metrics::DatasetTransfer, QString(), Peer, Timer.nsecsElapsed() / 1000
+	);
+}
+
+
+void AbstractService::saveProgress( void * context, unsigned long count ) {
+	*static_cast< quint64 * >( context ) = count;
+}
+
+
+void AbstractService::sendCFindResponses(
+	const T_DIMSE_C_FindRQ & Request,
+	unsigned char id,
+	const QList< Dataset > & Identifiers
+) {
+	if ( Identifiers.isEmpty() ) {
+		return;
+	}
+
+	QDICOM_LOG( Dimse, Debug,
+		"Sending %d C-FIND-RSPs at once", Identifiers.size()
+	);
+
+	QElapsedTimer timer;
+	timer.start();
+
+	T_ASC_Association * a = association()->tAscAssociation();
+
+	T_ASC_PresentationContext context;
+	if ( ASC_findAcceptedPresentationContext( a->params, id, &context ).bad() ) {
+		throw OperationFailedException(
+			QString( "No presentation context of ID %1 was accepted." ).arg( id )
+		);
+	}
+	const E_TransferSyntax Syntax =
+		DcmXfer( context.acceptedTransferSyntax ).getXfer()
+	;
+
+	Uint32 maxPdu = a->params->theirMaxPDUReceiveSize;
+	if ( maxPdu == 0 ) {
+		maxPdu = DefaultMaxPdu;
+	}
+
+	// All responses share the same command
+	DcmDataset command;
+	command.putAndInsertString( DCM_AffectedSOPClassUID, Request.AffectedSOPClassUID );
+	command.putAndInsertUint16( DCM_CommandField, DIMSE_C_FIND_RSP );
+	command.putAndInsertUint16( DCM_MessageIDBeingRespondedTo, Request.MessageID );
+	command.putAndInsertUint16( DCM_CommandDataSetType, 0x0000 );
+	command.putAndInsertUint16( DCM_Status, STATUS_Pending );
+	command.computeGroupLengthAndPadding(
+		EGL_withGL, EPD_noChange, EXS_LittleEndianImplicit, EET_ExplicitLength
+	);
+	const QByteArray Command = encoded( command, EXS_LittleEndianImplicit );
+
+	QByteArray stream;
+	int pdu = -1;
+	QList< int > sizes;
+
+	foreach ( const Dataset & Identifier, Identifiers ) {
+		const QByteArray Data = encoded( Identifier.dcmDataset(), Syntax );
+		sizes.append( Data.size() );
+
+		appendPdvs( stream, pdu, maxPdu, Command, id, true );
+		appendPdvs( stream, pdu, maxPdu, Data, id, false );
+	}
+	closePdu( stream, pdu );
+
+	DcmTransportConnection * connection =
+		DUL_getTransportConnection( a->DULassociation )
+	;
+	if ( ! connection ) {
+		throw OperationFailedException( "Association has no connection." );
+	}
+
+	// PDUs are written past DUL, whose state doesn't change with P-DATA-TF
+	// PDUs sent in the Data Transfer state, through the same transport
+	// connection DUL would write them to, which also takes care of TLS, if
+	// negotiated. The connection has no vectored write, and a writev() on
+	// its socket would bypass TLS, so the PDUs are packed into a single
+	// buffer instead; each byte of the identifiers is copied into it once.
+	char * data = stream.data();
+	int left = stream.size();
+	while ( left > 0 ) {
+		const ssize_t Written = connection->write( data, left );
+		if ( Written <= 0 ) {
+			throw OperationFailedException(
+				"Failed to send C-FIND-RSPs; connection closed."
+			);
+		}
+		data += Written;
+		left -= static_cast< int >( Written );
+	}
+
+	foreach ( const int Size, sizes ) {
+		recordCommand( Metrics::Sent, DIMSE_C_FIND_RSP );
+		recordTransfer( Metrics::Sent, Size, timer );
+	}
+}
+
+
+void AbstractService::sendCStoreResponse(
+	int status, const T_DIMSE_C_StoreRQ & Request, unsigned char Id
+) {
+	T_DIMSE_C_StoreRSP responseParams;
+	bzero( ( char * )&responseParams, sizeof( responseParams ) );
+	strcpy( responseParams.AffectedSOPClassUID,    Request.AffectedSOPClassUID );
+    strcpy( responseParams.AffectedSOPInstanceUID, Request.AffectedSOPInstanceUID );
+	responseParams.DataSetType = DIMSE_DATASET_NULL;
+	responseParams.DimseStatus = status;
+	responseParams.MessageIDBeingRespondedTo = Request.MessageID;
+    responseParams.opts = 
+		( O_STORE_AFFECTEDSOPCLASSUID | O_STORE_AFFECTEDSOPINSTANCEUID )
+	;
+    if ( Request.opts & O_STORE_RQ_BLANK_PADDING ) {
+		responseParams.opts |= O_STORE_RSP_BLANK_PADDING;
+	}
+    if ( dcmPeerRequiresExactUIDCopy.get() ) {
+		responseParams.opts |= O_STORE_PEER_REQUIRES_EXACT_UID_COPY;
+	}
+
+	T_DIMSE_Message response;
+	bzero( ( char * )&response, sizeof( response ) );
+	response.CommandField = DIMSE_C_STORE_RSP;
+	response.msg.CStoreRSP = responseParams;
+
+	sendCommand( response, Id );
+}
+
+
 void AbstractService::sendCommand(
 	const T_DIMSE_Message & command, unsigned char id
 ) {
@@ -251,16 +565,20 @@ void AbstractService::sendCommand(
 ) {
 	const QString & CommandName = commandName( Command.CommandField );
 
-	qDebug( "Sending a %s", qPrintable( CommandName ) );
+	QDICOM_LOG( Dimse, Debug, "Sending a %s", qPrintable( CommandName ) );
 
 	// ... fucking DCMTK.
 	T_DIMSE_Message & command = const_cast< T_DIMSE_Message & >( Command );
 
+	QElapsedTimer timer;
+	timer.start();
+	quint64 bytes = 0;
+
 	OFCondition result = DIMSE_sendMessageUsingMemoryData(
 		association()->tAscAssociation(), id,
 		&command, 0,
 		( Data.isEmpty() ? 0 : & Data.dcmDataset() ),
-		0, 0
+		&AbstractService::saveProgress, &bytes
 	);
 	if ( result.bad() ) {
 		throw OperationFailedException(
@@ -269,12 +587,29 @@ void AbstractService::sendCommand(
 			.arg( result.text() )
 		);
 	}
+
+	recordCommand( Metrics::Sent, Command.CommandField );
+	if ( ! Data.isEmpty() ) {
+		recordTransfer( Metrics::Sent, bytes, timer );
+	}
 }
 
 
 void AbstractService::setAssociation( Association * association ) {
+	if ( association_ != association ) {
+		contextTable_ = QPresentationContextTable();
+		peerAssociation_ = 0;
+		pendingRequest_.clear();
+	}
 	association_ = association;
 }
 
 
+void AbstractService::setPresentationContextTable(
+	const QPresentationContextTable & Table
+) {
+	contextTable_ = Table;
+}
+
+
 }; // Namspace DICOM ends here.
@@ -6,10 +6,20 @@
 #ifndef DICOM_ABSTRACTSERVICE_HPP
 #define DICOM_ABSTRACTSERVICE_HPP
 
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
 #include <QtCore/QString>
 
 #include <QtDicom/Globals.hpp>
+#include <QtDicom/Metrics.hpp>
+#include <QtDicom/QPresentationContextTable>
 
+class QtDicomTest;
+
+struct T_ASC_Association;
+struct T_DIMSE_C_FindRQ;
+struct T_DIMSE_C_StoreRQ;
 struct T_DIMSE_Message;
 
 namespace Dicom {
@@ -30,6 +40,8 @@ class Dataset;
  * \author Paweł Żak <pawel.zak@fluxinc.ca>
  */
 class QDICOM_DLLSPEC AbstractService {
+	friend class ::QtDicomTest;
+
 	public :
 		/**
 		 * Returns address of an association being used by a service.
@@ -48,10 +60,25 @@ class QDICOM_DLLSPEC AbstractService {
 		bool hasError() const;
 
 		/**
-		 * Sets \a association to be used by DIMSE messages.
+		 * Returns the table of presentation contexts negotiated for the
+		 * \ref association(). The table is empty unless it was provided with
+		 * \ref setPresentationContextTable().
+		 */
+		const QPresentationContextTable & presentationContextTable() const;
+
+		/**
+		 * Sets \a association to be used by DIMSE messages. Setting a
+		 * different association clears the \ref presentationContextTable().
 		 */
 		void setAssociation( Association * association );
 
+		/**
+		 * Sets the \a table of presentation contexts negotiated for the \ref
+		 * association(). When set, the table is used to look up presentation
+		 * context IDs instead of querying the association each time.
+		 */
+		void setPresentationContextTable( const QPresentationContextTable & table );
+
 	protected :
 		AbstractService();
 		AbstractService( Association * association );
@@ -67,6 +94,13 @@ class QDICOM_DLLSPEC AbstractService {
 		 */
 		void ignoreDataset();
 
+		/**
+		 * Returns the AE title of the peer of the \ref association() or an
+		 * empty string if there's none. The title is read once per
+		 * association.
+		 */
+		QString peerAeTitle() const;
+
 		/**
 		 * When a \a message is a non-empty string, sets both the error flag 
 		 * and the accompanying \a message.
@@ -129,16 +163,88 @@ class QDICOM_DLLSPEC AbstractService {
 			const T_DIMSE_Message & command, const Dataset & dataset, unsigned char ID
 		);
 
+		/**
+		 * Sends pending responses to the C-FIND \a request, received on
+		 * presentation context \a ID, one for each of the \a identifiers.
+		 *
+		 * Responses are encoded up front and packed into as few P-DATA-TF
+		 * PDUs, of the peer's maximum length, as they fit in; all of them
+		 * are written to the association's transport connection at once,
+		 * past DUL, which only passes such PDUs to the same connection.
+		 */
+		void sendCFindResponses(
+			const T_DIMSE_C_FindRQ & request,
+			unsigned char ID,
+			const QList< Dataset > & identifiers
+		);
+
+		/**
+		 * Responds to the C-STORE \a request received on presentation
+		 * context \a ID with the \a status.
+		 */
+		void sendCStoreResponse(
+			int status,
+			const T_DIMSE_C_StoreRQ & request,
+			unsigned char ID
+		);
+
 		/**
 		 * Returns name of a DIMSE \a command. The \a command parameter is 
 		 * DCMTK's enumerator value.
 		 */
 		static const QString & commandName( int command );
 
+		/**
+		 * Records the transfer of a Data Set of \a bytes, in the \a
+		 * direction, started when the \a timer was.
+		 */
+		void recordTransfer(
+			Metrics::Direction direction,
+			quint64 bytes,
+			const QElapsedTimer & timer
+		);
+
+	private :
+		/**
+		 * Appends PDV items of the \a data, a command or a Data Set sent on
+		 * the presentation context \a ID, to the \a stream of P-DATA-TF
+		 * PDUs. Items go to the PDU starting at the \a pdu offset of the
+		 * stream, or \c -1 to start one; PDUs which can't take more are
+		 * closed once their body reaches \a maxPdu bytes. The last item is
+		 * always appended, empty if the \a data is.
+		 */
+		static void appendPdvs(
+			QByteArray & stream, int & pdu, quint32 maxPdu,
+			const QByteArray & data, unsigned char ID, bool command
+		);
+
+		/**
+		 * Fills in the length of the PDU starting at the \a pdu offset of
+		 * the \a stream, if any, and resets the offset to \c -1.
+		 */
+		static void closePdu( QByteArray & stream, int & pdu );
+
+		/**
+		 * Counts the \a command in the \ref Metrics and measures the round
+		 * trip from a request to its first response.
+		 */
+		void recordCommand( Metrics::Direction direction, int command );
+
+		/**
+		 * DIMSE progress callback saving the \a count of bytes transferred
+		 * in the \c quint64 the \a context points to.
+		 */
+		static void saveProgress( void * context, unsigned long count );
+
 	private :
 		Association * association_;
+		QPresentationContextTable contextTable_;
 		bool errorFlag_;
 		QString errorMessage_;
+		mutable T_ASC_Association * peerAssociation_;
+		mutable QString peerAeTitle_;
+		QString pendingRequest_;
+		QElapsedTimer requestTimer_;
 };
 
 }; // Namespace DICOM ends here.
@@ -198,6 +198,14 @@ bool AcceptorAssociation::confirmRelease() {
 }
 
 
+void AcceptorAssociation::drop() {
+	if ( tAscAssociation() ) {
+		ASC_dropAssociation( tAscAssociation() );
+	}
+	setState( Disconnected );
+}
+
+
 QString AcceptorAssociation::parametersText() const {
 	OFString tmp;
 	ASC_dumpParameters( tmp, tAscAssociation()->params, ASC_ASSOC_RQ );
@@ -210,6 +218,15 @@ bool AcceptorAssociation::receive(
 	const ConnectionParameters & Parameters,
 	bool * timedOut
 ) { 
+	return receive( Parameters, timedOut, false );
+}
+
+
+bool AcceptorAssociation::receive(
+	const ConnectionParameters & Parameters,
+	bool * timedOut,
+	bool transportLayer
+) {
 #define RETURN( RESULT, TIMEOUT ) \
 	if ( timedOut ) { \
 		*timedOut = TIMEOUT; \
@@ -225,7 +242,7 @@ bool AcceptorAssociation::receive(
 	OFCondition result = ASC_receiveAssociation(
 		tAscNetwork(), &tAscAssociation(),
 		connectionParameters().maxPdu(),
-		NULL, NULL, false, DUL_NOBLOCK,
+		NULL, NULL, transportLayer, DUL_NOBLOCK,
 		timeout()
 	);
 
@@ -259,4 +276,63 @@ bool AcceptorAssociation::receive( bool * timedOut ) {
 	return receive( connectionParameters(), timedOut );
 }
 
+
+bool AcceptorAssociation::reject( RejectReason reason ) {
+	if ( ! isEstablished() ) {
+		raiseError( "None association request have been received yet." );
+		return false;
+	}
+
+	T_ASC_RejectParameters rejection = {
+		ASC_RESULT_REJECTEDPERMANENT,
+		ASC_SOURCE_SERVICEUSER,
+		ASC_REASON_SU_NOREASON
+	};
+
+	switch ( reason ) {
+		case ApplicationContextNotSupported :
+			rejection.reason = ASC_REASON_SU_APPCONTEXTNAMENOTSUPPORTED;
+			break;
+
+		case CallingAeNotRecognized :
+			rejection.reason = ASC_REASON_SU_CALLINGAETITLENOTRECOGNIZED;
+			break;
+
+		case CalledAeNotRecognized :
+			rejection.reason = ASC_REASON_SU_CALLEDAETITLENOTRECOGNIZED;
+			break;
+
+		case TemporaryCongestion :
+			rejection.result = ASC_RESULT_REJECTEDTRANSIENT;
+			rejection.source = ASC_SOURCE_SERVICEPROVIDER_PRESENTATION_RELATED;
+			rejection.reason = ASC_REASON_SP_PRES_TEMPORARYCONGESTION;
+			break;
+
+		case LocalLimitExceeded :
+			rejection.result = ASC_RESULT_REJECTEDTRANSIENT;
+			rejection.source = ASC_SOURCE_SERVICEPROVIDER_PRESENTATION_RELATED;
+			rejection.reason = ASC_REASON_SP_PRES_LOCALLIMITEXCEEDED;
+			break;
+
+		default :
+			break;
+	}
+
+	const OFCondition Result = ASC_rejectAssociation(
+		tAscAssociation(), &rejection
+	);
+	if ( Result.bad() ) {
+		raiseError(
+			QString( 
+				"Failed to reject an association. "
+				"Internal error description:\n%1"
+			)
+			.arg( Result.text() )
+		);
+		return false;
+	}
+
+	return true;
+}
+
 }; // Namespace DICOM ends here.
\ No newline at end of file
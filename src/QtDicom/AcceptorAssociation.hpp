@@ -29,6 +29,19 @@ namespace Dicom {
 class QDICOM_DLLSPEC AcceptorAssociation : public Association {
 	Q_OBJECT;
 
+	public :
+		/**
+		 * Reasons an association request can be rejected for.
+		 */
+		enum RejectReason {
+			NoReasonGiven,
+			ApplicationContextNotSupported,
+			CallingAeNotRecognized,
+			CalledAeNotRecognized,
+			TemporaryCongestion, /*< Resources are exhausted for a while. */
+			LocalLimitExceeded   /*< A limit of associations was reached. */
+		};
+
 	public :
 		/**
 		 * Creates an acceptor association and sets its \a parent.
@@ -94,12 +107,32 @@ class QDICOM_DLLSPEC AcceptorAssociation : public Association {
 		 */
 		bool confirmRelease();
 
+		/**
+		 * Closes the connection without sending any further PDU, e.g. after
+		 * the request has been rejected with \ref reject().
+		 */
+		void drop();
+
 		/**
 		 * Returns a text block containing parameters requested by last-received
 		 * association request.
 		 */
 		QString parametersText() const;
 
+		/**
+		 * Rejects the received association request, sending an
+		 * A-ASSOCIATE-RJ with the \a reason. Rejections for \ref
+		 * TemporaryCongestion and \ref LocalLimitExceeded are transient,
+		 * telling the requestor it may try again later; other are permanent.
+		 *
+		 * Returns \c true when the rejection has been sent. Otherwise \c
+		 * false is returned and \ref hasError() indicates \c true as well.
+		 * Either way the association should be dropped by the caller with
+		 * \ref drop(); aborting it would follow the A-ASSOCIATE-RJ with an
+		 * A-ABORT.
+		 */
+		bool reject( RejectReason reason );
+
 		/**
 		 * Initiates a network and listents on specified through connection 
 		 * \a parameters port for an incoming association.
@@ -125,6 +158,17 @@ class QDICOM_DLLSPEC AcceptorAssociation : public Association {
 		 * Receives an association on a pre-set \ref connectionParameters().
 		 */
 		bool receive( bool * timedOut = 0 );
+
+	protected :
+		/**
+		 * Receives an association as the public overload does; when \a
+		 * transportLayer is set, DCMTK creates the connection through the
+		 * network's transport layer.
+		 */
+		bool receive(
+			const ConnectionParameters & parameters, bool * timedOut,
+			bool transportLayer
+		);
 };
 
 }; // Namespace DICOM ends here.
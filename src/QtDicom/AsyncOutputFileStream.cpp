@@ -0,0 +1,348 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "AsyncOutputFileStream.hpp"
+
+#include <QtCore/QDir>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QPair>
+#include <QtCore/QQueue>
+#include <QtCore/QThread>
+
+#include <cstring>
+
+
+/**
+ * Number of blocks kept by the pool shared by consumers.
+ */
+static const int MaxPooledBlocks = 64;
+
+
+namespace Dicom {
+
+/**
+ * The \em AsyncFileConsumer::BlockPool class keeps blocks for reuse by all
+ * consumers. At most \c MaxPooledBlocks are allocated, unless a consumer
+ * holding none needs one.
+ */
+class AsyncFileConsumer::BlockPool {
+	public :
+		BlockPool() :
+			allocated_( 0 )
+		{
+		}
+
+		~BlockPool() {
+			qDeleteAll( free_ );
+		}
+
+		/**
+		 * Returns a block to the pool.
+		 */
+		void give( Block * block ) {
+			QMutexLocker locker( &lock_ );
+
+			block->size = 0;
+			if ( allocated_ > MaxPooledBlocks ) {
+				--allocated_;
+				delete block;
+			}
+			else {
+				free_.append( block );
+				returnedCondition_.wakeOne();
+			}
+		}
+
+		/**
+		 * Returns a free block. When the pool is exhausted, waits for a
+		 * block to be returned if \a mayWait is \c true or allocates one
+		 * beyond the limit otherwise.
+		 */
+		Block * take( bool mayWait ) {
+			QMutexLocker locker( &lock_ );
+
+			forever {
+				if ( ! free_.isEmpty() ) {
+					return free_.takeLast();
+				}
+				if ( allocated_ < MaxPooledBlocks || ! mayWait ) {
+					++allocated_;
+					return new Block();
+				}
+				returnedCondition_.wait( &lock_ );
+			}
+		}
+
+	private :
+		int allocated_;
+		QList< Block * > free_;
+		QMutex lock_;
+		QWaitCondition returnedCondition_;
+};
+
+
+AsyncFileConsumer::BlockPool AsyncFileConsumer::pool_;
+
+
+/**
+ * The \em AsyncFileConsumer::Writer is a thread storing blocks queued by
+ * consumers, in the order they were queued.
+ */
+class AsyncFileConsumer::Writer : public QThread {
+	public :
+		Writer() :
+			stopping_( false )
+		{
+		}
+
+		~Writer() {
+			lock_.lock();
+			stopping_ = true;
+			jobsCondition_.wakeAll();
+			lock_.unlock();
+
+			wait();
+		}
+
+		void enqueue( AsyncFileConsumer * consumer, Block * block ) {
+			QMutexLocker locker( &lock_ );
+
+			jobs_.enqueue( qMakePair( consumer, block ) );
+			jobsCondition_.wakeOne();
+		}
+
+	private :
+		void run() {
+			forever {
+				lock_.lock();
+				while ( jobs_.isEmpty() && ! stopping_ ) {
+					jobsCondition_.wait( &lock_ );
+				}
+				if ( jobs_.isEmpty() ) {
+					lock_.unlock();
+					break;
+				}
+				const QPair< AsyncFileConsumer *, Block * > Job = jobs_.dequeue();
+				lock_.unlock();
+
+				Job.first->writeBlock( Job.second );
+			}
+		}
+
+	private :
+		QQueue< QPair< AsyncFileConsumer *, Block * > > jobs_;
+		QWaitCondition jobsCondition_;
+		QMutex lock_;
+		bool stopping_;
+};
+
+
+AsyncFileConsumer::Block::Block() :
+	data( new char[ AsyncFileConsumer::blockSize() ] ),
+	size( 0 )
+{
+}
+
+
+AsyncFileConsumer::Block::~Block() {
+	delete [] data;
+}
+
+
+AsyncFileConsumer::AsyncFileConsumer( const QString & Path ) :
+	current_( 0 ),
+	file_( Path ),
+	queued_( 0 ),
+	status_( EC_Normal ),
+	writer_( nextWriter() ),
+	writeStatus_( EC_Normal )
+{
+	// Blocks are the only buffer, QFile's own would copy the data once more
+	if ( file_.open(
+		QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered
+	) ) {
+		current_ = pool_.take( false );
+	}
+	else {
+		status_ = makeOFCondition(
+			OFM_dcmdata, 18, OF_error,
+			qPrintable(
+				QString( "Unable to open `%1'. %2." )
+				.arg( QDir::toNativeSeparators( Path ) )
+				.arg( file_.errorString() )
+			)
+		);
+	}
+}
+
+
+AsyncFileConsumer::~AsyncFileConsumer() {
+	flush();
+
+	if ( current_ ) {
+		pool_.give( current_ );
+	}
+
+	file_.close();
+}
+
+
+offile_off_t AsyncFileConsumer::avail() const {
+	return good() ? blockSize() : 0;
+}
+
+
+int AsyncFileConsumer::blockCount() {
+	return 8;
+}
+
+
+int AsyncFileConsumer::blockSize() {
+	return 256 * 1024;
+}
+
+
+void AsyncFileConsumer::flush() {
+	if ( current_ && current_->size > 0 ) {
+		queueCurrentBlock();
+	}
+
+	QMutexLocker locker( &lock_ );
+	while ( queued_ > 0 ) {
+		drainedCondition_.wait( &lock_ );
+	}
+}
+
+
+OFBool AsyncFileConsumer::good() const {
+	// Write errors don't stop the producer, they're reported by status()
+	return status_.good();
+}
+
+
+OFBool AsyncFileConsumer::isFlushed() const {
+	QMutexLocker locker( &lock_ );
+
+	return queued_ == 0 && ( ! current_ || current_->size == 0 );
+}
+
+
+AsyncFileConsumer::Writer * AsyncFileConsumer::nextWriter() {
+	static QMutex Lock;
+	QMutexLocker locker( &Lock );
+
+	struct Writers {
+		~Writers() {
+			qDeleteAll( list );
+		}
+
+		QList< Writer * > list;
+	};
+	static Writers Instance;
+	static int Next = 0;
+
+	if ( Instance.list.isEmpty() ) {
+		const int Count = qBound( 1, QThread::idealThreadCount() / 2, 4 );
+		for ( int i = 0; i < Count; ++i ) {
+			Writer * writer = new Writer();
+			writer->start();
+			Instance.list.append( writer );
+		}
+	}
+
+	Next = ( Next + 1 ) % Instance.list.size();
+	return Instance.list.at( Next );
+}
+
+
+void AsyncFileConsumer::queueCurrentBlock() {
+	Block * block = current_;
+
+	// One slow file doesn't take the whole pool
+	QMutexLocker locker( &lock_ );
+	while ( queued_ >= blockCount() - 1 ) {
+		drainedCondition_.wait( &lock_ );
+	}
+	++queued_;
+	locker.unlock();
+
+	writer_->enqueue( this, block );
+
+	// The block just queued returns to the pool, waiting for it is safe
+	current_ = pool_.take( true );
+}
+
+
+OFCondition AsyncFileConsumer::status() const {
+	QMutexLocker locker( &lock_ );
+
+	return status_.bad() ? status_ : writeStatus_;
+}
+
+
+offile_off_t AsyncFileConsumer::write( const void * buffer, offile_off_t length ) {
+	if ( ! good() || ! current_ ) {
+		return 0;
+	}
+
+	const char * Source = static_cast< const char * >( buffer );
+	offile_off_t written = 0;
+
+	while ( written < length ) {
+		const int Count = static_cast< int >( qMin< offile_off_t >(
+			length - written, blockSize() - current_->size
+		) );
+		std::memcpy( current_->data + current_->size, Source + written, Count );
+		current_->size += Count;
+		written += Count;
+
+		if ( current_->size == blockSize() ) {
+			queueCurrentBlock();
+		}
+	}
+
+	return written;
+}
+
+
+void AsyncFileConsumer::writeBlock( Block * block ) {
+	lock_.lock();
+	const bool Good = writeStatus_.good();
+	lock_.unlock();
+
+	// After an error remaining blocks are dropped
+	const qint64 Written = Good ? file_.write( block->data, block->size ) : 0;
+	const int Size = block->size;
+	pool_.give( block );
+
+	QMutexLocker locker( &lock_ );
+	if ( Good && Written != Size ) {
+		writeStatus_ = makeOFCondition(
+			OFM_dcmdata, 18, OF_error,
+			qPrintable(
+				QString( "Unable to write to `%1'. %2." )
+				.arg( QDir::toNativeSeparators( file_.fileName() ) )
+				.arg( file_.errorString() )
+			)
+		);
+	}
+
+	--queued_;
+	drainedCondition_.wakeAll();
+}
+
+
+AsyncOutputFileStream::AsyncOutputFileStream( const QString & Path ) :
+	DcmOutputStream( &consumer_ ),
+	consumer_( Path )
+{
+}
+
+
+AsyncOutputFileStream::~AsyncOutputFileStream() {
+	flush();
+}
+
+}; // Namespace DICOM ends here.
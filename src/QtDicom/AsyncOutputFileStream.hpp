@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_ASYNCOUTPUTFILESTREAM_HPP
+#define DICOM_ASYNCOUTPUTFILESTREAM_HPP
+
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QWaitCondition>
+
+#include "QtDicom/Globals.hpp"
+
+#include <dcmtk/config/osconfig.h>
+#include <dcmtk/dcmdata/dcostrma.h>
+
+namespace Dicom {
+
+/**
+ * The \em AsyncFileConsumer class is a DCMTK consumer writing data to a file
+ * in the background.
+ *
+ * Written data is gathered in blocks taken from a pool shared by all
+ * consumers, so memory doesn't grow with the number of files being written.
+ * Full blocks are queued to one of writer threads shared by all consumers,
+ * so the thread producing the data (receiving it from network, for example)
+ * doesn't wait for the disk. When a consumer has queued its share of blocks,
+ * or the pool is exhausted, \ref write() blocks until the disk catches up.
+ *
+ * Errors encountered by writers are reported by \ref status() once all data
+ * have been written, i.e. after \ref flush(). Until then the consumer keeps
+ * accepting, and dropping, data, so the producer can finish reading it.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC AsyncFileConsumer : public DcmConsumer {
+	public :
+		/**
+		 * Creates a consumer writing to the file in the \a path, which is
+		 * truncated.
+		 */
+		AsyncFileConsumer( const QString & path );
+
+		/**
+		 * Writes remaining data, closes the file and destroys the consumer.
+		 */
+		~AsyncFileConsumer();
+
+		offile_off_t avail() const;
+		void flush();
+		OFBool good() const;
+		OFBool isFlushed() const;
+		OFCondition status() const;
+		offile_off_t write( const void * buffer, offile_off_t length );
+
+	private :
+		class BlockPool;
+		class Writer;
+
+		/**
+		 * The \em Block structure is a unit of data queued to writers.
+		 */
+		struct Block {
+			Block();
+			~Block();
+
+			char * data;
+			int size;
+		};
+
+	private :
+		/**
+		 * Returns the size of a single block.
+		 */
+		static int blockSize();
+
+		/**
+		 * Returns the number of blocks a single consumer may hold.
+		 */
+		static int blockCount();
+
+		/**
+		 * Picks a writer for a new consumer.
+		 */
+		static Writer * nextWriter();
+
+	private :
+		/**
+		 * Queues the current block to the writer, waiting for a free block
+		 * to replace it.
+		 */
+		void queueCurrentBlock();
+
+		/**
+		 * Called by the writer to store the \a block in the file.
+		 */
+		void writeBlock( Block * block );
+
+	private :
+		static BlockPool pool_;
+
+	private :
+		Block * current_;
+		QWaitCondition drainedCondition_;
+		QFile file_;
+		mutable QMutex lock_;
+		int queued_;
+		OFCondition status_;
+		Writer * writer_;
+		OFCondition writeStatus_;
+};
+
+
+/**
+ * The \em AsyncOutputFileStream class is a DCMTK output stream writing to a
+ * file through the \ref AsyncFileConsumer. It can replace the \em
+ * DcmOutputFileStream wherever writing shouldn't stall the calling thread.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC AsyncOutputFileStream : public DcmOutputStream {
+	public :
+		/**
+		 * Creates a stream writing to the file in the \a path.
+		 */
+		AsyncOutputFileStream( const QString & path );
+
+		/**
+		 * Flushes the stream and destroys it.
+		 */
+		~AsyncOutputFileStream();
+
+	private :
+		AsyncFileConsumer consumer_;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -0,0 +1,189 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "AsyncQueryScu.hpp"
+#include "AsyncQueryScu.moc.inl"
+
+#include "QtDicom/FindHandler.hpp"
+#include "QtDicom/QueryScu.hpp"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QRunnable>
+
+
+namespace Dicom {
+
+/**
+ * The \em AsyncQueryScu::Task class performs a single query on the executor.
+ */
+class AsyncQueryScu::Task : public QRunnable, public FindHandler {
+	public :
+		Task(
+			AsyncQueryScu & scu,
+			int query,
+			const ConnectionParameters & Parameters,
+			const QByteArray & AbstractSyntax,
+			const Dataset & Identifier,
+			int timeout,
+			int maxResults
+		) :
+			abstractSyntax_( AbstractSyntax ),
+			identifier_( Identifier ),
+			maxResults_( maxResults ),
+			parameters_( Parameters ),
+			query_( query ),
+			scu_( scu ),
+			timeout_( timeout )
+		{
+		}
+
+		bool handle( const Dataset & Identifier ) {
+			return scu_.match( query_, Identifier );
+		}
+
+		void run() {
+			if ( scu_.isCancelled( query_ ) ) {
+				scu_.complete( query_, 0, "Query cancelled." );
+				return;
+			}
+
+			QueryScu scu;
+			const int Matches = scu.query(
+				parameters_, abstractSyntax_.constData(), identifier_,
+				*this, maxResults_, timeout_
+			);
+
+			scu_.complete(
+				query_, qMax( 0, Matches ),
+				scu.hasError() ? scu.errorMessage() : QString()
+			);
+		}
+
+	private :
+		const QByteArray abstractSyntax_;
+		const Dataset identifier_;
+		const int maxResults_;
+		const ConnectionParameters parameters_;
+		const int query_;
+		AsyncQueryScu & scu_;
+		const int timeout_;
+};
+
+
+AsyncQueryScu::AsyncQueryScu( QObject * parent ) :
+	QObject( parent ),
+	cancelledBelow_( 0 ),
+	executor_( 16 ),
+	finishedQueries_( 0 ),
+	matches_( 0 ),
+	nextQuery_( 1 ),
+	startedQueries_( 0 )
+{
+	static const int DatasetTypeId = 
+		qRegisterMetaType< Dicom::Dataset >( "Dicom::Dataset" )
+	;
+	Q_ASSERT( DatasetTypeId > 0 );
+}
+
+
+AsyncQueryScu::~AsyncQueryScu() {
+	cancel();
+	executor_.waitForDone();
+}
+
+
+void AsyncQueryScu::cancel() {
+	QMutexLocker locker( &lock_ );
+
+	cancelledBelow_ = nextQuery_;
+}
+
+
+void AsyncQueryScu::complete(
+	int query, int matches, const QString & Error
+) {
+	lock_.lock();
+	const int Finished = ++finishedQueries_;
+	const int Started = startedQueries_;
+	const int Matches = matches_;
+	lock_.unlock();
+
+	emit finished( query, matches, Error );
+	emit progress( Finished, Started, Matches );
+
+	if ( Finished == Started ) {
+		emit allFinished();
+	}
+}
+
+
+bool AsyncQueryScu::isCancelled( int query ) const {
+	QMutexLocker locker( &lock_ );
+
+	return query < cancelledBelow_;
+}
+
+
+bool AsyncQueryScu::match( int query, const Dataset & Identifier ) {
+	lock_.lock();
+	if ( query < cancelledBelow_ ) {
+		lock_.unlock();
+		return false;
+	}
+	const int Finished = finishedQueries_;
+	const int Started = startedQueries_;
+	const int Matches = ++matches_;
+	lock_.unlock();
+
+	emit matched( query, Identifier );
+	emit progress( Finished, Started, Matches );
+
+	return true;
+}
+
+
+int AsyncQueryScu::maxConcurrentQueries() const {
+	return executor_.maxThreadCount();
+}
+
+
+int AsyncQueryScu::pendingQueries() const {
+	QMutexLocker locker( &lock_ );
+
+	return startedQueries_ - finishedQueries_;
+}
+
+
+int AsyncQueryScu::query(
+	const ConnectionParameters & Parameters,
+	const QByteArray & AbstractSyntax,
+	const Dataset & Identifier,
+	int timeout,
+	int maxResults
+) {
+	lock_.lock();
+	const int Query = nextQuery_++;
+	++startedQueries_;
+	lock_.unlock();
+
+	executor_.start( new Task(
+		*this, Query, Parameters, AbstractSyntax, Identifier,
+		timeout, maxResults
+	) );
+
+	return Query;
+}
+
+
+void AsyncQueryScu::setMaxConcurrentQueries( int count ) {
+	executor_.setMaxThreadCount( count );
+}
+
+
+bool AsyncQueryScu::waitForFinished( int msecs ) {
+	return executor_.waitForDone( msecs );
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,149 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_ASYNCQUERYSCU_HPP
+#define DICOM_ASYNCQUERYSCU_HPP
+
+#include "QtDicom/ConnectionParameters.hpp"
+#include "QtDicom/Dataset.hpp"
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/QDcmtkExecutor.hpp"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+namespace Dicom {
+
+/**
+ * The \em AsyncQueryScu class runs C-FIND queries in the background, many at
+ * a time.
+ *
+ * Each \ref query() is performed by a \ref QueryScu over its own association
+ * in a thread of the SCU's own \ref QDcmtkExecutor, so a fan-out to several AEs takes about as
+ * long as the slowest of them. Identifiers are reported with the \ref
+ * matched() signal as they arrive, completion of each query with \ref
+ * finished() and of all of them with \ref allFinished(); \ref progress()
+ * combines the state of all queries started.
+ *
+ * Signals are emitted from executor's threads; connections to objects living
+ * elsewhere are queued.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC AsyncQueryScu : public QObject {
+	Q_OBJECT;
+
+	public :
+		/**
+		 * Creates an SCU and sets its \a parent.
+		 */
+		AsyncQueryScu( QObject * parent = 0 );
+
+		/**
+		 * Cancels queries and waits for them to finish.
+		 */
+		~AsyncQueryScu();
+
+		/**
+		 * Cancels all queries started. Queries being performed are cancelled
+		 * at their next response, waiting ones finish at once.
+		 */
+		void cancel();
+
+		/**
+		 * Returns the maximum number of queries performed at a time.
+		 */
+		int maxConcurrentQueries() const;
+
+		/**
+		 * Returns the number of queries started but not finished yet.
+		 */
+		int pendingQueries() const;
+
+		/**
+		 * Queries the AE described by the \a parameters with the \a dataset
+		 * using the \a abstractSyntax. The query is cancelled after \a
+		 * timeout milliseconds or \a maxResults identifiers, unless zero.
+		 *
+		 * Returns the number identifying the query in signals.
+		 */
+		int query(
+			const ConnectionParameters & parameters,
+			const QByteArray & abstractSyntax,
+			const Dataset & dataset,
+			int timeout = 0,
+			int maxResults = 0
+		);
+
+		/**
+		 * Sets the maximum \a count of queries performed at a time.
+		 */
+		void setMaxConcurrentQueries( int count );
+
+		/**
+		 * Waits up to \a msecs milliseconds, or without a limit when \c -1,
+		 * for all queries to finish. Returns \c true if they did.
+		 */
+		bool waitForFinished( int msecs = -1 );
+
+	private :
+		class Task;
+
+	private :
+		/**
+		 * Called by the task of the \a query once it's done.
+		 */
+		void complete( int query, int matches, const QString & error );
+
+		/**
+		 * Returns \c true if the \a query has been cancelled.
+		 */
+		bool isCancelled( int query ) const;
+
+		/**
+		 * Called by the task of the \a query for each \a identifier received.
+		 * Returns \c false if the query should be cancelled.
+		 */
+		bool match( int query, const Dataset & identifier );
+
+	private :
+		int cancelledBelow_;
+		QDcmtkExecutor executor_;
+		int finishedQueries_;
+		mutable QMutex lock_;
+		int matches_;
+		int nextQuery_;
+		int startedQueries_;
+
+	signals :
+		/**
+		 * Emitted when all queries started have finished.
+		 */
+		void allFinished();
+
+		/**
+		 * Emitted when the \a query has finished, after \a matches identifiers.
+		 * The \a error is empty unless the query failed.
+		 */
+		void finished( int query, int matches, QString error );
+
+		/**
+		 * Emitted for each \a identifier matched by the \a query.
+		 */
+		void matched( int query, Dicom::Dataset identifier );
+
+		/**
+		 * Emitted when a query has received an identifier or finished. Tells
+		 * how many queries of those \a started have \a finished and how many
+		 * \a matches have been received by all of them.
+		 */
+		void progress( int finished, int started, int matches );
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -15,7 +15,8 @@ namespace Dicom {
 
 DataSource::DataSource( const QString & TypeName, QObject * parent ) :
 	TypeName_( TypeName ),
-	QObject( parent )
+	QObject( parent ),
+	generation_( 0 )
 {
 	static const bool FsRegistered = FileSystemDataSource::isRegistered();
 	if ( ! FsRegistered ) {
@@ -26,7 +27,8 @@ DataSource::DataSource( const QString & TypeName, QObject * parent ) :
 
 DataSource::DataSource( const DataSource & Other ) :
 	TypeName_( Other.TypeName_ ),
-	cache_( Other.cache_ )
+	cache_( Other.cache_ ),
+	generation_( Other.generation_ )
 {
 }
 
@@ -57,6 +59,11 @@ Dataset DataSource::dataset( int num ) const {
 }
 
 
+quint64 DataSource::generation() const {
+	return generation_;
+}
+
+
 DataSource * DataSource::fromXml(
 	QXmlStreamReader & input, QObject * parent, QString * errorMessage
 ) {
@@ -116,6 +123,17 @@ DataSource * DataSource::fromXml(
 
 
 
+Dataset DataSource::load( int num ) const {
+	return readDataset( num );
+}
+
+
+void DataSource::markChanged() {
+	cache().clear();
+	++generation_;
+}
+
+
 QMultiHash< QString, QString > DataSource::parameters() const {
 	static const QMultiHash< QString, QString > Empty;
 
@@ -123,6 +141,11 @@ QMultiHash< QString, QString > DataSource::parameters() const {
 }
 
 
+QString DataSource::path( int ) const {
+	return QString();
+}
+
+
 Dataset DataSource::readDataset( int num ) const {
 	return Dataset();
 }
@@ -169,7 +192,7 @@ void DataSource::readXmlParameter( QXmlStreamReader & input ) {
 
 
 void DataSource::refresh() {
-	cache().clear();
+	markChanged();
 }
 
 
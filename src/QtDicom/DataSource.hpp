@@ -26,6 +26,8 @@ namespace Dicom {
  * each one of them.
  * The \ref refresh() method was provided to allow reloading internal data and
  * clearing the cache (with the \ref clearCache() function) in sub-classess.
+ * Whenever datasets change, the \ref generation() is incremented, so users
+ * may keep results computed from datasets until it does.
  *
  * The interface is used by the DICOM Service Class Users and Providers to 
  * access datasets from various sources, but the \em DataSource itself serves 
@@ -87,10 +89,34 @@ class QDICOM_DLLSPEC DataSource : public QObject {
 		 */
 		Dataset dataset( int n ) const;
 
+		/**
+		 * Returns the number of times datasets of the source have changed.
+		 */
+		quint64 generation() const;
+
+		/**
+		 * Reads the \a n-th dataset bypassing the cache, so that scanning a
+		 * large source doesn't keep all of its datasets in memory.
+		 */
+		Dataset load( int n ) const;
+
+		/**
+		 * Returns the path of the file the \a n-th dataset is read from or
+		 * an empty string if it doesn't come from a file.
+		 *
+		 * \em DataSource class'es implementation returns an empty string.
+		 */
+		virtual QString path( int n ) const;
+
 		/**
 		 * Refreshes the list of all datasets.
+		 *
+		 * \em DataSource class'es implementation clears the cache and
+		 * increments the \ref generation(). Sub-classes able to tell whether
+		 * datasets have changed should re-implement it and call \ref
+		 * markChanged() only when they did.
 		 */
-		void refresh();
+		virtual void refresh();
 
 		/**
 		 * Returns the number of datasets available in the source.
@@ -116,6 +142,11 @@ class QDICOM_DLLSPEC DataSource : public QObject {
 		 */
 		void clearCache() const;
 
+		/**
+		 * Clears the cache and increments the \ref generation().
+		 */
+		void markChanged();
+
 		/**
 		 * Reads the \a n-th dataset and returns it.
 		 *
@@ -154,6 +185,11 @@ class QDICOM_DLLSPEC DataSource : public QObject {
 		 */
 		mutable QHash< int, Dataset > cache_;
 
+		/**
+		 * The number of changes.
+		 */
+		quint64 generation_;
+
 		/**
 		 * The type name.
 		 */
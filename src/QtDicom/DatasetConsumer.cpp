@@ -0,0 +1,14 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "DatasetConsumer.hpp"
+
+
+namespace Dicom {
+
+DatasetConsumer::~DatasetConsumer() {
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,38 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_DATASETCONSUMER_HPP
+#define DICOM_DATASETCONSUMER_HPP
+
+#include <QtCore/QString>
+
+#include <QtDicom/Dataset.hpp>
+#include <QtDicom/Globals.hpp>
+
+namespace Dicom {
+
+/**
+ * The \em DatasetConsumer class is an interface of objects processing Data
+ * Sets received by the \ref StorageScp in the \ref StorageScp::Memory mode.
+ *
+ * The \ref consume() method is called directly by consumer threads of the
+ * Storage SCP, bypassing the event loop; implementations must be thread-safe
+ * when more than one consumer thread is used.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC DatasetConsumer {
+	public :
+		virtual ~DatasetConsumer();
+
+		/**
+		 * Processes the \a dataSet sent by the \a callingAe.
+		 */
+		virtual void consume( const Dataset & dataSet, const QString & callingAe ) = 0;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
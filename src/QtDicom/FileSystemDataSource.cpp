@@ -8,6 +8,7 @@
 #include "FileSystemDataSource.hpp"
 #include "FileSystemDataSource.moc.inl"
 
+#include <QtCore/QDateTime>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfoList>
 #include <QtCore/QRegExp>
@@ -128,6 +129,7 @@ void FileSystemDataSource::addPath( const QString & Path ) {
 		else if ( Info.isDir() ) {
 			addDirectoryPath( Path );
 		}
+		markChanged();
 	}
 	else {
 		qWarning(
@@ -138,6 +140,59 @@ void FileSystemDataSource::addPath( const QString & Path ) {
 }
 
 
+QFileInfo FileSystemDataSource::file( int offset, FileType * type ) const {
+	for (
+		QHash< FileType, QFileInfoList >::const_iterator i = files().constBegin();
+		i != files().constEnd(); ++i
+	) {
+		if ( offset >= i.value().size() ) {
+			offset -= i.value().size();
+		}
+		else {
+			if ( type ) {
+				*type = i.key();
+			}
+			return i.value().at( offset );
+		}
+	}
+
+	return QFileInfo();
+}
+
+
+bool FileSystemDataSource::equal(
+	const QHash< FileType, QFileInfoList > & First,
+	const QHash< FileType, QFileInfoList > & Second
+) {
+	if ( First.size() != Second.size() ) {
+		return false;
+	}
+
+	for (
+		QHash< FileType, QFileInfoList >::const_iterator i = First.constBegin();
+		i != First.constEnd(); ++i
+	) {
+		const QFileInfoList & List = i.value();
+		const QFileInfoList Other = Second.value( i.key() );
+		if ( List.size() != Other.size() ) {
+			return false;
+		}
+
+		for ( int j = 0; j < List.size(); ++j ) {
+			if (
+				List.at( j ).absoluteFilePath() != Other.at( j ).absoluteFilePath() ||
+				List.at( j ).lastModified() != Other.at( j ).lastModified() ||
+				List.at( j ).size() != Other.at( j ).size()
+			) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
 FileSystemDataSource::FileType 
 FileSystemDataSource::fileTypeFromString( const QString & Value )
 {
@@ -271,6 +326,15 @@ void FileSystemDataSource::parseNameFilters( const QString & Value ) {
 }
 
 
+QString FileSystemDataSource::path( int offset ) const {
+	if ( offset >= size() || offset < 0 ) {
+		return QString();
+	}
+
+	return file( offset ).absoluteFilePath();
+}
+
+
 const QStringList & FileSystemDataSource::paths() const {
 	return paths_;
 }
@@ -290,25 +354,10 @@ Dicom::Dataset FileSystemDataSource::readDataset( int offset ) const {
 	}
 
 	FileType type = FileSystemDataSource::Unknown;
-	QFileInfoList & list = QFileInfoList();
-
-	for (
-		QHash< FileType, QFileInfoList >::const_iterator i = files().constBegin();
-		i != files().constEnd(); ++i
-	) {
-		list = i.value();
-		if ( offset >= list.size() ) {
-			offset -= list.size();
-		}
-		else {
-			type = i.key();
-			break;
-		}
-	}
 
 	Dicom::Dataset dset;
 	QString errorMessage;
-	const QString Path = list.at( offset ).absoluteFilePath();
+	const QString Path = file( offset, &type ).absoluteFilePath();
 	switch ( type ) {
 		case Dcm :
 			qDebug( "Loading Data Set from DCM file: `%s'", Path.toUtf8().constBegin() );
@@ -355,14 +404,26 @@ Dicom::Dataset FileSystemDataSource::readDataset( int offset ) const {
 
 
 void FileSystemDataSource::refresh() {
-	clearCache();
+	const QHash< FileType, QFileInfoList > Previous = files();
 	files().clear();
 
 	for (
 		QStringList::const_iterator i = paths().constBegin();
 		i != paths().constEnd(); ++i
 	) {
-		addPath( *i );
+		const QFileInfo Info( *i );
+		if ( Info.isFile() ) {
+			addFilePath( *i );
+		}
+		else if ( Info.isDir() ) {
+			addDirectoryPath( *i );
+		}
+	}
+
+	// Datasets read before stay valid unless files were added, removed or
+	// modified since
+	if ( ! equal( Previous, files() ) ) {
+		markChanged();
 	}
 }
 
@@ -39,6 +39,11 @@ class FileSystemDataSource : public DataSource {
 		const QHash< FileType, QStringList > & nameFilters() const;
 		QStringList nameFilters( FileType type ) const;
 
+		/**
+		 * Returns the path of the file the \a n-th dataset is read from.
+		 */
+		QString path( int n ) const;
+
 		const QStringList & paths() const;
 
 		void refresh();
@@ -48,6 +53,15 @@ class FileSystemDataSource : public DataSource {
 		int size() const;
 
 	private :
+		/**
+		 * Returns \c true if both lists have the same files, none of which
+		 * was modified.
+		 */
+		static bool equal(
+			const QHash< FileType, QFileInfoList > & first,
+			const QHash< FileType, QFileInfoList > & second
+		);
+
 		static FileType fileTypeFromString( const QString & string );
 		static const QString & fileTypeString( FileType type );		
 		static const QString & typeName();
@@ -61,6 +75,11 @@ class FileSystemDataSource : public DataSource {
 		void addFile( const QFileInfo & file, FileType type = Unknown ) const;
 		void addFilePath( const QString & file, FileType type = Unknown ) const;
 
+		/**
+		 * Returns the \a n-th file and its \a type.
+		 */
+		QFileInfo file( int n, FileType * type = 0 ) const;
+
 		QMultiHash< QString, QString > parameters() const;
 		void parseNameFilters( const QString & value );
 		Dicom::Dataset readDataset( int num ) const;
@@ -0,0 +1,14 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "FindHandler.hpp"
+
+
+namespace Dicom {
+
+FindHandler::~FindHandler() {
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,37 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_FINDHANDLER_HPP
+#define DICOM_FINDHANDLER_HPP
+
+#include <QtDicom/Dataset.hpp>
+#include <QtDicom/Globals.hpp>
+
+namespace Dicom {
+
+/**
+ * The \em FindHandler class is an interface of objects processing
+ * identifiers returned by a C-FIND operation as they arrive.
+ *
+ * The \ref handle() method is called by the thread performing the operation,
+ * once per pending response; the identifier can be released as soon as it's
+ * been processed, so memory doesn't grow with the number of matches.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC FindHandler {
+	public :
+		virtual ~FindHandler();
+
+		/**
+		 * Processes the \a identifier of a match. Returning \c false cancels
+		 * the operation; no more identifiers are passed then.
+		 */
+		virtual bool handle( const Dataset & identifier ) = 0;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -0,0 +1,136 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "ConnectionParameters.hpp"
+#include "Dataset.hpp"
+#include "GetScu.hpp"
+#include "Log.hpp"
+#include "QPresentationContextTable.hpp"
+#include "RequestorAssociation.hpp"
+
+
+static const int MaxPresentationContexts = 128;
+
+
+/**
+ * Returns the number of presentation contexts accepted on the \a association
+ * in which the requestor plays the SCP role.
+ */
+static int countScpContexts( const T_ASC_Association * association ) {
+	const QPresentationContextTable Table =
+		QPresentationContextTable::fromTAscAssociation( association )
+	;
+
+	int count = 0;
+	foreach (
+		const QPresentationContext & Pc, Table.acceptedPresentationContexts()
+	) {
+		if (
+			Pc.role() == QPresentationContext::ScpRole ||
+			Pc.role() == QPresentationContext::ScuScpRole
+		) {
+			++count;
+		}
+	}
+	return count;
+}
+
+
+namespace Dicom {
+
+GetScu::GetScu() :
+	ServiceUser(),
+	sopClasses_( UidList::storageSopClasses() )
+{
+}
+
+
+GetScu::~GetScu() {
+}
+
+
+int GetScu::get(
+	const ConnectionParameters & Parameters,
+	const char * AbstractSyntax,
+	const Dataset & Dataset,
+	const QString & Directory,
+	UidList * failedSopInstances,
+	int * warned
+) {
+	int result = 0;
+
+	RequestorAssociation a;
+	a.setConnectionParameters( Parameters );
+	setAssociation( &a );
+
+	bool timedOut;
+	const int Count = a.request( presentationContexts( AbstractSyntax ), &timedOut );
+	if ( Count > 0 ) {
+		// A conformant peer sends no C-STORE sub-operations on contexts
+		// whose SCP role it hasn't accepted
+		if ( countScpContexts( a.tAscAssociation() ) == 0 ) {
+			QDICOM_LOG( Dimse, Warning, __FUNCTION__": "
+				"no storage SOP class accepted in the SCP role, instances may "
+				"not be retrieved"
+			);
+		}
+
+		result = cGet(
+			Dataset, AbstractSyntax, Directory, 0, failedSopInstances, warned
+		);
+		if ( a.isEstablished() ) {
+			a.release();
+		}
+	}
+	else if ( timedOut ) {
+		raiseError( "Connection timed out." );
+	}
+	else if ( Count == 0 ) {
+		raiseError( "None of proposed presentation contexts were supported." );
+	}
+	else {
+		raiseError( association()->errorMessage() );
+	}
+
+	return result;
+}
+
+
+QPresentationContextList GetScu::presentationContexts(
+	const char * AbstractSyntax
+) const {
+	QPresentationContextList contexts;
+	contexts.append( QPresentationContext::defaultFor( AbstractSyntax ) );
+
+	const int Count = qMin( sopClasses_.size(), MaxPresentationContexts - 1 );
+	if ( Count < sopClasses_.size() ) {
+		QDICOM_LOG( Dimse, Warning,
+			"Only %d of %d SOP classes proposed for a C-GET.",
+			Count, sopClasses_.size()
+		);
+	}
+
+	for ( int i = 0; i < Count; ++i ) {
+		QPresentationContext context =
+			QPresentationContext::defaultFor( sopClasses_.at( i ) )
+		;
+		context.setRole( QPresentationContext::ScpRole );
+		contexts.append( context );
+	}
+
+	return contexts;
+}
+
+
+void GetScu::setSopClasses( const UidList & Classes ) {
+	sopClasses_ = Classes;
+}
+
+
+const UidList & GetScu::sopClasses() const {
+	return sopClasses_;
+}
+
+}; // Namespace DICOM ends here.
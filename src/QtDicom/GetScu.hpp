@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_GETSCU_HPP
+#define DICOM_GETSCU_HPP
+
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/QPresentationContext.hpp"
+#include "QtDicom/ServiceUser.hpp"
+#include "QtDicom/UidList.hpp"
+
+
+namespace Dicom {
+
+class ConnectionParameters;
+class Dataset;
+
+/**
+ * The \em GetScu class retrieves instances with C-GET.
+ *
+ * Unlike with C-MOVE, instances come back over the association the request
+ * was sent on, so the SCU needs no inbound connection nor an AE title known
+ * to the peer. To receive them, the SCU proposes presentation contexts of
+ * the \ref sopClasses() in the SCP role; since an association can carry at
+ * most 128 of them, only the first 127 classes are proposed.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC GetScu : public ServiceUser {
+	public :
+		GetScu();
+		~GetScu();
+
+		/**
+		 * Retrieves instances matching the \a dataset from the AE described
+		 * by the \a parameters using the \a abstractSyntax of a C-GET
+		 * information model. Instances are written to files in the \a
+		 * directory as they arrive.
+		 *
+		 * Returns the number of completed sub-operations; see \ref
+		 * ServiceUser::cGet().
+		 */
+		int get(
+			const ConnectionParameters & parameters,
+			const char * abstractSyntax,
+			const Dataset & dataset,
+			const QString & directory,
+			UidList * failedSopInstances = 0,
+			int * warned = 0
+		);
+
+		/**
+		 * Sets storage SOP classes of instances to be retrieved; all of them
+		 * by default.
+		 */
+		void setSopClasses( const UidList & classes );
+
+		/**
+		 * Returns storage SOP classes of instances to be retrieved.
+		 */
+		const UidList & sopClasses() const;
+
+	private :
+		/**
+		 * Returns presentation contexts to propose for a C-GET using the \a
+		 * abstractSyntax.
+		 */
+		QPresentationContextList presentationContexts(
+			const char * abstractSyntax
+		) const;
+
+	private :
+		UidList sopClasses_;
+};
+
+}; // Namespace DICOM ends here.
+
+
+#endif
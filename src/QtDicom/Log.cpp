@@ -0,0 +1,326 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "Log.hpp"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include <cstdarg>
+
+
+static const int Capacity = 4096; // Must be a power of two.
+static const int TextSize = 232;
+
+
+namespace Dicom {
+
+/**
+ * The \em Log::Writer class owns the ring records are logged to and writes
+ * them out in its own thread.
+ *
+ * The ring is a bounded queue of slots, each carrying a sequence number which
+ * tells whose turn it is: producers claim the next slot with a single
+ * compare-and-swap, format the record in place and publish it by advancing
+ * the sequence; the writer consumes published slots in order and hands them
+ * back. No one ever waits for a lock.
+ */
+class Log::Writer : public QThread {
+	public :
+		Writer();
+		~Writer();
+
+		quint64 dropped() const;
+		void flush();
+		void push( Category category, Level level, const char * format, va_list arguments );
+		bool setFile( const QString & path );
+		void stop();
+
+	private :
+		struct Slot {
+			QAtomicInt sequence;
+			int category;
+			int level;
+			qint64 time;
+			Qt::HANDLE thread;
+			char text[ TextSize ];
+		};
+
+	private :
+		/**
+		 * Writes out published records. Returns the number of records
+		 * written.
+		 */
+		int drain();
+
+		void run();
+
+		void write( const Slot & slot );
+
+	private :
+		QAtomicInt dequeued_;
+		QAtomicInt dropped_;
+		QAtomicInt enqueued_;
+		QFile file_;
+		QMutex fileLock_;
+		Slot ring_[ Capacity ];
+		volatile bool stopping_;
+};
+
+
+int Log::levels_[ Log::CategoryCount ] = {
+#ifdef QT_NO_DEBUG
+	Log::Info, Log::Info, Log::Info, Log::Info, Log::Info
+#else
+	Log::Debug, Log::Debug, Log::Debug, Log::Debug, Log::Debug
+#endif
+};
+
+
+QAtomicPointer< Log::Writer > Log::writer_;
+
+
+Log::Writer::Writer() :
+	stopping_( false )
+{
+	for ( int i = 0; i < Capacity; ++i ) {
+		ring_[ i ].sequence = i;
+	}
+}
+
+
+Log::Writer::~Writer() {
+	stop();
+}
+
+
+int Log::Writer::drain() {
+	int written = 0;
+
+	forever {
+		const int Position = dequeued_;
+		Slot & slot = ring_[ Position & ( Capacity - 1 ) ];
+
+		// A producer may still be formatting the record
+		if ( slot.sequence.fetchAndAddAcquire( 0 ) != Position + 1 ) {
+			return written;
+		}
+
+		write( slot );
+		++written;
+
+		slot.sequence.fetchAndStoreRelease( Position + Capacity );
+		dequeued_.fetchAndStoreRelease( Position + 1 );
+	}
+}
+
+
+quint64 Log::Writer::dropped() const {
+	return static_cast< unsigned >( static_cast< int >( dropped_ ) );
+}
+
+
+void Log::Writer::flush() {
+	const int Position = enqueued_.fetchAndAddAcquire( 0 );
+
+	while ( isRunning() && dequeued_.fetchAndAddAcquire( 0 ) - Position < 0 ) {
+		QThread::yieldCurrentThread();
+	}
+}
+
+
+void Log::Writer::push(
+	Category category, Level level, const char * Format, va_list arguments
+) {
+	int position = enqueued_;
+	Slot * slot;
+
+	forever {
+		slot = &ring_[ position & ( Capacity - 1 ) ];
+		const int Difference = slot->sequence.fetchAndAddAcquire( 0 ) - position;
+
+		if ( Difference == 0 ) {
+			if ( enqueued_.testAndSetRelaxed( position, position + 1 ) ) {
+				break;
+			}
+		}
+		else if ( Difference < 0 ) {
+			// The writer lags a full ring behind; never wait for it
+			dropped_.fetchAndAddRelaxed( 1 );
+			return;
+		}
+		position = enqueued_;
+	}
+
+	slot->category = category;
+	slot->level = level;
+	slot->time = QDateTime::currentMSecsSinceEpoch();
+	slot->thread = QThread::currentThreadId();
+	qvsnprintf( slot->text, TextSize, Format, arguments );
+
+	slot->sequence.fetchAndStoreRelease( position + 1 );
+}
+
+
+void Log::Writer::run() {
+	while ( ! stopping_ ) {
+		if ( drain() == 0 ) {
+			msleep( 10 );
+		}
+	}
+	drain();
+}
+
+
+bool Log::Writer::setFile( const QString & Path ) {
+	QMutexLocker locker( &fileLock_ );
+
+	file_.close();
+	if ( Path.isEmpty() ) {
+		return true;
+	}
+
+	file_.setFileName( Path );
+	if ( ! file_.open( QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text ) ) {
+		qWarning( __FUNCTION__": "
+			"unable to open the log file %s; %s",
+			qPrintable( QDir::toNativeSeparators( Path ) ),
+			qPrintable( file_.errorString() )
+		);
+		return false;
+	}
+	return true;
+}
+
+
+void Log::Writer::stop() {
+	stopping_ = true;
+	wait();
+}
+
+
+void Log::Writer::write( const Slot & Record ) {
+	static const char * const Categories[] = {
+		"general", "network", "dimse", "storage", "query"
+	};
+	static const char * const Levels[] = {
+		"debug", "info", "warning", "critical"
+	};
+
+	const QByteArray Line =
+		QDateTime::fromMSecsSinceEpoch( Record.time )
+			.toString( "yyyy-MM-dd hh:mm:ss.zzz" ).toLatin1() + ' ' +
+		QByteArray::number( reinterpret_cast< quintptr >( Record.thread ), 16 ) +
+		" [" + Levels[ Record.level ] + "] " +
+		Categories[ Record.category ] + ": " + Record.text
+	;
+
+	QMutexLocker locker( &fileLock_ );
+
+	if ( file_.isOpen() ) {
+		file_.write( Line + '\n' );
+		file_.flush();
+		return;
+	}
+	locker.unlock();
+
+	switch ( Record.level ) {
+		case Debug :
+		case Info :
+			qDebug( "%s", Line.constData() );
+			break;
+		case Warning :
+			qWarning( "%s", Line.constData() );
+			break;
+		default :
+			qCritical( "%s", Line.constData() );
+			break;
+	}
+}
+
+
+Log::Log() {
+}
+
+
+quint64 Log::dropped() {
+	return writer()->dropped();
+}
+
+
+void Log::flush() {
+	writer()->flush();
+}
+
+
+Log::Level Log::level( Category category ) {
+	return static_cast< Level >( levels_[ category ] );
+}
+
+
+bool Log::setFile( const QString & Path ) {
+	return writer()->setFile( Path );
+}
+
+
+void Log::setLevel( Category category, Level level ) {
+	levels_[ category ] = level;
+}
+
+
+void Log::setLevel( Level level ) {
+	for ( int i = 0; i < CategoryCount; ++i ) {
+		levels_[ i ] = level;
+	}
+}
+
+
+void Log::stopWriter() {
+	Writer * writer = writer_.fetchAndStoreOrdered( 0 );
+	if ( writer ) {
+		writer->stop();
+		delete writer;
+	}
+}
+
+
+void Log::write( Category category, Level level, const char * Format, ... ) {
+	if ( level >= Off ) {
+		return;
+	}
+
+	va_list arguments;
+	va_start( arguments, Format );
+	writer()->push( category, level, Format, arguments );
+	va_end( arguments );
+}
+
+
+Log::Writer * Log::writer() {
+	Writer * writer = writer_;
+	if ( writer ) {
+		return writer;
+	}
+
+	// Threads racing to create the writer agree on a single one
+	writer = new Writer();
+	if ( writer_.testAndSetOrdered( 0, writer ) ) {
+		writer->start( QThread::LowPriority );
+		qAddPostRoutine( &stopWriter );
+		return writer;
+	}
+	else {
+		delete writer;
+		return writer_;
+	}
+}
+
+}; // Namespace DICOM ends here.
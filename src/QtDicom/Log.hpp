@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_LOG_HPP
+#define DICOM_LOG_HPP
+
+#include "QtDicom/Globals.hpp"
+
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QString>
+
+/**
+ * Records below this level are compiled out of the library entirely; the
+ * default keeps all of them, leaving the choice to \ref Dicom::Log::setLevel().
+ */
+#ifndef QDICOM_LOG_MINIMUM_LEVEL
+# define QDICOM_LOG_MINIMUM_LEVEL 0
+#endif
+
+/**
+ * Logs a record of the \a CATEGORY and \a LEVEL, given by their \ref
+ * Dicom::Log enumerators' names, formatted printf-style. When the level is
+ * disabled, neither the arguments are evaluated nor the message formatted.
+ */
+#define QDICOM_LOG( CATEGORY, LEVEL, ... ) \
+	if ( \
+		::Dicom::Log::LEVEL < QDICOM_LOG_MINIMUM_LEVEL || \
+		! ::Dicom::Log::isEnabled( ::Dicom::Log::CATEGORY, ::Dicom::Log::LEVEL ) \
+	) { \
+	} \
+	else \
+		::Dicom::Log::write( ::Dicom::Log::CATEGORY, ::Dicom::Log::LEVEL, __VA_ARGS__ )
+
+namespace Dicom {
+
+/**
+ * The \em Log class is a categorized, leveled log of the library.
+ *
+ * Each category has its own level; checking it is a single comparison, done
+ * by the \ref QDICOM_LOG macro before any argument is evaluated. Enabled
+ * records are formatted into a slot of a fixed, lock-free ring buffer and
+ * written out by a background thread, so the calling thread never waits for
+ * a sink. When the ring is full, records are dropped and counted instead.
+ *
+ * Records are passed to Qt's message handler unless a file is set with \ref
+ * setFile().
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC Log {
+	public :
+		/**
+		 * Categories of records.
+		 */
+		enum Category {
+			General,
+			Network, /*< Association negotiation and transport. */
+			Dimse,   /*< Commands and Data Sets exchanged. */
+			Storage, /*< Storage of instances. */
+			Query,   /*< Query/Retrieve. */
+			CategoryCount
+		};
+
+		/**
+		 * Levels of records; \c Off disables a category.
+		 */
+		enum Level {
+			Debug,
+			Info,
+			Warning,
+			Critical,
+			Off
+		};
+
+	public :
+		/**
+		 * Returns the number of records dropped because the ring was full.
+		 */
+		static quint64 dropped();
+
+		/**
+		 * Waits until all records logged so far have been written out.
+		 */
+		static void flush();
+
+		/**
+		 * Returns \c true if records of the \a category and \a level are
+		 * logged.
+		 */
+		static inline bool isEnabled( Category category, Level level ) {
+			return level >= levels_[ category ];
+		}
+
+		/**
+		 * Returns the level of the \a category.
+		 */
+		static Level level( Category category );
+
+		/**
+		 * Writes records to the file in the \a path, appending them, instead
+		 * of passing them to Qt's message handler. An empty \a path restores
+		 * the handler. Returns \c false when the file can't be opened.
+		 */
+		static bool setFile( const QString & path );
+
+		/**
+		 * Sets the \a level of the \a category.
+		 */
+		static void setLevel( Category category, Level level );
+
+		/**
+		 * Sets the \a level of all categories.
+		 */
+		static void setLevel( Level level );
+
+		/**
+		 * Logs a record formatted printf-style. Use the \ref QDICOM_LOG macro
+		 * instead to skip disabled records at no cost.
+		 */
+		static void write(
+			Category category, Level level, const char * format, ...
+		)
+#ifdef Q_CC_GNU
+		__attribute__ ( ( format ( printf, 3, 4 ) ) )
+#endif
+		;
+
+	private :
+		class Writer;
+
+		Log();
+
+		/**
+		 * Writes out remaining records and stops the writer when the
+		 * application quits.
+		 */
+		static void stopWriter();
+
+		/**
+		 * Returns the writer, starting it on first use.
+		 */
+		static Writer * writer();
+
+	private :
+		static int levels_[ CategoryCount ];
+		static QAtomicPointer< Writer > writer_;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -0,0 +1,492 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "Metrics.hpp"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QMutexLocker>
+
+
+static const int MaximumExponent = 40;
+static const int SubBuckets = 4;
+
+
+namespace Dicom {
+
+/**
+ * The \em Shard class holds statistics recorded by a single thread; the
+ * thread's storage owns it and retires it when the thread finishes.
+ */
+class Metrics::Shard {
+	public :
+		Shard( Metrics & metrics ) :
+			metrics_( metrics )
+		{
+		}
+
+		~Shard() {
+			metrics_.retire( this );
+		}
+
+		/**
+		 * Guards the \em series against readers; recording threads never
+		 * contend for it.
+		 */
+		QMutex lock;
+		Series series;
+
+	private :
+		Metrics & metrics_;
+};
+
+
+Metrics::Histogram::Histogram() :
+	buckets_( bucketCount(), 0 ),
+	count_( 0 ),
+	maximum_( 0 ),
+	sum_( 0 )
+{
+}
+
+
+void Metrics::Histogram::add( const Histogram & Other ) {
+	for ( int bucket = 0; bucket < bucketCount(); ++bucket ) {
+		buckets_[ bucket ] += Other.countIn( bucket );
+	}
+	count_ += Other.count_;
+	maximum_ = qMax( maximum_, Other.maximum_ );
+	sum_ += Other.sum_;
+}
+
+
+int Metrics::Histogram::bucketCount() {
+	return ( MaximumExponent - 1 ) * SubBuckets + SubBuckets;
+}
+
+
+int Metrics::Histogram::bucketOf( qint64 value ) {
+	if ( value < SubBuckets ) {
+		return static_cast< int >( qMax( Q_INT64_C( 0 ), value ) );
+	}
+
+	int exponent = 0;
+	while ( exponent < 62 && ( value >> ( exponent + 1 ) ) > 0 ) {
+		++exponent;
+	}
+	if ( exponent > MaximumExponent ) {
+		return bucketCount() - 1;
+	}
+
+	// The two bits following the leading one select the sub-bucket
+	const int Sub = static_cast< int >( value >> ( exponent - 2 ) ) & 3;
+	return SubBuckets * ( exponent - 1 ) + Sub;
+}
+
+
+quint64 Metrics::Histogram::count() const {
+	return count_;
+}
+
+
+quint64 Metrics::Histogram::countIn( int bucket ) const {
+	return buckets_.value( bucket, 0 );
+}
+
+
+qint64 Metrics::Histogram::maximum() const {
+	return maximum_;
+}
+
+
+qint64 Metrics::Histogram::quantile( double quantile ) const {
+	if ( count_ == 0 ) {
+		return 0;
+	}
+
+	const quint64 Rank = qMax(
+		Q_UINT64_C( 1 ),
+		static_cast< quint64 >( qBound( 0.0, quantile, 1.0 ) * count_ + 0.5 )
+	);
+
+	quint64 seen = 0;
+	for ( int i = 0; i < buckets_.size(); ++i ) {
+		seen += buckets_.at( i );
+		if ( seen >= Rank ) {
+			return qMin( upperBound( i ), maximum_ );
+		}
+	}
+	return maximum_;
+}
+
+
+void Metrics::Histogram::record( qint64 value ) {
+	value = qMax( Q_INT64_C( 0 ), value );
+
+	++buckets_[ bucketOf( value ) ];
+	++count_;
+	maximum_ = qMax( maximum_, value );
+	sum_ += value;
+}
+
+
+qint64 Metrics::Histogram::sum() const {
+	return sum_;
+}
+
+
+qint64 Metrics::Histogram::upperBound( int bucket ) {
+	if ( bucket < SubBuckets ) {
+		return bucket;
+	}
+
+	const int Exponent = bucket / SubBuckets + 1;
+	const qint64 Width = Q_INT64_C( 1 ) << ( Exponent - 2 );
+	const qint64 Lower = ( SubBuckets + bucket % SubBuckets ) * Width;
+	return Lower + Width - 1;
+}
+
+
+Metrics::Key::Key( int k, const QString & Operation, const QString & Peer ) :
+	kind( k ),
+	operation( Operation ),
+	peer( Peer )
+{
+}
+
+
+bool Metrics::Key::matches(
+	int k, const QString & Operation, const QString & Peer
+) const {
+	return
+		kind == k &&
+		( Operation.isNull() || operation == Operation ) &&
+		( Peer.isNull() || peer == Peer )
+	;
+}
+
+
+bool Metrics::Key::operator < ( const Key & Other ) const {
+	if ( kind != Other.kind ) {
+		return kind < Other.kind;
+	}
+	else if ( operation != Other.operation ) {
+		return operation < Other.operation;
+	}
+	else {
+		return peer < Other.peer;
+	}
+}
+
+
+void Metrics::Series::clear() {
+	bytes.clear();
+	cacheLookups.clear();
+	commands.clear();
+	latencies.clear();
+}
+
+
+void Metrics::Series::merge( const Series & Other ) {
+	QMap< Key, quint64 >::const_iterator i;
+	for ( i = Other.bytes.constBegin(); i != Other.bytes.constEnd(); ++i ) {
+		bytes[ i.key() ] += i.value();
+	}
+	for ( i = Other.cacheLookups.constBegin(); i != Other.cacheLookups.constEnd(); ++i ) {
+		cacheLookups[ i.key() ] += i.value();
+	}
+	for ( i = Other.commands.constBegin(); i != Other.commands.constEnd(); ++i ) {
+		commands[ i.key() ] += i.value();
+	}
+
+	QMap< Key, Histogram >::const_iterator j;
+	for ( j = Other.latencies.constBegin(); j != Other.latencies.constEnd(); ++j ) {
+		latencies[ j.key() ].add( j.value() );
+	}
+}
+
+
+Metrics::Metrics() {
+}
+
+
+void Metrics::addBytes(
+	Direction direction, const QString & Peer, quint64 bytes
+) {
+	Shard * const Own = shard();
+	QMutexLocker locker( &Own->lock );
+
+	Own->series.bytes[ Key( direction, "", Peer ) ] += bytes;
+}
+
+
+void Metrics::addCacheLookup( CacheLookup lookup, const QString & Peer ) {
+	Shard * const Own = shard();
+	QMutexLocker locker( &Own->lock );
+
+	++Own->series.cacheLookups[ Key( lookup, "", Peer ) ];
+}
+
+
+void Metrics::addCommand(
+	Direction direction, const QString & Command, const QString & Peer
+) {
+	Shard * const Own = shard();
+	QMutexLocker locker( &Own->lock );
+
+	++Own->series.commands[ Key( direction, Command, Peer ) ];
+}
+
+
+void Metrics::addLatency(
+	Latency kind,
+	const QString & Operation,
+	const QString & Peer,
+	qint64 latency
+) {
+	const QString Label = kind == CommandRoundTrip ? Operation : QString( "" );
+
+	Shard * const Own = shard();
+	QMutexLocker locker( &Own->lock );
+
+	Own->series.latencies[ Key( kind, Label, Peer ) ].record( latency );
+}
+
+
+quint64 Metrics::bytes( Direction direction, const QString & Peer ) const {
+	const Series Merged = snapshot();
+
+	quint64 total = 0;
+	QMap< Key, quint64 >::const_iterator i;
+	for ( i = Merged.bytes.constBegin(); i != Merged.bytes.constEnd(); ++i ) {
+		if ( i.key().matches( direction, QString(), Peer ) ) {
+			total += i.value();
+		}
+	}
+	return total;
+}
+
+
+quint64 Metrics::cacheLookups(
+	CacheLookup outcome, const QString & Peer
+) const {
+	const Series Merged = snapshot();
+
+	quint64 total = 0;
+	QMap< Key, quint64 >::const_iterator i;
+	for ( i = Merged.cacheLookups.constBegin(); i != Merged.cacheLookups.constEnd(); ++i ) {
+		if ( i.key().matches( outcome, QString(), Peer ) ) {
+			total += i.value();
+		}
+	}
+	return total;
+}
+
+
+quint64 Metrics::commands(
+	Direction direction, const QString & Command, const QString & Peer
+) const {
+	const Series Merged = snapshot();
+
+	quint64 total = 0;
+	QMap< Key, quint64 >::const_iterator i;
+	for ( i = Merged.commands.constBegin(); i != Merged.commands.constEnd(); ++i ) {
+		if ( i.key().matches( direction, Command, Peer ) ) {
+			total += i.value();
+		}
+	}
+	return total;
+}
+
+
+QByteArray Metrics::escaped( const QString & Value ) {
+	QByteArray result = Value.toUtf8();
+	result.replace( '\\', "\\\\" );
+	result.replace( '"', "\\\"" );
+	result.replace( '\n', "\\n" );
+	return result;
+}
+
+
+Metrics & Metrics::instance() {
+	static Metrics metrics;
+
+	return metrics;
+}
+
+
+Metrics::Histogram Metrics::latency(
+	Latency kind, const QString & Operation, const QString & Peer
+) const {
+	const Series Merged = snapshot();
+
+	Histogram result;
+	QMap< Key, Histogram >::const_iterator i;
+	for ( i = Merged.latencies.constBegin(); i != Merged.latencies.constEnd(); ++i ) {
+		if ( i.key().matches( kind, Operation, Peer ) ) {
+			result.add( i.value() );
+		}
+	}
+	return result;
+}
+
+
+void Metrics::reset() {
+	QMutexLocker locker( &lock_ );
+
+	retired_.clear();
+	foreach ( Shard * shard, shards_ ) {
+		QMutexLocker shardLocker( &shard->lock );
+		shard->series.clear();
+	}
+}
+
+
+void Metrics::retire( Shard * shard ) {
+	QMutexLocker locker( &lock_ );
+
+	retired_.merge( shard->series );
+	shards_.removeOne( shard );
+}
+
+
+Metrics::Shard * Metrics::shard() {
+	if ( ! threadShards_.hasLocalData() ) {
+		Shard * created = new Shard( *this );
+		threadShards_.setLocalData( created );
+
+		QMutexLocker locker( &lock_ );
+		shards_.append( created );
+	}
+	return threadShards_.localData();
+}
+
+
+Metrics::Series Metrics::snapshot() const {
+	QMutexLocker locker( &lock_ );
+
+	Series result = retired_;
+	foreach ( Shard * shard, shards_ ) {
+		QMutexLocker shardLocker( &shard->lock );
+		result.merge( shard->series );
+	}
+	return result;
+}
+
+
+QByteArray Metrics::toPrometheusText() const {
+	static const char * const Directions[] = { "received", "sent" };
+	static const char * const Lookups[] = { "hit", "miss" };
+	static const char * const Latencies[] = {
+		"qtdicom_association_setup_seconds",
+		"qtdicom_dimse_round_trip_seconds",
+		"qtdicom_dimse_dataset_transfer_seconds"
+	};
+
+	const Series Merged = snapshot();
+
+	QByteArray text;
+
+	text += "# TYPE qtdicom_dimse_commands_total counter\n";
+	QMap< Key, quint64 >::const_iterator i;
+	for ( i = Merged.commands.constBegin(); i != Merged.commands.constEnd(); ++i ) {
+		text +=
+			"qtdicom_dimse_commands_total{direction=\"" +
+			QByteArray( Directions[ i.key().kind ] ) +
+			"\",command=\"" + escaped( i.key().operation ) +
+			"\",peer=\"" + escaped( i.key().peer ) + "\"} " +
+			QByteArray::number( i.value() ) + '\n'
+		;
+	}
+
+	text += "# TYPE qtdicom_dimse_dataset_bytes_total counter\n";
+	for ( i = Merged.bytes.constBegin(); i != Merged.bytes.constEnd(); ++i ) {
+		text +=
+			"qtdicom_dimse_dataset_bytes_total{direction=\"" +
+			QByteArray( Directions[ i.key().kind ] ) +
+			"\",peer=\"" + escaped( i.key().peer ) + "\"} " +
+			QByteArray::number( i.value() ) + '\n'
+		;
+	}
+
+	text += "# TYPE qtdicom_query_cache_lookups_total counter\n";
+	for ( i = Merged.cacheLookups.constBegin(); i != Merged.cacheLookups.constEnd(); ++i ) {
+		text +=
+			"qtdicom_query_cache_lookups_total{result=\"" +
+			QByteArray( Lookups[ i.key().kind ] ) +
+			"\",peer=\"" + escaped( i.key().peer ) + "\"} " +
+			QByteArray::number( i.value() ) + '\n'
+		;
+	}
+
+	for ( int kind = AssociationSetup; kind <= DatasetTransfer; ++kind ) {
+		const QByteArray Name = Latencies[ kind ];
+		text += "# TYPE " + Name + " histogram\n";
+
+		QMap< Key, Histogram >::const_iterator j;
+		for ( j = Merged.latencies.constBegin(); j != Merged.latencies.constEnd(); ++j ) {
+			if ( j.key().kind != kind ) {
+				continue;
+			}
+
+			QByteArray labels = "peer=\"" + escaped( j.key().peer ) + '"';
+			if ( kind == CommandRoundTrip ) {
+				labels.prepend( "command=\"" + escaped( j.key().operation ) + "\"," );
+			}
+
+			const int Last = Histogram::bucketOf( j->maximum() );
+			quint64 cumulative = 0;
+			for ( int bucket = 0; bucket <= Last; ++bucket ) {
+				cumulative += j->countIn( bucket );
+				text +=
+					Name + "_bucket{" + labels + ",le=\"" +
+					QByteArray::number( Histogram::upperBound( bucket ) / 1e6, 'g', 9 ) +
+					"\"} " + QByteArray::number( cumulative ) + '\n'
+				;
+			}
+			text +=
+				Name + "_bucket{" + labels + ",le=\"+Inf\"} " +
+				QByteArray::number( j->count() ) + '\n' +
+				Name + "_sum{" + labels + "} " +
+				QByteArray::number( j->sum() / 1e6, 'g', 12 ) + '\n' +
+				Name + "_count{" + labels + "} " +
+				QByteArray::number( j->count() ) + '\n'
+			;
+		}
+	}
+
+	return text;
+}
+
+
+bool Metrics::writeToFile( const QString & Path ) const {
+	const QByteArray Text = toPrometheusText();
+
+	QFile file( Path + ".tmp" );
+	if (
+		! file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ||
+		file.write( Text ) != Text.size()
+	) {
+		qWarning( __FUNCTION__": "
+			"unable to write metrics to %s; %s",
+			qPrintable( QDir::toNativeSeparators( file.fileName() ) ),
+			qPrintable( file.errorString() )
+		);
+		return false;
+	}
+	file.close();
+
+	QFile::remove( Path );
+	if ( ! QFile::rename( file.fileName(), Path ) ) {
+		qWarning( __FUNCTION__": "
+			"unable to replace %s",
+			qPrintable( QDir::toNativeSeparators( Path ) )
+		);
+		return false;
+	}
+	return true;
+}
+
+}; // Namespace DICOM ends here.
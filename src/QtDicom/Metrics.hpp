@@ -0,0 +1,291 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_METRICS_HPP
+#define DICOM_METRICS_HPP
+
+#include "QtDicom/Globals.hpp"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+
+namespace Dicom {
+
+/**
+ * The \em Metrics class is a registry of DIMSE traffic statistics.
+ *
+ * Services record commands exchanged, bytes of Data Sets transferred,
+ * latencies of command round trips, Data Set transfers and association
+ * setups, and lookups of query results cached, labelled by the peer's AE
+ * title. The registry can be queried
+ * in-process or exported in the Prometheus text format with \ref
+ * toPrometheusText(), \ref writeToFile() or the \ref MetricsExporter.
+ *
+ * Latencies are kept in log-linear histograms: each power of two of
+ * microseconds is split into four buckets, so any percentile is reported
+ * within 25% of its true value at a fixed memory cost.
+ *
+ * The registry is thread-safe; a single one is shared by the process. Each
+ * thread records into a shard of its own, so recording threads don't contend
+ * with each other; shards are merged when statistics are read and when their
+ * threads finish.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC Metrics {
+	public :
+		/**
+		 * Directions of the traffic.
+		 */
+		enum Direction {
+			Received,
+			Sent
+		};
+
+		/**
+		 * Outcomes of query result cache lookups.
+		 */
+		enum CacheLookup {
+			CacheHit,
+			CacheMiss
+		};
+
+		/**
+		 * Kinds of latencies measured.
+		 */
+		enum Latency {
+			AssociationSetup, /*< From a request to its acceptance. */
+			CommandRoundTrip, /*< From a request to its first response. */
+			DatasetTransfer   /*< Of a single Data Set. */
+		};
+
+		/**
+		 * The \em Histogram class counts values in log-linear buckets.
+		 */
+		class QDICOM_DLLSPEC Histogram {
+			public :
+				/**
+				 * Creates an empty histogram.
+				 */
+				Histogram();
+
+				/**
+				 * Adds values recorded by the \a other histogram.
+				 */
+				void add( const Histogram & other );
+
+				/**
+				 * Returns the number of buckets.
+				 */
+				static int bucketCount();
+
+				/**
+				 * Returns the index of the bucket the \a value falls into.
+				 */
+				static int bucketOf( qint64 value );
+
+				/**
+				 * Returns the number of values recorded.
+				 */
+				quint64 count() const;
+
+				/**
+				 * Returns the number of values recorded in the \a bucket.
+				 */
+				quint64 countIn( int bucket ) const;
+
+				/**
+				 * Returns the maximum value recorded.
+				 */
+				qint64 maximum() const;
+
+				/**
+				 * Returns the value below which the \a quantile, between 0
+				 * and 1, of recorded values fall. The value is the upper
+				 * bound of the bucket it was found in.
+				 */
+				qint64 quantile( double quantile ) const;
+
+				/**
+				 * Adds the \a value to the histogram.
+				 */
+				void record( qint64 value );
+
+				/**
+				 * Returns the sum of values recorded.
+				 */
+				qint64 sum() const;
+
+				/**
+				 * Returns the greatest value falling into the \a bucket.
+				 */
+				static qint64 upperBound( int bucket );
+
+			private :
+				friend class Metrics;
+
+				QVector< quint64 > buckets_;
+				quint64 count_;
+				qint64 maximum_;
+				qint64 sum_;
+		};
+
+	public :
+		/**
+		 * Returns the registry of the process.
+		 */
+		static Metrics & instance();
+
+		/**
+		 * Adds \a bytes of Data Sets exchanged with the \a peer.
+		 */
+		void addBytes( Direction direction, const QString & peer, quint64 bytes );
+
+		/**
+		 * Counts a query result cache \a lookup for the \a peer.
+		 */
+		void addCacheLookup( CacheLookup lookup, const QString & peer );
+
+		/**
+		 * Counts the \a command exchanged with the \a peer.
+		 */
+		void addCommand(
+			Direction direction, const QString & command, const QString & peer
+		);
+
+		/**
+		 * Records the \a latency of the \a operation, in microseconds, of
+		 * the \a kind with the \a peer. The \a operation is a command name
+		 * for round trips and is ignored otherwise.
+		 */
+		void addLatency(
+			Latency kind,
+			const QString & operation,
+			const QString & peer,
+			qint64 latency
+		);
+
+		/**
+		 * Returns bytes of Data Sets exchanged with the \a peer or with all
+		 * peers when the \a peer is a null string.
+		 */
+		quint64 bytes( Direction direction, const QString & peer = QString() ) const;
+
+		/**
+		 * Returns how many query result cache lookups of the \a outcome were
+		 * made for the \a peer or for all peers when the \a peer is a null
+		 * string.
+		 */
+		quint64 cacheLookups(
+			CacheLookup outcome, const QString & peer = QString()
+		) const;
+
+		/**
+		 * Returns how many times the \a command was exchanged with the \a
+		 * peer or with all peers when the \a peer is a null string.
+		 */
+		quint64 commands(
+			Direction direction,
+			const QString & command,
+			const QString & peer = QString()
+		) const;
+
+		/**
+		 * Returns latencies of the \a kind of the \a operation with the \a
+		 * peer. Null strings match all operations and peers.
+		 */
+		Histogram latency(
+			Latency kind,
+			const QString & operation = QString(),
+			const QString & peer = QString()
+		) const;
+
+		/**
+		 * Clears all statistics.
+		 */
+		void reset();
+
+		/**
+		 * Returns statistics in the Prometheus text exposition format.
+		 */
+		QByteArray toPrometheusText() const;
+
+		/**
+		 * Writes \ref toPrometheusText() to the file at the \a path,
+		 * replacing it at once so readers never see a partial file. Returns
+		 * \c false in case of an error.
+		 */
+		bool writeToFile( const QString & path ) const;
+
+	private :
+		/**
+		 * The \em Key structure identifies a series of statistics.
+		 */
+		struct Key {
+			Key( int kind, const QString & operation, const QString & peer );
+
+			bool matches( int kind, const QString & operation, const QString & peer ) const;
+			bool operator < ( const Key & other ) const;
+
+			int kind;
+			QString operation;
+			QString peer;
+		};
+
+		/**
+		 * The \em Series structure holds statistics of all kinds.
+		 */
+		struct Series {
+			void clear();
+			void merge( const Series & other );
+
+			QMap< Key, quint64 > bytes;
+			QMap< Key, quint64 > cacheLookups;
+			QMap< Key, quint64 > commands;
+			QMap< Key, Histogram > latencies;
+		};
+
+		class Shard;
+
+	private :
+		Metrics();
+		Q_DISABLE_COPY( Metrics );
+
+		/**
+		 * Returns the \a value escaped for a Prometheus label.
+		 */
+		static QByteArray escaped( const QString & value );
+
+		/**
+		 * Merges statistics of the \a shard, whose thread has finished, and
+		 * forgets about it.
+		 */
+		void retire( Shard * shard );
+
+		/**
+		 * Returns the shard of the calling thread, creating it if needed.
+		 */
+		Shard * shard();
+
+		/**
+		 * Returns statistics of all shards merged.
+		 */
+		Series snapshot() const;
+
+	private :
+		mutable QMutex lock_;
+		Series retired_;
+		QList< Shard * > shards_;
+		QThreadStorage< Shard * > threadShards_;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
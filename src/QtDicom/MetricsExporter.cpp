@@ -0,0 +1,78 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "MetricsExporter.hpp"
+#include "MetricsExporter.moc.inl"
+
+#include "QtDicom/Metrics.hpp"
+
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+
+
+namespace Dicom {
+
+MetricsExporter::MetricsExporter( QObject * parent ) :
+	QObject( parent ),
+	server_( new QLocalServer( this ) )
+{
+	connect( server_, SIGNAL( newConnection() ), SLOT( serve() ) );
+	connect( &timer_, SIGNAL( timeout() ), SLOT( write() ) );
+}
+
+
+MetricsExporter::~MetricsExporter() {
+	server_->close();
+	timer_.stop();
+}
+
+
+bool MetricsExporter::listen( const QString & Name ) {
+	server_->close();
+
+	// A socket left by a crashed process would block the name
+	QLocalServer::removeServer( Name );
+
+	if ( ! server_->listen( Name ) ) {
+		qWarning( __FUNCTION__": "
+			"unable to serve metrics on `%s'; %s",
+			qPrintable( Name ), qPrintable( server_->errorString() )
+		);
+		return false;
+	}
+	return true;
+}
+
+
+void MetricsExporter::serve() {
+	while ( QLocalSocket * socket = server_->nextPendingConnection() ) {
+		connect( socket, SIGNAL( disconnected() ), socket, SLOT( deleteLater() ) );
+
+		socket->write( Metrics::instance().toPrometheusText() );
+		socket->disconnectFromServer();
+	}
+}
+
+
+void MetricsExporter::setFile( const QString & Path, int interval ) {
+	path_ = Path;
+
+	if ( Path.isEmpty() ) {
+		timer_.stop();
+	}
+	else {
+		timer_.start( qMax( 100, interval ) );
+		write();
+	}
+}
+
+
+void MetricsExporter::write() {
+	if ( ! path_.isEmpty() ) {
+		Metrics::instance().writeToFile( path_ );
+	}
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_METRICSEXPORTER_HPP
+#define DICOM_METRICSEXPORTER_HPP
+
+#include "QtDicom/Globals.hpp"
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QTimer>
+
+class QLocalServer;
+
+namespace Dicom {
+
+/**
+ * The \em MetricsExporter class publishes the \ref Metrics of the process in
+ * the Prometheus text format.
+ *
+ * Metrics can be served on a local socket, a named pipe on Windows, to every
+ * client connecting to it and written periodically to a file, e.g. one read
+ * by the node exporter's textfile collector. Both require an event loop in
+ * the exporter's thread.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC MetricsExporter : public QObject {
+	Q_OBJECT;
+
+	public :
+		/**
+		 * Creates an exporter and sets its \a parent.
+		 */
+		MetricsExporter( QObject * parent = 0 );
+
+		/**
+		 * Stops exporting and destroys the exporter.
+		 */
+		~MetricsExporter();
+
+		/**
+		 * Serves metrics on the local socket of the \a name. Returns \c false
+		 * in case of an error.
+		 */
+		bool listen( const QString & name );
+
+		/**
+		 * Writes metrics to the file in the \a path every \a interval
+		 * milliseconds. An empty \a path stops writing.
+		 */
+		void setFile( const QString & path, int interval = 15000 );
+
+	private slots :
+		/**
+		 * Sends metrics to a client connected to the local socket.
+		 */
+		void serve();
+
+		/**
+		 * Writes metrics to the file.
+		 */
+		void write();
+
+	private :
+		QString path_;
+		QLocalServer * server_;
+		QTimer timer_;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
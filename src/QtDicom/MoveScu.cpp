@@ -45,7 +45,7 @@ int MoveScu::move(
 	if ( Count > 0 ) {
 		int failed;
 		result = cMove( Dataset, AbstractSyntax, DestinationAe, &failed, failedSopInstances, warned );
-		if ( failed != failedSopInstances->size() ) {
+		if ( failedSopInstances && failed != failedSopInstances->size() ) {
 			qWarning(
 				"Retrieved instances count (%d) differs from the status info (%d).",
 				failedSopInstances->size(), failed
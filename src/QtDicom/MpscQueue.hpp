@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_MPSCQUEUE_HPP
+#define DICOM_MPSCQUEUE_HPP
+
+#include <QtCore/QAtomicPointer>
+
+namespace Dicom {
+
+/**
+ * The \em MpscQueue class template is an unbounded, lock-free queue which
+ * many threads can \ref push() to, but only one can \ref pop() from.
+ *
+ * Pushing takes a single atomic exchange, so producers never wait for each
+ * other nor for the consumer. The queue always holds a stub node; a node is
+ * released once the value following it has been popped.
+ *
+ * A value pushed may be invisible to the consumer for a brief moment, while
+ * the producer links it to the list; \ref pop() returns \c false then, even
+ * though the queue isn't empty. Callers counting values pushed should retry.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+template< typename T >
+class MpscQueue {
+	public :
+		MpscQueue();
+
+		/**
+		 * Destroys the queue along with the values remaining. Must not be
+		 * called while values are pushed.
+		 */
+		~MpscQueue();
+
+		/**
+		 * Returns \c true if no value can be popped. Consumer only.
+		 */
+		bool isEmpty() const;
+
+		/**
+		 * Removes the oldest value from the queue and stores it in the \a
+		 * value. Returns \c false when there's nothing to pop. Consumer only.
+		 */
+		bool pop( T & value );
+
+		/**
+		 * Appends the \a value to the queue. Safe to call from any thread.
+		 */
+		void push( const T & value );
+
+	private :
+		struct Node {
+			Node() {
+			}
+
+			Node( const T & Value ) :
+				value( Value )
+			{
+			}
+
+			QAtomicPointer< Node > next;
+			T value;
+		};
+
+	private :
+		QAtomicPointer< Node > head_;
+		Node * tail_;
+
+		Q_DISABLE_COPY( MpscQueue );
+};
+
+
+template< typename T >
+MpscQueue< T >::MpscQueue() :
+	head_( new Node() ),
+	tail_( head_ )
+{
+}
+
+
+template< typename T >
+MpscQueue< T >::~MpscQueue() {
+	while ( tail_ ) {
+		Node * next = tail_->next;
+		delete tail_;
+		tail_ = next;
+	}
+}
+
+
+template< typename T >
+bool MpscQueue< T >::isEmpty() const {
+	return static_cast< Node * >( tail_->next ) == 0;
+}
+
+
+template< typename T >
+bool MpscQueue< T >::pop( T & value ) {
+	Node * tail = tail_;
+
+	// Qt 4 offers no plain load with acquire semantics
+	Node * next = tail->next.fetchAndAddAcquire( 0 );
+
+	if ( next ) {
+		value = next->value;
+		next->value = T();
+
+		// The node popped becomes the new stub
+		tail_ = next;
+		delete tail;
+		return true;
+	}
+	else {
+		return false;
+	}
+}
+
+
+template< typename T >
+void MpscQueue< T >::push( const T & Value ) {
+	Node * node = new Node( Value );
+
+	Node * previous = head_.fetchAndStoreOrdered( node );
+	previous->next.fetchAndStoreRelease( node );
+}
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -4,10 +4,12 @@
  **************************************************************************/
 
 #include "ConnectionParameters.hpp"
+#include "Log.hpp"
 
 #include "QAssociation.hpp"
 #include "QAssociation.moc.inl"
 #include "QDcmtkTask.hpp"
+#include "QPresentationContextCache.hpp"
 
 #include <QtCore/QString>
 #include <QtCore/QtConcurrentRun>
@@ -36,12 +38,20 @@ inline static OFCondition ASC_requestAssociationWrapper(
 	int timeout
 );
 
+/**
+ * Returns \c true if the A-ASSOCIATE-RJ received for the \a association is
+ * permanent, i.e. proposing again wouldn't help.
+ */
+static bool isRejectedPermanently( T_ASC_Association * association );
+
 
 QAssociation::QAssociation( QObject * parent ) :
 	QObject( parent ),
 	Mode_( Requestor ),
 	association_( NULL ),
 	network_( NULL ),
+	contextCache_( QPresentationContextCache::globalInstance() ),
+	proposingCachedContexts_( false ),
 	state_( Unconnected )
 {
 }
@@ -63,7 +73,7 @@ void QAssociation::abort() {
 		QMetaObject::invokeMethod( this, "startAborting", Qt::QueuedConnection );
 	}
 	else {
-		qDebug( __FUNCTION__": "
+		QDICOM_LOG( Network, Debug, __FUNCTION__": "
 			"association is not in the Established state"
 		);
 	}
@@ -74,35 +84,10 @@ QPresentationContextList QAssociation::acceptedPresentationContexts() const {
 	Q_ASSERT( tAscAssociation() );
 
 	if ( isEstablished() ) {
-		T_ASC_Parameters * params = tAscAssociation()->params;
-		T_ASC_PresentationContext dcmContext;
-
-		QPresentationContextList contexts;
-		const int Count = ASC_countPresentationContexts( params );
-		for ( int i = 0; i < Count; ++i ) {
-			const OFCondition Status = ASC_getPresentationContext(
-				params, i, &dcmContext
-			);
-			if ( Status.good() ) {
-				QPresentationContext context = 
-					QPresentationContext::fromTAscPresentationContext( dcmContext )
-				;
-				if ( context.accepted() ) {
-					contexts.append( context );
-				}
-			}
-			else {
-				qWarning( __FUNCTION__": "
-					"unable to read presentation context #%d; %s",
-					i, Status.text()
-				);
-			}
-		}
-
-		return contexts;
+		return contextTable_.acceptedPresentationContexts();
 	}
 	else {
-		qDebug( __FUNCTION__": "
+		QDICOM_LOG( Network, Debug, __FUNCTION__": "
 			"the list can be obtained only when association is established"
 		);
 		return QPresentationContextList();
@@ -119,7 +104,7 @@ void QAssociation::dropTAscAssociation() {
 	if ( tAscAssociation() ) {
 		const OFCondition Result = ASC_destroyAssociation( &tAscAssociation() );
 		if ( Result.good() ) {
-			qDebug( __FUNCTION__": destroyed DCMTK association object" );
+			QDICOM_LOG( Network, Debug, __FUNCTION__": destroyed DCMTK association object" );
 		}
 		else {
 			qWarning( __FUNCTION__": "
@@ -130,6 +115,8 @@ void QAssociation::dropTAscAssociation() {
 
 		association_ = 0;
 	}
+
+	contextTable_ = QPresentationContextTable();
 }
 
 
@@ -140,7 +127,7 @@ void QAssociation::dropTAscNetwork() {
 		const OFCondition Result = ASC_dropNetwork( & network_ );
 		network_ = NULL;
 		if ( Result.good() ) {
-			qDebug( __FUNCTION__": destroyed DCMTK network object" );
+			QDICOM_LOG( Network, Debug, __FUNCTION__": destroyed DCMTK network object" );
 		}
 		else {
 			qWarning( __FUNCTION__": "
@@ -162,7 +149,7 @@ void QAssociation::fillAeTitles( T_ASC_Parameters *& parameters ) const {
 
 	const OFCondition Result = ASC_setAPTitles( parameters, My, Host, NULL );
 	if ( Result.good() ) {
-		qDebug( __FUNCTION__": "
+		QDICOM_LOG( Network, Debug, __FUNCTION__": "
 			"setting AE titles:\n"
 			"\tlocal : `%s'\n"
 			"\tremote: `%s'",
@@ -193,7 +180,7 @@ void QAssociation::fillConnectionSettings(
 		parameters, LocalHostName, RemoteHostAddress
 	);
 	if ( result.good() ) {
-		qDebug( __FUNCTION__": "
+		QDICOM_LOG( Network, Debug, __FUNCTION__": "
 			"setting presentation addresses:\n"
 			"\tlocal : `%s'\n"
 			"\tremote: `%s'",
@@ -210,7 +197,7 @@ void QAssociation::fillConnectionSettings(
 
 	result = ASC_setTransportLayerType( parameters, false );
 	if ( result.bad() ) {
-		qDebug( "Selected transport layer" );
+		QDICOM_LOG( Network, Debug, "Selected transport layer" );
 	}
 	else {
 		throw QString( 
@@ -225,7 +212,7 @@ void QAssociation::fillConnectionSettings(
 void QAssociation::fillPresentationContexts(
 	T_ASC_Parameters *& parameters
 ) const {
-	const QPresentationContextList & Contexts = presentationContexts_;
+	const QPresentationContextList & Contexts = proposedContexts_;
 
 	const int PcCount = Contexts.size();
 
@@ -246,10 +233,11 @@ void QAssociation::fillPresentationContexts(
 		}
 
 		const OFCondition Result = ASC_addPresentationContext(
-			parameters, i * 2 + 1, As, tss, TssCount
+			parameters, i * 2 + 1, As, tss, TssCount,
+			static_cast< T_ASC_SC_ROLE >( Pc.tAscRole() )
 		);
 		if ( Result.good() ) {
-			qDebug( __FUNCTION__": "
+			QDICOM_LOG( Network, Debug, __FUNCTION__": "
 				"adding presentation context:\n%s",
 				qPrintable( Pc.toString() )
 			);
@@ -270,7 +258,7 @@ void QAssociation::finishAborting( QDcmtkResult result ) {
 	Q_ASSERT( state_ == Aborting );
 
 	if ( result.ofCondition().good() ) {
-		qDebug( __FUNCTION__": association aborted successfully" );
+		QDICOM_LOG( Network, Debug, __FUNCTION__": association aborted successfully" );
 	}
 	else {
 		qWarning( __FUNCTION__": "
@@ -289,7 +277,7 @@ void QAssociation::finishAcquiringNetwork( QDcmtkResult result ) {
 	Q_ASSERT( state_ == AcquiringNetwork );
 
 	if ( result.ofCondition().good() ) {
-		qDebug( __FUNCTION__": "
+		QDICOM_LOG( Network, Debug, __FUNCTION__": "
 			"network object created:\n"
 			"\tport    : %d\n"
 			"\ttimeout : %d s",
@@ -315,7 +303,7 @@ void QAssociation::finishAcquiringNetwork( QDcmtkResult result ) {
 
 void QAssociation::finishReleasing( QDcmtkResult result ) {
 	if ( result.ofCondition().good() ) {
-		qDebug( __FUNCTION__": association released successfully" );
+		QDICOM_LOG( Network, Debug, __FUNCTION__": association released successfully" );
 
 		dropTAscAssociation();
 
@@ -338,25 +326,56 @@ void QAssociation::finishRequesting( QDcmtkResult result ) {
 
 	OFCondition status = result.ofCondition();
 	if ( status.good() ) {
-		qDebug( __FUNCTION__": association requested successfully" );
+		QDICOM_LOG( Network, Debug, __FUNCTION__": association requested successfully" );
+
+		contextTable_ = QPresentationContextTable::fromTAscAssociation(
+			tAscAssociation()
+		);
+		setState( Established );
 
-#ifdef _DEBUG
 		const QPresentationContextList Contexts = acceptedPresentationContexts();
+		if ( contextCache_ ) {
+			if ( proposingCachedContexts_ && Contexts.size() < proposedContexts_.size() ) {
+				// Peer no longer accepts what it used to, renegotiate fully
+				// next time
+				contextCache_->remove( connectionParameters_ );
+			}
+			else {
+				contextCache_->update(
+					connectionParameters_, proposedContexts_, Contexts
+				);
+			}
+		}
+
+#ifdef _DEBUG
 		for (
 			QPresentationContextList::const_iterator i = Contexts.constBegin();
 			i != Contexts.constEnd(); ++i
 		) {
-			qDebug( __FUNCTION__": "
+			QDICOM_LOG( Network, Debug, __FUNCTION__": "
 				"accepted presentation context:\n%s",
 				qPrintable( i->toString() )
 			);
 		}
 #endif
 
-		setState( Established );
 		emit connected();
 		return;
 	}
+	else if (
+		status == DUL_ASSOCIATIONREJECTED && proposingCachedContexts_ &&
+		! isRejectedPermanently( tAscAssociation() )
+	) {
+		QDICOM_LOG( Network, Debug, __FUNCTION__": "
+			"association with reduced presentation contexts rejected, "
+			"retrying with the full proposal"
+		);
+
+		contextCache_->remove( connectionParameters_ );
+		dropTAscAssociation();
+		startRequesting();
+		return;
+	}
 	else if ( status == DUL_ASSOCIATIONREJECTED ) {
 		QString rejectParamsString;
 		T_ASC_RejectParameters rejectParameters;
@@ -415,7 +434,7 @@ bool QAssociation::initializeTAscNetwork() {
 		);
 
 		if ( Result.good() ) {
-			qDebug( __FUNCTION__": "
+			QDICOM_LOG( Network, Debug, __FUNCTION__": "
 				"network object created for %s mode:\n"
 				"\tport    : %d\n"
 				"\ttimeout : %d s",
@@ -479,6 +498,21 @@ quint16 QAssociation::port() const {
 }
 
 
+QPresentationContextCache * QAssociation::presentationContextCache() const {
+	return contextCache_;
+}
+
+
+const QPresentationContextTable & QAssociation::presentationContextTable() const {
+	return contextTable_;
+}
+
+
+const QPresentationContextList & QAssociation::presentationContexts() const {
+	return presentationContexts_;
+}
+
+
 void QAssociation::raiseError( const QString & Message ) {
 	if ( errorMessage_.isEmpty() ) {
 		errorMessage_ = Message;
@@ -497,7 +531,7 @@ void QAssociation::release() {
 		);		
 	}
 	else {
-		qDebug( __FUNCTION__": "
+		QDICOM_LOG( Network, Debug, __FUNCTION__": "
 			"association is not established; ignoring"
 		);
 	}
@@ -570,6 +604,20 @@ void QAssociation::setConnectionParameters(
 }
 
 
+void QAssociation::setPresentationContextCache(
+	QPresentationContextCache * cache
+) {
+	contextCache_ = cache;
+}
+
+
+void QAssociation::setPresentationContexts(
+	const QPresentationContextList & Contexts
+) {
+	presentationContexts_ = Contexts;
+}
+
+
 void QAssociation::setState( State s ) {
 	state_ = s;
 }
@@ -639,7 +687,7 @@ void QAssociation::startRequesting() {
 		&parameters, maxPdu()
 	);
 	if ( result.good() ) {
-		qDebug( __FUNCTION__": "
+		QDICOM_LOG( Network, Debug, __FUNCTION__": "
 			"created association parameters with max PDU: %d",
 			maxPdu()
 		);
@@ -651,6 +699,17 @@ void QAssociation::startRequesting() {
 		;
 	}
 
+	proposedContexts_ = contextCache_ ?
+		contextCache_->minimalContexts(
+			connectionParameters_, presentationContexts_,
+			&proposingCachedContexts_
+		) :
+		presentationContexts_
+	;
+	if ( ! contextCache_ ) {
+		proposingCachedContexts_ = false;
+	}
+
 	try { // Nested try block for parameters
 
 	fillAeTitles( parameters );
@@ -730,3 +789,13 @@ OFCondition ASC_requestAssociationWrapper(
 		network, parameters, association, NULL, NULL, DUL_NOBLOCK, timeout
 	);
 }
+
+
+bool isRejectedPermanently( T_ASC_Association * association ) {
+	T_ASC_RejectParameters parameters;
+	const OFCondition Result =
+		ASC_getRejectParameters( association->params, &parameters )
+	;
+
+	return Result.good() && parameters.result == ASC_RESULT_REJECTEDPERMANENT;
+}
@@ -14,9 +14,11 @@
 #include <QtDicom/UidList.hpp>
 #include <QtDicom/QDcmtkResult>
 #include <QtDicom/QPresentationContextList>
+#include <QtDicom/QPresentationContextTable>
 
 
 class QHostAddress;
+class QPresentationContextCache;
 
 struct T_ASC_Association;
 struct T_ASC_Network;
@@ -205,6 +207,20 @@ class QDICOM_DLLSPEC QAssociation : public QObject {
 		 */
 		const QPresentationContextList & presentationContexts() const;
 
+		/**
+		 * Returns the cache used to remember negotiation outcome for each
+		 * peer; by default it is \ref QPresentationContextCache::globalInstance().
+		 * Returns \c 0 when caching was disabled.
+		 */
+		QPresentationContextCache * presentationContextCache() const;
+
+		/**
+		 * Returns the index of presentation contexts accepted by the DICOM
+		 * server. The table is built once, when the association gets
+		 * established, and stays empty otherwise.
+		 */
+		const QPresentationContextTable & presentationContextTable() const;
+
 		/**
 		 * An overloaded method, provided for conveniance. Sets connection
 		 * parameters for this association to \a parameters and then calls the
@@ -249,6 +265,17 @@ class QDICOM_DLLSPEC QAssociation : public QObject {
 		 */
 		void setPresentationContexts( const QPresentationContextList & list );
 
+		/**
+		 * Sets the negotiation \a cache. When the peer is known to the cache,
+		 * the association is first requested with a reduced list of
+		 * presentation contexts, which the peer accepted before. If the peer
+		 * rejects such association, the entry is dropped and the association
+		 * is requested again with the full list of \ref presentationContexts().
+		 *
+		 * Pass \c 0 to always propose the full list.
+		 */
+		void setPresentationContextCache( QPresentationContextCache * cache );
+
 		/**
 		 * Return current state of the association.
 		 */
@@ -379,7 +406,11 @@ class QDICOM_DLLSPEC QAssociation : public QObject {
 		void dropTAscNetwork();
 		bool initializeTAscNetwork();
 
+		QPresentationContextCache * contextCache_;
+		QPresentationContextTable contextTable_;
 		QPresentationContextList presentationContexts_;
+		QPresentationContextList proposedContexts_;
+		bool proposingCachedContexts_;
 
 		State state_;
 		inline void setState( State );
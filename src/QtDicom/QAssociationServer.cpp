@@ -5,18 +5,104 @@
 
 #include "AssociationServer.hpp"
 #include "AssociationServer.moc.inl"
+#include "Log.hpp"
+#include "Metrics.hpp"
 #include "ServerAssociation.hpp"
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutexLocker>
+
 #include <dcmtk/dcmnet/assoc.h>
+#include <dcmtk/dcmnet/dcmlayer.h>
+#include <dcmtk/dcmnet/dcmtrans.h>
+#include <dcmtk/dcmnet/dul.h>
+
+#ifdef Q_OS_UNIX
+# include <errno.h>
+# include <netinet/in.h>
+# include <string.h>
+# include <sys/socket.h>
+# include <unistd.h>
+# ifdef SO_REUSEPORT
+#  define QDICOM_SHARED_SOCKETS
+# endif
+#endif
 
 
 namespace Dicom {
 
+/**
+ * The \em AssociationServer::AcceptingLayer is the transport layer of a
+ * shard's network. DCMTK asks it for a connection right after accepting a
+ * socket and before reading the A-ASSOCIATE-RQ; that's where the shard's
+ * accept lock is released.
+ *
+ * Connections are plain TCP ones; DCMTK only calls the layer when receiving
+ * with its "secure layer" flag, see \ref ServerAssociation::setUseTransportLayer().
+ */
+class AssociationServer::AcceptingLayer : public DcmTransportLayer {
+	public :
+		AcceptingLayer( Shard & shard ) :
+			DcmTransportLayer( NET_ACCEPTOR ),
+			shard_( shard )
+		{
+		}
+
+		DcmTransportConnection * createConnection( int openSocket, OFBool ) {
+			// Called by the negotiator holding the lock
+			if ( shard_.acceptLockHeld ) {
+				shard_.acceptLockHeld = false;
+				shard_.acceptLock.unlock();
+			}
+
+			return new DcmTCPConnection( openSocket );
+		}
+
+	private :
+		Shard & shard_;
+};
+
+
+/**
+ * The \em AssociationServer::Negotiator is an additional thread running the
+ * \ref AssociationServer::negotiate() loop.
+ */
+class AssociationServer::Negotiator : public QThread {
+	public :
+		Negotiator( AssociationServer & server, Shard & shard ) :
+			server_( server ),
+			shard_( shard )
+		{
+		}
+
+	private :
+		void run() {
+			server_.negotiate( shard_ );
+		}
+
+	private :
+		AssociationServer & server_;
+		Shard & shard_;
+};
+
+
+AssociationServer::Shard::Shard() :
+	acceptLockHeld( false ),
+	tAscNetwork( 0 ),
+	transportLayer( 0 )
+{
+}
+
+
 AssociationServer::AssociationServer( QObject * parent ) :
 	QThread( parent ),
+	activeAssociations_( 0 ),
 	closing_( false ),
 	connectionParameters_( ConnectionParameters::Server ),
-	tAscNetwork_( 0 )
+	listenerShards_( 1 ),
+	maxAssociations_( 0 ),
+	maxAssociationsPerAe_( 0 ),
+	negotiatorCount_( qMax( 2, QThread::idealThreadCount() ) )
 {
 }
 
@@ -31,28 +117,73 @@ const UidList & AssociationServer::abstractSyntaxes() const {
 }
 
 
+int AssociationServer::activeAssociations() const {
+	QMutexLocker locker( &dataLock() );
+
+	return activeAssociations_;
+}
+
+
+bool AssociationServer::admit( const QString & CallingAe, QString & explanation ) {
+	QMutexLocker locker( &dataLock() );
+
+	if ( maxAssociations_ > 0 && activeAssociations_ >= maxAssociations_ ) {
+		explanation = QString( "%1 association(s) active already" )
+			.arg( activeAssociations_ )
+		;
+		return false;
+	}
+
+	int & perAe = activeAssociationsPerAe_[ CallingAe ];
+	if ( maxAssociationsPerAe_ > 0 && perAe >= maxAssociationsPerAe_ ) {
+		explanation = QString( "%1 association(s) of `%2' active already" )
+			.arg( perAe ).arg( CallingAe )
+		;
+		return false;
+	}
+
+	++activeAssociations_;
+	++perAe;
+	return true;
+}
+
+
 void AssociationServer::close() {
 	if ( isListening() ) {
 		setClosingFlag();
 
-		// Give thread polling interval + a hundred miliseconds to quit run()
-		if ( ! wait( pollingInterval() + 100 ) ) {
+		// Give threads waiting interval + a hundred miliseconds to quit
+		const int Timeout = waitingInterval() * 1000 + 100;
+		if ( ! wait( Timeout ) ) {
 			qWarning( "Terminating thread." );
 			terminate();
+			wait();
 		}
+		foreach ( Negotiator * negotiator, negotiators_ ) {
+			if ( ! negotiator->wait( Timeout ) ) {
+				qWarning( "Terminating negotiator thread." );
+				negotiator->terminate();
+				negotiator->wait();
+			}
+			delete negotiator;
+		}
+		negotiators_.clear();
 	}
-	if ( tAscNetwork() ) {
-		const OFCondition Result = ASC_dropNetwork( & tAscNetwork() );
-		if ( Result.bad() ) {
-			qWarning(
-				"Error occured when dropping network. "
-				"Internal error description:\n%s",
-				Result.text()
-			);
+	foreach ( Shard * shard, shards_ ) {
+		if ( shard->tAscNetwork ) {
+			const OFCondition Result = ASC_dropNetwork( & shard->tAscNetwork );
+			if ( Result.bad() ) {
+				qWarning(
+					"Error occured when dropping network. "
+					"Internal error description:\n%s",
+					Result.text()
+				);
+			}
 		}
-
-		tAscNetwork_ = 0;
+		delete shard->transportLayer;
+		delete shard;
 	}
+	shards_.clear();
 }
 
 
@@ -75,6 +206,15 @@ void AssociationServer::enqueuePendingAssociation( ServerAssociation * associati
 }
 
 
+void AssociationServer::forgetAssociation( QObject * association ) {
+	dataLock().lock();
+	const QString CallingAe = admittedAssociations_.take( association );
+	dataLock().unlock();
+
+	releaseAdmission( CallingAe );
+}
+
+
 QString AssociationServer::errorString() const {
 	return errorString_;
 }
@@ -112,88 +252,178 @@ bool AssociationServer::listen( const ConnectionParameters & Parameters ) {
 
 	setConnectionParameters( Parameters );
 
-	Q_ASSERT( ! tAscNetwork() );
-
-	const OFCondition Result = ASC_initializeNetwork(
-		NET_ACCEPTOR,
-		static_cast< int >( Parameters.port() ),
-		Parameters.timeout(),
-		&tAscNetwork()
-	);
+	Q_ASSERT( shards_.isEmpty() );
 
-	if ( Result.good() ) {
-		start();
-		return true;
-	}
-	else {
-		raiseError(
-			QString( 
-				"Failed to initialize network. "
-				"Internal error description:\n%1"
-			)
-			.arg( Result.text() )
+#ifdef QDICOM_SHARED_SOCKETS
+	const int ShardCount = listenerShards();
+#else
+	const int ShardCount = 1;
+	if ( listenerShards() > 1 ) {
+		qWarning( __FUNCTION__": "
+			"SO_REUSEPORT is not supported, using a single listener"
 		);
-		return false;
 	}
-}
+#endif
 
+	// DCMTK takes an externally opened socket through a global variable
+	static QMutex ExternalSocketLock;
 
-ServerAssociation * AssociationServer::nextPendingAssociation() {
-	dataLock().lock();
-	ServerAssociation * tmp =
-		pendingAssociations_.size() > 0 ?
-		pendingAssociations_.dequeue() :
-		0
-	;
-	dataLock().unlock();
+	for ( int i = 0; i < ShardCount; ++i ) {
+		Shard * shard = new Shard();
+		shards_.append( shard );
 
-	return tmp;
-}
+		int socket = -1;
+		if ( ShardCount > 1 ) {
+			socket = openSharedSocket( Parameters.port() );
+			if ( socket < 0 ) {
+				close();
+				return false;
+			}
+		}
 
+		QMutexLocker locker( &ExternalSocketLock );
+		if ( socket > -1 ) {
+			dcmExternalSocketHandle.set( socket );
+		}
 
-int AssociationServer::pollingInterval() {
-	return 10;
+		const OFCondition Result = ASC_initializeNetwork(
+			NET_ACCEPTOR,
+			static_cast< int >( Parameters.port() ),
+			Parameters.timeout(),
+			&shard->tAscNetwork
+		);
+
+		if ( socket > -1 ) {
+			dcmExternalSocketHandle.set( -1 );
+		}
+		locker.unlock();
+
+		if ( Result.bad() ) {
+#ifdef QDICOM_SHARED_SOCKETS
+			if ( socket > -1 && ! shard->tAscNetwork ) {
+				::close( socket );
+			}
+#endif
+			raiseError(
+				QString( 
+					"Failed to initialize network. "
+					"Internal error description:\n%1"
+				)
+				.arg( Result.text() )
+			);
+			close();
+			return false;
+		}
+
+		shard->transportLayer = new AcceptingLayer( *shard );
+		const OFCondition Layered = ASC_setTransportLayer(
+			shard->tAscNetwork, shard->transportLayer, 0
+		);
+		if ( Layered.bad() ) {
+			raiseError(
+				QString( 
+					"Failed to set the transport layer. "
+					"Internal error description:\n%1"
+				)
+				.arg( Layered.text() )
+			);
+			close();
+			return false;
+		}
+	}
+
+	dataLock().lock();
+	closing_ = false;
+	dataLock().unlock();
+
+	// Each shard gets its own negotiators, the first one runs in this thread
+	const int Count = qMax( negotiatorCount(), ShardCount );
+	for ( int i = 1; i < Count; ++i ) {
+		Negotiator * negotiator = new Negotiator(
+			*this, *shards_.at( i % ShardCount )
+		);
+		negotiators_.append( negotiator );
+		negotiator->start();
+	}
+	start();
+	return true;
 }
 
 
-void AssociationServer::raiseError( const QString & Message ) {
-	errorString_ = Message;
+int AssociationServer::listenerShards() const {
+	return listenerShards_;
 }
 
 
-void AssociationServer::run() {
+void AssociationServer::negotiate( Shard & shard ) {
 	ServerAssociation * association = 0;
 	bool timedOut = false;
 
 	while ( ! ( isClosing() ) ) {
 		if ( ! association ) {
 			association = new ServerAssociation(
-				tAscNetwork(), connectionParameters()
+				shard.tAscNetwork, connectionParameters()
 			);
 		}
 
-		if ( ! association->isPending() ) {
-			QThread::msleep( pollingInterval() );
+		QElapsedTimer setupTimer;
+		bool result = false;
+		if ( ! receivePendingAssociation(
+			shard, association, result, timedOut, setupTimer
+		) ) {
 			continue;
 		}
 
-		bool result = association->receive( &timedOut );
 		if ( result && ! isClosing() ) {
+			const QString CallingAe = association->callingAeTitle();
+
+			// Load above limits is shed before any work is done for it
+			QString explanation;
+			if ( ! admit( CallingAe, explanation ) ) {
+				association->reject( AcceptorAssociation::LocalLimitExceeded );
+				emit newAssociationError(
+					QString( "Association from `%1' rejected; %2." )
+					.arg( CallingAe ).arg( explanation )
+				);
+				// The A-ASSOCIATE-RJ ends the association, no A-ABORT may
+				// follow; the connection is closed and a fresh object used
+				association->drop();
+				delete association;
+				association = 0;
+				continue;
+			}
+
 			result = association->accept( 
 				abstractSyntaxes(), transferSyntaxes()
 			);
 			if ( result ) {
+				Metrics::instance().addLatency(
+					Metrics::AssociationSetup, QString(), CallingAe,
+					setupTimer.nsecsElapsed() / 1000
+				);
+
+				dataLock().lock();
+				admittedAssociations_.insert( association, CallingAe );
+				dataLock().unlock();
+				connect(
+					association, SIGNAL( destroyed( QObject * ) ),
+					SLOT( forgetAssociation( QObject * ) ),
+					Qt::DirectConnection
+				);
+
 				enqueuePendingAssociation( association );
 				association = 0;
 			}
 			else {
+				releaseAdmission( CallingAe );
 				emit newAssociationError( association->errorMessage() );
 				association->abort();
 			}
 		}
 		else if ( timedOut ) {
-			emit newAssociationError(
-				"Timeout occured when receiving an association."
+			// The connection was dropped before it could be accepted
+			QDICOM_LOG( Network, Debug,
+				"No association request to receive on a pending connection."
 			);
 			association->abort();
 		}
@@ -204,7 +434,138 @@ void AssociationServer::run() {
 			association->abort();
 		}
 	}
-	qt_noop();
+
+	delete association;
+}
+
+
+int AssociationServer::maxAssociations() const {
+	return maxAssociations_;
+}
+
+
+int AssociationServer::maxAssociationsPerAe() const {
+	return maxAssociationsPerAe_;
+}
+
+
+int AssociationServer::negotiatorCount() const {
+	return negotiatorCount_;
+}
+
+
+ServerAssociation * AssociationServer::nextPendingAssociation() {
+	dataLock().lock();
+	ServerAssociation * tmp =
+		pendingAssociations_.size() > 0 ?
+		pendingAssociations_.dequeue() :
+		0
+	;
+	dataLock().unlock();
+
+	return tmp;
+}
+
+
+int AssociationServer::openSharedSocket( quint16 port ) {
+#ifdef QDICOM_SHARED_SOCKETS
+	const int Socket = ::socket( AF_INET, SOCK_STREAM, 0 );
+	if ( Socket < 0 ) {
+		raiseError(
+			QString( "Failed to create a socket. %1." )
+			.arg( ::strerror( errno ) )
+		);
+		return -1;
+	}
+
+	const int On = 1;
+	sockaddr_in address;
+	::memset( &address, 0, sizeof( address ) );
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl( INADDR_ANY );
+	address.sin_port = htons( port );
+
+	if (
+		::setsockopt( Socket, SOL_SOCKET, SO_REUSEADDR, &On, sizeof( On ) ) < 0 ||
+		::setsockopt( Socket, SOL_SOCKET, SO_REUSEPORT, &On, sizeof( On ) ) < 0 ||
+		::bind(
+			Socket, reinterpret_cast< sockaddr * >( &address ), sizeof( address )
+		) < 0 ||
+		::listen( Socket, SOMAXCONN ) < 0
+	) {
+		raiseError(
+			QString( "Failed to open a shared socket on port %1. %2." )
+			.arg( port )
+			.arg( ::strerror( errno ) )
+		);
+		::close( Socket );
+		return -1;
+	}
+
+	return Socket;
+#else
+	raiseError(
+		QString( "Unable to share port %1, SO_REUSEPORT is not supported." )
+		.arg( port )
+	);
+	return -1;
+#endif
+}
+
+
+void AssociationServer::raiseError( const QString & Message ) {
+	errorString_ = Message;
+}
+
+
+bool AssociationServer::receivePendingAssociation(
+	Shard & shard,
+	ServerAssociation * association,
+	bool & received,
+	bool & timedOut,
+	QElapsedTimer & timer
+) {
+	// Negotiators not holding the socket queue up here. The lock is held
+	// until the connection is accepted, as another negotiator seeing the
+	// same connection pending would block in accept() otherwise
+	if ( ! shard.acceptLock.tryLock( waitingInterval() * 1000 ) ) {
+		return false;
+	}
+
+	shard.acceptLockHeld = true;
+
+	const bool Pending =
+		! isClosing() && association->waitForPending( waitingInterval() )
+	;
+	if ( Pending ) {
+		// The transport layer unlocks once the connection is accepted
+		timer.start();
+		association->setUseTransportLayer( true );
+		received = association->receive( &timedOut );
+	}
+
+	// Nothing was accepted after all
+	if ( shard.acceptLockHeld ) {
+		shard.acceptLockHeld = false;
+		shard.acceptLock.unlock();
+	}
+
+	return Pending;
+}
+
+
+void AssociationServer::releaseAdmission( const QString & CallingAe ) {
+	QMutexLocker locker( &dataLock() );
+
+	--activeAssociations_;
+	if ( --activeAssociationsPerAe_[ CallingAe ] <= 0 ) {
+		activeAssociationsPerAe_.remove( CallingAe );
+	}
+}
+
+
+void AssociationServer::run() {
+	negotiate( *shards_.first() );
 }
 
 
@@ -231,6 +592,26 @@ void AssociationServer::setConnectionParameters( const ConnectionParameters & Pa
 
 
 
+void AssociationServer::setListenerShards( int count ) {
+	listenerShards_ = qMax( 1, count );
+}
+
+
+void AssociationServer::setMaxAssociations( int count ) {
+	maxAssociations_ = qMax( 0, count );
+}
+
+
+void AssociationServer::setMaxAssociationsPerAe( int count ) {
+	maxAssociationsPerAe_ = qMax( 0, count );
+}
+
+
+void AssociationServer::setNegotiatorCount( int count ) {
+	negotiatorCount_ = qMax( 1, count );
+}
+
+
 void AssociationServer::setTransferSyntaxes( const UidList & List ) {
 	dataLock().lock();
 	transferSyntaxes_ = List;
@@ -238,13 +619,13 @@ void AssociationServer::setTransferSyntaxes( const UidList & List ) {
 }
 
 
-T_ASC_Network *& AssociationServer::tAscNetwork() {
-	return tAscNetwork_;
+const UidList & AssociationServer::transferSyntaxes() const {
+	return transferSyntaxes_;
 }
 
 
-const UidList & AssociationServer::transferSyntaxes() const {
-	return transferSyntaxes_;
+int AssociationServer::waitingInterval() {
+	return 1;
 }
 
 }; // Namespace DICOM ends here.
@@ -6,6 +6,8 @@
 #ifndef DICOM_ASSOCIATIONSERVER_HPP
 #define DICOM_ASSOCIATIONSERVER_HPP
 
+#include <QtCore/QHash>
+#include <QtCore/QList>
 #include <QtCore/QMutex>
 #include <QtCore/QQueue>
 #include <QtCore/QThread>
@@ -14,6 +16,7 @@
 #include "QtDicom/Globals.hpp"
 #include "QtDicom/UidList.hpp"
 
+class QElapsedTimer;
 class QHostAddress;
 
 struct T_ASC_Network;
@@ -35,6 +38,12 @@ class QDICOM_DLLSPEC AssociationServer : public QThread {
 		 */
 		const UidList & abstractSyntaxes() const;
 
+		/**
+		 * Returns the number of associations accepted by the server which
+		 * haven't been destroyed yet.
+		 */
+		int activeAssociations() const;
+
 		/**
 		 * Stops listening.
 		 */
@@ -63,6 +72,28 @@ class QDICOM_DLLSPEC AssociationServer : public QThread {
 		 */
 		bool listen( const ConnectionParameters & parameters );
 
+		/**
+		 * Returns the number of sockets listening on the server's port.
+		 */
+		int listenerShards() const;
+
+		/**
+		 * Returns the maximum number of active associations; \c 0 means no
+		 * limit.
+		 */
+		int maxAssociations() const;
+
+		/**
+		 * Returns the maximum number of active associations requested by a
+		 * single AE; \c 0 means no limit.
+		 */
+		int maxAssociationsPerAe() const;
+
+		/**
+		 * Returns the number of threads negotiating incoming associations.
+		 */
+		int negotiatorCount() const;
+
 		/**
 		 * Returns the next pending association as an accepted \ref Association
 		 * object.
@@ -78,6 +109,42 @@ class QDICOM_DLLSPEC AssociationServer : public QThread {
 		 */
 		void setAbstractSyntaxes( const UidList & syntaxes );
 
+		/**
+		 * Sets the number of sockets listening on the server's port to \a
+		 * count. Each socket is bound with the \c SO_REUSEPORT option and has
+		 * its own share of negotiators, so the system spreads incoming
+		 * connections across them.
+		 *
+		 * On systems lacking \c SO_REUSEPORT a single socket is used. The
+		 * setting takes effect the next time server starts listening.
+		 */
+		void setListenerShards( int count );
+
+		/**
+		 * Limits the number of \ref activeAssociations() to \a count.
+		 * Requests above the limit are rejected with the \ref
+		 * AcceptorAssociation::LocalLimitExceeded reason, so the requestor
+		 * knows to retry later. An association stays active until the object
+		 * retrieved with \ref nextPendingAssociation() is destroyed.
+		 */
+		void setMaxAssociations( int count );
+
+		/**
+		 * Limits the number of active associations requested by any single
+		 * calling AE to \a count, so one peer can't take all of them.
+		 */
+		void setMaxAssociationsPerAe( int count );
+
+		/**
+		 * Sets the number of threads negotiating incoming associations to \a
+		 * count. Each negotiator receives an A-ASSOCIATE-RQ and responds to
+		 * it on its own, so a slow peer stalls only one of them. The default
+		 * is the number of processor cores, but no less than two.
+		 *
+		 * The setting takes effect the next time server starts listening.
+		 */
+		void setNegotiatorCount( int count );
+
 		/**
 		 * Sets a list of transfer \a syntaxes for the server to accept.
 		 */
@@ -93,30 +160,104 @@ class QDICOM_DLLSPEC AssociationServer : public QThread {
 		bool waitForNewAssociation( int msec = 0, bool * timedOut = 0 );
 
 	private :
+		class AcceptingLayer;
+		class Negotiator;
+
 		/**
-		 * Returns default polling interval in miliseconds. 100 is the default.
+		 * The \em Shard structure binds a listening network with a lock
+		 * serializing negotiators waiting on it and accepting connections.
+		 * The network's transport layer releases the lock once a connection
+		 * has been accepted.
 		 */
-		static int pollingInterval();
+		struct Shard {
+			Shard();
+
+			QMutex acceptLock;
+			bool acceptLockHeld;
+			T_ASC_Network * tAscNetwork;
+			AcceptingLayer * transportLayer;
+		};
+
+		/**
+		 * Returns, in seconds, for how long a negotiator waits for incoming
+		 * connection before checking whether server is closing.
+		 */
+		static int waitingInterval();
 
 	private :
+		/**
+		 * Reserves a place for an association requested by the \a callingAe.
+		 * Returns \c false if a limit has been reached; the \a explanation
+		 * then says which.
+		 */
+		bool admit( const QString & callingAe, QString & explanation );
+
 		/**
 		 * Returns \c true when thread is closing.
 		 */
 		bool isClosing() const;
 
 		/**
-		 * Thread body.
+		 * Negotiator's body: waits for incoming connections on the \a shard,
+		 * receives and accepts associations until the server is closed.
+		 */
+		void negotiate( Shard & shard );
+
+		/**
+		 * Opens a listening socket on the \a port that other sockets can
+		 * share. Returns the socket or \c -1 in case of an error.
+		 */
+		int openSharedSocket( quint16 port );
+
+		/**
+		 * Frees the place reserved for an association of the \a callingAe.
+		 */
+		void releaseAdmission( const QString & callingAe );
+
+		/**
+		 * Thread body, runs the first negotiator.
 		 */
 		void run();
 
+		/**
+		 * Waits up to the \ref waitingInterval() for a connection on the \a
+		 * shard's socket and receives its request into the \a association.
+		 * Returns \c false if no connection arrived; otherwise \a received
+		 * and \a timedOut tell the result of receiving it and the \a timer
+		 * is started once the connection is there.
+		 *
+		 * Only one negotiator at a time waits on the socket and accepts the
+		 * connection, so none is left blocked in accept() by another taking
+		 * the connection first. The lock is released as soon as the
+		 * connection is accepted; the A-ASSOCIATE-RQ is read without it, so
+		 * a slow peer doesn't hold up other negotiators.
+		 */
+		bool receivePendingAssociation(
+			Shard & shard,
+			ServerAssociation * association,
+			bool & received,
+			bool & timedOut,
+			QElapsedTimer & timer
+		);
+
 		/**
 		 * Forces thread to quit.
 		 */
 		void setClosingFlag();
 
 
+	private slots :
+		/**
+		 * Called when an accepted \a association is destroyed.
+		 */
+		void forgetAssociation( QObject * association );
+
 	private :
 		UidList abstractSyntaxes_;
+
+		int activeAssociations_;
+		QHash< QString, int > activeAssociationsPerAe_;
+		QHash< QObject *, QString > admittedAssociations_;
 		// UidList & abstractSyntaxes();
 
 		bool closing_;
@@ -134,8 +275,15 @@ class QDICOM_DLLSPEC AssociationServer : public QThread {
 		void enqueuePendingAssociation( ServerAssociation * association );
 		QQueue< ServerAssociation * > pendingAssociations_;
 
-		T_ASC_Network * tAscNetwork_;
-		T_ASC_Network *& tAscNetwork();
+		int listenerShards_;
+
+		int maxAssociations_;
+		int maxAssociationsPerAe_;
+
+		int negotiatorCount_;
+		QList< Negotiator * > negotiators_;
+
+		QList< Shard * > shards_;
 
 		UidList transferSyntaxes_;
 		// UidList & transferSyntaxes();
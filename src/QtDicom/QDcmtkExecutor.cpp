@@ -0,0 +1,290 @@
+﻿/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "QDcmtkExecutor.hpp"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+
+
+Q_GLOBAL_STATIC( QDcmtkExecutor, sharedExecutor );
+
+
+/**
+ * The \em QDcmtkExecutor::Worker class is a thread running the \ref
+ * QDcmtkExecutor::work() loop.
+ */
+class QDcmtkExecutor::Worker : public QThread {
+	public :
+		Worker( QDcmtkExecutor & executor ) :
+			executor_( executor )
+		{
+		}
+
+	private :
+		void run() {
+			executor_.work();
+		}
+
+	private :
+		QDcmtkExecutor & executor_;
+};
+
+
+QDcmtkExecutor::QDcmtkExecutor( int threads, int capacity ) :
+	active_( 0 ),
+	capacity_( qMax( 0, capacity ) ),
+	completed_( 0 ),
+	expiryTimeout_( 30000 ),
+	idle_( 0 ),
+	maxThreads_( qMax( 1, threads ) ),
+	queueTime_( 0 ),
+	rejected_( 0 ),
+	stopping_( false )
+{
+}
+
+
+QDcmtkExecutor::~QDcmtkExecutor() {
+	lock_.lock();
+	stopping_ = true;
+	queueCondition_.wakeAll();
+	lock_.unlock();
+
+	// Threads no longer retire once the executor is stopping
+	foreach ( QThread * worker, workers_ ) {
+		worker->wait();
+		delete worker;
+	}
+	reapWorkers();
+}
+
+
+int QDcmtkExecutor::activeThreadCount() const {
+	QMutexLocker locker( &lock_ );
+
+	return active_;
+}
+
+
+double QDcmtkExecutor::averageQueueTime() const {
+	QMutexLocker locker( &lock_ );
+
+	const quint64 Started = completed_ + active_;
+	return Started > 0 ? double( queueTime_ ) / Started : 0.0;
+}
+
+
+bool QDcmtkExecutor::cancel( QRunnable * runnable ) {
+	QMutexLocker locker( &lock_ );
+
+	for ( int i = 0; i < queue_.size(); ++i ) {
+		if ( queue_.at( i ).runnable == runnable ) {
+			queue_.removeAt( i );
+			if ( queue_.isEmpty() && active_ == 0 ) {
+				doneCondition_.wakeAll();
+			}
+			locker.unlock();
+
+			if ( runnable->autoDelete() ) {
+				delete runnable;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+
+int QDcmtkExecutor::capacity() const {
+	QMutexLocker locker( &lock_ );
+
+	return capacity_;
+}
+
+
+quint64 QDcmtkExecutor::completedTaskCount() const {
+	QMutexLocker locker( &lock_ );
+
+	return completed_;
+}
+
+
+int QDcmtkExecutor::expiryTimeout() const {
+	QMutexLocker locker( &lock_ );
+
+	return expiryTimeout_;
+}
+
+
+QDcmtkExecutor & QDcmtkExecutor::instance() {
+	return *sharedExecutor();
+}
+
+
+int QDcmtkExecutor::maxThreadCount() const {
+	QMutexLocker locker( &lock_ );
+
+	return maxThreads_;
+}
+
+
+int QDcmtkExecutor::queuedTaskCount() const {
+	QMutexLocker locker( &lock_ );
+
+	return queue_.size();
+}
+
+
+void QDcmtkExecutor::reapWorkers() {
+	lock_.lock();
+	const QList< QThread * > Retired = retired_;
+	retired_.clear();
+	lock_.unlock();
+
+	// Retired threads have left work() already, waiting is brief
+	foreach ( QThread * worker, Retired ) {
+		worker->wait();
+		delete worker;
+	}
+}
+
+
+quint64 QDcmtkExecutor::rejectedTaskCount() const {
+	QMutexLocker locker( &lock_ );
+
+	return rejected_;
+}
+
+
+void QDcmtkExecutor::setCapacity( int capacity ) {
+	QMutexLocker locker( &lock_ );
+
+	capacity_ = qMax( 0, capacity );
+}
+
+
+void QDcmtkExecutor::setExpiryTimeout( int msecs ) {
+	QMutexLocker locker( &lock_ );
+
+	expiryTimeout_ = msecs;
+}
+
+
+void QDcmtkExecutor::setMaxThreadCount( int threads ) {
+	QMutexLocker locker( &lock_ );
+
+	maxThreads_ = qMax( 1, threads );
+}
+
+
+bool QDcmtkExecutor::start( QRunnable * runnable ) {
+	Q_ASSERT( runnable );
+
+	reapWorkers();
+
+	QMutexLocker locker( &lock_ );
+
+	if ( stopping_ || ( capacity_ > 0 && queue_.size() >= capacity_ ) ) {
+		++rejected_;
+		return false;
+	}
+
+	Entry entry;
+	entry.runnable = runnable;
+	entry.queued.start();
+	queue_.enqueue( entry );
+
+	// Threads are added only when those waiting for work don't suffice
+	queueCondition_.wakeOne();
+	if ( idle_ < queue_.size() && workers_.size() < maxThreads_ ) {
+		Worker * worker = new Worker( *this );
+		workers_.append( worker );
+		worker->start();
+	}
+	return true;
+}
+
+
+bool QDcmtkExecutor::waitForDone( int msecs ) {
+	QElapsedTimer timer;
+	timer.start();
+
+	QMutexLocker locker( &lock_ );
+
+	while ( ! queue_.isEmpty() || active_ > 0 ) {
+		if ( msecs < 0 ) {
+			doneCondition_.wait( &lock_ );
+		}
+		else {
+			const qint64 Remaining = msecs - timer.elapsed();
+			if (
+				Remaining <= 0 ||
+				! doneCondition_.wait( &lock_, static_cast< unsigned long >( Remaining ) )
+			) {
+				return queue_.isEmpty() && active_ == 0;
+			}
+		}
+	}
+	return true;
+}
+
+
+void QDcmtkExecutor::work() {
+	QThread * const Self = QThread::currentThread();
+
+	QMutexLocker locker( &lock_ );
+
+	forever {
+		bool expired = false;
+		while ( queue_.isEmpty() && ! stopping_ && ! expired ) {
+			++idle_;
+			expired = expiryTimeout_ < 0 ?
+				! queueCondition_.wait( &lock_ ) :
+				! queueCondition_.wait( &lock_, expiryTimeout_ )
+			;
+			--idle_;
+		}
+
+		// Threads idle for too long, or above the maximum lowered meanwhile,
+		// exit; the next call to start() deletes them
+		if (
+			! stopping_ &&
+			( ( expired && queue_.isEmpty() ) || workers_.size() > maxThreads_ )
+		) {
+			workers_.removeOne( Self );
+			retired_.append( Self );
+
+			// A wake-up taken by this thread goes to another one
+			if ( ! queue_.isEmpty() ) {
+				queueCondition_.wakeOne();
+			}
+			return;
+		}
+
+		// Runnables queued are run before the executor is gone
+		if ( queue_.isEmpty() ) {
+			return;
+		}
+
+		const Entry Next = queue_.dequeue();
+		queueTime_ += Next.queued.elapsed();
+		++active_;
+		locker.unlock();
+
+		Next.runnable->run();
+		if ( Next.runnable->autoDelete() ) {
+			delete Next.runnable;
+		}
+
+		locker.relock();
+		--active_;
+		++completed_;
+		if ( queue_.isEmpty() && active_ == 0 ) {
+			doneCondition_.wakeAll();
+		}
+	}
+}
@@ -0,0 +1,175 @@
+﻿/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef QTDICOM_QDCMTKEXECUTOR_HPP
+#define QTDICOM_QDCMTKEXECUTOR_HPP
+
+#include "Globals.hpp"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QWaitCondition>
+
+class QRunnable;
+class QThread;
+
+/**
+ * The \em QDcmtkExecutor class runs blocking DCMTK calls, such as association
+ * negotiation, release and abort, in threads of its own.
+ *
+ * Unlike the global \em QThreadPool, which is shared with computations, an
+ * executor's threads spend most of their time waiting for the network; giving
+ * them a pool of their own keeps slow peers from starving the computations
+ * and the other way round.
+ *
+ * Runnables are queued and picked up by at most \ref maxThreadCount()
+ * threads, created when needed. Threads idle for longer than \ref
+ * expiryTimeout() exit, and so do those above the maximum once it's lowered.
+ * When \ref capacity() runnables are queued already, \ref start() refuses
+ * more. Runnables which haven't started yet can be cancelled. Runnables
+ * flagged with \em autoDelete() are deleted after they run or are cancelled.
+ *
+ * The \ref instance() executor is shared by \ref QDcmtkTask objects.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC QDcmtkExecutor {
+	public :
+		/**
+		 * Creates an executor running at most \a threads runnables at a time
+		 * with at most \a capacity of them queued; zero means no limit.
+		 */
+		QDcmtkExecutor( int threads = 8, int capacity = 0 );
+
+		/**
+		 * Runs the runnables queued and destroys the executor.
+		 */
+		~QDcmtkExecutor();
+
+		/**
+		 * Returns the number of runnables being run.
+		 */
+		int activeThreadCount() const;
+
+		/**
+		 * Returns the average time, in milliseconds, runnables have waited
+		 * in the queue.
+		 */
+		double averageQueueTime() const;
+
+		/**
+		 * Removes the \a runnable from the queue. Returns \c false if it's
+		 * been started already or wasn't queued.
+		 */
+		bool cancel( QRunnable * runnable );
+
+		/**
+		 * Returns the maximum number of runnables queued.
+		 */
+		int capacity() const;
+
+		/**
+		 * Returns the number of runnables run.
+		 */
+		quint64 completedTaskCount() const;
+
+		/**
+		 * Returns the time, in milliseconds, after which idle threads exit;
+		 * a negative value means never. Defaults to 30 seconds.
+		 */
+		int expiryTimeout() const;
+
+		/**
+		 * Returns the executor shared by the process.
+		 */
+		static QDcmtkExecutor & instance();
+
+		/**
+		 * Returns the maximum number of runnables run at a time.
+		 */
+		int maxThreadCount() const;
+
+		/**
+		 * Returns the number of runnables waiting to be run.
+		 */
+		int queuedTaskCount() const;
+
+		/**
+		 * Returns the number of runnables refused because the queue was full.
+		 */
+		quint64 rejectedTaskCount() const;
+
+		/**
+		 * Sets the maximum \a capacity of the queue; zero means no limit.
+		 */
+		void setCapacity( int capacity );
+
+		/**
+		 * Sets the time after which idle threads exit to \a msecs.
+		 */
+		void setExpiryTimeout( int msecs );
+
+		/**
+		 * Sets the maximum number of \a threads. Threads above it exit once
+		 * they finish their runnables.
+		 */
+		void setMaxThreadCount( int threads );
+
+		/**
+		 * Queues the \a runnable. Returns \c false if the queue is full.
+		 */
+		bool start( QRunnable * runnable );
+
+		/**
+		 * Waits up to \a msecs milliseconds, or without a limit when \c -1,
+		 * for all runnables to finish. Returns \c true if they did.
+		 */
+		bool waitForDone( int msecs = -1 );
+
+	private :
+		class Worker;
+
+		/**
+		 * The \em Entry structure is a runnable waiting in the queue.
+		 */
+		struct Entry {
+			QRunnable * runnable;
+			QElapsedTimer queued;
+		};
+
+	private :
+		/**
+		 * Waits for threads which have exited and deletes them.
+		 */
+		void reapWorkers();
+
+		/**
+		 * Body of worker threads.
+		 */
+		void work();
+
+	private :
+		int active_;
+		int capacity_;
+		quint64 completed_;
+		QWaitCondition doneCondition_;
+		int expiryTimeout_;
+		int idle_;
+		mutable QMutex lock_;
+		int maxThreads_;
+		QQueue< Entry > queue_;
+		QWaitCondition queueCondition_;
+		qint64 queueTime_;
+		quint64 rejected_;
+		QList< QThread * > retired_;
+		bool stopping_;
+		QList< QThread * > workers_;
+
+		Q_DISABLE_COPY( QDcmtkExecutor );
+};
+
+#endif
@@ -3,41 +3,39 @@
  *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
  **************************************************************************/
 
+#include "QDcmtkExecutor.hpp"
 #include "QDcmtkTask.hpp"
 
 #include <dcmtk/ofstd/ofcond.h>
 
 
 
+void QDcmtkTask::cancel() {
+	if ( QDcmtkExecutor::instance().cancel( this ) ) {
+		result_ = QDcmtkResult( OF_failure, "task cancelled" );
+		emit finished( result_ );
+	}
+}
+
+
 void QDcmtkTask::run() {
 	result_ = Functor_->execute();
-	bool ran_ = true;
 
 	emit finished( result_ );
 }
 
 
 void QDcmtkTask::start() {
-	QThreadPool * pool = QThreadPool::globalInstance();
-
-	static const int Guard = 100;
-	int count = 0;
-	while ( count < Guard ) {
-		if ( pool->tryStart( this ) ) {
-			return;
-		}
-		else {
-			pool->reserveThread();
-			++count;
-		}
+	if ( QDcmtkExecutor::instance().start( this ) ) {
+		return;
 	}
 
 	qCritical( __FUNCTION__": "
-		"failed to start a thread from the pool"
+		"failed to queue a task in the executor"
 	);
 
 	result_ = QDcmtkResult( OF_failure,
-		"failed to start a thread from the pool"
+		"failed to queue a task in the executor"
 	);
 	emit finished( result_ );
 }
\ No newline at end of file
@@ -27,8 +27,10 @@ class OFCondition;
  * in most cases the arguments should remain valid throughout the entire time
  * task is running.
  *
- * Tasks can be started with the \ref start() slot. The slot reserves a thread 
- * from global thread pool and runs task's body (the \ref run() method) in it.
+ * Tasks can be started with the \ref start() slot. The slot queues the task in
+ * the shared \ref QDcmtkExecutor, dedicated to blocking DCMTK calls, which
+ * runs task's body (the \ref run() method) in one of its threads. A task which
+ * hasn't started running yet can be withdrawn with the \ref cancel() slot.
  * Inside the \ref run() method, stored functor is being executed. After DCMTK
  * finishes operation, the result is saved in task's local variable and the
  * \ref finished() signal is emitted. The signal passes a copy of the result as
@@ -43,8 +45,7 @@ class OFCondition;
  * pointers to them, it is caller's duty to free acquired memory. It is 
  * possible to connect the \ref finished() signal with \em QObject's \em
  * deleteLater(). It is also possible to provide parent's object pointer during
- * task construction, for task to be removed when its parent dies. During 
- * destruction, task releases acquired thread.
+ * task construction, for task to be removed when its parent dies.
  *
  * The following example illustrates a typical usage scenario of \em QDcmtkTask
  * objects:
@@ -92,6 +93,16 @@ class QDICOM_DLLSPEC QDcmtkTask : public QObject, public QRunnable {
 			QObject * parent = NULL
 		);
 
+		/**
+		 * Creates a task, launching DCMTK function \a f with three
+		 * parameters: \a p1, \a p2 and \a p3.
+		 */
+		template< typename P1, typename P2, typename P3 >
+		inline static QDcmtkTask * create( 
+			OFCondition ( *f )( P1, P2, P3 ), P1 p1, P2 p2, P3 p3,
+			QObject * parent = NULL
+		);
+
 		/**
 		 * Creates a task, launching DCMTK function \a f with four parameters:
 		 * \a p1, \a p2, \a p3 and \a p4.
@@ -102,9 +113,34 @@ class QDICOM_DLLSPEC QDcmtkTask : public QObject, public QRunnable {
 			QObject * parent = NULL
 		);
 
+		/**
+		 * Creates a task, launching DCMTK function \a f with five parameters:
+		 * \a p1 to \a p5.
+		 */
+		template< typename P1, typename P2, typename P3, typename P4, typename P5 >
+		inline static QDcmtkTask * create( 
+			OFCondition ( *f )( P1, P2, P3, P4, P5 ),
+			P1 p1, P2 p2, P3 p3, P4 p4, P5 p5,
+			QObject * parent = NULL
+		);
+
+		/**
+		 * Creates a task, launching DCMTK function \a f with six parameters:
+		 * \a p1 to \a p6.
+		 */
+		template<
+			typename P1, typename P2, typename P3,
+			typename P4, typename P5, typename P6
+		>
+		inline static QDcmtkTask * create( 
+			OFCondition ( *f )( P1, P2, P3, P4, P5, P6 ),
+			P1 p1, P2 p2, P3 p3, P4 p4, P5 p5, P6 p6,
+			QObject * parent = NULL
+		);
+
 	public :
 		/**
-		 * Destroys the task, releasing thread back to the pool.
+		 * Destroys the task. A task must not be destroyed while it's running.
 		 */
 		inline ~QDcmtkTask();
 
@@ -121,6 +157,12 @@ class QDICOM_DLLSPEC QDcmtkTask : public QObject, public QRunnable {
 		void run();
 
 	public slots :
+		/**
+		 * Withdraws the task unless it has started running already. A task
+		 * withdrawn emits the \ref finished() signal with a failure.
+		 */
+		void cancel();
+
 		/**
 		 * Starts the task. When specified routine finishes exectution, the \ref
 		 * finished() signal is emitted.
@@ -136,14 +178,22 @@ class QDICOM_DLLSPEC QDcmtkTask : public QObject, public QRunnable {
 	private :		
 		template < typename P > class Functor1;
 		template < typename P1, typename P2 > class Functor2;
+		template < typename P1, typename P2, typename P3 > class Functor3;
 		template < typename P1, typename P2, typename P3, typename P4 > class Functor4;
+		template <
+			typename P1, typename P2, typename P3,
+			typename P4, typename P5
+		> class Functor5;
+		template <
+			typename P1, typename P2, typename P3,
+			typename P4, typename P5, typename P6
+		> class Functor6;
 
 	private :
 		inline QDcmtkTask( const Functor * f, QObject * parent );
 
 	private :
 		const Functor * Functor_;
-		bool ran_;
 		QDcmtkResult result_;
 
 };
@@ -181,6 +231,20 @@ class QDcmtkTask::Functor2 : public QDcmtkTask::Functor {
 };
 
 
+template < typename P1, typename P2, typename P3 >
+class QDcmtkTask::Functor3 : public QDcmtkTask::Functor {
+	public :
+		Functor3( OFCondition ( *f )( P1, P2, P3 ), P1 p1, P2 p2, P3 p3 );
+		QDcmtkResult execute() const;
+
+	private :
+		OFCondition ( * const F_ )( P1, P2, P3 );
+		const P1 P1_;
+		const P2 P2_;
+		const P3 P3_;
+};
+
+
 template < typename P1, typename P2, typename P3, typename P4 >
 class QDcmtkTask::Functor4 : public QDcmtkTask::Functor {
 	public :
@@ -196,6 +260,51 @@ class QDcmtkTask::Functor4 : public QDcmtkTask::Functor {
 };
 
 
+template <
+	typename P1, typename P2, typename P3,
+	typename P4, typename P5
+>
+class QDcmtkTask::Functor5 : public QDcmtkTask::Functor {
+	public :
+		Functor5(
+			OFCondition ( *f )( P1, P2, P3, P4, P5 ),
+			P1 p1, P2 p2, P3 p3, P4 p4, P5 p5
+		);
+		QDcmtkResult execute() const;
+
+	private :
+		OFCondition ( * const F_ )( P1, P2, P3, P4, P5 );
+		const P1 P1_;
+		const P2 P2_;
+		const P3 P3_;
+		const P4 P4_;
+		const P5 P5_;
+};
+
+
+template <
+	typename P1, typename P2, typename P3,
+	typename P4, typename P5, typename P6
+>
+class QDcmtkTask::Functor6 : public QDcmtkTask::Functor {
+	public :
+		Functor6(
+			OFCondition ( *f )( P1, P2, P3, P4, P5, P6 ),
+			P1 p1, P2 p2, P3 p3, P4 p4, P5 p5, P6 p6
+		);
+		QDcmtkResult execute() const;
+
+	private :
+		OFCondition ( * const F_ )( P1, P2, P3, P4, P5, P6 );
+		const P1 P1_;
+		const P2 P2_;
+		const P3 P3_;
+		const P4 P4_;
+		const P5 P5_;
+		const P6 P6_;
+};
+
+
 #include "QDcmtkTask.inl"
 #include "QDcmtkTask.moc.inl"
 
@@ -3,13 +3,9 @@
  *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
  **************************************************************************/
 
-#include <QtCore/QThreadPool>
-
-
 QDcmtkTask::QDcmtkTask( const Functor * Functor, QObject * parent ) :
 	QObject( parent ),
-	Functor_( Functor ),
-	ran_( false )
+	Functor_( Functor )
 {
 	setAutoDelete( false );
 	Q_ASSERT( Functor_ != NULL );
@@ -21,10 +17,6 @@ QDcmtkTask::QDcmtkTask( const Functor * Functor, QObject * parent ) :
 }
 
 QDcmtkTask::~QDcmtkTask() {
-	if ( ran_ ) {
-		QThreadPool::globalInstance()->releaseThread();
-	}
-
 	delete Functor_;
 }
 
@@ -42,6 +34,13 @@ QDcmtkTask * QDcmtkTask::create(
 	return new QDcmtkTask( new Functor2< P1, P2 >( f, p1, p2 ), parent );
 }
 
+template< typename P1, typename P2, typename P3 >
+QDcmtkTask * QDcmtkTask::create(
+	OFCondition ( *f )( P1, P2, P3 ), P1 p1, P2 p2, P3 p3, QObject * parent
+) {
+	return new QDcmtkTask( new Functor3< P1, P2, P3 >( f, p1, p2, p3 ), parent );
+}
+
 template< typename P1, typename P2, typename P3, typename P4 >
 QDcmtkTask * QDcmtkTask::create(
 	OFCondition ( *f )( P1, P2, P3, P4 ), P1 p1, P2 p2, P3 p3, P4 p4, QObject * parent
@@ -49,6 +48,31 @@ QDcmtkTask * QDcmtkTask::create(
 	return new QDcmtkTask( new Functor4< P1, P2, P3, P4 >( f, p1, p2, p3, p4 ), parent );
 }
 
+template< typename P1, typename P2, typename P3, typename P4, typename P5 >
+QDcmtkTask * QDcmtkTask::create(
+	OFCondition ( *f )( P1, P2, P3, P4, P5 ),
+	P1 p1, P2 p2, P3 p3, P4 p4, P5 p5,
+	QObject * parent
+) {
+	return new QDcmtkTask(
+		new Functor5< P1, P2, P3, P4, P5 >( f, p1, p2, p3, p4, p5 ), parent
+	);
+}
+
+template<
+	typename P1, typename P2, typename P3,
+	typename P4, typename P5, typename P6
+>
+QDcmtkTask * QDcmtkTask::create(
+	OFCondition ( *f )( P1, P2, P3, P4, P5, P6 ),
+	P1 p1, P2 p2, P3 p3, P4 p4, P5 p5, P6 p6,
+	QObject * parent
+) {
+	return new QDcmtkTask(
+		new Functor6< P1, P2, P3, P4, P5, P6 >( f, p1, p2, p3, p4, p5, p6 ), parent
+	);
+}
+
 
 const QDcmtkResult & QDcmtkTask::result() const {
 	return result_;
@@ -88,6 +112,22 @@ QDcmtkResult QDcmtkTask::Functor2< P1, P2 >::execute() const {
 }
 
 
+template < typename P1, typename P2, typename P3 >
+QDcmtkTask::Functor3< P1, P2, P3 >::Functor3( OFCondition ( *f )( P1, P2, P3 ), P1 p1, P2 p2, P3 p3 ) :
+	F_( f ),
+	P1_( p1 ),
+	P2_( p2 ),
+	P3_( p3 )
+{
+	Q_ASSERT( F_ != NULL );
+}
+
+template < typename P1, typename P2, typename P3 >
+QDcmtkResult QDcmtkTask::Functor3< P1, P2, P3 >::execute() const {
+	return F_( P1_, P2_, P3_ );
+}
+
+
 template < typename P1, typename P2, typename P3, typename P4 >
 QDcmtkTask::Functor4< P1, P2, P3, P4 >::Functor4( OFCondition ( *f )( P1, P2, P3, P4 ), P1 p1, P2 p2, P3 p3, P4 p4 ) :
 	F_( f ),
@@ -102,4 +142,53 @@ QDcmtkTask::Functor4< P1, P2, P3, P4 >::Functor4( OFCondition ( *f )( P1, P2, P3
 template < typename P1, typename P2, typename P3, typename P4 >
 QDcmtkResult QDcmtkTask::Functor4< P1, P2, P3, P4 >::execute() const {
 	return F_( P1_, P2_, P3_, P4_ );
+}
+
+
+template < typename P1, typename P2, typename P3, typename P4, typename P5 >
+QDcmtkTask::Functor5< P1, P2, P3, P4, P5 >::Functor5(
+	OFCondition ( *f )( P1, P2, P3, P4, P5 ),
+	P1 p1, P2 p2, P3 p3, P4 p4, P5 p5
+) :
+	F_( f ),
+	P1_( p1 ),
+	P2_( p2 ),
+	P3_( p3 ),
+	P4_( p4 ),
+	P5_( p5 )
+{
+	Q_ASSERT( F_ != NULL );
+}
+
+template < typename P1, typename P2, typename P3, typename P4, typename P5 >
+QDcmtkResult QDcmtkTask::Functor5< P1, P2, P3, P4, P5 >::execute() const {
+	return F_( P1_, P2_, P3_, P4_, P5_ );
+}
+
+
+template <
+	typename P1, typename P2, typename P3,
+	typename P4, typename P5, typename P6
+>
+QDcmtkTask::Functor6< P1, P2, P3, P4, P5, P6 >::Functor6(
+	OFCondition ( *f )( P1, P2, P3, P4, P5, P6 ),
+	P1 p1, P2 p2, P3 p3, P4 p4, P5 p5, P6 p6
+) :
+	F_( f ),
+	P1_( p1 ),
+	P2_( p2 ),
+	P3_( p3 ),
+	P4_( p4 ),
+	P5_( p5 ),
+	P6_( p6 )
+{
+	Q_ASSERT( F_ != NULL );
+}
+
+template <
+	typename P1, typename P2, typename P3,
+	typename P4, typename P5, typename P6
+>
+QDcmtkResult QDcmtkTask::Functor6< P1, P2, P3, P4, P5, P6 >::execute() const {
+	return F_( P1_, P2_, P3_, P4_, P5_, P6_ );
 }
\ No newline at end of file
@@ -124,7 +124,11 @@ QPresentationContext QPresentationContext::fromTAscPresentationContext(
 		}
 	}
 
+	result.setRole( roleFromTAscRole( dcmContext.proposedRole ) );
+
 	if ( dcmContext.resultReason == ASC_P_ACCEPTANCE ) {
+		result.setRole( roleFromTAscRole( dcmContext.acceptedRole ) );
+
 		const QTransferSyntax Ts = QTransferSyntax::fromUid(
 			dcmContext.acceptedTransferSyntax
 		);
@@ -143,6 +147,12 @@ QPresentationContext QPresentationContext::fromTAscPresentationContext(
 }
 
 
+void QPresentationContext::clearTransferSyntaxes() {
+	data_->transferSyntaxes_.clear();
+	data_->acceptedTransferSyntaxPosition_ = -1;
+}
+
+
 bool QPresentationContext::isNull() const {
 	return data_->abstractSyntax_.isEmpty() || data_->transferSyntaxes_.isEmpty();
 }
@@ -160,12 +170,52 @@ const {
 }
 
 
+QPresentationContext::Role QPresentationContext::role() const {
+	return static_cast< Role >( data_->role_ );
+}
+
+
+QPresentationContext::Role QPresentationContext::roleFromTAscRole( int role ) {
+	switch ( role ) {
+		case ASC_SC_ROLE_SCU :
+			return ScuRole;
+		case ASC_SC_ROLE_SCP :
+			return ScpRole;
+		case ASC_SC_ROLE_SCUSCP :
+			return ScuScpRole;
+		default :
+			return DefaultRole;
+	}
+}
+
+
 void QPresentationContext::setAbstractSyntax( const QUid & Uid ) {
 	data_->abstractSyntax_ = Uid;
 }
 
 
+void QPresentationContext::setRole( Role role ) {
+	data_->role_ = role;
+}
+
+
+int QPresentationContext::tAscRole() const {
+	switch ( role() ) {
+		case ScuRole :
+			return ASC_SC_ROLE_SCU;
+		case ScpRole :
+			return ASC_SC_ROLE_SCP;
+		case ScuScpRole :
+			return ASC_SC_ROLE_SCUSCP;
+		default :
+			return ASC_SC_ROLE_DEFAULT;
+	}
+}
+
+
 QString QPresentationContext::toString() const {
+	static const char * const Roles[] = { "Default", "SCU", "SCP", "SCU/SCP" };
+
 	QStringList tsNames;
 	foreach( const QTransferSyntax & ts, data_->transferSyntaxes_ ) {
 		tsNames.append( ts.toString() );
@@ -174,9 +224,11 @@ QString QPresentationContext::toString() const {
 	return QString(
 		"Abstract Syntax  : %1\n"
 		"Transfer Syntaxes: %2\n"
-		"Accepted         : %3"
+		"Role             : %3\n"
+		"Accepted         : %4"
 	)
 	.arg( dcmFindNameOfUID( data_->abstractSyntax_, data_->abstractSyntax_ ) )
 	.arg( tsNames.join( ", " ) )
+	.arg( Roles[ role() ] )
 	.arg( accepted() ? acceptedTransferSyntax().toString() : QString( "<None>" ) );
 }
\ No newline at end of file
@@ -23,6 +23,20 @@ struct T_ASC_PresentationContext;
  * \author Paweł Żak <pawel.zak@fluxinc.ca>
  */
 class QDICOM_DLLSPEC QPresentationContext {
+	public :
+		/**
+		 * Roles the requestor of an association proposes to play for the
+		 * abstract syntax; the acceptor plays the opposite one.
+		 */
+		enum Role {
+			DefaultRole, /*< No role selection is negotiated; requestor is
+			                 the SCU. */
+			ScuRole,
+			ScpRole,     /*< Required to receive C-STORE sub-operations of
+			                 a C-GET. */
+			ScuScpRole
+		};
+
 	public :
 		static QPresentationContext defaultFor( const QUid & abstract );
 		static QPresentationContext fromTAscPresentationContext(
@@ -42,13 +56,36 @@ class QDICOM_DLLSPEC QPresentationContext {
 		const QTransferSyntax & acceptedTransferSyntax() const;
 		void addTransferSyntax( const QTransferSyntax & syntax );
 
+		/**
+		 * Removes the proposed Transfer Syntaxes, and the accepted one,
+		 * keeping the other attributes of the context.
+		 */
+		void clearTransferSyntaxes();
+
 		bool isNull() const;
 		bool isValid() const;
 
 		const QList< QTransferSyntax > proposedTransferSyntaxes() const;
+
+		/**
+		 * Returns the role proposed or, once the context is accepted, the
+		 * role accepted.
+		 */
+		Role role() const;
+
 		void setAbstractSyntax( const QUid & syntax );
+		void setRole( Role role );
+
+		/**
+		 * Returns the \ref role() as DCMTK's \c T_ASC_SC_ROLE enumerator.
+		 */
+		int tAscRole() const;
+
 		QString toString() const;
 
+	private :
+		static Role roleFromTAscRole( int role );
+
 	private :
 		QSharedDataPointer< QPresentationContextData > data_;
 		
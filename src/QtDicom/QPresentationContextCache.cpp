@@ -0,0 +1,227 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "ConnectionParameters.hpp"
+#include "QPresentationContextCache.hpp"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QPair>
+
+#include <QtNetwork/QHostAddress>
+
+
+QPresentationContextCache::Entry::Entry() :
+	associations( 0 )
+{
+	age.start();
+}
+
+
+QPresentationContextCache::QPresentationContextCache() :
+	maxAge_( 3600 ),
+	renegotiationInterval_( 100 )
+{
+}
+
+
+QPresentationContextCache::~QPresentationContextCache() {
+}
+
+
+void QPresentationContextCache::clear() {
+	QMutexLocker locker( &lock_ );
+
+	entries_.clear();
+}
+
+
+bool QPresentationContextCache::contains(
+	const Dicom::ConnectionParameters & Peer
+) const {
+	QMutexLocker locker( &lock_ );
+
+	return entries_.contains( key( Peer ) );
+}
+
+
+bool QPresentationContextCache::expired( const Entry & Cached ) const {
+	return
+		( maxAge_ > 0 && Cached.age.elapsed() >= qint64( maxAge_ ) * 1000 ) ||
+		( renegotiationInterval_ > 0 && Cached.associations >= renegotiationInterval_ )
+	;
+}
+
+
+QPresentationContextCache * QPresentationContextCache::globalInstance() {
+	static QPresentationContextCache Instance;
+
+	return &Instance;
+}
+
+
+QString QPresentationContextCache::key( const Dicom::ConnectionParameters & Peer ) {
+	return QString( "%1@%2:%3/%4" )
+		.arg( Peer.peerAeTitle() )
+		.arg( Peer.hostAddress().toString() )
+		.arg( Peer.port() )
+		.arg( Peer.myAeTitle() )
+	;
+}
+
+
+int QPresentationContextCache::maxAge() const {
+	QMutexLocker locker( &lock_ );
+
+	return maxAge_;
+}
+
+
+QPresentationContextList QPresentationContextCache::minimalContexts(
+	const Dicom::ConnectionParameters & Peer,
+	const QPresentationContextList & Proposed,
+	bool * reduced
+) const {
+	if ( reduced ) {
+		*reduced = false;
+	}
+
+	QMutexLocker locker( &lock_ );
+
+	QHash< QString, Entry >::const_iterator entry =
+		entries_.constFind( key( Peer ) )
+	;
+	if ( entry == entries_.constEnd() || expired( *entry ) ) {
+		return Proposed;
+	}
+
+	QPresentationContextList result;
+	QSet< QPair< QByteArray, int > > proposedPairs;
+	bool changed = false;
+
+	foreach ( const QPresentationContext & Pc, Proposed ) {
+		const QByteArray & As = Pc.abstractSyntax();
+		if ( entry->rejected.contains( As ) ) {
+			changed = true;
+			continue;
+		}
+
+		const QList< QTransferSyntax > & Accepted = entry->accepted[ As ];
+		const QList< QTransferSyntax > Tss = Pc.proposedTransferSyntaxes();
+
+		QTransferSyntax known;
+		foreach ( const QTransferSyntax & Ts, Tss ) {
+			if ( Accepted.contains( Ts ) ) {
+				known = Ts;
+				break;
+			}
+		}
+
+		if ( known.isValid() ) {
+			const QPair< QByteArray, int > Pair = qMakePair( As, known.toInt() );
+			if ( proposedPairs.contains( Pair ) ) {
+				// The same syntax would be proposed twice
+				changed = true;
+				continue;
+			}
+			proposedPairs.insert( Pair );
+
+			// The role, and anything else proposed, is kept
+			QPresentationContext minimal( Pc );
+			minimal.clearTransferSyntaxes();
+			minimal << known;
+			result.append( minimal );
+
+			changed = changed || Tss.size() > 1;
+		}
+		else {
+			result.append( Pc );
+		}
+	}
+
+	if ( result.isEmpty() ) {
+		// Nothing known to be acceptable; let the peer decide again
+		return Proposed;
+	}
+
+	if ( reduced ) {
+		*reduced = changed;
+	}
+
+	return result;
+}
+
+
+void QPresentationContextCache::remove( const Dicom::ConnectionParameters & Peer ) {
+	QMutexLocker locker( &lock_ );
+
+	entries_.remove( key( Peer ) );
+}
+
+
+int QPresentationContextCache::renegotiationInterval() const {
+	QMutexLocker locker( &lock_ );
+
+	return renegotiationInterval_;
+}
+
+
+void QPresentationContextCache::setMaxAge( int seconds ) {
+	QMutexLocker locker( &lock_ );
+
+	maxAge_ = qMax( 0, seconds );
+}
+
+
+void QPresentationContextCache::setRenegotiationInterval( int associations ) {
+	QMutexLocker locker( &lock_ );
+
+	renegotiationInterval_ = qMax( 0, associations );
+}
+
+
+int QPresentationContextCache::size() const {
+	QMutexLocker locker( &lock_ );
+
+	return entries_.size();
+}
+
+
+void QPresentationContextCache::update(
+	const Dicom::ConnectionParameters & Peer,
+	const QPresentationContextList & Proposed,
+	const QPresentationContextList & Accepted
+) {
+	QMutexLocker locker( &lock_ );
+
+	const QString Key = key( Peer );
+
+	// An expired entry made the full proposal go out; its outcome replaces
+	// everything known about the peer
+	QHash< QString, Entry >::iterator i = entries_.find( Key );
+	if ( i == entries_.end() || expired( *i ) ) {
+		i = entries_.insert( Key, Entry() );
+	}
+
+	Entry & entry = *i;
+	++entry.associations;
+
+	// Only the outcome for Abstract Syntaxes proposed this time is replaced,
+	// what is known about the remaining ones still holds
+	foreach ( const QPresentationContext & Pc, Proposed ) {
+		entry.accepted.remove( Pc.abstractSyntax() );
+		entry.rejected.insert( Pc.abstractSyntax() );
+	}
+
+	foreach ( const QPresentationContext & Pc, Accepted ) {
+		if ( Pc.accepted() ) {
+			const QByteArray & As = Pc.abstractSyntax();
+			QList< QTransferSyntax > & tss = entry.accepted[ As ];
+			if ( ! tss.contains( Pc.acceptedTransferSyntax() ) ) {
+				tss.append( Pc.acceptedTransferSyntax() );
+			}
+			entry.rejected.remove( As );
+		}
+	}
+}
@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef QTDICOM_QPRESENTATIONCONTEXTCACHE_HPP
+#define QTDICOM_QPRESENTATIONCONTEXTCACHE_HPP
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+
+#include <QtDicom/Globals.hpp>
+#include <QtDicom/QPresentationContextList>
+#include <QtDicom/QTransferSyntax>
+
+namespace Dicom {
+	class ConnectionParameters;
+};
+
+/**
+ * The \em QPresentationContextCache class remembers the outcome of
+ * Presentation Context negotiation with each DICOM peer.
+ *
+ * Most of the time an SCU keeps proposing the same, long list of Abstract
+ * and Transfer Syntaxes to a peer, which keeps accepting the same subset of
+ * it. The cache records, per peer, which Transfer Syntax was accepted for
+ * every Abstract Syntax and which Abstract Syntaxes were rejected. The next
+ * time an association is requested, \ref minimalContexts() reduces the full
+ * proposal to a single, known to be acceptable Transfer Syntax per context,
+ * keeping the original order of contexts.
+ *
+ * Peers are identified by the called and calling AE titles, the host address
+ * and the port read from connection parameters.
+ *
+ * Peers' configuration changes, so what is remembered expires: once an entry
+ * is older than \ref maxAge() or has been used for \ref
+ * renegotiationInterval() associations, the full proposal is sent again and
+ * the entry starts afresh. This way Abstract Syntaxes rejected once are
+ * eventually proposed again.
+ *
+ * Cache is thread-safe; by default all \ref QAssociation objects share the
+ * \ref globalInstance().
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC QPresentationContextCache {
+	public :
+		/**
+		 * Returns a process-wide instance of the cache.
+		 */
+		static QPresentationContextCache * globalInstance();
+
+	public :
+		QPresentationContextCache();
+		~QPresentationContextCache();
+
+		/**
+		 * Forgets about all peers.
+		 */
+		void clear();
+
+		/**
+		 * Returns \c true if negotiation outcome for the \a peer is known.
+		 */
+		bool contains( const Dicom::ConnectionParameters & peer ) const;
+
+		/**
+		 * Returns the time (in seconds) after which an entry expires; \c 0
+		 * means never. Defaults to one hour.
+		 */
+		int maxAge() const;
+
+		/**
+		 * Reduces the \a proposed list of presentation contexts using the
+		 * negotiation outcome remembered for the \a peer.
+		 *
+		 * Contexts which Abstract Syntax was rejected before are omitted,
+		 * contexts for which an accepted Transfer Syntax is known are reduced
+		 * to that syntax alone; other contexts are proposed as they are. If
+		 * \a reduced is provided, it is set to \c true when the returned list
+		 * differs from the \a proposed one. For an expired entry the \a
+		 * proposed list is returned as it is.
+		 */
+		QPresentationContextList minimalContexts(
+			const Dicom::ConnectionParameters & peer,
+			const QPresentationContextList & proposed,
+			bool * reduced = 0
+		) const;
+
+		/**
+		 * Removes the entry for \a peer, forcing the full proposal during
+		 * the next negotiation.
+		 */
+		void remove( const Dicom::ConnectionParameters & peer );
+
+		/**
+		 * Returns the number of associations negotiated using an entry after
+		 * which it expires; \c 0 means never. Defaults to \c 100.
+		 */
+		int renegotiationInterval() const;
+
+		void setMaxAge( int seconds );
+		void setRenegotiationInterval( int associations );
+
+		/**
+		 * Returns the number of peers remembered.
+		 */
+		int size() const;
+
+		/**
+		 * Records the outcome of negotiation with the \a peer; the \a proposed
+		 * contexts are those sent in the A-ASSOCIATE-RQ message and the \a
+		 * accepted the ones accepted by the peer.
+		 */
+		void update(
+			const Dicom::ConnectionParameters & peer,
+			const QPresentationContextList & proposed,
+			const QPresentationContextList & accepted
+		);
+
+	private :
+		struct Entry {
+			Entry();
+
+			QHash< QByteArray, QList< QTransferSyntax > > accepted;
+			QElapsedTimer age;
+			int associations;
+			QSet< QByteArray > rejected;
+		};
+
+		/**
+		 * Returns \c true if the \a entry should no longer be used; the
+		 * cache must be locked.
+		 */
+		bool expired( const Entry & entry ) const;
+
+		static QString key( const Dicom::ConnectionParameters & peer );
+
+	private :
+		QHash< QString, Entry > entries_;
+		mutable QMutex lock_;
+		int maxAge_;
+		int renegotiationInterval_;
+
+		Q_DISABLE_COPY( QPresentationContextCache );
+};
+
+#endif
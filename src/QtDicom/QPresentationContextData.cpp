@@ -7,7 +7,8 @@
 
 
 QPresentationContextData::QPresentationContextData() :
-	acceptedTransferSyntaxPosition_( -1 )
+	acceptedTransferSyntaxPosition_( -1 ),
+	role_( 0 )
 {
 }
 
@@ -18,6 +19,7 @@ QPresentationContextData::QPresentationContextData(
 	QSharedData( Other ),
 	abstractSyntax_( Other.abstractSyntax_ ),
 	acceptedTransferSyntaxPosition_( Other.acceptedTransferSyntaxPosition_ ),
+	role_( Other.role_ ),
 	transferSyntaxes_( Other.transferSyntaxes_ )
 {
 }
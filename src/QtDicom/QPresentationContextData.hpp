@@ -26,6 +26,7 @@ class QDICOM_DLLSPEC QPresentationContextData : public QSharedData {
 	private :
 		QUid abstractSyntax_;
 		int acceptedTransferSyntaxPosition_;
+		int role_;
 		QList< QTransferSyntax > transferSyntaxes_;
 };
 
@@ -0,0 +1,256 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "QPresentationContextTable.hpp"
+
+#include <QtCore/QMap>
+
+#include <QtDicom/QDicomImageCodec>
+
+#include <dcmtk/dcmnet/assoc.h>
+
+
+static const int MaxPresentationContextId = 255;
+
+
+QPresentationContextTable::Route::Route() :
+	id( 0 )
+{
+}
+
+
+bool QPresentationContextTable::Route::isValid() const {
+	return id > 0;
+}
+
+
+QPresentationContextTable::QPresentationContextTable() :
+	d_( new Data() )
+{
+	d_->positions.fill( -1, MaxPresentationContextId + 1 );
+}
+
+
+QPresentationContextTable::QPresentationContextTable(
+	const QPresentationContextTable & Other
+) :
+	d_( Other.d_ )
+{
+}
+
+
+QPresentationContextTable::~QPresentationContextTable() {
+}
+
+
+QPresentationContextTable & QPresentationContextTable::operator = (
+	const QPresentationContextTable & Other
+) {
+	d_ = Other.d_;
+
+	return *this;
+}
+
+
+const QUid & QPresentationContextTable::abstractSyntax( quint8 id ) const {
+	const int Position = d_->positions.at( id );
+	if ( Position > -1 ) {
+		return d_->contexts.at( Position ).abstractSyntax();
+	}
+	else {
+		static const QUid Dummy;
+		return Dummy;
+	}
+}
+
+
+const QPresentationContextList &
+	QPresentationContextTable::acceptedPresentationContexts()
+const {
+	return d_->contexts;
+}
+
+
+const QList< QTransferSyntax > & QPresentationContextTable::acceptedTransferSyntaxes(
+	const QByteArray & SopClass
+) const {
+	const int ClassId = sopClassId( SopClass );
+	if ( ClassId > -1 ) {
+		return d_->syntaxes.at( ClassId );
+	}
+	else {
+		static const QList< QTransferSyntax > Dummy;
+		return Dummy;
+	}
+}
+
+
+bool QPresentationContextTable::canConvert(
+	const QTransferSyntax & SrcTs, const QTransferSyntax & DstTs
+) {
+	// Mirrors Dataset::canConvertToTransferSyntax()
+	static const QList< QTransferSyntax > SupportedTs =
+		QDicomImageCodec::supported()
+	;
+
+	return
+		( ( ! SrcTs.isCompressed() ) || SupportedTs.contains( SrcTs ) ) &&
+		( ( ! DstTs.isCompressed() ) || SupportedTs.contains( DstTs ) )
+	;
+}
+
+
+bool QPresentationContextTable::contains( const QByteArray & SopClass ) const {
+	return d_->classIds.contains( SopClass );
+}
+
+
+QPresentationContextTable QPresentationContextTable::fromTAscAssociation(
+	const T_ASC_Association * association
+) {
+	QPresentationContextTable table;
+	if ( ! association || ! association->params ) {
+		return table;
+	}
+
+	Data & d = *table.d_;
+	QVector< QList< quint8 > > ids;
+
+	// DCMTK lists contexts in the order of its parameters, the table orders
+	// them by their IDs
+	QMap< quint8, QPresentationContext > accepted;
+
+	T_ASC_PresentationContext dcmContext;
+	const int Count = ASC_countPresentationContexts( association->params );
+	for ( int i = 0; i < Count; ++i ) {
+		const OFCondition Status = ASC_getPresentationContext(
+			association->params, i, &dcmContext
+		);
+		if ( Status.bad() ) {
+			qWarning( __FUNCTION__": "
+				"unable to read presentation context #%d; %s",
+				i, Status.text()
+			);
+			continue;
+		}
+
+		const QPresentationContext Context =
+			QPresentationContext::fromTAscPresentationContext( dcmContext )
+		;
+		if ( Context.accepted() ) {
+			accepted.insert( dcmContext.presentationContextID, Context );
+		}
+	}
+
+	for (
+		QMap< quint8, QPresentationContext >::const_iterator i =
+			accepted.constBegin();
+		i != accepted.constEnd(); ++i
+	) {
+		const quint8 Id = i.key();
+		const QPresentationContext & Context = i.value();
+		const QByteArray As = Context.abstractSyntax();
+		const QTransferSyntax & Ts = Context.acceptedTransferSyntax();
+
+		d.positions[ Id ] = d.contexts.size();
+		d.contexts.append( Context );
+
+		// SOP Classes are interned in the order of their first contexts
+		QHash< QByteArray, int >::const_iterator classId =
+			d.classIds.constFind( As )
+		;
+		if ( classId == d.classIds.constEnd() ) {
+			classId = d.classIds.insert( As, d.syntaxes.size() );
+			d.syntaxes.append( QList< QTransferSyntax >() );
+			ids.append( QList< quint8 >() );
+		}
+
+		QList< QTransferSyntax > & tss = d.syntaxes[ *classId ];
+		if ( ! tss.contains( Ts ) ) {
+			tss.append( Ts );
+			ids[ *classId ].append( Id );
+		}
+	}
+
+	// Prepare routes for every Transfer Syntax a Data Set can come in
+	d.routes.resize( d.syntaxes.size() * RouteStride );
+	for ( int classId = 0; classId < d.syntaxes.size(); ++classId ) {
+		const QList< QTransferSyntax > & Tss = d.syntaxes.at( classId );
+		const QList< quint8 > & Ids = ids.at( classId );
+
+		for ( int src = QTransferSyntax::LittleEndianImplicit; src <= QTransferSyntax::Xml; ++src ) {
+			const QTransferSyntax SrcTs( static_cast< QTransferSyntax::Id >( src ) );
+
+			int position = Tss.indexOf( SrcTs );
+			for ( int j = 0; position < 0 && j < Tss.size(); ++j ) {
+				if ( canConvert( SrcTs, Tss.at( j ) ) ) {
+					position = j;
+				}
+			}
+
+			if ( position > -1 ) {
+				Route route;
+				route.id = Ids.at( position );
+				route.syntax = Tss.at( position );
+				d.routes[ classId * RouteStride + src ] = route;
+			}
+		}
+	}
+
+	return table;
+}
+
+
+quint8 QPresentationContextTable::id(
+	const QByteArray & SopClass, const QTransferSyntax & Ts
+) const {
+	const Route R = route( SopClass, Ts );
+
+	return R.syntax == Ts ? R.id : 0;
+}
+
+
+bool QPresentationContextTable::isEmpty() const {
+	return d_->contexts.isEmpty();
+}
+
+
+QPresentationContextTable::Route QPresentationContextTable::route(
+	const QByteArray & SopClass, const QTransferSyntax & Ts
+) const {
+	return route( sopClassId( SopClass ), Ts );
+}
+
+
+QPresentationContextTable::Route QPresentationContextTable::route(
+	int classId, const QTransferSyntax & Ts
+) const {
+	const int Syntax = Ts.toInt();
+	if (
+		classId < 0 || classId >= d_->syntaxes.size() ||
+		Syntax < 0 || Syntax >= RouteStride
+	) {
+		return Route();
+	}
+
+	return d_->routes.at( classId * RouteStride + Syntax );
+}
+
+
+int QPresentationContextTable::sopClassId( const QByteArray & SopClass ) const {
+	return d_->classIds.value( SopClass, -1 );
+}
+
+
+const QTransferSyntax & QPresentationContextTable::transferSyntax( quint8 id ) const {
+	const int Position = d_->positions.at( id );
+	if ( Position > -1 ) {
+		return d_->contexts.at( Position ).acceptedTransferSyntax();
+	}
+	else {
+		static const QTransferSyntax Dummy;
+		return Dummy;
+	}
+}
@@ -0,0 +1,183 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef QTDICOM_QPRESENTATIONCONTEXTTABLE_HPP
+#define QTDICOM_QPRESENTATIONCONTEXTTABLE_HPP
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QSharedData>
+#include <QtCore/QVector>
+
+#include <QtDicom/Globals.hpp>
+#include <QtDicom/QPresentationContextList>
+#include <QtDicom/QTransferSyntax>
+#include <QtDicom/QUid>
+
+struct T_ASC_Association;
+
+/**
+ * The \em QPresentationContextTable class is an immutable index of
+ * presentation contexts accepted during association negotiation.
+ *
+ * The table is built once, right after the association has been established
+ * (or acknowledged), with the \ref fromTAscAssociation() method. Afterwards
+ * it answers, in constant time, the questions asked for every transferred
+ * Data Set: what presentation context ID should carry a given SOP Class in
+ * a given Transfer Syntax (\ref id()), which SOP Class and Transfer Syntax
+ * does the received presentation context ID stand for (\ref abstractSyntax(),
+ * \ref transferSyntax()), and -- when Data Set's Transfer Syntax wasn't
+ * accepted -- what Transfer Syntax it should be converted to (\ref route()).
+ *
+ * Conversion plans are prepared for every known Transfer Syntax while the
+ * table is built, respecting the order of presentation context IDs.
+ *
+ * Objects of this class are implicitly shared, copying them is cheap and
+ * they can be read from multiple threads at once.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC QPresentationContextTable {
+	public :
+		/**
+		 * The \em Route structure describes how to send a Data Set: the
+		 * presentation context \a id to use and the Transfer Syntax the Data
+		 * Set has to be encoded in. The \a id equal to \c 0 means the Data Set
+		 * cannot be sent.
+		 */
+		struct Route {
+			Route();
+
+			bool isValid() const;
+
+			quint8 id;
+			QTransferSyntax syntax;
+		};
+
+	public :
+		/**
+		 * Builds a table from the presentation contexts of DCMTK \a
+		 * association. Only accepted contexts are indexed.
+		 */
+		static QPresentationContextTable fromTAscAssociation(
+			const T_ASC_Association * association
+		);
+
+	public :
+		/**
+		 * Creates an empty table.
+		 */
+		QPresentationContextTable();
+		QPresentationContextTable( const QPresentationContextTable & other );
+		~QPresentationContextTable();
+
+		QPresentationContextTable & operator = (
+			const QPresentationContextTable & other
+		);
+
+		/**
+		 * Returns the SOP Class negotiated for presentation context \a id or
+		 * an empty UID if the context wasn't accepted.
+		 */
+		const QUid & abstractSyntax( quint8 id ) const;
+
+		/**
+		 * Returns the list of accepted presentation contexts, ordered by
+		 * their IDs.
+		 */
+		const QPresentationContextList & acceptedPresentationContexts() const;
+
+		/**
+		 * Returns the Transfer Syntaxes accepted for the \a sopClass in the
+		 * order of their presentation context IDs.
+		 */
+		const QList< QTransferSyntax > & acceptedTransferSyntaxes(
+			const QByteArray & sopClass
+		) const;
+
+		/**
+		 * Returns \c true if at least one presentation context was accepted
+		 * for the \a sopClass.
+		 */
+		bool contains( const QByteArray & sopClass ) const;
+
+		/**
+		 * Returns the ID of presentation context accepted for the \a sopClass
+		 * and the \a syntax, or \c 0 if there is none.
+		 */
+		quint8 id( const QByteArray & sopClass, const QTransferSyntax & syntax ) const;
+
+		/**
+		 * Returns \c true when no presentation context was accepted.
+		 */
+		bool isEmpty() const;
+
+		/**
+		 * Returns a route for a Data Set of \a sopClass encoded with the \a
+		 * syntax. If \a syntax was accepted, route uses it directly. Otherwise
+		 * the first accepted Transfer Syntax the Data Set can be converted to
+		 * is used; the caller may fall back on the others from \ref
+		 * acceptedTransferSyntaxes() when the conversion fails.
+		 */
+		Route route(
+			const QByteArray & sopClass, const QTransferSyntax & syntax
+		) const;
+
+		/**
+		 * Returns a route for a Data Set of the SOP Class interned as \a
+		 * classId, see \ref sopClassId(), encoded with the \a syntax.
+		 * Routes are kept in an array indexed by both IDs, so this overload
+		 * neither hashes nor copies the UID.
+		 */
+		Route route( int classId, const QTransferSyntax & syntax ) const;
+
+		/**
+		 * Returns the small integer the \a sopClass is interned as in this
+		 * table, or \c -1 if no presentation context was accepted for it.
+		 * IDs are numbered from \c 0 and are only valid for this table.
+		 */
+		int sopClassId( const QByteArray & sopClass ) const;
+
+		/**
+		 * Returns the Transfer Syntax accepted for presentation context \a id
+		 * or an invalid syntax if the context wasn't accepted.
+		 */
+		const QTransferSyntax & transferSyntax( quint8 id ) const;
+
+	private :
+		static bool canConvert(
+			const QTransferSyntax & source, const QTransferSyntax & destination
+		);
+
+	private :
+		class Data : public QSharedData {
+			public :
+				QHash< QByteArray, int > classIds;
+				QPresentationContextList contexts;
+				QVector< int > positions;
+
+				/**
+				 * Routes of each SOP Class, in rows of \ref RouteStride
+				 * indexed by Transfer Syntax IDs.
+				 */
+				QVector< Route > routes;
+
+				/**
+				 * Transfer Syntaxes accepted for each SOP Class, by its ID.
+				 */
+				QVector< QList< QTransferSyntax > > syntaxes;
+		};
+
+		/**
+		 * The number of routes kept for each SOP Class, one for each
+		 * Transfer Syntax ID.
+		 */
+		static const int RouteStride = QTransferSyntax::Xml + 1;
+
+		QExplicitlySharedDataPointer< Data > d_;
+};
+
+#endif
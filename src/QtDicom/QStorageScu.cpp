@@ -4,6 +4,7 @@
  **************************************************************************/
 
 #include "ConnectionParameters.hpp"
+#include "Log.hpp"
 #include "RequestorAssociation.hpp"
 #include "QStorageScu.hpp"
 #include "QStorageScu.moc.inl"
@@ -44,53 +45,27 @@ QStorageScu::~QStorageScu() {
 }
 
 
-QList< QTransferSyntax > QStorageScu::acceptedTransferSyntaxes(
+const QList< QTransferSyntax > & QStorageScu::acceptedTransferSyntaxes(
 	const QUid & Uid
 ) const {
-	QList< QTransferSyntax > result;
-
-	QList< QPresentationContext > All = 
-		association().acceptedPresentationContexts()
-	;
-
-	for (
-		QList< QPresentationContext >::const_iterator i = All.constBegin();
-		i != All.constEnd(); ++i
-	) {
-		if ( i->abstractSyntax() == Uid ) {
-			result.append( i->acceptedTransferSyntax() );
-		}
-	}
-
-	return result;
+	return contextTable_.acceptedTransferSyntaxes( Uid );
 }
 
 
 bool QStorageScu::areAllSopClassesAccepted(
 	const QList< QPresentationContext > & ProposedContexts
 ) const {
-	const QList< QPresentationContext > AcceptedContexts = 
-			association().acceptedPresentationContexts()
-	;
 	Q_ASSERT(
-		AcceptedContexts.size() > 0 && 
-		AcceptedContexts.size() <= ProposedContexts.size()
+		! contextTable_.isEmpty() && 
+		contextTable_.acceptedPresentationContexts().size() <= ProposedContexts.size()
 	);
 
-	QList< QUid > acceptedSopClasses;
-	for (
-		QList< QPresentationContext >::const_iterator i = AcceptedContexts.constBegin();
-		i != AcceptedContexts.constEnd(); ++i
-	) {
-		acceptedSopClasses.append( i->abstractSyntax() );
-	}
-
 	// Make sure each SOP class is supported
 	for (
 		QList< QUid >::const_iterator i = sopClasses_.constBegin();
 		i != sopClasses_.constEnd(); ++i 
 	) {
-		if ( acceptedSopClasses.contains( *i ) ) {
+		if ( contextTable_.contains( *i ) ) {
 			continue;
 		}
 		else {
@@ -125,7 +100,7 @@ void QStorageScu::connectToAe() {
 	error_ = NoError;
 
 	if ( state() != Disconnected ) {
-		qDebug( 
+		QDICOM_LOG( Storage, Debug,
 			__FUNCTION__": called when the previous connection is still open; "
 			"disconnecting"
 		);
@@ -250,6 +225,9 @@ void QStorageScu::releaseAssociation() {
 		association().release();
 	}
 
+	contextTable_ = QPresentationContextTable();
+	dimseClient_.setPresentationContextTable( contextTable_ );
+
 	setState( Disconnected );
 }
 
@@ -265,11 +243,20 @@ void QStorageScu::requestAssociation() {
 	const int Count = association().request( ProposedContexts, &timedOut );
 
 	if ( Count > 0 ) {
+		contextTable_ = QPresentationContextTable::fromTAscAssociation(
+			association().tAscAssociation()
+		);
+
 		allSopClassesAccepted =
 			areAllSopClassesAccepted( ProposedContexts )
 		;
 
 		if ( allSopClassesAccepted ) {
+			warnAboutPreferredTransferSyntax();
+
+			dimseClient_.setAssociation( &association() );
+			dimseClient_.setPresentationContextTable( contextTable_ );
+
 			setState( Connected );
 
 			return;
@@ -342,39 +329,33 @@ void QStorageScu::store( Dicom::Dataset dataset ) {
 	const QUid SopClass = dataset.sopClassUid();
 
 	if ( sopClasses_.contains( SopClass ) ) {
-		QList< QTransferSyntax > AcceptedTs = acceptedTransferSyntaxes(
-			SopClass
-		);
-		Q_ASSERT( AcceptedTs.size() > 0 );
+		Q_ASSERT( contextTable_.contains( SopClass ) );
 
-		// We propose maximum two presentation contexts per SOP class. If only
-		// one of them was accepted, check if that's the preferred one
-		if (
-			AcceptedTs.size() == 1 && 
-			( AcceptedTs.at( 0 ) != transferSyntax_ )
-		) {
-			qWarning( __FUNCTION__": "
-				"SCP doesn't support preferred Transfer Syntax: %s "
-				"for SOP class: %s; the default: %s will be used instead",
-				transferSyntax_.name(),
-				SopClass.constData(),
-				AcceptedTs.at( 0 ).name()
-			);
-		}
+		const QPresentationContextTable::Route Route = contextTable_.route(
+			SopClass, dataset.syntax()
+		);
 
-		if ( ! AcceptedTs.contains( dataset.syntax() ) ) {
+		if ( Route.syntax != dataset.syntax() ) {
 			bool converted = false;
-			for (
-				QList< QTransferSyntax >::const_iterator i = AcceptedTs.constBegin();
-				i != AcceptedTs.constEnd(); ++i
-			) {
-				if ( dataset.canConvertToTransferSyntax( *i ) ) {
-					const Dicom::Dataset Tmp = dataset.convertedToTransferSyntax( *i );
+			if ( Route.isValid() ) {
+				// The route's syntax goes first; should the conversion fail,
+				// the remaining accepted syntaxes are tried in order
+				QList< QTransferSyntax > candidates =
+					contextTable_.acceptedTransferSyntaxes( SopClass )
+				;
+				candidates.removeAll( Route.syntax );
+				candidates.prepend( Route.syntax );
+
+				foreach ( const QTransferSyntax & Ts, candidates ) {
+					if ( Ts != Route.syntax && ! dataset.canConvertToTransferSyntax( Ts ) ) {
+						continue;
+					}
 
+					const Dicom::Dataset Tmp = dataset.convertedToTransferSyntax( Ts );
 					if ( ! Tmp.isEmpty() ) {
-						qDebug( __FUNCTION__": "
+						QDICOM_LOG( Storage, Debug, __FUNCTION__": "
 							"converted Data Set from %s to negotiated %s transfer syntax",
-							dataset.syntax().name(), i->name()
+							dataset.syntax().name(), Ts.name()
 						);
 
 						dataset = Tmp;
@@ -382,16 +363,16 @@ void QStorageScu::store( Dicom::Dataset dataset ) {
 						break;
 					}
 					else {
-						qWarning( __FUNCTION__": "
+						QDICOM_LOG( Storage, Warning, __FUNCTION__": "
 							"failed to convert Data Set from %s to %s transfer syntax",
-							dataset.syntax().name(), i->name()
+							dataset.syntax().name(), Ts.name()
 						);
 					}
-				}				
+				}
 			}
 
 			if ( ! converted ) {
-				qWarning( __FUNCTION__": "
+				QDICOM_LOG( Storage, Warning, __FUNCTION__": "
 					"Data Set's: %s Transfer Syntax: %s "
 					"cannot be converted to those accpeted by SCP",
 					dataset.sopInstanceUid().constData(),
@@ -410,7 +391,7 @@ void QStorageScu::store( Dicom::Dataset dataset ) {
 		);
 	}
 	else {
-		qWarning( __FUNCTION__": "
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
 			"Data Set's: %s SOP class: %s doesn't match requested",
 			dataset.sopInstanceUid().constData(),
 			qPrintable( sopClassString( SopClass ) )
@@ -425,11 +406,7 @@ void QStorageScu::store( Dicom::Dataset dataset ) {
 void QStorageScu::storeDataset( Dicom::Dataset dataset ) {
 	if ( state_ != Disconnected ) {
 		Q_ASSERT( sopClasses_.contains( dataset.sopClassUid() ) );
-		Q_ASSERT(
-			acceptedTransferSyntaxes( dataset.sopClassUid() ).contains(
-				dataset.syntax()
-			)
-		);
+		Q_ASSERT( contextTable_.id( dataset.sopClassUid(), dataset.syntax() ) > 0 );
 
 		setState( Sending );
 
@@ -447,7 +424,7 @@ void QStorageScu::storeDataset( Dicom::Dataset dataset ) {
 		}
 	}
 	else {
-		qWarning( __FUNCTION__": "
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
 			"Disconnected; ignoring Data Set: %s",
 			qPrintable( dataset.sopInstanceUid() )
 		);
@@ -455,6 +432,31 @@ void QStorageScu::storeDataset( Dicom::Dataset dataset ) {
 }
 
 
+void QStorageScu::warnAboutPreferredTransferSyntax() const {
+	if ( ! transferSyntax_.isValid() ) {
+		return;
+	}
+
+	foreach ( const QUid & SopClass, sopClasses_ ) {
+		const QList< QTransferSyntax > & AcceptedTs =
+			acceptedTransferSyntaxes( SopClass )
+		;
+
+		// We propose maximum two presentation contexts per SOP class. If only
+		// one of them was accepted, check if that's the preferred one
+		if ( AcceptedTs.size() == 1 && AcceptedTs.at( 0 ) != transferSyntax_ ) {
+			QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+				"SCP doesn't support preferred Transfer Syntax: %s "
+				"for SOP class: %s; the default: %s will be used instead",
+				transferSyntax_.name(),
+				SopClass.constData(),
+				AcceptedTs.at( 0 ).name()
+			);
+		}
+	}
+}
+
+
 QString sopClassString( const char * Uid ) {
 	return QString( dcmFindNameOfUID( Uid, Uid ) );
 }
@@ -12,6 +12,7 @@
 #include <QtDicom/Globals.hpp>
 #include <QtDicom/ServiceUser.hpp>
 #include <QtDicom/QPresentationContext>
+#include <QtDicom/QPresentationContextTable>
 #include <QtDicom/QTransferSyntax>
 #include <QtDicom/QUid>
 
@@ -248,7 +249,7 @@ class QDICOM_DLLSPEC QStorageScu : public QObject {
 		void storeDataset( Dicom::Dataset dataset );
 
 	private :
-		QList< QTransferSyntax > acceptedTransferSyntaxes(
+		const QList< QTransferSyntax > & acceptedTransferSyntaxes(
 			const QUid & SopClass
 		) const;
 		bool areAllSopClassesAccepted(
@@ -258,12 +259,14 @@ class QDICOM_DLLSPEC QStorageScu : public QObject {
 		QList< QPresentationContext > preparePresentationContexts() const;
 		inline void setError( Error e );
 		inline void setState( State s );
+		void warnAboutPreferredTransferSyntax() const;
 
 	private :
 		inline Dicom::RequestorAssociation & association();
 		inline const Dicom::RequestorAssociation & association() const;
 		Dicom::RequestorAssociation * association_;
 
+		QPresentationContextTable contextTable_;
 		Dicom::ServiceUser dimseClient_;
 		Error error_;
 		QList< QUid > sopClasses_;
@@ -4,10 +4,16 @@
  **************************************************************************/
 
 #include "DataSource.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
 #include "QueryScp.hpp"
 #include "QueryScp.moc.inl"
+#include "QueryScpCache.hpp"
+#include "QueryScpIndex.hpp"
+#include "QueryScpMover.hpp"
 #include "QueryScpReceiverThread.hpp"
 
+#include <dcmtk/dcmdata/dcdeftag.h>
 #include <dcmtk/dcmnet/dimse.h>
 
 namespace Dicom {
@@ -15,21 +21,46 @@ namespace Dicom {
 QueryScp::QueryScp( QObject * parent ) :
 	QObject( parent ),
 	associationServer_( parent ),
-	dataSource_( 0 )
+	cache_( new Cache() ),
+	dataSource_( 0 ),
+	index_( new Index() ),
+	maxQueryTime_( 0 ),
+	maxResults_( 0 ),
+	moveConnections_( 4 ),
+	refreshInterval_( 1000 ),
+	responseLatency_( 20 )
 {
+	connect( &refreshTimer_, SIGNAL( timeout() ), SLOT( refresh() ) );
 }
 
 
 QueryScp::QueryScp( DataSource * source, QObject * parent ) :
 	QObject( parent ),
 	associationServer_( parent ),
-	dataSource_( source )
+	cache_( new Cache() ),
+	dataSource_( source ),
+	index_( new Index() ),
+	maxQueryTime_( 0 ),
+	maxResults_( 0 ),
+	moveConnections_( 4 ),
+	refreshInterval_( 1000 ),
+	responseLatency_( 20 )
 {
+	connect( &refreshTimer_, SIGNAL( timeout() ), SLOT( refresh() ) );
 }
 
 
 QueryScp::~QueryScp() {
 	stop();
+	delete cache_;
+	delete index_;
+}
+
+
+void QueryScp::addMoveDestination(
+	const QString & Title, const ConnectionParameters & Parameters
+) {
+	moveDestinations_.insert( Title, Parameters );
 }
 
 
@@ -43,6 +74,21 @@ AssociationServer & QueryScp::associationServer() {
 }
 
 
+int QueryScp::cacheCapacity() const {
+	return cache_->capacity();
+}
+
+
+quint64 QueryScp::cacheHits() const {
+	return cache_->hits();
+}
+
+
+quint64 QueryScp::cacheMisses() const {
+	return cache_->misses();
+}
+
+
 void QueryScp::createReceiverThread() {
 	Q_ASSERT( associationServer().hasPendingConnections() );
 
@@ -51,15 +97,26 @@ void QueryScp::createReceiverThread() {
 			associationServer().nextPendingAssociation()
 		)
 	);
+	thread->setMoveConnections( moveConnections() );
+	thread->setMoveDestinations( moveDestinations() );
+	thread->setResponseLatency( responseLatency() );
 
 	connect( 
-		thread, SIGNAL( newQuery( Dataset, ReceiverThread * ) ),
-		this, SLOT( match( Dataset, ReceiverThread * ) )
+		thread, SIGNAL( newQuery( Dataset, int, ReceiverThread * ) ),
+		this, SLOT( match( Dataset, int, ReceiverThread * ) )
 	);
 	connect( 
-		thread, SIGNAL( newQuery( Dataset, ReceiverThread *  ) ),
+		thread, SIGNAL( newQuery( Dataset, int, ReceiverThread * ) ),
 		SIGNAL( newQuery( Dataset ) )
 	);
+	connect( 
+		thread, SIGNAL( newMove( Dataset, int, ReceiverThread * ) ),
+		this, SLOT( resolve( Dataset, int, ReceiverThread * ) )
+	);
+	connect( 
+		thread, SIGNAL( newMove( Dataset, int, ReceiverThread * ) ),
+		SIGNAL( newRetrieve( Dataset ) )
+	);
 	connect(
 		thread, SIGNAL( finished() ),
 		thread, SLOT( deleteLater() )
@@ -77,27 +134,257 @@ DataSource * QueryScp::dataSource() {
 }
 
 
+int QueryScp::interruption(
+	ReceiverThread * thread, int query, const QElapsedTimer & Timer
+) const {
+	if ( ! thread->queryInProgress( query ) ) {
+		return STATUS_FIND_Cancel_MatchingTerminatedDueToCancelRequest;
+	}
+	if ( maxQueryTime_ > 0 && Timer.elapsed() >= maxQueryTime_ ) {
+		return STATUS_FIND_Failed_UnableToProcess;
+	}
+	return STATUS_Success;
+}
+
+
 bool QueryScp::isRunning() const {
 	return associationServer().isListening();
 }
 
 
-void QueryScp::match( Dataset mask, ReceiverThread * thread ) {
-	dataSource()->refresh();
+int QueryScp::listenerShards() const {
+	return associationServer().listenerShards();
+}
+
+
+int QueryScp::maxQueryTime() const {
+	return maxQueryTime_;
+}
+
+
+int QueryScp::maxResults() const {
+	return maxResults_;
+}
+
+
+void QueryScp::match( Dataset mask, int query, ReceiverThread * thread ) {
+	QElapsedTimer timer;
+	timer.start();
+
+	if ( refreshInterval_ == 0 ) {
+		refresh();
+	}
+
+	const QByteArray Key = Cache::key( thread->sopClass(), mask );
+	const quint64 Generation = dataSource()->generation();
+
+	QList< Dataset > results;
+	if ( cache_->find( Key, Generation, results ) ) {
+		Metrics::instance().addCacheLookup( Metrics::CacheHit, thread->peer() );
 
-	for ( int i = 0; i < dataSource()->size(); ++i ) {
-		const Dataset Rsp = dataSource()->dataset( i ).match( mask );
-		if ( ! Rsp.isEmpty() ) {
-			thread->queueIdentifier( Rsp );
+		int status = STATUS_Success;
+		if ( maxResults_ > 0 && results.size() > maxResults_ ) {
+			results = results.mid( 0, maxResults_ );
+			status = STATUS_FIND_Refused_OutOfResources;
 		}
+		foreach ( const Dataset & Rsp, results ) {
+			thread->queueIdentifier( query, Rsp );
+		}
+		thread->finish( query, status );
+		return;
+	}
+	Metrics::instance().addCacheLookup( Metrics::CacheMiss, thread->peer() );
+
+	if ( ! index_->isCurrent( *dataSource() ) ) {
+		index_->build( *dataSource() );
 	}
 
-	thread->finish( STATUS_Success );
+	const Index::Level Level = Index::level( mask );
+	int status = STATUS_Success;
+
+	if ( Level == Index::Patient || Level == Index::Study || Level == Index::Series ) {
+		foreach ( const Dataset & Record, index_->records( Level ) ) {
+			status = interruption( thread, query, timer );
+			if ( status != STATUS_Success ) {
+				break;
+			}
+
+			const Dataset Rsp = Record.match( mask );
+			if ( ! Rsp.isEmpty() ) {
+				// Refused only once there are more matches than allowed
+				if ( maxResults_ > 0 && results.size() >= maxResults_ ) {
+					status = STATUS_FIND_Refused_OutOfResources;
+					break;
+				}
+
+				Rsp.dcmDataset().putAndInsertString(
+					DCM_QueryRetrieveLevel, Index::levelName( Level )
+				);
+				thread->queueIdentifier( query, Rsp );
+				results.append( Rsp );
+			}
+		}
+	}
+	else {
+		foreach ( const int Offset, index_->instances( mask ) ) {
+			status = interruption( thread, query, timer );
+			if ( status != STATUS_Success ) {
+				break;
+			}
+
+			const Dataset Rsp = dataSource()->dataset( Offset ).match( mask );
+			if ( ! Rsp.isEmpty() ) {
+				if ( maxResults_ > 0 && results.size() >= maxResults_ ) {
+					status = STATUS_FIND_Refused_OutOfResources;
+					break;
+				}
+
+				// Instances don't carry the level, responses have to
+				if ( Level == Index::Image ) {
+					Rsp.dcmDataset().putAndInsertString(
+						DCM_QueryRetrieveLevel, Index::levelName( Level )
+					);
+				}
+				thread->queueIdentifier( query, Rsp );
+				results.append( Rsp );
+			}
+		}
+	}
+
+	switch ( status ) {
+		case STATUS_Success :
+			cache_->insert( Key, Generation, results );
+			break;
+		case STATUS_FIND_Cancel_MatchingTerminatedDueToCancelRequest :
+			QDICOM_LOG( Query, Info,
+				"Query of %s cancelled after %d matches.",
+				qPrintable( thread->peer() ), results.size()
+			);
+			// The receiver has already responded
+			return;
+		default :
+			QDICOM_LOG( Query, Warning,
+				"Query of %s stopped after %d matches in %lld ms.",
+				qPrintable( thread->peer() ), results.size(), timer.elapsed()
+			);
+	}
+
+	thread->finish( query, status );
+}
+
+
+int QueryScp::moveConnections() const {
+	return moveConnections_;
+}
+
+
+const QHash< QString, ConnectionParameters > & QueryScp::moveDestinations() const {
+	return moveDestinations_;
+}
+
+
+void QueryScp::refresh() {
+	if ( dataSource() ) {
+		dataSource()->refresh();
+	}
+}
+
+
+int QueryScp::refreshInterval() const {
+	return refreshInterval_;
+}
+
+
+int QueryScp::responseLatency() const {
+	return responseLatency_;
+}
+
+
+void QueryScp::resolve( Dataset identifier, int move, ReceiverThread * thread ) {
+	if ( refreshInterval_ == 0 ) {
+		refresh();
+	}
+
+	if ( ! index_->isCurrent( *dataSource() ) ) {
+		index_->build( *dataSource() );
+	}
+
+	// Instances read from files are read again by senders, so those aren't
+	// kept in memory meanwhile
+	QList< Mover::Instance > instances;
+	foreach ( const int Offset, index_->instances( identifier ) ) {
+		const Dataset Candidate = dataSource()->dataset( Offset );
+		if ( Candidate.match( identifier ).isEmpty() ) {
+			continue;
+		}
+
+		Mover::Instance instance;
+		instance.path = dataSource()->path( Offset );
+		if ( instance.path.isEmpty() ) {
+			instance.dataSet = dataSource()->load( Offset );
+		}
+		instance.sopClassUid = Candidate.sopClassUid();
+		instance.sopInstanceUid = Candidate.sopInstanceUid();
+		instance.syntax = Candidate.syntax();
+		instances.append( instance );
+	}
+
+	thread->startMove( move, instances );
+}
+
+
+void QueryScp::setCacheCapacity( int capacity ) {
+	cache_->setCapacity( capacity );
 }
 
 
 void QueryScp::setDataSource( DataSource * source ) {
 	dataSource_ = source;
+	cache_->clear();
+	index_->clear();
+	if ( isRunning() ) {
+		refresh();
+	}
+}
+
+
+void QueryScp::setListenerShards( int count ) {
+	associationServer().setListenerShards( count );
+}
+
+
+void QueryScp::setMaxQueryTime( int msecs ) {
+	maxQueryTime_ = qMax( 0, msecs );
+}
+
+
+void QueryScp::setMaxResults( int count ) {
+	maxResults_ = qMax( 0, count );
+}
+
+
+void QueryScp::setMoveConnections( int count ) {
+	moveConnections_ = qMax( 1, count );
+}
+
+
+void QueryScp::setMoveDestinations(
+	const QHash< QString, ConnectionParameters > & Destinations
+) {
+	moveDestinations_ = Destinations;
+}
+
+
+void QueryScp::setRefreshInterval( int msecs ) {
+	refreshInterval_ = qMax( 0, msecs );
+	if ( isRunning() ) {
+		startRefreshTimer();
+	}
+}
+
+
+void QueryScp::setResponseLatency( int msecs ) {
+	responseLatency_ = qMax( 1, msecs );
 }
 
 
@@ -119,6 +406,8 @@ bool QueryScp::start( const ConnectionParameters & Parameters ) {
 	);
 	associationServer().setTransferSyntaxes( UidList::supportedTransferSyntaxes() );
 	if ( associationServer().listen( Parameters ) ) {
+		refresh();
+		startRefreshTimer();
 		connect( 
 			&associationServer(), SIGNAL( newAssociation() ),
 			SLOT( createReceiverThread() )
@@ -136,7 +425,18 @@ bool QueryScp::start( const ConnectionParameters & Parameters ) {
 }
 
 
+void QueryScp::startRefreshTimer() {
+	if ( refreshInterval_ > 0 ) {
+		refreshTimer_.start( refreshInterval_ );
+	}
+	else {
+		refreshTimer_.stop();
+	}
+}
+
+
 void QueryScp::stop() {
+	refreshTimer_.stop();
 	associationServer().close();
 }
 
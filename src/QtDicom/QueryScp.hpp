@@ -6,53 +6,258 @@
 #ifndef DICOM_QUERYSCP_HPP
 #define DICOM_QUERYSCP_HPP
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
 #include <QtCore/QObject>
+#include <QtCore/QTimer>
 
 #include "QtDicom/AssociationServer.hpp"
+#include "QtDicom/ConnectionParameters.hpp"
 #include "QtDicom/Dataset.hpp"
 #include "QtDicom/Globals.hpp"
 
 
 class QDir;
+class QtDicomTest;
 
 namespace Dicom {
 
-class ConnectionParameters;
 class DataSource;
 
 
+/**
+ * The \em QueryScp class answers C-FIND and C-MOVE requests with instances of
+ * its \ref dataSource().
+ *
+ * Results of recent queries are cached until datasets of the source change,
+ * so clients polling with the same query are answered without matching it
+ * again; lookups are counted in the \ref Metrics.
+ *
+ * Identifiers matched are sent in batches, several C-FIND responses packed
+ * into each P-DATA-TF PDU, at most \ref responseLatency() after they were
+ * produced.
+ *
+ * Matching stops as soon as the peer cancels the query. It's also stopped,
+ * with a Refused: Out of Resources or Unable to Process status, once it
+ * matches more than \ref maxResults() identifiers or takes \ref
+ * maxQueryTime(); identifiers sent until then stay valid. A query producing
+ * exactly \ref maxResults() identifiers succeeds.
+ *
+ * Queries are matched at their Query/Retrieve Level: PATIENT, STUDY and SERIES
+ * ones against aggregate records of the \ref dataSource(), one for each
+ * entity, carrying counts of related entities; IMAGE level ones against
+ * instances selected by unique keys of upper levels. Queries without a level
+ * are matched against all instances.
+ *
+ * C-MOVE destinations are looked up by their AE titles among \ref
+ * moveDestinations(). Matched instances are stored on the destination over
+ * \ref moveConnections() associations at once, each reading files of its own
+ * instances, and the progress is reported with pending responses until all
+ * sub-operations are done or the peer cancels them.
+ */
 class QDICOM_DLLSPEC QueryScp : public QObject {
 	Q_OBJECT;
 
+	friend class ::QtDicomTest;
+
 	public :
 		QueryScp( QObject * parent = 0 );
 		QueryScp( DataSource * source, QObject * parent = 0 );
 		~QueryScp();
 
+		/**
+		 * Adds the AE of the \a title, accepting associations as described
+		 * by the \a parameters, to the \ref moveDestinations().
+		 */
+		void addMoveDestination(
+			const QString & title, const ConnectionParameters & parameters
+		);
+
+		/**
+		 * Returns the maximum number of queries whose results are cached;
+		 * the default is 64.
+		 */
+		int cacheCapacity() const;
+
+		/**
+		 * Returns the number of queries answered from the cache.
+		 */
+		quint64 cacheHits() const;
+
+		/**
+		 * Returns the number of queries which had to be matched.
+		 */
+		quint64 cacheMisses() const;
+
 		DataSource * dataSource();
 		bool isRunning() const;
+
+		/**
+		 * Returns the number of sockets listening on the SCP's port.
+		 */
+		int listenerShards() const;
+
+		/**
+		 * Returns the maximum time, in milliseconds, a query may take to be
+		 * matched; \c 0, the default, means no limit.
+		 */
+		int maxQueryTime() const;
+
+		/**
+		 * Returns the maximum number of identifiers a query may produce;
+		 * \c 0, the default, means no limit.
+		 */
+		int maxResults() const;
+
+		/**
+		 * Returns the maximum number of associations instances of a single
+		 * C-MOVE are stored over; the default is 4.
+		 */
+		int moveConnections() const;
+
+		/**
+		 * Returns AEs instances may be moved to, by their titles.
+		 */
+		const QHash< QString, ConnectionParameters > & moveDestinations() const;
+
+		/**
+		 * Returns the time, in milliseconds, between refreshes of the \ref
+		 * dataSource(); the default is 1000. The source is refreshed in the
+		 * background, queries are answered from datasets already known and
+		 * from the cache until a refresh changes its generation. \c 0
+		 * refreshes it for each query instead, so that even queries answered
+		 * from the cache pay for a scan.
+		 */
+		int refreshInterval() const;
+
+		/**
+		 * Returns the maximum time, in milliseconds, identifiers matched wait
+		 * to be sent with others; the default is 20.
+		 */
+		int responseLatency() const;
+
+		/**
+		 * Sets the maximum number of queries whose results are cached to \a
+		 * capacity; \c 0 disables the cache.
+		 */
+		void setCacheCapacity( int capacity );
+
 		void setDataSource( DataSource * source );
+
+		/**
+		 * Sets the number of sockets listening on the SCP's port to \a count.
+		 * See \ref AssociationServer::setListenerShards().
+		 */
+		void setListenerShards( int count );
+
+		/**
+		 * Sets the maximum time a query may take to be matched to \a msecs;
+		 * \c 0 means no limit.
+		 */
+		void setMaxQueryTime( int msecs );
+
+		/**
+		 * Sets the maximum number of identifiers a query may produce to \a
+		 * count; \c 0 means no limit.
+		 */
+		void setMaxResults( int count );
+
+		/**
+		 * Sets the maximum number of associations instances of a single
+		 * C-MOVE are stored over to \a count. Takes effect for associations
+		 * accepted afterwards.
+		 */
+		void setMoveConnections( int count );
+
+		/**
+		 * Sets AEs instances may be moved to, by their titles. Takes effect
+		 * for associations accepted afterwards.
+		 */
+		void setMoveDestinations(
+			const QHash< QString, ConnectionParameters > & destinations
+		);
+
+		/**
+		 * Sets the time between refreshes of the \ref dataSource() to \a
+		 * msecs. See \ref refreshInterval().
+		 */
+		void setRefreshInterval( int msecs );
+
+		/**
+		 * Sets the maximum time identifiers wait to be sent to \a msecs.
+		 * Longer times pack more responses into each write. Takes effect for
+		 * associations accepted afterwards.
+		 */
+		void setResponseLatency( int msecs );
+
 		bool start( const ConnectionParameters & parameters );
 		void stop();
 
 	private :
+		class Cache;
+		class Index;
+		class Mover;
 		class ReceiverThread;
 
 	private :
 		const AssociationServer & associationServer() const;
 		AssociationServer & associationServer();
 
+		/**
+		 * Returns the status the \a query of the \a thread has to be
+		 * stopped with, having been matched since the \a timer was started,
+		 * or \c STATUS_Success to go on.
+		 */
+		int interruption(
+			ReceiverThread * thread, int query, const QElapsedTimer & timer
+		) const;
+
+		/**
+		 * (Re)starts refreshing the \ref dataSource() every \ref
+		 * refreshInterval(), or stops it if that is \c 0.
+		 */
+		void startRefreshTimer();
+
 	private slots :
 		void createReceiverThread();
-		void match( Dataset dataset, ReceiverThread * );
+		/**
+		 * Matches the \a dataset of the \a query of the \a thread;
+		 * identifiers are passed to the thread as long as that query is in
+		 * progress.
+		 */
+		void match( Dataset dataset, int query, ReceiverThread * thread );
+
+		/**
+		 * Resolves the C-MOVE \a identifier into instances of the \ref
+		 * dataSource() and passes them to the \a thread to be moved as its
+		 * \a move. Candidates are picked with the index by unique keys of
+		 * the identifier, only those are matched.
+		 */
+		void resolve( Dataset identifier, int move, ReceiverThread * thread );
+
+		/**
+		 * Refreshes the \ref dataSource(); a source that changed bumps its
+		 * generation, which invalidates cached results.
+		 */
+		void refresh();
 
 	private :
 		AssociationServer associationServer_;
+		Cache * cache_;
 		DataSource * dataSource_;
+		Index * index_;
+		int maxQueryTime_;
+		int maxResults_;
+		int moveConnections_;
+		QHash< QString, ConnectionParameters > moveDestinations_;
+		int refreshInterval_;
+		QTimer refreshTimer_;
+		int responseLatency_;
 
 	signals :
 		void failedToQuery( QString message );
 		void newQuery( Dataset dataset );
+		void newRetrieve( Dataset identifier );
 };
 
 
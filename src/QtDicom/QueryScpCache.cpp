@@ -0,0 +1,156 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "QueryScpCache.hpp"
+
+#include <QtCore/QCryptographicHash>
+
+#include <dcmtk/dcmdata/dcelem.h>
+#include <dcmtk/dcmdata/dcitem.h>
+#include <dcmtk/dcmdata/dcsequen.h>
+
+
+static const int MaxCachedResults = 10000;
+
+
+namespace Dicom {
+
+QueryScp::Cache::Cache( int capacity ) :
+	capacity_( qMax( 0, capacity ) ),
+	hits_( 0 ),
+	misses_( 0 ),
+	uses_( 0 )
+{
+}
+
+
+QueryScp::Cache::~Cache() {
+}
+
+
+void QueryScp::Cache::canonicalize( DcmItem & item, QByteArray & text ) {
+	// Items keep their elements ordered by tags
+	for ( unsigned long i = 0; i < item.card(); ++i ) {
+		DcmElement * element = item.getElement( i );
+		const DcmTag & Tag = element->getTag();
+
+		text +=
+			QByteArray::number( Tag.getGTag(), 16 ) + ',' +
+			QByteArray::number( Tag.getETag(), 16 )
+		;
+
+		if ( element->ident() == EVR_SQ ) {
+			DcmSequenceOfItems * sequence =
+				reinterpret_cast< DcmSequenceOfItems * >( element )
+			;
+			text += '{';
+			for ( unsigned long j = 0; j < sequence->card(); ++j ) {
+				text += '[';
+				canonicalize( *sequence->getItem( j ), text );
+				text += ']';
+			}
+			text += '}';
+		}
+		else {
+			OFString value;
+			element->getOFStringArray( value );
+			text += '=' + QByteArray( value.c_str() ).trimmed();
+		}
+		text += '\n';
+	}
+}
+
+
+int QueryScp::Cache::capacity() const {
+	return capacity_;
+}
+
+
+void QueryScp::Cache::clear() {
+	entries_.clear();
+}
+
+
+void QueryScp::Cache::evict() {
+	while ( entries_.size() > capacity_ ) {
+		QHash< QByteArray, Entry >::iterator oldest = entries_.begin();
+		for (
+			QHash< QByteArray, Entry >::iterator i = entries_.begin();
+			i != entries_.end(); ++i
+		) {
+			if ( i->used < oldest->used ) {
+				oldest = i;
+			}
+		}
+		entries_.erase( oldest );
+	}
+}
+
+
+bool QueryScp::Cache::find(
+	const QByteArray & Key, quint64 generation, QList< Dataset > & results
+) {
+	QHash< QByteArray, Entry >::iterator i = entries_.find( Key );
+	if ( i == entries_.end() ) {
+		++misses_;
+		return false;
+	}
+
+	if ( i->generation != generation ) {
+		entries_.erase( i );
+		++misses_;
+		return false;
+	}
+
+	i->used = ++uses_;
+	results = i->results;
+	++hits_;
+	return true;
+}
+
+
+quint64 QueryScp::Cache::hits() const {
+	return hits_;
+}
+
+
+void QueryScp::Cache::insert(
+	const QByteArray & Key, quint64 generation,
+	const QList< Dataset > & Results
+) {
+	if ( capacity_ == 0 || Results.size() > MaxCachedResults ) {
+		return;
+	}
+
+	Entry & entry = entries_[ Key ];
+	entry.generation = generation;
+	entry.results = Results;
+	entry.used = ++uses_;
+
+	evict();
+}
+
+
+QByteArray QueryScp::Cache::key(
+	const QByteArray & SopClass, const Dataset & Mask
+) {
+	QByteArray text = SopClass + '\n';
+	canonicalize( Mask.dcmDataset(), text );
+
+	return QCryptographicHash::hash( text, QCryptographicHash::Sha1 );
+}
+
+
+quint64 QueryScp::Cache::misses() const {
+	return misses_;
+}
+
+
+void QueryScp::Cache::setCapacity( int capacity ) {
+	capacity_ = qMax( 0, capacity );
+	evict();
+}
+
+}; // Namespace DICOM ends here.
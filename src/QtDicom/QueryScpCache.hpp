@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_QUERYSCP_CACHE_HPP
+#define DICOM_QUERYSCP_CACHE_HPP
+
+#include "QtDicom/Dataset.hpp"
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/QueryScp.hpp"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+
+class DcmItem;
+
+namespace Dicom {
+
+/**
+ * The \em Cache class keeps results of recent queries.
+ *
+ * Results are stored under a \ref key() computed from the SOP class and a
+ * canonical form of the mask, so masks differing only in order of attributes
+ * or padding of values share their results. Each entry remembers the \ref
+ * DataSource::generation() it was matched at and is valid only as long as
+ * the source's generation stays the same. When the cache is full, the least
+ * recently used entry is dropped.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC QueryScp::Cache {
+	public :
+		/**
+		 * Returns the key of results of the \a mask matched for the \a
+		 * sopClass.
+		 */
+		static QByteArray key( const QByteArray & sopClass, const Dataset & mask );
+
+	public :
+		/**
+		 * Creates a cache of at most \a capacity entries.
+		 */
+		Cache( int capacity = 64 );
+		~Cache();
+
+		/**
+		 * Returns the maximum number of entries.
+		 */
+		int capacity() const;
+
+		/**
+		 * Removes all entries.
+		 */
+		void clear();
+
+		/**
+		 * Looks the \a key up, storing \a results found. Returns \c false if
+		 * there are none or they were matched at a \a generation other than
+		 * the one given.
+		 */
+		bool find(
+			const QByteArray & key, quint64 generation, QList< Dataset > & results
+		);
+
+		/**
+		 * Returns the number of lookups which found results.
+		 */
+		quint64 hits() const;
+
+		/**
+		 * Stores \a results of the \a key matched at the \a generation.
+		 * Results of more than 10000 identifiers aren't stored.
+		 */
+		void insert(
+			const QByteArray & key, quint64 generation,
+			const QList< Dataset > & results
+		);
+
+		/**
+		 * Returns the number of lookups which didn't find results.
+		 */
+		quint64 misses() const;
+
+		/**
+		 * Sets the maximum number of entries to \a capacity; \c 0 disables
+		 * the cache.
+		 */
+		void setCapacity( int capacity );
+
+	private :
+		struct Entry {
+			quint64 generation;
+			QList< Dataset > results;
+			quint64 used;
+		};
+
+	private :
+		/**
+		 * Appends the canonical form of the \a item to the \a text.
+		 */
+		static void canonicalize( DcmItem & item, QByteArray & text );
+
+		/**
+		 * Drops least recently used entries beyond the \ref capacity().
+		 */
+		void evict();
+
+	private :
+		int capacity_;
+		QHash< QByteArray, Entry > entries_;
+		quint64 hits_;
+		quint64 misses_;
+		quint64 uses_;
+
+		Q_DISABLE_COPY( Cache );
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
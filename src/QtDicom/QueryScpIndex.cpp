@@ -0,0 +1,272 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "DataSource.hpp"
+#include "QueryScpIndex.hpp"
+
+#include <QtCore/QSet>
+
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcelem.h>
+
+
+static const DcmTagKey PatientTags[] = {
+	DCM_PatientName,
+	DCM_PatientID,
+	DCM_IssuerOfPatientID,
+	DCM_OtherPatientIDs,
+	DCM_PatientBirthDate,
+	DCM_PatientBirthTime,
+	DCM_PatientSex,
+	DCM_EthnicGroup,
+	DCM_PatientComments
+};
+
+static const int PatientTagCount = sizeof( PatientTags ) / sizeof( DcmTagKey );
+
+
+static const DcmTagKey StudyTags[] = {
+	DCM_StudyDate,
+	DCM_StudyTime,
+	DCM_AccessionNumber,
+	DCM_StudyID,
+	DCM_StudyInstanceUID,
+	DCM_ReferringPhysicianName,
+	DCM_StudyDescription,
+	DCM_NameOfPhysiciansReadingStudy,
+	DCM_AdmittingDiagnosesDescription,
+	DCM_PatientAge,
+	DCM_PatientSize,
+	DCM_PatientWeight,
+	DCM_Occupation,
+	DCM_AdditionalPatientHistory
+};
+
+static const int StudyTagCount = sizeof( StudyTags ) / sizeof( DcmTagKey );
+
+
+static const DcmTagKey SeriesTags[] = {
+	DCM_Modality,
+	DCM_SeriesNumber,
+	DCM_SeriesInstanceUID,
+	DCM_SeriesDescription,
+	DCM_SeriesDate,
+	DCM_SeriesTime,
+	DCM_BodyPartExamined,
+	DCM_Laterality,
+	DCM_ProtocolName,
+	DCM_PerformedProcedureStepStartDate,
+	DCM_PerformedProcedureStepStartTime
+};
+
+static const int SeriesTagCount = sizeof( SeriesTags ) / sizeof( DcmTagKey );
+
+
+/**
+ * Aggregate of instances below a record, while records are being built.
+ */
+struct Aggregate {
+	Aggregate() : instances( 0 ) {}
+
+	Dicom::Dataset record;
+	int instances;
+	QSet< QString > modalities;
+	QSet< QString > series;
+	QSet< QString > sopClasses;
+	QSet< QString > studies;
+};
+
+
+static QString joined( const QSet< QString > & Values ) {
+	QStringList list = Values.toList();
+	list.removeAll( QString() );
+	qSort( list );
+	return list.join( "\\" );
+}
+
+
+static void put( Dicom::Dataset & record, const DcmTagKey & Tag, const QString & Value ) {
+	record.dcmDataset().putAndInsertString( Tag, Value.toAscii().constData() );
+}
+
+
+namespace Dicom {
+
+QueryScp::Index::Index() :
+	generation_( 0 ),
+	size_( 0 ),
+	source_( 0 )
+{
+}
+
+
+QueryScp::Index::~Index() {
+}
+
+
+void QueryScp::Index::build( const DataSource & Source ) {
+	clear();
+
+	QHash< QString, Aggregate > patients, studies, series;
+
+	generation_ = Source.generation();
+	size_ = Source.size();
+	source_ = &Source;
+	for ( int i = 0; i < size_; ++i ) {
+		const Dataset Dataset = Source.dataset( i );
+
+		const QString PatientId = Dataset.tagValue( DCM_PatientID );
+		const QString StudyUid = Dataset.tagValue( DCM_StudyInstanceUID );
+		const QString SeriesUid = Dataset.tagValue( DCM_SeriesInstanceUID );
+		if ( StudyUid.isEmpty() || SeriesUid.isEmpty() ) {
+			continue;
+		}
+
+		Aggregate & patient = patients[ PatientId ];
+		if ( patient.instances++ == 0 ) {
+			copy( Dataset, patient.record, PatientTags, PatientTagCount );
+		}
+		patient.series.insert( SeriesUid );
+		patient.studies.insert( StudyUid );
+
+		Aggregate & study = studies[ StudyUid ];
+		if ( study.instances++ == 0 ) {
+			copy( Dataset, study.record, PatientTags, PatientTagCount );
+			copy( Dataset, study.record, StudyTags, StudyTagCount );
+		}
+		study.modalities.insert( Dataset.tagValue( DCM_Modality ) );
+		study.series.insert( SeriesUid );
+		study.sopClasses.insert( QString( Dataset.sopClassUid() ) );
+
+		Aggregate & aSeries = series[ SeriesUid ];
+		if ( aSeries.instances++ == 0 ) {
+			copy( Dataset, aSeries.record, PatientTags, PatientTagCount );
+			copy( Dataset, aSeries.record, StudyTags, StudyTagCount );
+			copy( Dataset, aSeries.record, SeriesTags, SeriesTagCount );
+			studySeries_[ StudyUid ].append( SeriesUid );
+		}
+		seriesInstances_[ SeriesUid ].append( i );
+	}
+
+	foreach ( Aggregate patient, patients ) {
+		put( patient.record, DCM_NumberOfPatientRelatedStudies, QString::number( patient.studies.size() ) );
+		put( patient.record, DCM_NumberOfPatientRelatedSeries, QString::number( patient.series.size() ) );
+		put( patient.record, DCM_NumberOfPatientRelatedInstances, QString::number( patient.instances ) );
+		patients_.append( patient.record );
+	}
+
+	foreach ( Aggregate study, studies ) {
+		put( study.record, DCM_ModalitiesInStudy, joined( study.modalities ) );
+		put( study.record, DCM_SOPClassesInStudy, joined( study.sopClasses ) );
+		put( study.record, DCM_NumberOfStudyRelatedSeries, QString::number( study.series.size() ) );
+		put( study.record, DCM_NumberOfStudyRelatedInstances, QString::number( study.instances ) );
+		studies_.append( study.record );
+	}
+
+	foreach ( Aggregate aSeries, series ) {
+		put( aSeries.record, DCM_NumberOfSeriesRelatedInstances, QString::number( aSeries.instances ) );
+		series_.append( aSeries.record );
+	}
+}
+
+
+void QueryScp::Index::clear() {
+	patients_.clear();
+	series_.clear();
+	seriesInstances_.clear();
+	size_ = 0;
+	source_ = 0;
+	studies_.clear();
+	studySeries_.clear();
+}
+
+
+void QueryScp::Index::copy(
+	const Dataset & Source, Dataset & target,
+	const DcmTagKey * Tags, int count
+) {
+	for ( int i = 0; i < count; ++i ) {
+		DcmElement * element = 0;
+		if ( Source.dcmDataset().findAndGetElement( Tags[ i ], element ).good() ) {
+			target.dcmDataset().insert(
+				reinterpret_cast< DcmElement * >( element->clone() ), true
+			);
+		}
+	}
+}
+
+
+QList< int > QueryScp::Index::instances( const Dataset & Mask ) const {
+	QList< int > result;
+
+	const QString SeriesUids = Mask.tagValue( DCM_SeriesInstanceUID ).trimmed();
+	if ( ! SeriesUids.isEmpty() ) {
+		foreach ( const QString & Uid, SeriesUids.split( '\\' ) ) {
+			result += seriesInstances_.value( Uid.trimmed() );
+		}
+		return result;
+	}
+
+	const QString StudyUids = Mask.tagValue( DCM_StudyInstanceUID ).trimmed();
+	if ( ! StudyUids.isEmpty() ) {
+		foreach ( const QString & Uid, StudyUids.split( '\\' ) ) {
+			foreach ( const QString & Series, studySeries_.value( Uid.trimmed() ) ) {
+				result += seriesInstances_.value( Series );
+			}
+		}
+		return result;
+	}
+
+	for ( int i = 0; i < size_; ++i ) {
+		result.append( i );
+	}
+	return result;
+}
+
+
+bool QueryScp::Index::isCurrent( const DataSource & Source ) const {
+	return source_ == &Source && generation_ == Source.generation();
+}
+
+
+QueryScp::Index::Level QueryScp::Index::level( const Dataset & Mask ) {
+	const QString Value =
+		Mask.tagValue( DCM_QueryRetrieveLevel ).trimmed().toUpper()
+	;
+
+	for ( int i = Patient; i <= Image; ++i ) {
+		if ( Value == levelName( static_cast< Level >( i ) ) ) {
+			return static_cast< Level >( i );
+		}
+	}
+	return UnknownLevel;
+}
+
+
+const char * QueryScp::Index::levelName( Level level ) {
+	static const char * const Names[] = {
+		"", "PATIENT", "STUDY", "SERIES", "IMAGE"
+	};
+
+	return Names[ level ];
+}
+
+
+const QList< Dataset > & QueryScp::Index::records( Level level ) const {
+	static const QList< Dataset > None;
+
+	switch ( level ) {
+		case Patient :
+			return patients_;
+		case Study :
+			return studies_;
+		case Series :
+			return series_;
+		default :
+			return None;
+	}
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,120 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_QUERYSCP_INDEX_HPP
+#define DICOM_QUERYSCP_INDEX_HPP
+
+#include "QtDicom/Dataset.hpp"
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/QueryScp.hpp"
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+class DcmTagKey;
+
+namespace Dicom {
+
+class DataSource;
+
+/**
+ * The \em Index class keeps aggregate records of patients, studies and
+ * series of a data source.
+ *
+ * Each record carries attributes of its own level and levels above it, taken
+ * from the first instance found, along with counts computed over instances
+ * below it, such as the Number of Study Related Instances. Queries at the
+ * PATIENT, STUDY and SERIES levels are matched against those records only;
+ * IMAGE level ones are matched against instances of series selected by
+ * unique keys of the query, if it has any.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC QueryScp::Index {
+	public :
+		/**
+		 * Query/Retrieve levels.
+		 */
+		enum Level {
+			UnknownLevel = 0,
+			Patient,
+			Study,
+			Series,
+			Image
+		};
+
+	public :
+		/**
+		 * Returns the Query/Retrieve Level of the \a mask.
+		 */
+		static Level level( const Dataset & mask );
+
+		/**
+		 * Returns the value of the Query/Retrieve Level attribute of the \a
+		 * level.
+		 */
+		static const char * levelName( Level level );
+
+	public :
+		Index();
+		~Index();
+
+		/**
+		 * Builds records of all datasets of the \a source, replacing current
+		 * ones.
+		 */
+		void build( const DataSource & source );
+
+		/**
+		 * Removes all records.
+		 */
+		void clear();
+
+		/**
+		 * Returns \c true if records were built of the \a source at its
+		 * current generation.
+		 */
+		bool isCurrent( const DataSource & source ) const;
+
+		/**
+		 * Returns offsets of datasets the \a mask may match. When the \a
+		 * mask has Series or Study Instance UIDs, only instances of those are
+		 * returned, otherwise all are.
+		 */
+		QList< int > instances( const Dataset & mask ) const;
+
+		/**
+		 * Returns records of the PATIENT, STUDY or SERIES \a level.
+		 */
+		const QList< Dataset > & records( Level level ) const;
+
+	private :
+		/**
+		 * Copies attributes of the \a tags, \a count of them, present in the
+		 * \a source dataset to the \a target.
+		 */
+		static void copy(
+			const Dataset & source, Dataset & target,
+			const DcmTagKey * tags, int count
+		);
+
+	private :
+		quint64 generation_;
+		QList< Dataset > patients_;
+		QList< Dataset > series_;
+		QHash< QString, QList< int > > seriesInstances_;
+		int size_;
+		const DataSource * source_;
+		QList< Dataset > studies_;
+		QHash< QString, QStringList > studySeries_;
+
+		Q_DISABLE_COPY( Index );
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -0,0 +1,301 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "Log.hpp"
+#include "QPresentationContextTable.hpp"
+#include "QueryScpMover.hpp"
+#include "RequestorAssociation.hpp"
+#include "ServiceUser.hpp"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
+
+#include <dcmtk/dcmnet/assoc.h>
+
+
+static const int MaxPresentationContexts = 128;
+
+
+namespace Dicom {
+
+/**
+ * The \em QueryScp::Mover::Sender class stores instances of a mover over its
+ * own association, until there are none left or the association breaks.
+ */
+class QueryScp::Mover::Sender : public QThread, private ServiceUser {
+	public :
+		Sender( Mover * mover );
+
+	private :
+		/**
+		 * Reads the \a instance from its file, if it comes from one.
+		 */
+		Dataset load( const Instance & instance ) const;
+
+		void run();
+
+	private :
+		Mover * mover_;
+};
+
+
+QueryScp::Mover::Sender::Sender( Mover * mover ) :
+	QThread(),
+	ServiceUser(),
+	mover_( mover )
+{
+}
+
+
+Dataset QueryScp::Mover::Sender::load( const Instance & Instance ) const {
+	if ( Instance.path.isEmpty() ) {
+		return Instance.dataSet;
+	}
+
+	QString errorMessage;
+	Dataset dataset = Dataset::fromDicomFile( Instance.path, &errorMessage );
+	if ( dataset.isEmpty() ) {
+		dataset = Dataset::fromXmlFile( Instance.path, &errorMessage );
+	}
+	if ( dataset.isEmpty() ) {
+		QDICOM_LOG( Storage, Warning,
+			"Unable to read the instance %s from `%s'; %s",
+			Instance.sopInstanceUid.constData(),
+			qPrintable( Instance.path ),
+			qPrintable( errorMessage )
+		);
+	}
+	return dataset;
+}
+
+
+void QueryScp::Mover::Sender::run() {
+	RequestorAssociation a;
+	a.setConnectionParameters( mover_->Destination_ );
+	setAssociation( &a );
+
+	bool timedOut;
+	const int Count = a.request( mover_->contexts_, &timedOut );
+	if ( Count <= 0 ) {
+		QDICOM_LOG( Query, Warning,
+			"Unable to associate with the move destination %s; %s",
+			qPrintable( mover_->Destination_.peerAeTitle() ),
+			timedOut ? "connection timed out." :
+			Count == 0 ? "none of proposed presentation contexts were supported." :
+			qPrintable( a.errorMessage() )
+		);
+		mover_->abandon();
+		return;
+	}
+
+	setPresentationContextTable(
+		QPresentationContextTable::fromTAscAssociation( a.tAscAssociation() )
+	);
+
+	Instance instance;
+	while ( a.isEstablished() && mover_->next( instance ) ) {
+		const Dataset Dataset = load( instance );
+
+		bool stored = false;
+		if ( ! Dataset.isEmpty() ) {
+			stored = cStore(
+				Dataset, mover_->OriginatorAe_, mover_->OriginatorId_
+			);
+			if ( ! stored ) {
+				QDICOM_LOG( Query, Warning,
+					"Failed to store the instance %s on %s; %s",
+					instance.sopInstanceUid.constData(),
+					qPrintable( mover_->Destination_.peerAeTitle() ),
+					qPrintable( errorMessage() )
+				);
+			}
+		}
+		mover_->report( instance, stored );
+	}
+
+	if ( a.isEstablished() ) {
+		a.release();
+	}
+
+	mover_->abandon();
+}
+
+
+QueryScp::Mover::Mover(
+	const QList< Instance > & Instances,
+	const ConnectionParameters & Destination,
+	const QString & OriginatorAe,
+	quint16 originatorId
+) :
+	active_( 0 ),
+	cancelled_( false ),
+	completed_( 0 ),
+	Destination_( Destination ),
+	failed_( 0 ),
+	instances_( Instances ),
+	next_( 0 ),
+	OriginatorAe_( OriginatorAe ),
+	OriginatorId_( originatorId )
+{
+	contexts_ = presentationContexts();
+}
+
+
+QueryScp::Mover::~Mover() {
+	cancel();
+	wait();
+
+	qDeleteAll( senders_ );
+}
+
+
+void QueryScp::Mover::abandon() {
+	QMutexLocker locker( &lock_ );
+
+	if ( --active_ > 0 || cancelled_ ) {
+		return;
+	}
+
+	// No one is left to send the rest
+	for ( ; next_ < instances_.size(); ++next_ ) {
+		++failed_;
+		failedInstances_.append( instances_.at( next_ ).sopInstanceUid );
+	}
+}
+
+
+void QueryScp::Mover::cancel() {
+	QMutexLocker locker( &lock_ );
+
+	cancelled_ = true;
+}
+
+
+int QueryScp::Mover::completed() const {
+	QMutexLocker locker( &lock_ );
+
+	return completed_;
+}
+
+
+int QueryScp::Mover::failed() const {
+	QMutexLocker locker( &lock_ );
+
+	return failed_;
+}
+
+
+UidList QueryScp::Mover::failedInstances() const {
+	QMutexLocker locker( &lock_ );
+
+	return failedInstances_;
+}
+
+
+bool QueryScp::Mover::isFinished() const {
+	QMutexLocker locker( &lock_ );
+
+	return active_ == 0;
+}
+
+
+bool QueryScp::Mover::next( Instance & instance ) {
+	QMutexLocker locker( &lock_ );
+
+	if ( cancelled_ || next_ >= instances_.size() ) {
+		return false;
+	}
+
+	instance = instances_.at( next_ );
+
+	// Instances held in memory aren't needed once taken
+	instances_[ next_ ].dataSet = Dataset();
+	++next_;
+
+	return true;
+}
+
+
+QPresentationContextList QueryScp::Mover::presentationContexts() const {
+	QPresentationContextList contexts;
+	QSet< QByteArray > proposed;
+
+	foreach ( const Instance & Instance, instances_ ) {
+		const QByteArray Key =
+			Instance.sopClassUid + '\\' + Instance.syntax.uid()
+		;
+		if ( proposed.contains( Key ) ) {
+			continue;
+		}
+		if ( contexts.size() == MaxPresentationContexts ) {
+			QDICOM_LOG( Query, Warning,
+				"Too many kinds of instances to move; only %d presentation "
+				"contexts proposed.", MaxPresentationContexts
+			);
+			break;
+		}
+		proposed.insert( Key );
+
+		if ( Instance.syntax.isValid() ) {
+			QPresentationContext context( Instance.sopClassUid );
+			context.addTransferSyntax( Instance.syntax );
+			contexts.append( context );
+		}
+		else {
+			contexts.append(
+				QPresentationContext::defaultFor( Instance.sopClassUid )
+			);
+		}
+	}
+
+	return contexts;
+}
+
+
+int QueryScp::Mover::remaining() const {
+	QMutexLocker locker( &lock_ );
+
+	return instances_.size() - completed_ - failed_;
+}
+
+
+void QueryScp::Mover::report( const Instance & Instance, bool stored ) {
+	QMutexLocker locker( &lock_ );
+
+	if ( stored ) {
+		++completed_;
+	}
+	else {
+		++failed_;
+		failedInstances_.append( Instance.sopInstanceUid );
+	}
+}
+
+
+void QueryScp::Mover::start( int connections ) {
+	QMutexLocker locker( &lock_ );
+
+	if ( instances_.isEmpty() ) {
+		return;
+	}
+
+	const int Count = qBound( 1, connections, instances_.size() );
+	active_ = Count;
+	for ( int i = 0; i < Count; ++i ) {
+		Sender * sender = new Sender( this );
+		senders_.append( sender );
+		sender->start();
+	}
+}
+
+
+void QueryScp::Mover::wait() {
+	foreach ( Sender * sender, senders_ ) {
+		sender->wait();
+	}
+}
+
+}; // Namespace DICOM ends here.
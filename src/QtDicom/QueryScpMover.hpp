@@ -0,0 +1,158 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_QUERYSCP_MOVER_HPP
+#define DICOM_QUERYSCP_MOVER_HPP
+
+#include "QtDicom/ConnectionParameters.hpp"
+#include "QtDicom/Dataset.hpp"
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/QPresentationContext.hpp"
+#include "QtDicom/QTransferSyntax.hpp"
+#include "QtDicom/QueryScp.hpp"
+#include "QtDicom/UidList.hpp"
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+namespace Dicom {
+
+/**
+ * The \em Mover class performs C-STORE sub-operations of a single C-MOVE.
+ *
+ * Instances are sent to the destination over several associations at once;
+ * each one is served by a sender thread which takes the next instance to
+ * send, reads it from its file and stores it, so files are read in parallel
+ * as well. Only instances which don't come from files are kept in memory.
+ *
+ * Receivers poll the counters of sub-operations to report them in pending
+ * responses and \ref cancel() the rest when a C-CANCEL arrives.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC QueryScp::Mover {
+	public :
+		/**
+		 * The \em Instance structure describes an instance to be moved.
+		 */
+		struct Instance {
+			/**
+			 * The instance itself, unless it's read from the \ref path.
+			 */
+			Dataset dataSet;
+
+			QString path;
+			QByteArray sopClassUid;
+			QByteArray sopInstanceUid;
+			QTransferSyntax syntax;
+		};
+
+	public :
+		/**
+		 * Creates a mover sending \a instances to the \a destination on
+		 * behalf of the C-MOVE of the \a originatorId requested by the \a
+		 * originatorAe.
+		 */
+		Mover(
+			const QList< Instance > & instances,
+			const ConnectionParameters & destination,
+			const QString & originatorAe,
+			quint16 originatorId
+		);
+
+		/**
+		 * Cancels remaining sub-operations and waits for senders to finish.
+		 */
+		~Mover();
+
+		/**
+		 * Cancels sub-operations not started yet.
+		 */
+		void cancel();
+
+		/**
+		 * Returns the number of instances stored.
+		 */
+		int completed() const;
+
+		/**
+		 * Returns the number of instances which failed to be stored.
+		 */
+		int failed() const;
+
+		/**
+		 * Returns UIDs of instances which failed to be stored.
+		 */
+		UidList failedInstances() const;
+
+		/**
+		 * Returns \c true once all senders have finished.
+		 */
+		bool isFinished() const;
+
+		/**
+		 * Returns the number of sub-operations not finished yet.
+		 */
+		int remaining() const;
+
+		/**
+		 * Starts at most \a connections senders.
+		 */
+		void start( int connections );
+
+		/**
+		 * Waits for senders to finish; after \ref cancel() that's once they
+		 * have stored instances they've already taken.
+		 */
+		void wait();
+
+	private :
+		class Sender;
+
+		/**
+		 * Called by a sender which can't store instances any more; once no
+		 * sender is left, remaining instances fail.
+		 */
+		void abandon();
+
+		/**
+		 * Takes the next \a instance to be sent. Returns \c false when there
+		 * are none or the move was cancelled.
+		 */
+		bool next( Instance & instance );
+
+		/**
+		 * Returns presentation contexts senders propose, one for each SOP
+		 * class and transfer syntax of instances, at most 128 of them.
+		 */
+		QPresentationContextList presentationContexts() const;
+
+		/**
+		 * Counts the \a instance as \a stored or failed.
+		 */
+		void report( const Instance & instance, bool stored );
+
+	private :
+		int active_;
+		bool cancelled_;
+		int completed_;
+		QPresentationContextList contexts_;
+		const ConnectionParameters Destination_;
+		int failed_;
+		UidList failedInstances_;
+		QList< Instance > instances_;
+		mutable QMutex lock_;
+		int next_;
+		const QString OriginatorAe_;
+		const quint16 OriginatorId_;
+		QList< Sender * > senders_;
+
+		Q_DISABLE_COPY( Mover );
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -4,9 +4,11 @@
  **************************************************************************/
 
 #include "AcceptorAssociation.hpp"
+#include "Log.hpp"
 #include "QueryScpReceiverThread.hpp"
 #include "QueryScpReceiverThread.moc.inl"
 
+#include <dcmtk/dcmdata/dcdeftag.h>
 #include <dcmtk/dcmnet/dimse.h>
 
 
@@ -17,6 +19,13 @@ QueryScp::ReceiverThread::ReceiverThread(
 ) :
 	QThread( parent ),
 	ServiceProvider( association ),
+	moveConnections_( 4 ),
+	moveResolved_( false ),
+	move_( 0 ),
+	mover_( 0 ),
+	query_( 0 ),
+	reported_( 0 ),
+	responseLatency_( 20 ),
 	state_( Idle ),
 	status_( 0 )
 {
@@ -24,6 +33,7 @@ QueryScp::ReceiverThread::ReceiverThread(
 
 
 QueryScp::ReceiverThread::~ReceiverThread() {
+	delete mover_;
 	delete association();
 }
 
@@ -35,6 +45,99 @@ AcceptorAssociation * QueryScp::ReceiverThread::association() {
 }
 
 
+void QueryScp::ReceiverThread::cancelMove(
+	const T_DIMSE_C_MoveRQ & Request, unsigned char ID
+) {
+	dataLock().lock();
+	moveInstances_.clear();
+	moveResolved_ = false;
+	dataLock().unlock();
+
+	if ( mover_ ) {
+		mover_->cancel();
+		mover_->wait();
+	}
+
+	sendMoveResponse(
+		Request, ID,
+		STATUS_MOVE_Cancel_SubOperationsTerminatedDueToCancelIndication
+	);
+
+	delete mover_;
+	mover_ = 0;
+	setState( ReceivingCommands );
+}
+
+
+void QueryScp::ReceiverThread::continueMove(
+	const T_DIMSE_C_MoveRQ & Request, unsigned char ID
+) {
+	if ( ! mover_ ) {
+		dataLock().lock();
+		const bool Resolved = moveResolved_;
+		const QList< Mover::Instance > Instances = moveInstances_;
+		moveInstances_.clear();
+		moveResolved_ = false;
+		dataLock().unlock();
+
+		// Instances are resolved by the SCP, which may be gone or busy
+		if ( ! Resolved ) {
+			const qint64 Timeout =
+				qint64( association()->connectionParameters().timeout() ) * 1000
+			;
+			if ( progressTimer_.elapsed() >= Timeout ) {
+				QDICOM_LOG( Query, Warning,
+					"Instances to move weren't resolved within %lld ms.", Timeout
+				);
+				sendMoveResponse(
+					Request, ID, STATUS_MOVE_Failed_UnableToProcess
+				);
+				setState( ReceivingCommands );
+			}
+			return;
+		}
+
+		QDICOM_LOG( Query, Info,
+			"Moving %d instances to %s.",
+			Instances.size(), qPrintable( moveDestination_.peerAeTitle() )
+		);
+
+		mover_ = new Mover(
+			Instances, moveDestination_,
+			association()->callingAeTitle(), Request.MessageID
+		);
+		mover_->start( moveConnections_ );
+		reported_ = 0;
+		progressTimer_.start();
+	}
+
+	if ( mover_->isFinished() ) {
+		int status = STATUS_Success;
+		if ( mover_->failed() > 0 ) {
+			status = mover_->completed() > 0 ?
+				STATUS_MOVE_Warning_SubOperationsCompleteOneOrMoreFailures :
+				STATUS_MOVE_Refused_OutOfResourcesSubOperations
+			;
+		}
+		sendMoveResponse( Request, ID, status );
+
+		delete mover_;
+		mover_ = 0;
+		setState( ReceivingCommands );
+		return;
+	}
+
+	// Pending responses are sent at most once a second, so that large
+	// moves don't flood the peer with them
+	const int Done = mover_->completed() + mover_->failed();
+	if ( Done != reported_ && progressTimer_.elapsed() >= 1000 ) {
+		sendMoveResponse( Request, ID, STATUS_Pending );
+		reported_ = Done;
+		progressTimer_.restart();
+	}
+}
+
+
 QMutex & QueryScp::ReceiverThread::dataLock() const {
 	return dataLock_;
 }
@@ -49,11 +152,14 @@ bool QueryScp::ReceiverThread::hasQueuedIdentifiers() const {
 }
 
 
-void QueryScp::ReceiverThread::finish( int status ) {
+void QueryScp::ReceiverThread::finish( int query, int status ) {
 	dataLock().lock();
-	status_ = status;
+	if ( state_ == QueryInProgress && query_ == query ) {
+		status_ = status;
+		state_ = QueryFinishing;
+		queryFinishing_.wakeAll();
+	}
 	dataLock().unlock();
-	setState( QueryFinishing );
 }
 
 
@@ -62,11 +168,30 @@ bool QueryScp::ReceiverThread::finished() const {
 }
 
 
+bool QueryScp::ReceiverThread::moving() const {
+	return state() == MoveInProgress;
+}
+
+
+QString QueryScp::ReceiverThread::peer() const {
+	return peerAeTitle();
+}
+
+
 bool QueryScp::ReceiverThread::queryFinishing() const {
 	return state() == QueryFinishing;
 }
 
 
+bool QueryScp::ReceiverThread::queryInProgress( int query ) const {
+	dataLock().lock();
+	const bool Result = state_ == QueryInProgress && query_ == query;
+	dataLock().unlock();
+
+	return Result;
+}
+
+
 QQueue< Dataset > & QueryScp::ReceiverThread::queue() {
 	Q_ASSERT( ! dataLock().tryLock() ); // We can only access this member if
 	                                    // the mutex was locked already.
@@ -83,9 +208,11 @@ const QQueue< Dataset > & QueryScp::ReceiverThread::queue() const {
 }
 
 
-void QueryScp::ReceiverThread::queueIdentifier( Dataset identifier ) {
+void QueryScp::ReceiverThread::queueIdentifier( int query, Dataset identifier ) {
 	dataLock().lock();
-	queue().enqueue( identifier );
+	if ( state_ == QueryInProgress && query_ == query ) {
+		queue().enqueue( identifier );
+	}
 	dataLock().unlock();
 }
 
@@ -103,11 +230,18 @@ void QueryScp::ReceiverThread::run() {
 		return;
 	}
 
+	setPresentationContextTable(
+		QPresentationContextTable::fromTAscAssociation(
+			association()->tAscAssociation()
+		)
+	);
+
 	try {
 
 	bool released, timedOut;
 	unsigned char presentationContextId = 0;
 	T_DIMSE_C_FindRQ request;
+	T_DIMSE_C_MoveRQ moveRequest;
 
 	setState( ReceivingCommands );
 
@@ -137,8 +271,44 @@ void QueryScp::ReceiverThread::run() {
 					Message.msg.CFindRQ, presentationContextId
 				);
 				request = Message.msg.CFindRQ;
-				setState( QueryInProgress );
-				emit newQuery( Mask, this );
+				// Matching of a cancelled query may still be running; the
+				// number keeps its results out of this one
+				dataLock().lock();
+				sopClass_ = request.AffectedSOPClassUID;
+				const int Query = ++query_;
+				state_ = QueryInProgress;
+				dataLock().unlock();
+				emit newQuery( Mask, Query, this );
+			}
+			else if ( Message.CommandField == DIMSE_C_MOVE_RQ ) {
+				moveRequest = Message.msg.CMoveRQ;
+				const Dataset Identifier = receiveDataset( presentationContextId );
+				const QString Destination =
+					QString( moveRequest.MoveDestination ).trimmed()
+				;
+
+				if ( moveDestinations_.contains( Destination ) ) {
+					moveDestination_ = moveDestinations_.value( Destination );
+
+					// Instances resolved for an earlier C-MOVE, which timed
+					// out, are told apart by its number
+					dataLock().lock();
+					const int Move = ++move_;
+					state_ = MoveInProgress;
+					dataLock().unlock();
+
+					progressTimer_.start();
+					emit newMove( Identifier, Move, this );
+				}
+				else {
+					QDICOM_LOG( Query, Warning,
+						"Unknown move destination: %s.", qPrintable( Destination )
+					);
+					sendMoveResponse(
+						moveRequest, presentationContextId,
+						STATUS_MOVE_Failed_MoveDestinationUnknown
+					);
+				}
 			}
 			else if ( Message.CommandField == DIMSE_C_ECHO_RQ ) {
 				handleCEcho( Message.msg.CEchoRQ, presentationContextId );
@@ -151,29 +321,54 @@ void QueryScp::ReceiverThread::run() {
 			}
 		}
 		// No cancel request.
+		else if ( timedOut && moving() ) {
+			continueMove( moveRequest, presentationContextId );
+			msleep( 100 );
+		}
 		else if ( timedOut ) {
+			// Identifiers are taken at once, so the final status is never
+			// sent ahead of those queued before the query finished
 			dataLock().lock();
-			while ( ! queue().isEmpty() ) {				
-				sendIdentifier( 
-					request, presentationContextId, queue().dequeue()
-				);
+			const bool Finishing = state_ == QueryFinishing;
+			QList< Dataset > identifiers;
+			identifiers.reserve( queue().size() );
+			while ( ! queue().isEmpty() ) {
+				identifiers.append( queue().dequeue() );
 			}
 			dataLock().unlock();
 
-			if ( queryFinishing() ) {
+			sendIdentifiers( request, presentationContextId, identifiers );
+
+			if ( Finishing ) {
 				sendStatus( request, presentationContextId, status() );
 				setState( ReceivingCommands );
 			}
-
-			msleep( 100 );
+			else {
+				// Identifiers are batched for up to the latency, the final
+				// ones are sent as soon as the query finishes
+				dataLock().lock();
+				if ( state_ == QueryInProgress ) {
+					queryFinishing_.wait( &dataLock_, responseLatency_ );
+				}
+				dataLock().unlock();
+			}
 		}
 		else {
-			if ( Message.CommandField == DIMSE_C_CANCEL_RQ ) {
+			if ( Message.CommandField == DIMSE_C_CANCEL_RQ && moving() ) {
+				cancelMove( moveRequest, presentationContextId );
+			}
+			else if ( Message.CommandField == DIMSE_C_CANCEL_RQ ) {
+				// Matching stops once it sees the query is no longer in
+				// progress; identifiers queued meanwhile are dropped
+				setState( ReceivingCommands );
+				dataLock().lock();
+				queue().clear();
+				dataLock().unlock();
+
 				sendStatus( 
 					request, presentationContextId,
 					STATUS_FIND_Cancel_MatchingTerminatedDueToCancelRequest
 				);
-				setState( ReceivingCommands );
 			}
 		}
 	}
@@ -192,6 +387,81 @@ void QueryScp::ReceiverThread::run() {
 }
 
 
+void QueryScp::ReceiverThread::sendMoveResponse(
+	const T_DIMSE_C_MoveRQ & Request, unsigned char ID, int status
+) {
+	T_DIMSE_Message response;
+	bzero( ( char * )&response, sizeof( response ) );
+	response.CommandField = DIMSE_C_MOVE_RSP;
+
+	T_DIMSE_C_MoveRSP & params = response.msg.CMoveRSP;
+	strcpy( params.AffectedSOPClassUID, Request.AffectedSOPClassUID );
+	params.DataSetType = DIMSE_DATASET_NULL;
+	params.DimseStatus = status;
+	params.MessageIDBeingRespondedTo = Request.MessageID;
+	params.opts |= O_MOVE_AFFECTEDSOPCLASSUID;
+
+	if ( ! mover_ ) {
+		sendCommand( response, ID );
+		return;
+	}
+
+	params.NumberOfCompletedSubOperations = mover_->completed();
+	params.NumberOfFailedSubOperations = mover_->failed();
+	params.NumberOfWarningSubOperations = 0;
+	params.opts |=
+		O_MOVE_NUMBEROFCOMPLETEDSUBOPERATIONS |
+		O_MOVE_NUMBEROFFAILEDSUBOPERATIONS |
+		O_MOVE_NUMBEROFWARNINGSUBOPERATIONS
+	;
+	if ( status == STATUS_Pending || mover_->remaining() > 0 ) {
+		params.NumberOfRemainingSubOperations = mover_->remaining();
+		params.opts |= O_MOVE_NUMBEROFREMAININGSUBOPERATIONS;
+	}
+
+	const UidList Failed = status == STATUS_Pending ?
+		UidList() : mover_->failedInstances()
+	;
+	if ( Failed.isEmpty() ) {
+		sendCommand( response, ID );
+		return;
+	}
+
+	QByteArray list;
+	foreach ( const QByteArray & Uid, Failed ) {
+		if ( ! list.isEmpty() ) {
+			list.append( '\\' );
+		}
+		list.append( Uid );
+	}
+
+	const Dataset Identifier;
+	Identifier.dcmDataset().putAndInsertString(
+		DCM_FailedSOPInstanceUIDList, list.constData()
+	);
+	params.DataSetType = DIMSE_DATASET_PRESENT;
+
+	sendCommand( response, Identifier, ID );
+}
+
+
+void QueryScp::ReceiverThread::setMoveConnections( int count ) {
+	moveConnections_ = count;
+}
+
+
+void QueryScp::ReceiverThread::setMoveDestinations(
+	const QHash< QString, ConnectionParameters > & Destinations
+) {
+	moveDestinations_ = Destinations;
+}
+
+
+void QueryScp::ReceiverThread::setResponseLatency( int msecs ) {
+	responseLatency_ = msecs;
+}
+
+
 void QueryScp::ReceiverThread::setState( State state ) {
 	dataLock().lock();
 	state_ = state;
@@ -199,21 +469,17 @@ void QueryScp::ReceiverThread::setState( State state ) {
 }
 
 
-void QueryScp::ReceiverThread::sendIdentifier(
-	const T_DIMSE_C_FindRQ & Request, unsigned char ID, const Dataset & Identifier
+void QueryScp::ReceiverThread::sendIdentifiers(
+	const T_DIMSE_C_FindRQ & Request,
+	unsigned char ID,
+	const QList< Dataset > & Identifiers
 ) {
-	T_DIMSE_Message response;
-	bzero( ( char * )&response, sizeof( response ) );
-	response.CommandField = DIMSE_C_FIND_RSP;
+	// Bounds the memory responses are encoded into before being written
+	static const int BatchSize = 256;
 
-	T_DIMSE_C_FindRSP & params = response.msg.CFindRSP;	
-	strcpy( params.AffectedSOPClassUID, Request.AffectedSOPClassUID );
-	params.DataSetType = DIMSE_DATASET_PRESENT;
-	params.DimseStatus = STATUS_Pending;
-	params.MessageIDBeingRespondedTo = Request.MessageID;
-	params.opts |= O_FIND_AFFECTEDSOPCLASSUID;
-
-	sendCommand( response, Identifier, ID );
+	for ( int i = 0; i < Identifiers.size(); i += BatchSize ) {
+		sendCFindResponses( Request, ID, Identifiers.mid( i, BatchSize ) );
+	}
 }
 
 
@@ -235,6 +501,27 @@ void QueryScp::ReceiverThread::sendStatus(
 }
 
 
+QByteArray QueryScp::ReceiverThread::sopClass() const {
+	dataLock().lock();
+	const QByteArray Result = sopClass_;
+	dataLock().unlock();
+
+	return Result;
+}
+
+
+void QueryScp::ReceiverThread::startMove(
+	int move, const QList< Mover::Instance > & Instances
+) {
+	dataLock().lock();
+	if ( state_ == MoveInProgress && move_ == move ) {
+		moveInstances_ = Instances;
+		moveResolved_ = true;
+	}
+	dataLock().unlock();
+}
+
+
 int QueryScp::ReceiverThread::status() const {
 	dataLock().lock();
 	const int Result = status_;
@@ -6,15 +6,22 @@
 #ifndef DICOM_QUERYSCP_RECEIVERTHREAD_HPP
 #define DICOM_QUERYSCP_RECEIVERTHREAD_HPP
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
 #include <QtCore/QMutex>
 #include <QtCore/QThread>
 #include <QtCore/QQueue>
+#include <QtCore/QWaitCondition>
 
+#include "QtDicom/ConnectionParameters.hpp"
 #include "QtDicom/Dataset.hpp"
 #include "QtDicom/Globals.hpp"
 #include "QtDicom/QueryScp.hpp"
+#include "QtDicom/QueryScpMover.hpp"
 #include "QtDicom/ServiceProvider.hpp"
 
+class QtDicomTest;
+
 namespace Dicom {
 
 class AcceptorAssociation;
@@ -22,18 +29,73 @@ class AcceptorAssociation;
 class QDICOM_DLLSPEC QueryScp::ReceiverThread : public QThread, private ServiceProvider {
 	Q_OBJECT;
 
+	friend class ::QtDicomTest;
+
 	public :
 		ReceiverThread( AcceptorAssociation * association, QObject * parent = 0 );
 		~ReceiverThread();
 
 		bool finished() const;
 		bool queryFinishing() const;
+
+		/**
+		 * Returns \c true while the \a query is being matched; once it's
+		 * cancelled by the peer or another query follows, matching should
+		 * stop.
+		 */
+		bool queryInProgress( int query ) const;
 		bool hasQueuedIdentifiers() const;
+
+		/**
+		 * Returns the AE title of the peer.
+		 */
+		QString peer() const;
 		bool receivingCommands() const;
 
+		/**
+		 * Sets the maximum number of associations instances of a C-MOVE are
+		 * stored over to \a count. Has to be called before the thread starts.
+		 */
+		void setMoveConnections( int count );
+
+		/**
+		 * Sets AEs instances may be moved to, by their titles. Has to be
+		 * called before the thread starts.
+		 */
+		void setMoveDestinations(
+			const QHash< QString, ConnectionParameters > & destinations
+		);
+
+		/**
+		 * Sets the maximum time, in milliseconds, identifiers queued wait to
+		 * be sent to \a msecs. Has to be called before the thread starts.
+		 */
+		void setResponseLatency( int msecs );
+
+		/**
+		 * Returns the SOP class of the query in progress.
+		 */
+		QByteArray sopClass() const;
+
+		/**
+		 * Starts storing the \a instances matching the identifier of the
+		 * C-MOVE numbered \a move on its destination. Does nothing unless
+		 * that C-MOVE is still in progress.
+		 */
+		void startMove( int move, const QList< Mover::Instance > & instances );
+
 	public slots :
-		void finish( int status = 0 );
-		void queueIdentifier( Dataset dataset );
+		/**
+		 * Finishes the \a query with the \a status. Does nothing unless
+		 * it's still in progress.
+		 */
+		void finish( int query, int status = 0 );
+
+		/**
+		 * Queues an identifier of the \a query to be sent. Does nothing
+		 * unless it's still in progress.
+		 */
+		void queueIdentifier( int query, Dataset dataset );
 
 	private :
 		enum State {
@@ -41,21 +103,51 @@ class QDICOM_DLLSPEC QueryScp::ReceiverThread : public QThread, private ServiceP
 			ReceivingCommands,
 			QueryInProgress,
 			QueryFinishing,
+			MoveInProgress,
 			Finished
 		};
 
 	private :
 		AcceptorAssociation * association();
+		/**
+		 * Cancels sub-operations of the C-MOVE \a request and responds once
+		 * those in progress are done.
+		 */
+		void cancelMove( const T_DIMSE_C_MoveRQ & request, unsigned char ID );
+
+		/**
+		 * Starts the mover once instances are resolved, reports its progress
+		 * and sends the final response to the C-MOVE \a request when it's
+		 * done. Fails the C-MOVE if instances aren't resolved within the
+		 * association's timeout.
+		 */
+		void continueMove( const T_DIMSE_C_MoveRQ & request, unsigned char ID );
+
 		QMutex & dataLock() const;
+		bool moving() const;
 		QQueue< Dataset > & queue();
 		const QQueue< Dataset > & queue() const;
 		void run();
 		void sendCancelConfirmation( 
 			const T_DIMSE_C_FindRQ & request, unsigned char ID
 		);
-		void sendIdentifier(
-			const T_DIMSE_C_FindRQ & request, unsigned char ID, 
-			const Dataset & dataset
+
+		/**
+		 * Sends a C-MOVE response with the \a status and numbers of
+		 * sub-operations of the \ref mover_, if there is one. The final
+		 * response lists instances which failed to be stored.
+		 */
+		void sendMoveResponse(
+			const T_DIMSE_C_MoveRQ & request, unsigned char ID, int status
+		);
+
+		/**
+		 * Sends pending responses to the C-FIND \a request with the \a
+		 * identifiers, as many of them in each write as fit in a batch.
+		 */
+		void sendIdentifiers(
+			const T_DIMSE_C_FindRQ & request, unsigned char ID,
+			const QList< Dataset > & identifiers
 		);
 		void sendStatus( 
 			const T_DIMSE_C_FindRQ & request, unsigned char ID, int status
@@ -66,13 +158,35 @@ class QDICOM_DLLSPEC QueryScp::ReceiverThread : public QThread, private ServiceP
 
 	private :
 		mutable QMutex dataLock_;
+		int moveConnections_;
+		ConnectionParameters moveDestination_;
+		QHash< QString, ConnectionParameters > moveDestinations_;
+		QList< Mover::Instance > moveInstances_;
+		bool moveResolved_;
+		int move_;
+		Mover * mover_;
+		QElapsedTimer progressTimer_;
+		int query_;
 		QQueue< Dataset > queue_;
+		QWaitCondition queryFinishing_;
+		int reported_;
+		int responseLatency_;
+		QByteArray sopClass_;
 		State state_;
 		int status_;
 
 	signals :
 		void failedToQuery( QString message, ReceiverThread * );
-		void newQuery( Dataset dataset, ReceiverThread * );
+		/**
+		 * Signal emitted for each C-MOVE with its \a identifier and the \a
+		 * move number telling it apart from others of the association.
+		 */
+		void newMove( Dataset identifier, int move, ReceiverThread * );
+		/**
+		 * Signal emitted for each C-FIND with its \a dataset and the \a
+		 * query number telling it apart from others of the association.
+		 */
+		void newQuery( Dataset dataset, int query, ReceiverThread * );
 };
 
 }; // Namespace DICOM ends here.
@@ -28,7 +28,29 @@ QList< Dataset > QueryScu::query(
 	const char * AbstractSyntax,
 	const Dataset & Dataset
 ) {
-	QList< Dicom::Dataset > result;
+	struct Collector : public FindHandler {
+		bool handle( const Dicom::Dataset & Identifier ) {
+			identifiers.append( Identifier );
+			return true;
+		}
+
+		QList< Dicom::Dataset > identifiers;
+	} collector;
+
+	query( Parameters, AbstractSyntax, Dataset, collector );
+
+	return collector.identifiers;
+}
+
+
+int QueryScu::query(
+	const ConnectionParameters & Parameters,
+	const char * AbstractSyntax,
+	const Dataset & Dataset,
+	FindHandler & handler,
+	int maxResults, int deadline
+) {
+	int result = -1;
 
 	const UidList AbstractSyntaxes = 
 		UidList( AbstractSyntax )
@@ -40,8 +62,10 @@ QList< Dataset > QueryScu::query(
 	bool timedOut;
 	const int Count = a.request( Parameters, AbstractSyntaxes, &timedOut );
 	if ( Count > 0 ) {
-		result = cFind( Dataset, AbstractSyntax );
-		a.release();
+		result = cFind( Dataset, AbstractSyntax, handler, maxResults, deadline );
+		if ( a.isEstablished() ) {
+			a.release();
+		}
 	}
 	else if ( timedOut ) {
 		raiseError( "Connection timed out." );
@@ -28,6 +28,24 @@ class QDICOM_DLLSPEC QueryScu : public ServiceUser {
 			const char * abstractSyntax,
 			const Dataset & dataset
 		);
+
+		/**
+		 * Queries a DICOM AE using the parameters, passing identifiers to the
+		 * \a handler as they arrive. The query is cancelled after \a
+		 * maxResults identifiers or \a deadline milliseconds, unless zero.
+		 *
+		 * Returns the number of identifiers handled or \c -1 in case of an
+		 * error.
+		 *
+		 * \sa ServiceUser::cFind()
+		 */
+		int query(
+			const ConnectionParameters & parameters,
+			const char * abstractSyntax,
+			const Dataset & dataset,
+			FindHandler & handler,
+			int maxResults = 0, int deadline = 0
+		);
 };
 
 }; // Namespace DICOM ends here.
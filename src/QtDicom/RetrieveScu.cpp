@@ -0,0 +1,332 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "RetrieveScu.hpp"
+#include "RetrieveScu.moc.inl"
+
+#include "ConnectionParameters.hpp"
+#include "Dataset.hpp"
+#include "Log.hpp"
+#include "RequestorAssociation.hpp"
+#include "StorageScp.hpp"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEventLoop>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include <dcmtk/dcmnet/assoc.h>
+#include <dcmtk/dcmnet/dimse.h>
+
+
+namespace Dicom {
+
+/**
+ * The \em RetrieveScu::Retrieval class performs a retrieval in the background
+ * while the thread the receiver lives in processes its events.
+ */
+class RetrieveScu::Retrieval : public QThread {
+	public :
+		Retrieval(
+			RetrieveScu & scu,
+			const ConnectionParameters & Parameters,
+			const char * AbstractSyntax,
+			const Dataset & Data,
+			UidList * failedSopInstances
+		) :
+			abstractSyntax_( AbstractSyntax ),
+			dataset_( Data ),
+			failedSopInstances_( failedSopInstances ),
+			parameters_( Parameters ),
+			result_( -1 ),
+			scu_( scu )
+		{
+		}
+
+		int result() const {
+			return result_;
+		}
+
+	private :
+		void run() {
+			result_ = scu_.performRetrieval(
+				parameters_, abstractSyntax_, dataset_, failedSopInstances_
+			);
+		}
+
+	private :
+		const char * abstractSyntax_;
+		const Dataset & dataset_;
+		UidList * failedSopInstances_;
+		const ConnectionParameters & parameters_;
+		int result_;
+		RetrieveScu & scu_;
+};
+
+
+RetrieveScu::RetrieveScu( QObject * parent ) :
+	QObject( parent ),
+	MoveScu(),
+	messageId_( -1 ),
+	ownsReceiver_( false ),
+	received_( 0 ),
+	receiver_( 0 )
+{
+}
+
+
+RetrieveScu::~RetrieveScu() {
+	stopReceiver();
+}
+
+
+void RetrieveScu::cMoveProgressed(
+	int remaining, int completed, int failed, int warned
+) {
+	emit progress( remaining, completed, failed, warned );
+}
+
+
+void RetrieveScu::collect(
+	QString sopInstanceUid,
+	QString path,
+	QString moveOriginatorAe,
+	int moveOriginatorId,
+	int status
+) {
+	QMutexLocker locker( &lock_ );
+
+	if (
+		moveOriginatorId < 0 || moveOriginatorId != messageId_ ||
+		moveOriginatorAe != moveOriginatorAe_
+	) {
+		return;
+	}
+
+	if ( status == STATUS_Success || ( status & 0xf000 ) == 0xb000 ) {
+		++received_;
+		arrived_.wakeAll();
+	}
+	locker.unlock();
+
+	emit retrieved( sopInstanceUid, path, status );
+}
+
+
+quint16 RetrieveScu::nextMessageId() {
+	static QAtomicInt id( 0 );
+
+	// Zero isn't a valid ID
+	quint16 result;
+	do {
+		result = static_cast< quint16 >( id.fetchAndAddRelaxed( 1 ) + 1 );
+	} while ( result == 0 );
+	return result;
+}
+
+
+StorageScp * RetrieveScu::receiver() const {
+	return receiver_;
+}
+
+
+int RetrieveScu::retrieve(
+	const ConnectionParameters & Parameters,
+	const char * AbstractSyntax,
+	const Dataset & Dataset,
+	UidList * failedSopInstances
+) {
+	clearErrorStatus();
+
+	if ( failedSopInstances ) {
+		failedSopInstances->clear();
+	}
+
+	if ( ! receiver_ ) {
+		raiseError( "No receiver to retrieve instances into." );
+		return -1;
+	}
+
+	{
+		QMutexLocker locker( &lock_ );
+
+		messageId_ = -1;
+		moveOriginatorAe_ = Parameters.myAeTitle();
+		received_ = 0;
+	}
+
+	connect(
+		receiver_,
+		SIGNAL( instanceReceived( QString, QString, QString, int, int ) ),
+		SLOT( collect( QString, QString, QString, int, int ) ),
+		Qt::DirectConnection
+	);
+
+	int result = -1;
+
+	// Blocking the receiver's thread would keep sub-associations from being
+	// accepted
+	if ( receiver_->thread() == QThread::currentThread() ) {
+		Retrieval retrieval(
+			*this, Parameters, AbstractSyntax, Dataset, failedSopInstances
+		);
+		QEventLoop loop;
+		connect(
+			&retrieval, SIGNAL( finished() ), &loop, SLOT( quit() ),
+			Qt::QueuedConnection
+		);
+		retrieval.start();
+		loop.exec();
+		retrieval.wait();
+
+		result = retrieval.result();
+	}
+	else {
+		result = performRetrieval(
+			Parameters, AbstractSyntax, Dataset, failedSopInstances
+		);
+	}
+
+	disconnect(
+		receiver_,
+		SIGNAL( instanceReceived( QString, QString, QString, int, int ) ),
+		this,
+		SLOT( collect( QString, QString, QString, int, int ) )
+	);
+
+	QMutexLocker locker( &lock_ );
+	messageId_ = -1;
+
+	return result;
+}
+
+
+int RetrieveScu::performRetrieval(
+	const ConnectionParameters & Parameters,
+	const char * AbstractSyntax,
+	const Dataset & Dataset,
+	UidList * failedSopInstances
+) {
+	int result = -1;
+
+	RequestorAssociation a;
+	setAssociation( &a );
+
+	bool timedOut;
+	const int Count = a.request(
+		Parameters, UidList( AbstractSyntax ), &timedOut
+	);
+	if ( Count > 0 ) {
+		a.tAscAssociation()->nextMsgID = nextMessageId();
+
+		int failed = 0, warned = 0;
+		result = cMove(
+			Dataset, AbstractSyntax, Parameters.myAeTitle(),
+			&failed, failedSopInstances, &warned
+		);
+		if ( a.isEstablished() ) {
+			a.release();
+		}
+
+		// The final response may overtake the last instances, which are
+		// reported only after the receiver has responded to them
+		if ( result >= 0 && ! hasError() ) {
+			const int Expected = result + warned;
+			const int Timeout = Parameters.timeout() * 1000;
+
+			QElapsedTimer timer;
+			timer.start();
+
+			QMutexLocker locker( &lock_ );
+			while ( received_ < Expected && timer.elapsed() < Timeout ) {
+				arrived_.wait(
+					&lock_, static_cast< unsigned long >( Timeout - timer.elapsed() )
+				);
+			}
+			if ( received_ < Expected ) {
+				QDICOM_LOG( Storage, Warning,
+					"%d of %d instances retrieved from %s have been received.",
+					received_, Expected, qPrintable( Parameters.peerAeTitle() )
+				);
+			}
+		}
+	}
+	else if ( timedOut ) {
+		raiseError( "Connection timed out." );
+	}
+	else if ( Count == 0 ) {
+		raiseError( "None of proposed presentation contexts were supported." );
+	}
+	else {
+		raiseError( association()->errorMessage() );
+	}
+
+	return result;
+}
+
+
+void RetrieveScu::sendingCMove( quint16 messageId ) {
+	QMutexLocker locker( &lock_ );
+
+	messageId_ = messageId;
+}
+
+
+void RetrieveScu::setReceiver( StorageScp * receiver ) {
+	if ( receiver != receiver_ ) {
+		stopReceiver();
+		receiver_ = receiver;
+	}
+}
+
+
+bool RetrieveScu::startReceiver(
+	const ConnectionParameters & Parameters, const QString & StorageRoot
+) {
+	StorageScp * receiver = new StorageScp( StorageScp::Disk, this );
+	receiver->setStorageRoot( StorageRoot );
+	return startReceiver( receiver, Parameters );
+}
+
+
+bool RetrieveScu::startReceiver(
+	const ConnectionParameters & Parameters, DatasetConsumer * consumer
+) {
+	StorageScp * receiver = new StorageScp( StorageScp::Memory, this );
+	receiver->setDatasetConsumer( consumer );
+	return startReceiver( receiver, Parameters );
+}
+
+
+bool RetrieveScu::startReceiver(
+	StorageScp * receiver, const ConnectionParameters & Parameters
+) {
+	stopReceiver();
+
+	clearErrorStatus();
+
+	if ( ! receiver->start( Parameters ) ) {
+		raiseError( receiver->errorString() );
+		delete receiver;
+		return false;
+	}
+
+	receiver_ = receiver;
+	ownsReceiver_ = true;
+	return true;
+}
+
+
+void RetrieveScu::stopReceiver() {
+	if ( ownsReceiver_ ) {
+		receiver_->stop();
+		delete receiver_;
+		ownsReceiver_ = false;
+	}
+	receiver_ = 0;
+}
+
+}; // Namespace DICOM ends here.
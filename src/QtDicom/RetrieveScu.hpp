@@ -0,0 +1,200 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_RETRIEVESCU_HPP
+#define DICOM_RETRIEVESCU_HPP
+
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/MoveScu.hpp"
+
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QWaitCondition>
+
+namespace Dicom {
+
+class ConnectionParameters;
+class Dataset;
+class DatasetConsumer;
+class StorageScp;
+
+/**
+ * The \em RetrieveScu class retrieves instances with C-MOVE into a Storage
+ * SCP running in the same process.
+ *
+ * The SCU issues the C-MOVE with its own AE title as the destination, so the
+ * peer has to know that title by the address of the \ref receiver(). The
+ * receiver is either started by the SCU with \ref startReceiver(), storing
+ * instances to a directory or passing them to a \ref DatasetConsumer, or an
+ * already running \ref StorageScp set with \ref setReceiver(); then it may be
+ * shared by many SCUs retrieving at the same time.
+ *
+ * Instances received are told apart by their Move Originator Message ID and
+ * AE title and each one is reported with the \ref retrieved() signal, while
+ * pending C-MOVE responses are reported with \ref progress(). Peers which
+ * don't send the originator in their C-STORE requests still store instances
+ * in the receiver, but those aren't reported.
+ *
+ * The receiver accepts sub-associations through events of the thread it
+ * lives in, like the one calling \ref startReceiver(). When that's the
+ * thread calling \ref retrieve(), the C-MOVE is performed in a background
+ * thread while events of the calling one are processed, so signals of the
+ * SCU and other objects of that thread are delivered meanwhile.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC RetrieveScu : public QObject, public MoveScu {
+	Q_OBJECT;
+
+	public :
+		/**
+		 * Creates an SCU and sets its \a parent.
+		 */
+		RetrieveScu( QObject * parent = 0 );
+
+		/**
+		 * Stops the receiver started by the SCU.
+		 */
+		~RetrieveScu();
+
+		/**
+		 * Returns the Storage SCP instances are retrieved into, \c 0 when
+		 * there's none.
+		 */
+		StorageScp * receiver() const;
+
+		/**
+		 * Retrieves instances matching the \a dataset from the AE described
+		 * by the \a parameters using the \a abstractSyntax of a C-MOVE
+		 * information model. Blocks until all sub-operations are done; see
+		 * the class description for events processed meanwhile.
+		 *
+		 * Returns the number of completed sub-operations or \c -1 in case of
+		 * an error; the \ref hasError() returns \c true then. UIDs of
+		 * instances which failed to be sent are stored in \a
+		 * failedSopInstances.
+		 */
+		int retrieve(
+			const ConnectionParameters & parameters,
+			const char * abstractSyntax,
+			const Dataset & dataset,
+			UidList * failedSopInstances = 0
+		);
+
+		/**
+		 * Sets the Storage SCP to retrieve instances into. The \a receiver
+		 * isn't owned by the SCU and has to be started; setting one stops the
+		 * receiver started by the SCU, if any.
+		 */
+		void setReceiver( StorageScp * receiver );
+
+		/**
+		 * Starts a receiver, described by the \a parameters, storing
+		 * instances in files under the \a storageRoot. Returns \c false in
+		 * case of an error.
+		 */
+		bool startReceiver(
+			const ConnectionParameters & parameters,
+			const QString & storageRoot
+		);
+
+		/**
+		 * Starts a receiver, described by the \a parameters, passing
+		 * instances received to the \a consumer, which isn't owned by the
+		 * SCU. Returns \c false in case of an error.
+		 */
+		bool startReceiver(
+			const ConnectionParameters & parameters,
+			DatasetConsumer * consumer
+		);
+
+		/**
+		 * Stops the receiver started by the SCU.
+		 */
+		void stopReceiver();
+
+	protected :
+		/**
+		 * Emits the \ref progress() signal.
+		 */
+		void cMoveProgressed(
+			int remaining, int completed, int failed, int warned
+		);
+
+		/**
+		 * Notes the \a messageId instances are going to be sent with.
+		 */
+		void sendingCMove( quint16 messageId );
+
+	private :
+		class Retrieval;
+
+		/**
+		 * Returns a Message ID for the next C-MOVE. IDs are unique across
+		 * the process, so retrievals sharing a receiver never mix their
+		 * instances up.
+		 */
+		static quint16 nextMessageId();
+
+		/**
+		 * Performs the C-MOVE for \ref retrieve() and waits for instances
+		 * to arrive in the receiver.
+		 */
+		int performRetrieval(
+			const ConnectionParameters & parameters,
+			const char * abstractSyntax,
+			const Dataset & dataset,
+			UidList * failedSopInstances
+		);
+
+		/**
+		 * Starts the \a receiver, taking its ownership.
+		 */
+		bool startReceiver(
+			StorageScp * receiver, const ConnectionParameters & parameters
+		);
+
+	private slots :
+		/**
+		 * Reports the instance received by the \ref receiver_ if it was sent
+		 * on behalf of the C-MOVE in progress.
+		 */
+		void collect(
+			QString sopInstanceUid,
+			QString path,
+			QString moveOriginatorAe,
+			int moveOriginatorId,
+			int status
+		);
+
+	private :
+		QWaitCondition arrived_;
+		QMutex lock_;
+		int messageId_;
+		QString moveOriginatorAe_;
+		bool ownsReceiver_;
+		int received_;
+		StorageScp * receiver_;
+
+	signals :
+		/**
+		 * Signal emitted for each pending C-MOVE response with the numbers of
+		 * \a remaining, \a completed, \a failed and \a warned
+		 * sub-operations; those the peer didn't report are \c -1.
+		 */
+		void progress( int remaining, int completed, int failed, int warned );
+
+		/**
+		 * Signal emitted from a receiver thread once the instance of the \a
+		 * sopInstanceUid has been received with the \a status; the \a path
+		 * is where it was stored, if the receiver stores instances in files.
+		 */
+		void retrieved( QString sopInstanceUid, QString path, int status );
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -16,7 +16,8 @@ ServerAssociation::ServerAssociation(
 	const ConnectionParameters & Parameters, QObject * parent
 ) :
 	AcceptorAssociation( Parameters, parent ),
-	externalTAscNetwork_( external )
+	externalTAscNetwork_( external ),
+	useTransportLayer_( false )
 {
 	Q_ASSERT( external );
 	Q_ASSERT( Parameters.isValid() );
@@ -49,10 +50,26 @@ bool ServerAssociation::receive( bool * timedOut ) {
 
 	T_ASC_Network * backup = tAscNetwork();
 	tAscNetwork() = externalTAscNetwork();
-	const bool Result = AcceptorAssociation::receive( timedOut );
+	const bool Result = AcceptorAssociation::receive(
+		connectionParameters(), timedOut, useTransportLayer_
+	);
 	tAscNetwork() = backup;
 
 	return Result;
 }
 
+
+void ServerAssociation::setUseTransportLayer( bool use ) {
+	useTransportLayer_ = use;
+}
+
+
+bool ServerAssociation::waitForPending( int seconds ) const {
+	if ( ! ( externalTAscNetwork() ) ) {
+		return false;
+	}
+
+	return ASC_associationWaiting( externalTAscNetwork(), seconds );
+}
+
 }; // Namespace DICOM ends here.
@@ -68,6 +68,22 @@ class QDICOM_DLLSPEC ServerAssociation : public AcceptorAssociation {
 		 */
 		bool receive( bool * timedOut = 0 );
 
+		/**
+		 * Makes \ref receive() create connections through the transport
+		 * layer set on the external network with \c ASC_setTransportLayer(),
+		 * which DCMTK only does when told to use a "secure" layer. The layer
+		 * then learns when a connection has been accepted, before its
+		 * request is read.
+		 */
+		void setUseTransportLayer( bool use );
+
+		/**
+		 * Blocks for up to \a seconds until an association is waiting to be
+		 * established on a \ref port(). Unlike polling with \ref isPending(),
+		 * the wait is driven by the listening socket becoming readable.
+		 */
+		bool waitForPending( int seconds ) const;
+
 	private :
 		/**
 		 * Returns external network address.
@@ -80,6 +96,7 @@ class QDICOM_DLLSPEC ServerAssociation : public AcceptorAssociation {
 		 * association is destroyed.
 		 */
 		mutable T_ASC_Network * externalTAscNetwork_;
+		bool useTransportLayer_;
 };
 
 }; // Namespace DICOM ends here.
@@ -3,15 +3,22 @@
  *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
  **************************************************************************/
 
+#include "AsyncOutputFileStream.hpp"
 #include "Exceptions.hpp"
+#include "Log.hpp"
 #include "ServiceProvider.hpp"
 
 #include <QtDicom/Association.hpp>
 
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
 #include <QtCore/QTemporaryFile>
 
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcmetinf.h>
 #include <dcmtk/dcmdata/dcostrmf.h>
+#include <dcmtk/dcmdata/dcuid.h>
 
 #include <dcmtk/dcmnet/assoc.h>
 #include <dcmtk/dcmnet/dimse.h>
@@ -20,14 +27,22 @@
 namespace Dicom {
 
 ServiceProvider::ServiceProvider() :
-	AbstractService()
+	AbstractService(),
+	asyncFileWrites_( false ),
+	datasetBytes_( 0 ),
+	lastCStoreStatus_( -1 ),
+	part10Files_( false )
 {
 	clearErrorStatus();
 }
 
 
 ServiceProvider::ServiceProvider( Association * association ) :
-	AbstractService( association )
+	AbstractService( association ),
+	asyncFileWrites_( false ),
+	datasetBytes_( 0 ),
+	lastCStoreStatus_( -1 ),
+	part10Files_( false )
 {
 	clearErrorStatus();
 }
@@ -37,6 +52,18 @@ ServiceProvider::~ServiceProvider() {
 }
 
 
+bool ServiceProvider::asyncFileWrites() const {
+	return asyncFileWrites_;
+}
+
+
+int ServiceProvider::completeCStore(
+	const T_DIMSE_C_StoreRQ &, unsigned char, const QString &, int status
+) {
+	return status;
+}
+
+
 void ServiceProvider::handleCEcho(
 	const T_DIMSE_C_EchoRQ & Request, unsigned char presentationContextId
 ) {
@@ -82,6 +109,8 @@ Dataset ServiceProvider::handleCFind(
 		throw OperationFailedException( "Invalid association." );
 	}
 
+	verifyPresentationContext( Request.AffectedSOPClassUID, presentationContextId );
+
 	return receiveDataset( presentationContextId );
 
 
@@ -123,28 +152,61 @@ bool ServiceProvider::handleCStore(
 		throw OperationFailedException( "Invalid association." );
 	}
 
+	verifyPresentationContext( Request.AffectedSOPClassUID, presentationContextId );
+
 	int status = STATUS_Success;
 	if ( ! Path.isEmpty() ) {
-		DcmOutputFileStream * filestream = NULL;
-		OFCondition result = DIMSE_createFilestream(
-			Path.toUtf8().constData(),
-			&Request, association()->tAscAssociation(),
-			presentationContextId,
-			0, &filestream
-		);
+		DcmOutputStream * stream = 0;
+		OFCondition result = EC_Normal;
+
+		if ( asyncFileWrites() ) {
+			stream = new AsyncOutputFileStream( Path );
+			OFCondition written = stream->status();
+			if ( written.good() && part10Files() ) {
+				written = writeMetaHeader( *stream, Request, presentationContextId );
+			}
+			if ( written.bad() ) {
+				QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+					"falling back to synchronous writes; %s",
+					written.text()
+				);
+				delete stream;
+				stream = 0;
+			}
+		}
+
+		if ( ! stream ) {
+			DcmOutputFileStream * filestream = NULL;
+			result = DIMSE_createFilestream(
+				Path.toUtf8().constData(),
+				&Request, association()->tAscAssociation(),
+				presentationContextId,
+				part10Files() ? OFTrue : OFFalse, &filestream
+			);
+			stream = filestream;
+		}
 
 		if ( result.good() ) {
-			receiveDatasetInFile( presentationContextId, filestream );
+			// The peer is told to retry later, the association goes on
+			if ( ! receiveDatasetInFile( presentationContextId, stream ) ) {
+				QFile::remove( Path );
+				status = STATUS_STORE_Refused_OutOfResources;
+			}
+			status = completeCStore(
+				Request, presentationContextId, Path, status
+			);
 		}
 		else {
 			raiseError(
 				QString( "Failed to create a file stream: `%1'." )
 				.arg( Path )
 			);
+			ignoreDataset( presentationContextId );
 			status = STATUS_STORE_Refused_OutOfResources;
 		}
 	}
 	else {
+		ignoreDataset( presentationContextId );
 		status = STATUS_STORE_Refused_OutOfResources;
 	}
 
@@ -164,6 +226,48 @@ bool ServiceProvider::handleCStore(
 }
 
 
+bool ServiceProvider::handleCStore(
+	const T_DIMSE_C_StoreRQ & Request,
+	unsigned char presentationContextId,
+	DcmOutputStream * stream
+) {
+	try {
+
+	if ( ! ( association() || association()->isEstablished() ) ) {
+		delete stream;
+		throw OperationFailedException( "Invalid association." );
+	}
+
+	verifyPresentationContext( Request.AffectedSOPClassUID, presentationContextId );
+
+	int status = STATUS_STORE_Refused_OutOfResources;
+	if ( stream ) {
+		const bool Written = receiveDatasetInFile( presentationContextId, stream );
+		status = completeCStore(
+			Request, presentationContextId, QString(),
+			Written ? STATUS_Success : STATUS_STORE_Refused_OutOfResources
+		);
+	}
+	else {
+		ignoreDataset( presentationContextId );
+	}
+
+	sendCStoreResponse( status, Request, presentationContextId );
+	
+	return ! hasError();
+
+	} // End of the try block.
+	catch ( std::exception & e ) {
+		raiseError( e.what() );
+	}
+	catch ( ... ) {
+		raiseError( "Unknown exception occured." );
+	}	
+
+	return false;
+}
+
+
 Dataset ServiceProvider::handleCStore(
 	const T_DIMSE_C_StoreRQ & Request, unsigned char presentationContextId
 ) {
@@ -173,6 +277,8 @@ Dataset ServiceProvider::handleCStore(
 		throw OperationFailedException( "Invalid association." );
 	}
 
+	verifyPresentationContext( Request.AffectedSOPClassUID, presentationContextId );
+
 	Dataset dataSet;
 	receiveDatasetInMemory( presentationContextId, &dataSet.dcmDataset() );
 
@@ -192,20 +298,67 @@ Dataset ServiceProvider::handleCStore(
 }
 
 
-void ServiceProvider::receiveDatasetInFile( 
+void ServiceProvider::ignoreDataset( unsigned char & id ) {
+	const OFCondition Result = DIMSE_ignoreDataSet(
+		association()->tAscAssociation(),
+		DIMSE_NONBLOCKING,
+		association()->connectionParameters().timeout(),
+		&id
+	);
+
+	if ( Result.bad() ) {
+		throw OperationFailedException(
+			QString( 
+				"Failed to skip a Data Set. "
+				"Internal error description:\n%1"
+			)
+			.arg( Result.text() )
+		);
+	}
+}
+
+
+int ServiceProvider::lastCStoreStatus() const {
+	return lastCStoreStatus_;
+}
+
+
+bool ServiceProvider::part10Files() const {
+	return part10Files_;
+}
+
+
+bool ServiceProvider::receiveDatasetInFile( 
 	unsigned char & id, DcmOutputStream * stream
 ) {
+	QElapsedTimer timer;
+	timer.start();
+	datasetBytes_ = 0;
+
 	const OFCondition Result = DIMSE_receiveDataSetInFile(
 		association()->tAscAssociation(),
 		DIMSE_NONBLOCKING, 
 		association()->connectionParameters().timeout(),
-		&id, stream, 0, 0
+		&id, stream, &ServiceProvider::reportProgress, this
 	);
 
+	// Background writers report their errors once all data is written
+	stream->flush();
+	const OFCondition Written = stream->status();
+
 	delete stream;
 
-	if ( Result.good() ) {
-		qDebug( "Dataset stored in file." );
+	// The whole Data Set has been read, so the association is still usable
+	if ( Result.good() && Written.bad() ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"failed to write a Data Set; %s", Written.text()
+		);
+		return false;
+	}
+	else if ( Result.good() ) {
+		recordTransfer( Metrics::Received, datasetBytes_, timer );
+		QDICOM_LOG( Dimse, Debug, "Dataset stored in file." );
+		return true;
 	}
 	else {
 		throw OperationFailedException(
@@ -222,15 +375,20 @@ void ServiceProvider::receiveDatasetInFile(
 void ServiceProvider::receiveDatasetInMemory(
 	unsigned char & id, DcmDataset * dataSet
 ) {
+	QElapsedTimer timer;
+	timer.start();
+	datasetBytes_ = 0;
+
 	const OFCondition Result = DIMSE_receiveDataSetInMemory(
 		association()->tAscAssociation(),
 		DIMSE_NONBLOCKING,
 		association()->connectionParameters().timeout(),
-		&id, &dataSet, 0, 0
+		&id, &dataSet, &ServiceProvider::reportProgress, this
 	);
 
 	if ( Result.good() ) {
-		qDebug( "Data Set successfully received." );
+		recordTransfer( Metrics::Received, datasetBytes_, timer );
+		QDICOM_LOG( Dimse, Debug, "Data Set successfully received." );
 	}
 	else {
 		throw OperationFailedException(
@@ -244,6 +402,18 @@ void ServiceProvider::receiveDatasetInMemory(
 }
 
 
+void ServiceProvider::receivingDataset( quint64 ) {
+}
+
+
+void ServiceProvider::reportProgress( void * context, unsigned long count ) {
+	ServiceProvider * const Provider = static_cast< ServiceProvider * >( context );
+
+	Provider->datasetBytes_ = count;
+	Provider->receivingDataset( count );
+}
+
+
 void ServiceProvider::sendCEchoResponse(
 	const T_DIMSE_C_EchoRQ & Request, unsigned char Id
 ) {
@@ -267,30 +437,105 @@ void ServiceProvider::sendCEchoResponse(
 void ServiceProvider::sendCStoreResponse(
 	int status, const T_DIMSE_C_StoreRQ & Request, unsigned char Id
 ) {
-	T_DIMSE_C_StoreRSP responseParams;
-	bzero( ( char * )&responseParams, sizeof( responseParams ) );
-	strcpy( responseParams.AffectedSOPClassUID,    Request.AffectedSOPClassUID );
-    strcpy( responseParams.AffectedSOPInstanceUID, Request.AffectedSOPInstanceUID );
-	responseParams.DataSetType = DIMSE_DATASET_NULL;
-	responseParams.DimseStatus = status;
-	responseParams.MessageIDBeingRespondedTo = Request.MessageID;
-    responseParams.opts = 
-		( O_STORE_AFFECTEDSOPCLASSUID | O_STORE_AFFECTEDSOPINSTANCEUID )
-	;
-    if ( Request.opts & O_STORE_RQ_BLANK_PADDING ) {
-		responseParams.opts |= O_STORE_RSP_BLANK_PADDING;
+	lastCStoreStatus_ = status;
+
+	AbstractService::sendCStoreResponse( status, Request, Id );
+}
+
+
+void ServiceProvider::setAsyncFileWrites( bool enabled ) {
+	asyncFileWrites_ = enabled;
+}
+
+
+void ServiceProvider::setPart10Files( bool enabled ) {
+	part10Files_ = enabled;
+}
+
+
+bool ServiceProvider::skipCStore(
+	const T_DIMSE_C_StoreRQ & Request,
+	unsigned char presentationContextId,
+	int status
+) {
+	try {
+
+	if ( ! ( association() || association()->isEstablished() ) ) {
+		throw OperationFailedException( "Invalid association." );
 	}
-    if ( dcmPeerRequiresExactUIDCopy.get() ) {
-		responseParams.opts |= O_STORE_PEER_REQUIRES_EXACT_UID_COPY;
+
+	verifyPresentationContext( Request.AffectedSOPClassUID, presentationContextId );
+
+	ignoreDataset( presentationContextId );
+	sendCStoreResponse( status, Request, presentationContextId );
+
+	return ! hasError();
+
+	} // End of the try block.
+	catch ( std::exception & e ) {
+		raiseError( e.what() );
 	}
+	catch ( ... ) {
+		raiseError( "Unknown exception occured." );
+	}	
 
-	T_DIMSE_Message response;
-	bzero( ( char * )&response, sizeof( response ) );
-	response.CommandField = DIMSE_C_STORE_RSP;
-	response.msg.CStoreRSP = responseParams;
+	return false;
+}
 
-	sendCommand( response, Id );
+
+void ServiceProvider::verifyPresentationContext(
+	const char * SopClass, unsigned char Id
+) const {
+	const QPresentationContextTable & Table = presentationContextTable();
+	if ( ! Table.isEmpty() && Table.abstractSyntax( Id ) != SopClass ) {
+		QDICOM_LOG( Dimse, Warning, __FUNCTION__": "
+			"request for SOP class: %s arrived on presentation context #%d "
+			"negotiated for: %s",
+			SopClass, Id, Table.abstractSyntax( Id ).constData()
+		);
+	}
 }
 
 
+OFCondition ServiceProvider::writeMetaHeader(
+	DcmOutputStream & stream,
+	const T_DIMSE_C_StoreRQ & Request,
+	unsigned char id
+) const {
+	T_ASC_Association * a = association()->tAscAssociation();
+
+	T_ASC_PresentationContext context;
+	OFCondition result = ASC_findAcceptedPresentationContext(
+		a->params, id, &context
+	);
+	if ( result.bad() ) {
+		return result;
+	}
+
+	static const Uint8 Version[] = { 0x00, 0x01 };
+
+	DcmMetaInfo meta;
+	meta.putAndInsertUint8Array( DCM_FileMetaInformationVersion, Version, 2 );
+	meta.putAndInsertString( DCM_MediaStorageSOPClassUID, Request.AffectedSOPClassUID );
+	meta.putAndInsertString( DCM_MediaStorageSOPInstanceUID, Request.AffectedSOPInstanceUID );
+	meta.putAndInsertString( DCM_TransferSyntaxUID, context.acceptedTransferSyntax );
+	meta.putAndInsertString( DCM_ImplementationClassUID, OFFIS_IMPLEMENTATION_CLASS_UID );
+	meta.putAndInsertString( DCM_ImplementationVersionName, OFFIS_DTK_IMPLEMENTATION_VERSION_NAME );
+	meta.putAndInsertString(
+		DCM_SourceApplicationEntityTitle, a->params->DULparams.callingAPTitle
+	);
+	meta.computeGroupLengthAndPadding(
+		EGL_withGL, EPD_noChange, META_HEADER_DEFAULT_TRANSFERSYNTAX, EET_ExplicitLength
+	);
+
+	// Meta Information writes the preamble and the DICM prefix as well
+	meta.transferInit();
+	result = meta.write(
+		stream, META_HEADER_DEFAULT_TRANSFERSYNTAX, EET_ExplicitLength, 0
+	);
+	meta.transferEnd();
+
+	return result;
+}
+
 }; // Namespace DICOM ends here.
@@ -11,6 +11,7 @@
 #include "QtDicom/Globals.hpp"
 
 class DcmOutputStream;
+class OFCondition;
 class QDir;
 
 struct T_DIMSE_C_EchoRQ;
@@ -27,6 +28,12 @@ class QDICOM_DLLSPEC ServiceProvider : protected AbstractService {
 		ServiceProvider( Association * association );
 		virtual ~ServiceProvider();
 
+		/**
+		 * Returns \c true if Data Sets received by \ref handleCStore() are
+		 * written to files in the background.
+		 */
+		bool asyncFileWrites() const;
+
 		/**
 		 * Handles a C-ECHO request by sending a C-ECHO response.
 		 */
@@ -48,6 +55,11 @@ class QDICOM_DLLSPEC ServiceProvider : protected AbstractService {
 
 		/**
 		 * Attempts to store incoming Data Set in file specified by the \a path.
+		 * The file is a Part 10 one if \ref part10Files() is set.
+		 *
+		 * When the Data Set is received but can't be written, the request is
+		 * refused with the \c 0xA700 status and the association remains
+		 * usable.
 		 */
 		bool handleCStore(
 			Association * association,
@@ -61,6 +73,17 @@ class QDICOM_DLLSPEC ServiceProvider : protected AbstractService {
 			const QString & path
 		);
 
+		/**
+		 * Writes incoming Data Set to the \a stream, as it arrives, and
+		 * deletes the stream afterwards. When the \a stream is \c 0, the
+		 * Data Set is skipped and refused.
+		 */
+		bool handleCStore(
+			const T_DIMSE_C_StoreRQ & Request,
+			unsigned char ID,
+			DcmOutputStream * stream
+		);
+
 		/**
 		 * Saves incoming Data Set in the \ref Dataset structure.
 		 */
@@ -69,19 +92,131 @@ class QDICOM_DLLSPEC ServiceProvider : protected AbstractService {
 			unsigned char ID
 		);
 
+		/**
+		 * Returns \c true if files written by \ref handleCStore() start with
+		 * the preamble and the File Meta Information; \c false, by default,
+		 * if they contain the bare Data Set.
+		 */
+		bool part10Files() const;
+
+		/**
+		 * Sets whether Data Sets received by \ref handleCStore() are written
+		 * to files by background writers (see \ref AsyncOutputFileStream),
+		 * leaving the calling thread to receive data from network.
+		 *
+		 * When a file cannot be opened this way, the regular DCMTK stream is
+		 * used.
+		 */
+		void setAsyncFileWrites( bool enabled );
+
+		/**
+		 * Sets whether files written by \ref handleCStore() are Part 10
+		 * ones.
+		 */
+		void setPart10Files( bool enabled );
+
+		/**
+		 * Skips the Data Set following the C-STORE \a request without
+		 * storing it anywhere and responds with the \a status.
+		 */
+		bool skipCStore(
+			const T_DIMSE_C_StoreRQ & Request,
+			unsigned char ID,
+			int status
+		);
+
+	protected :
+		/**
+		 * Returns the status of the last C-STORE response sent, \c -1 if none
+		 * was sent yet.
+		 */
+		int lastCStoreStatus() const;
+
+		/**
+		 * Called by \ref handleCStore() once a Data Set has been received in
+		 * the file specified by the \a path (empty for Data Sets written to
+		 * streams), before the response to the \a request is sent. Returns
+		 * the status to respond with.
+		 *
+		 * The default implementation returns the \a status unchanged.
+		 */
+		virtual int completeCStore(
+			const T_DIMSE_C_StoreRQ & request,
+			unsigned char ID,
+			const QString & path,
+			int status
+		);
+
+		/**
+		 * Called repeatedly while a Data Set is being received, with the \a
+		 * count of bytes received so far.
+		 *
+		 * The default implementation does nothing.
+		 */
+		virtual void receivingDataset( quint64 count );
+
+		/**
+		 * Writes the preamble and File Meta Information of the instance of
+		 * the C-STORE \a request, received on presentation context \a ID,
+		 * to the \a stream; the same DIMSE_createFilestream() writes, so
+		 * files written to any stream are Part 10 ones.
+		 */
+		OFCondition writeMetaHeader(
+			DcmOutputStream & stream,
+			const T_DIMSE_C_StoreRQ & Request,
+			unsigned char ID
+		) const;
+
 	private :
-		void receiveDatasetInFile( unsigned char & ID, DcmOutputStream * stream );
+		/**
+		 * DCMTK's progress callback; saves the \a count, for the \ref
+		 * Metrics, and passes it to the \ref receivingDataset() of the
+		 * provider in the \a context.
+		 */
+		static void reportProgress( void * context, unsigned long count );
+
+		/**
+		 * Receives and discards the Data Set following a command.
+		 */
+		void ignoreDataset( unsigned char & ID );
+
+		/**
+		 * Receives the Data Set into the \a stream and deletes the stream.
+		 * Returns \c false if the Data Set has been received but couldn't be
+		 * written; receiving errors throw.
+		 */
+		bool receiveDatasetInFile( unsigned char & ID, DcmOutputStream * stream );
 		void receiveDatasetInMemory( unsigned char & ID, DcmDataset * dataset );
 
 		void sendCEchoResponse(
 			const T_DIMSE_C_EchoRQ & Request,
 			unsigned char ID
 		);
+
+		/**
+		 * Remembers the \a status as the \ref lastCStoreStatus() and sends
+		 * the response.
+		 */
 		void sendCStoreResponse(
 			int status,
 			const T_DIMSE_C_StoreRQ & Request,
 			unsigned char ID
 		);
+
+		/**
+		 * Warns when the \a sopClass of a request doesn't match the abstract
+		 * syntax of presentation context \a ID it arrived on. Requires the
+		 * \ref presentationContextTable() to be set.
+		 */
+		void verifyPresentationContext(
+			const char * sopClass, unsigned char ID
+		) const;
+
+	private :
+		bool asyncFileWrites_;
+		quint64 datasetBytes_;
+		int lastCStoreStatus_;
+		bool part10Files_;
 };
 
 }; // Namespace DICOM ends here.
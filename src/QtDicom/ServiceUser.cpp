@@ -4,14 +4,18 @@
  **************************************************************************/
 
 #include "Exceptions.hpp"
+#include "Log.hpp"
 #include "ServiceUser.hpp"
+#include "StorageScpDiskSink.hpp"
 
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
 #include <QtCore/QStringList>
 
-#include <QtDicom/QPresentationContext>
-#include <QtDicom/RequestorAssociation.hpp>
-
 #include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcostrmf.h>
 #include <dcmtk/dcmdata/dcuid.h>
 
 #include <dcmtk/dcmnet/dimse.h>
@@ -39,7 +43,7 @@ ServiceUser::~ServiceUser() {
 
 
 bool ServiceUser::cEcho() {
-	qDebug( "Performing a C-ECHO operation." );
+	QDICOM_LOG( Dimse, Debug, "Performing a C-ECHO operation." );
 
 	clearErrorStatus();
 
@@ -98,11 +102,34 @@ bool ServiceUser::cEcho() {
 QList< Dataset > ServiceUser::cFind( 
 	const Dataset & Attributes, const char * SopClass
 ) {
-	qDebug( "Performing a C-FIND operation." );
+	struct Collector : public FindHandler {
+		bool handle( const Dataset & Identifier ) {
+			identifiers.append( Identifier );
+			return true;
+		}
+
+		QList< Dataset > identifiers;
+	} collector;
+
+	cFind( Attributes, SopClass, collector );
+
+	return collector.identifiers;
+}
+
+
+int ServiceUser::cFind(
+	const Dataset & Attributes, const char * SopClass,
+	FindHandler & handler,
+	int maxResults, int deadline,
+	bool * cancelled
+) {
+	QDICOM_LOG( Dimse, Debug, "Performing a C-FIND operation." );
 
 	clearErrorStatus();
 
-	QList< Dicom::Dataset > responseIdentifiers;
+	if ( cancelled ) *cancelled = false;
+
+	int handled = 0;
 	try {
 	
 	if ( ! ( association() || association()->isEstablished() ) ) {
@@ -135,34 +162,229 @@ QList< Dataset > ServiceUser::cFind(
 	request.CommandField = DIMSE_C_FIND_RQ;
 	request.msg.CFindRQ = requestParameters;
 
+	QElapsedTimer timer;
+	timer.start();
+
 	sendCommand( request, Attributes, presentationContextId );
 
+	const int Timeout = association()->connectionParameters().timeout();
+	bool cancelSent = false;
 	bool finished = false;
 	do {
-		const T_DIMSE_Message Response = receiveCommand( 
-			DIMSE_C_FIND_RSP, presentationContextId
-		);
+		// Waiting for a response can't outlast the deadline
+		int seconds = Timeout;
+		if ( deadline > 0 && ! cancelSent ) {
+			const qint64 Remaining = deadline - timer.elapsed();
+			seconds = static_cast< int >( qMax( Q_INT64_C( 0 ), Remaining + 999 ) / 1000 );
+		}
 
-		finished = validateCFindResponse( Response, request );
+		bool timedOut = seconds == 0;
+		T_DIMSE_Message response;
+		if ( ! timedOut ) {
+			response = receiveCommand(
+				DIMSE_C_FIND_RSP, seconds, presentationContextId, 0, &timedOut
+			);
+		}
+
+		if ( timedOut ) {
+			if ( cancelSent || deadline == 0 ) {
+				association()->abort();
+				throw OperationFailedException(
+					"Timeout occured when waiting for a C-FIND response."
+				);
+			}
+			else if ( timer.elapsed() >= deadline ) {
+				QDICOM_LOG( Dimse, Debug,
+					"C-FIND deadline of %d ms passed; cancelling", deadline
+				);
+				sendCCancel( requestParameters.MessageID, presentationContextId );
+				cancelSent = true;
+			}
+			continue;
+		}
+
+		finished = validateCFindResponse( response, request );
 
 		if ( finished ) {
 			break;
 		}
 
-		if ( Response.msg.CFindRSP.DataSetType == DIMSE_DATASET_NULL ) {
-			qWarning( 
+		if ( response.msg.CFindRSP.DataSetType == DIMSE_DATASET_NULL ) {
+			QDICOM_LOG( Dimse, Warning,
 				"Non-conformant Query SCP detected: C-FIND pending response "
 				"does not contain a dataset. Ignoring."
 			);
 			continue;
 		}
 
+		// Matches arriving after the cancellation are drained
+		if ( cancelSent ) {
+			ignoreDataset();
+			continue;
+		}
+
 		const Dataset Identifier = receiveDataset( presentationContextId );
-		
-		responseIdentifiers.append( Identifier );
+		++handled;
+
+		if (
+			! handler.handle( Identifier ) ||
+			( maxResults > 0 && handled >= maxResults ) ||
+			( deadline > 0 && timer.elapsed() >= deadline )
+		) {
+			sendCCancel( requestParameters.MessageID, presentationContextId );
+			cancelSent = true;
+		}
+	} while ( ! finished );
+
+	if ( cancelled ) *cancelled = cancelSent;
+
+	return handled;
+
+	} // End of the try block.
+	catch ( std::exception & e ) {
+		raiseError( e.what() );
+	}
+	catch ( ... ) {
+		raiseError( "Unknown exception occured." );
+	}	
+
+	return -1;
+}
+
+
+int ServiceUser::cGet(
+	const Dataset & Attributes, const char * SopClass,
+	const QString & Directory,
+	int * failed, UidList * failedInstances,
+	int * warned
+) {
+	QDICOM_LOG( Dimse, Debug, "Performing a C-GET operation." );
+
+	clearErrorStatus();
+
+	if ( failed ) *failed = 0;
+	if ( failedInstances ) failedInstances->clear();
+	if ( warned ) *warned = 0;
+
+	try {
+
+	if ( ! ( association() || association()->isEstablished() ) ) {
+		throw OperationFailedException( "Invalid association." );
+	}
+
+	T_ASC_PresentationContextID presentationContextId = 
+		association()->acceptedPresentationContextId( SopClass )
+	;
+
+	if ( presentationContextId < 1 ) {
+		throw OperationFailedException(
+			QString( 
+				"Unable to find presentation context ID "
+				"matching SOP Class: `%1'."
+			)
+			.arg( SopClass )
+		);
+	}
+
+	T_DIMSE_C_GetRQ requestParameters;
+	bzero( ( char * )& requestParameters, sizeof( requestParameters ) );
+	strcpy( requestParameters.AffectedSOPClassUID, SopClass );
+	requestParameters.DataSetType = DIMSE_DATASET_PRESENT;
+	requestParameters.MessageID = association()->nextMessageId();
+	requestParameters.Priority = DIMSE_PRIORITY_HIGH;
+
+	T_DIMSE_Message request;
+	bzero( ( char * )& request, sizeof( request ) );
+	request.CommandField = DIMSE_C_GET_RQ;
+	request.msg.CGetRQ = requestParameters;
+
+	sendCommand( request, Attributes, presentationContextId );
+
+	bool finished = false;
+	do {
+		// Sub-operations arrive on their own presentation contexts
+		unsigned char id = 0;
+		const T_DIMSE_Message Response = receiveCommand( id );
+
+		if ( Response.CommandField == DIMSE_C_STORE_RQ ) {
+			storeCGetInstance( Response.msg.CStoreRQ, id, Directory );
+			continue;
+		}
+		else if ( Response.CommandField != DIMSE_C_GET_RSP ) {
+			throw OperationFailedException(
+				QString( "Unexpected %1 received during a C-GET." )
+				.arg( commandName( Response.CommandField ) )
+			);
+		}
+
+		finished = validateCGetResponse( Response, request );
+
+		if ( ! finished ) {
+			const T_DIMSE_C_GetRSP & Pending = Response.msg.CGetRSP;
+			cGetProgressed(
+				( Pending.opts & O_GET_NUMBEROFREMAININGSUBOPERATIONS ) ?
+					Pending.NumberOfRemainingSubOperations : -1,
+				( Pending.opts & O_GET_NUMBEROFCOMPLETEDSUBOPERATIONS ) ?
+					Pending.NumberOfCompletedSubOperations : -1,
+				( Pending.opts & O_GET_NUMBEROFFAILEDSUBOPERATIONS ) ?
+					Pending.NumberOfFailedSubOperations : -1,
+				( Pending.opts & O_GET_NUMBEROFWARNINGSUBOPERATIONS ) ?
+					Pending.NumberOfWarningSubOperations : -1
+			);
+		}
+
+		if ( finished ) {
+			const T_DIMSE_C_GetRSP Parameters = Response.msg.CGetRSP;
+			if ( warned ) {
+				*warned = Parameters.NumberOfWarningSubOperations;
+			}
+			if ( failed ) {
+				*failed = Parameters.NumberOfFailedSubOperations;
+			}
+
+			if ( Parameters.DimseStatus == STATUS_Success ) {
+				return Parameters.NumberOfCompletedSubOperations;
+			}
+
+			if ( Parameters.DataSetType != DIMSE_DATASET_PRESENT ) {
+				QDICOM_LOG( Dimse, Warning,
+					"Non-conformant Get SCP detected: C-GET final response "
+					"does NOT contain a dataset. Ignoring."
+				);
+			}
+			else if ( failedInstances ) {
+				const Dataset Dset = receiveDataset( id );
+
+				bool exists;
+				const QString Value = Dset.tagValue( 
+					DCM_FailedSOPInstanceUIDList, &exists
+				);
+				if ( exists && ! Value.isEmpty() ) {
+					*failedInstances = Value.split( '\\' );
+				}
+				else {
+					QDICOM_LOG( Dimse, Warning,
+						"Non-conformant Get SCP detected: C-GET final response's "
+						"dataset does not contain Failed SOP Instance UID List."
+					);
+				}
+			}
+			else {
+				ignoreDataset();
+			}
+
+			return 0;
+		}
+		else if ( Response.msg.CGetRSP.DataSetType == DIMSE_DATASET_PRESENT ) {
+			QDICOM_LOG( Dimse, Warning,
+				"Non-conformant Get SCP detected: C-GET pending response "
+				"does contain a dataset. Ignoring."
+			);
+			ignoreDataset();
+		}		
 	} while ( ! finished );
 
-	return responseIdentifiers;
+	Q_ASSERT( 0 );
 
 	} // End of the try block.
 	catch ( std::exception & e ) {
@@ -172,7 +394,15 @@ QList< Dataset > ServiceUser::cFind(
 		raiseError( "Unknown exception occured." );
 	}	
 
-	return responseIdentifiers;
+	return -1;
+}
+
+
+void ServiceUser::cGetProgressed( int, int, int, int ) {
+}
+
+
+void ServiceUser::cGetStored( const QByteArray &, const QString & ) {
 }
 
 
@@ -182,7 +412,7 @@ int ServiceUser::cMove(
 	int * failed, UidList * failedInstances,
 	int * warned
 ) {
-	qDebug( "Performing a C-MOVE operation." );
+	QDICOM_LOG( Dimse, Debug, "Performing a C-MOVE operation." );
 
 	clearErrorStatus();
 
@@ -223,6 +453,7 @@ int ServiceUser::cMove(
 	request.CommandField = DIMSE_C_MOVE_RQ;
 	request.msg.CMoveRQ = requestParameters;
 
+	sendingCMove( requestParameters.MessageID );
 	sendCommand( request, Attributes, presentationContextId );
 
 	int completed = 0;
@@ -235,6 +466,20 @@ int ServiceUser::cMove(
 
 		finished = validateCMoveResponse( Response, request );
 
+		if ( ! finished ) {
+			const T_DIMSE_C_MoveRSP & Pending = Response.msg.CMoveRSP;
+			cMoveProgressed(
+				( Pending.opts & O_MOVE_NUMBEROFREMAININGSUBOPERATIONS ) ?
+					Pending.NumberOfRemainingSubOperations : -1,
+				( Pending.opts & O_MOVE_NUMBEROFCOMPLETEDSUBOPERATIONS ) ?
+					Pending.NumberOfCompletedSubOperations : -1,
+				( Pending.opts & O_MOVE_NUMBEROFFAILEDSUBOPERATIONS ) ?
+					Pending.NumberOfFailedSubOperations : -1,
+				( Pending.opts & O_MOVE_NUMBEROFWARNINGSUBOPERATIONS ) ?
+					Pending.NumberOfWarningSubOperations : -1
+			);
+		}
+
 		if ( finished ) {
 			const T_DIMSE_C_MoveRSP Parameters = Response.msg.CMoveRSP;
 			if ( warned ) {
@@ -249,7 +494,7 @@ int ServiceUser::cMove(
 			}
 
 			if ( Parameters.DataSetType != DIMSE_DATASET_PRESENT ) {
-				qWarning( 
+				QDICOM_LOG( Dimse, Warning,
 					"Non-conformant Move SCP detected: C-MOVE final response "
 					"does NOT contain a dataset. Ignoring."
 				);
@@ -265,7 +510,7 @@ int ServiceUser::cMove(
 					*failedInstances = Value.split( '\\' );
 				}
 				else {
-					qWarning( 
+					QDICOM_LOG( Dimse, Warning,
 						"Non-conformant Move SCP detected: C-MOVE final response's "
 						"dataset does not contain Failed SOP Instance UID List."
 					);
@@ -278,7 +523,7 @@ int ServiceUser::cMove(
 			return 0;
 		}
 		else if ( Response.msg.CMoveRSP.DataSetType == DIMSE_DATASET_PRESENT ) {
-			qWarning( 
+			QDICOM_LOG( Dimse, Warning,
 				"Non-conformant Move SCP detected: C-MOVE pending response "
 				"does contain a dataset. Ignoring."
 			);
@@ -300,6 +545,10 @@ int ServiceUser::cMove(
 }
 
 
+void ServiceUser::cMoveProgressed( int, int, int, int ) {
+}
+
+
 bool ServiceUser::cStore( const Dataset & dataset ) {
 	return cStore( dataset, QString(), -1 );
 }
@@ -308,7 +557,7 @@ bool ServiceUser::cStore( const Dataset & dataset ) {
 bool ServiceUser::cStore( 
 	const Dataset & Dataset, const QString & MoveAe, int moveId
 ) {
-	qDebug( "Performing a C-STORE operation." );
+	QDICOM_LOG( Dimse, Debug, "Performing a C-STORE operation." );
 
 	clearErrorStatus();
 
@@ -331,27 +580,14 @@ bool ServiceUser::cStore(
 	}
 
 	const QTransferSyntax TransferSyntax = Dataset.syntax();
-#ifdef _DEBUG
-	RequestorAssociation * a = reinterpret_cast< RequestorAssociation * >( association() );
-	const QList< QPresentationContext > Contexts = a->acceptedPresentationContexts();
-
-	bool foundPresentationContext = false;
-	foreach( const QPresentationContext & Context, Contexts ) {
-		if ( Context.abstractSyntax() == QUid( SopClass ) ) {
-			if ( Context.acceptedTransferSyntax() == TransferSyntax ) {
-				foundPresentationContext = true;
-				break;
-			}
-		}
-	}
-
-	Q_ASSERT( foundPresentationContext );
-#endif
 
 	T_ASC_PresentationContextID presentationContextId = 
+		presentationContextTable().isEmpty() ?
 		association()->acceptedPresentationContextId( 
 			SopClass, TransferSyntax.uid()
-		);
+		) :
+		presentationContextTable().id( SopClass, TransferSyntax )
+	;
 
 	if ( presentationContextId < 1 ) {
 		throw OperationFailedException(
@@ -406,6 +642,42 @@ bool ServiceUser::cStore(
 }
 
 
+DcmOutputFileStream * ServiceUser::createCGetFile(
+	const T_DIMSE_C_StoreRQ & Request,
+	T_ASC_Association * association,
+	unsigned char presentationContextId,
+	const QString & Directory,
+	QString & path
+) {
+	// The UID comes from the peer and is sanitized before naming the file.
+	// An instance received again is kept next to the earlier file rather than
+	// overwriting it
+	path = StorageScp::DiskSink::availablePath(
+		QDir( Directory ).absoluteFilePath(
+			StorageScp::DiskSink::fileName( Request.AffectedSOPInstanceUID ) +
+			".dcm"
+		)
+	);
+
+	DcmOutputFileStream * stream = 0;
+	const OFCondition Created = DIMSE_createFilestream(
+		path.toUtf8().constData(),
+		&Request, association,
+		presentationContextId,
+		OFTrue, &stream
+	);
+	if ( Created.bad() ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"unable to create %s; %s",
+			qPrintable( QDir::toNativeSeparators( path ) ), Created.text()
+		);
+		return 0;
+	}
+
+	return stream;
+}
+
+
 QByteArray ServiceUser::nCreate( 
 	const char * SopClass,
 	const Dataset & Attributes,
@@ -423,7 +695,7 @@ QByteArray ServiceUser::nCreate(
 	Dataset * affectedAttributes,
 	quint16 * status
 ) {
-	qDebug( "Performing a N-CREATE operation." );
+	QDICOM_LOG( Dimse, Debug, "Performing a N-CREATE operation." );
 
 	try {
 
@@ -513,7 +785,7 @@ QByteArray ServiceUser::nSet(
 	Dataset * modifiedAttrbutes,
 	quint16 * status
 ) {
-	qDebug( "Performing a N-SET operation." );
+	QDICOM_LOG( Dimse, Debug, "Performing a N-SET operation." );
 
 	try {
 
@@ -587,6 +859,71 @@ QByteArray ServiceUser::nSet(
 }
 
 
+void ServiceUser::sendCCancel(
+	quint16 messageId, unsigned char presentationContextId
+) {
+	T_DIMSE_Message cancel;
+	bzero( ( char * )& cancel, sizeof( cancel ) );
+	cancel.CommandField = DIMSE_C_CANCEL_RQ;
+	cancel.msg.CCancelRQ.MessageIDBeingRespondedTo = messageId;
+	cancel.msg.CCancelRQ.DataSetType = DIMSE_DATASET_NULL;
+
+	sendCommand( cancel, presentationContextId );
+}
+
+
+void ServiceUser::sendingCMove( quint16 ) {
+}
+
+
+void ServiceUser::storeCGetInstance(
+	const T_DIMSE_C_StoreRQ & Request,
+	unsigned char presentationContextId,
+	const QString & Directory
+) {
+	QString path;
+	DcmOutputFileStream * stream = createCGetFile(
+		Request, association()->tAscAssociation(), presentationContextId,
+		Directory, path
+	);
+	if ( ! stream ) {
+		ignoreDataset();
+		sendCStoreResponse(
+			STATUS_STORE_Refused_OutOfResources, Request, presentationContextId
+		);
+		return;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// The file is written as the Data Set arrives, never held in memory
+	const OFCondition Received = DIMSE_receiveDataSetInFile(
+		association()->tAscAssociation(),
+		DIMSE_NONBLOCKING,
+		association()->connectionParameters().timeout(),
+		&presentationContextId, stream, 0, 0
+	);
+	delete stream;
+
+	if ( Received.bad() ) {
+		QFile::remove( path );
+		throw OperationFailedException(
+			QString( 
+				"Failed to store a dataset in a file. "
+				"Internal error description:\n%1"
+			)
+			.arg( Received.text() )
+		);
+	}
+	recordTransfer( Metrics::Received, QFileInfo( path ).size(), timer );
+
+	sendCStoreResponse( STATUS_Success, Request, presentationContextId );
+
+	cGetStored( Request.AffectedSOPInstanceUID, path );
+}
+
+
 void ServiceUser::validateCEchoResponse(
 	const T_DIMSE_Message & Response,
 	const T_DIMSE_Message & Request
@@ -618,7 +955,7 @@ void ServiceUser::validateCEchoResponse(
 	}
 
 	if ( ResponseParameters.DataSetType != DIMSE_DATASET_NULL ) {
-		qWarning( 
+		QDICOM_LOG( Dimse, Warning,
 			"Non-conformant Echo SCP detected: C-ECHO response contains a "
 			"dataset. Ignoring."
 		);
@@ -654,7 +991,7 @@ bool ServiceUser::validateCFindResponse(
 		case STATUS_Success :
 			break;
 		case STATUS_FIND_Pending_WarningUnsupportedOptionalKeys :
-			qWarning(
+			QDICOM_LOG( Dimse, Warning,
 				"One or more Optional Keys were not "
 				"supported for existence and/or matching "
 				"for this Identifier."
@@ -662,13 +999,13 @@ bool ServiceUser::validateCFindResponse(
 			// Fallthrough
 		case STATUS_Pending : {
 			if ( ResponseParameters.DataSetType != DIMSE_DATASET_PRESENT ) {
-				qWarning( "Recieved pending status without a dataset." );
+				QDICOM_LOG( Dimse, Warning, "Recieved pending status without a dataset." );
 			}
 			finished = false;
 			break;
 		}
 		case STATUS_FIND_Refused_OutOfResources :
-			qWarning(
+			QDICOM_LOG( Dimse, Warning,
 				"Received status: `Refused: Out of Resources'."
 			);
 			break;
@@ -677,7 +1014,7 @@ bool ServiceUser::validateCFindResponse(
 				"Received status: `Identifier does not match SOP Class'."
 			);
 		case STATUS_FIND_Cancel_MatchingTerminatedDueToCancelRequest :
-			qDebug(
+			QDICOM_LOG( Dimse, Debug,
 				"Received status: `Matching Terminated Due To Cancel Request'."
 			);
 			break;
@@ -688,7 +1025,7 @@ bool ServiceUser::validateCFindResponse(
 				);
 			}
 			else {
-				qWarning(
+				QDICOM_LOG( Dimse, Warning,
 					"Unknown status received: 0x%04X",
 					( int )ResponseParameters.DimseStatus
 				);
@@ -700,6 +1037,82 @@ bool ServiceUser::validateCFindResponse(
 }
 
 
+bool ServiceUser::validateCGetResponse(
+	const T_DIMSE_Message & Response,
+	const T_DIMSE_Message & Request
+) {
+	Q_ASSERT( Response.CommandField == DIMSE_C_GET_RSP );
+
+	const T_DIMSE_C_GetRSP ResponseParameters = Response.msg.CGetRSP;
+	const T_DIMSE_C_GetRQ  RequestParameters =  Request.msg.CGetRQ;
+
+	if ( 
+		ResponseParameters.MessageIDBeingRespondedTo != 
+		RequestParameters.MessageID
+	) {
+		throw OperationFailedException(
+			QString( 
+				"Response's Message ID is different than request's: %1 vs %2"
+			)
+			.arg( ResponseParameters.MessageIDBeingRespondedTo )
+			.arg( RequestParameters.MessageID )
+		);
+	}
+
+	// Those status codes that do not include the number of 
+	// Completed/Failed/Warned sub-operations throw an exception.
+	bool finished = true;
+	switch ( ResponseParameters.DimseStatus ) {
+		case STATUS_Success :
+			break;
+		case STATUS_Pending :
+			finished = false;
+			break;
+		case STATUS_GET_Refused_OutOfResourcesNumberOfMatches :
+			throw OperationFailedException(
+				"Received status: `Refused: Out of Resources - "
+				"Unable to calculate number of matches'."
+			);
+		case STATUS_GET_Refused_OutOfResourcesSubOperations :
+			raiseError(
+				"Received status: `Refused: Out of Resources - "
+				"Unable to perform sub-operations'."
+			);
+			break;
+		case STATUS_GET_Failed_IdentifierDoesNotMatchSOPClass :
+			throw OperationFailedException(
+				"Received status: `Identifier does not match SOP Class'."
+			);
+		case STATUS_GET_Cancel_SubOperationsTerminatedDueToCancelIndication :
+			QDICOM_LOG( Dimse, Debug,
+				"Received status: `Sub-operations terminated due to Cancel Indication'."
+			);
+			break;
+		case STATUS_GET_Warning_SubOperationsCompleteOneOrMoreFailures :
+			QDICOM_LOG( Dimse, Warning,
+				"Received status: `Sub-operations Complete - "
+				"One or more Failures'."
+			);
+			break;
+		default :
+			if ( ( ResponseParameters.DimseStatus & 0xF000 ) == 0xC000  ) {
+				throw OperationFailedException(
+					"Received status: `Unable to process'."
+				);
+			}
+			else {
+				QDICOM_LOG( Dimse, Warning,
+					"Unrecognized status received: 0x%04X.",
+					( int )ResponseParameters.DimseStatus
+				);
+				finished = true;
+			}
+	};
+
+	return finished;
+}
+
+
 bool ServiceUser::validateCMoveResponse(
 	const T_DIMSE_Message & Response,
 	const T_DIMSE_Message & Request
@@ -751,12 +1164,12 @@ bool ServiceUser::validateCMoveResponse(
 				"Received status: `Identifier does not match SOP Class'."
 			);
 		case STATUS_MOVE_Cancel_SubOperationsTerminatedDueToCancelIndication :
-			qDebug(
+			QDICOM_LOG( Dimse, Debug,
 				"Received status: `Sub-operations terminated due to Cancel Indication'."
 			);
 			break;
 		case STATUS_MOVE_Warning_SubOperationsCompleteOneOrMoreFailures :
-			qWarning(
+			QDICOM_LOG( Dimse, Warning,
 				"Received status: `Sub-operations Complete - "
 				"One or more Failures'."
 			);
@@ -768,7 +1181,7 @@ bool ServiceUser::validateCMoveResponse(
 				);
 			}
 			else {
-				qWarning(
+				QDICOM_LOG( Dimse, Warning,
 					"Unrecognized status received: 0x%04X.",
 					( int )ResponseParameters.DimseStatus
 				);
@@ -803,7 +1216,7 @@ void ServiceUser::validateCStoreResponse(
 	}
 
 	if ( ResponseParameters.DataSetType != DIMSE_DATASET_NULL ) {
-		qWarning( 
+		QDICOM_LOG( Dimse, Warning,
 			"Non-conformant Store SCP detected: C-STORE response contains a "
 			"dataset. Ignoring."
 		);
@@ -846,10 +1259,10 @@ void ServiceUser::validateCStoreResponse(
 	}
 
 	if ( message ) {
-		qWarning( "Response status: `%s'", message );
+		QDICOM_LOG( Dimse, Warning, "Response status: `%s'", message );
 	}
 	else {
-		qWarning( "Unknown Response status: 0x%04X", Status );
+		QDICOM_LOG( Dimse, Warning, "Unknown Response status: 0x%04X", Status );
 	}
 }
 
@@ -881,7 +1294,7 @@ void ServiceUser::validateNCreateResponse(
 			ResponseParameters.AffectedSOPInstanceUID[ 0 ] &&
 			RequestParameters.AffectedSOPInstanceUID[ 0 ]
 		) {
-			qWarning( 
+			QDICOM_LOG( Dimse, Warning,
 				"Non-conformant N-service-provider detected: "
 				"both N-CREATE request and response contain the Affected SOP "
 				"Instance UID. Ignoring."
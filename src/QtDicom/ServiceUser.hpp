@@ -9,16 +9,22 @@
 #include "QtDicom/AbstractService.hpp"
 #include "QtDicom/Association.hpp"
 #include "QtDicom/Dataset.hpp"
+#include "QtDicom/FindHandler.hpp"
 #include "QtDicom/Globals.hpp"
 
 
 class DcmDataset;
+class DcmOutputFileStream;
+class QtDicomTest;
 
+struct T_DIMSE_C_StoreRQ;
 struct T_DIMSE_Message;
 
 namespace Dicom {
 
 class QDICOM_DLLSPEC ServiceUser : public AbstractService {
+	friend class ::QtDicomTest;
+
 	public :
 		ServiceUser();
 		ServiceUser( Association * association );
@@ -46,6 +52,52 @@ class QDICOM_DLLSPEC ServiceUser : public AbstractService {
 			const Dataset & dataset, const char * SOP
 		);
 
+		/**
+		 * Performs a C-FIND operation, passing identifiers to the \a handler
+		 * as they arrive.
+		 *
+		 * The operation is cancelled with a C-CANCEL request once the \a
+		 * handler returns \c false, \a maxResults identifiers have been
+		 * handled or \a deadline milliseconds have passed; zero disables a
+		 * limit. Responses following the cancellation are received and
+		 * discarded. The \a cancelled flag, if given, tells whether that
+		 * happened.
+		 *
+		 * Returns the number of identifiers handled or \c -1 in case of an
+		 * error; the \ref hasError() returns \c true then.
+		 */
+		int cFind(
+			const Dataset & dataset, const char * SOP,
+			FindHandler & handler,
+			int maxResults = 0, int deadline = 0,
+			bool * cancelled = 0
+		);
+
+		/**
+		 * Performs a C-GET operation.
+		 *
+		 * Selects one or more SOP Instances from called AE using unique key
+		 * elements stored in the \a dataset and with corresponding \a SOP
+		 * class; the called AE sends them back over the same association with
+		 * C-STORE sub-operations, which requires presentation contexts of
+		 * their storage SOP classes to be negotiated in the \ref
+		 * QPresentationContext::ScpRole. Each instance is written, as it
+		 * arrives, to a Part 10 file with the File Meta Information, named
+		 * after its SOP Instance UID in the \a
+		 * directory; UIDs unsafe as file names are replaced with their hash.
+		 * Existing files are never overwritten, an instance received again
+		 * gets a number appended to its name.
+		 *
+		 * Returns a number of completed sub-operations, with the \a failed,
+		 * \a failedInstances and \a warned output parameters and the error
+		 * handling as in \ref cMove().
+		 */
+		int cGet(
+			const Dataset & dataset, const char * SOP, const QString & directory,
+			int * failed = 0, UidList * failedInstances = 0,
+			int * warned = 0
+		);
+
 		/**
 		 * Performs a C-MOVE operation.
 		 *
@@ -119,8 +171,82 @@ class QDICOM_DLLSPEC ServiceUser : public AbstractService {
 			quint16 * status = 0
 		);
 
+	protected :
+		/**
+		 * Called by \ref cGet() for each pending response with the numbers
+		 * of \a remaining, \a completed, \a failed and \a warned
+		 * sub-operations; those the peer didn't report are \c -1.
+		 *
+		 * The default implementation does nothing.
+		 */
+		virtual void cGetProgressed(
+			int remaining, int completed, int failed, int warned
+		);
+
+		/**
+		 * Called by \ref cGet() once the instance of the \a sopInstanceUid
+		 * has been written to the file in the \a path.
+		 *
+		 * The default implementation does nothing.
+		 */
+		virtual void cGetStored(
+			const QByteArray & sopInstanceUid, const QString & path
+		);
+
+		/**
+		 * Called by \ref cMove() for each pending response with the numbers
+		 * of \a remaining, \a completed, \a failed and \a warned
+		 * sub-operations; those the peer didn't report are \c -1.
+		 *
+		 * The default implementation does nothing.
+		 */
+		virtual void cMoveProgressed(
+			int remaining, int completed, int failed, int warned
+		);
+
+		/**
+		 * Called by \ref cMove() right before the request of the \a
+		 * messageId is sent. Store sub-operations on behalf of the request
+		 * carry the ID as their Move Originator Message ID.
+		 *
+		 * The default implementation does nothing.
+		 */
+		virtual void sendingCMove( quint16 messageId );
 
 	private :
+		/**
+		 * Creates a Part 10 file, with File Meta Information, for the Data
+		 * Set of the C-STORE sub-operation \a request of a C-GET, received
+		 * on the presentation context \a ID of the \a association. The file
+		 * is created in the \a directory and named after the SOP Instance,
+		 * numbered if the name is taken. Returns a stream writing to it,
+		 * owned by the caller, or \c 0 in case of an error; the \a path
+		 * receives the path of the file.
+		 */
+		static DcmOutputFileStream * createCGetFile(
+			const T_DIMSE_C_StoreRQ & request,
+			T_ASC_Association * association,
+			unsigned char ID,
+			const QString & directory,
+			QString & path
+		);
+
+		/**
+		 * Sends a C-CANCEL request for the request of the \a messageId using
+		 * the presentation context \a ID.
+		 */
+		void sendCCancel( quint16 messageId, unsigned char ID );
+
+		/**
+		 * Receives the Data Set of the C-STORE sub-operation \a request of a
+		 * C-GET into a file in the \a directory and responds to it.
+		 */
+		void storeCGetInstance(
+			const T_DIMSE_C_StoreRQ & request,
+			unsigned char ID,
+			const QString & directory
+		);
+
 		/**
 		 * Validates a C-ECHO \a response which was received after issuing the
 		 * \a request. Method throws an exception if any abnormality is found.
@@ -142,6 +268,17 @@ class QDICOM_DLLSPEC ServiceUser : public AbstractService {
 		);
 
 
+		/**
+		 * Validates a C-GET \a response which was received after sending the
+		 * \a request. Throws an exception if any abnormality is found.
+		 *
+		 * Returns \c true if \a response was final.
+		 */
+		bool validateCGetResponse(
+			const T_DIMSE_Message & response,
+			const T_DIMSE_Message & request
+		);
+
 		/**
 		 * Validates a C-MOVE \a response which was received after sending the
 		 * \a request. Throws an exception if any abnormality is found.
@@ -5,7 +5,14 @@
 
 #include "StorageScp.hpp"
 #include "StorageScp.moc.inl"
+#include "StorageScpCompressor.hpp"
+#include "StorageScpConsumerPool.hpp"
+#include "StorageScpDiskSink.hpp"
+#include "StorageScpInstanceIndex.hpp"
+#include "StorageScpReceiverPool.hpp"
 #include "StorageScpReceiverThread.hpp"
+#include "StorageScpResourceMonitor.hpp"
+#include "StorageScpSpool.hpp"
 
 #include "QtDicom/AcceptorAssociation.hpp"
 
@@ -13,19 +20,58 @@ namespace Dicom {
 
 StorageScp::StorageScp( QObject * parent ) :
 	QObject( parent ),
-	destination_( Disk )
+	asyncFileWrites_( false ),
+	compressionCapacity_( 32 ),
+	compressionThreads_( 1 ),
+	consumerCapacity_( 64 ),
+	consumerThreads_( 1 ),
+	datasetConsumer_( 0 ),
+	destination_( Disk ),
+	directoryLayout_( Hashed ),
+	duplicateContentCompared_( false ),
+	duplicatePolicy_( KeepBoth ),
+	durability_( NoSync ),
+	executionMode_( ThreadPerAssociation ),
+	groupCommitInterval_( 10 ),
+	maxActiveAssociations_( 0 ),
+	maxInFlightBytes_( 0 ),
+	maxPendingAssociations_( 0 ),
+	maxWorkerThreads_( QThread::idealThreadCount() ),
+	minFreeDiskSpace_( 0 ),
+	receiverPool_( 0 ),
+	streamSink_( 0 )
 {
 }
 
 StorageScp::StorageScp( Destination dst, QObject * parent ) :
 	QObject( parent ),
-	destination_( dst )
+	asyncFileWrites_( false ),
+	compressionCapacity_( 32 ),
+	compressionThreads_( 1 ),
+	consumerCapacity_( 64 ),
+	consumerThreads_( 1 ),
+	datasetConsumer_( 0 ),
+	destination_( dst ),
+	directoryLayout_( Hashed ),
+	duplicateContentCompared_( false ),
+	duplicatePolicy_( KeepBoth ),
+	durability_( NoSync ),
+	executionMode_( ThreadPerAssociation ),
+	groupCommitInterval_( 10 ),
+	maxActiveAssociations_( 0 ),
+	maxInFlightBytes_( 0 ),
+	maxPendingAssociations_( 0 ),
+	maxWorkerThreads_( QThread::idealThreadCount() ),
+	minFreeDiskSpace_( 0 ),
+	receiverPool_( 0 ),
+	streamSink_( 0 )
 {
 	Q_ASSERT( dst != Unknown );
 }
 
 
 StorageScp::~StorageScp() {
+	delete receiverPool_;
 }
 
 
@@ -39,6 +85,11 @@ const AssociationServer & StorageScp::associationServer() const {
 }
 
 
+bool StorageScp::asyncFileWrites() const {
+	return asyncFileWrites_;
+}
+
+
 void StorageScp::createReceiverThread() {
 	Q_ASSERT( associationServer().hasPendingConnections() );
 	AcceptorAssociation * association = reinterpret_cast< AcceptorAssociation * >(
@@ -49,7 +100,14 @@ void StorageScp::createReceiverThread() {
 	lastCalledAe_ = association->calledAeTitle();
 
 	ReceiverThread * thread = new ReceiverThread( association, destination(), this );
-	thread->start();
+	thread->setAsyncFileWrites( asyncFileWrites() );
+	thread->setCompressor( compressor_ );
+	thread->setConsumerPool( consumerPool_ );
+	thread->setDiskSink( diskSink_ );
+	thread->setInstanceIndex( instanceIndex_ );
+	thread->setResourceMonitor( resourceMonitor_ );
+	thread->setSpool( spool_ );
+	thread->setStreamSink( streamSink() );
 	connect( 
 		thread, SIGNAL( stored( QString ) ),
 		SIGNAL( stored( QString ) )
@@ -63,9 +121,34 @@ void StorageScp::createReceiverThread() {
 		SIGNAL( failedToStore( QString ) )
 	);
 	connect(
-		thread, SIGNAL( finished() ),
-		thread, SLOT( deleteLater() )
+		thread, SIGNAL( instanceReceived( QString, QString, QString, int, int ) ),
+		SIGNAL( instanceReceived( QString, QString, QString, int, int ) ),
+		Qt::DirectConnection
 	);
+
+	if ( receiverPool_ ) {
+		if ( ! receiverPool_->submit( thread ) ) {
+			thread->abandon( "Too many associations pending." );
+			delete thread;
+		}
+	}
+	else {
+		connect(
+			thread, SIGNAL( finished() ),
+			thread, SLOT( deleteLater() )
+		);
+		thread->start();
+	}
+}
+
+
+const QTransferSyntax & StorageScp::compressionSyntax() const {
+	return compressionSyntax_;
+}
+
+
+DatasetConsumer * StorageScp::datasetConsumer() const {
+	return datasetConsumer_;
 }
 
 
@@ -83,6 +166,7 @@ const QString & StorageScp::destinationString( Destination dst ) {
 		}
 		CASE( Disk );
 		CASE( Memory );
+		CASE( Stream );
 #undef CASE
 		default : {
 			static const QString Unknown = "Unknown";
@@ -95,6 +179,7 @@ const QString & StorageScp::destinationString( Destination dst ) {
 StorageScp::Destination StorageScp::destinationFromString( const QString & Value ) {
 	static const QString & DiskString = destinationString( Disk );
 	static const QString & MemoryString = destinationString( Memory );
+	static const QString & StreamString = destinationString( Stream );
 
 	if ( Value.compare( DiskString, Qt::CaseInsensitive ) == 0 ) {
 		return Disk;
@@ -102,17 +187,50 @@ StorageScp::Destination StorageScp::destinationFromString( const QString & Value
 	else if ( Value.compare( MemoryString, Qt::CaseInsensitive ) == 0 ) {
 		return Memory;
 	}
+	else if ( Value.compare( StreamString, Qt::CaseInsensitive ) == 0 ) {
+		return Stream;
+	}
 	else {
 		return Unknown;
 	}
 }
 
 
+StorageScp::DirectoryLayout StorageScp::directoryLayout() const {
+	return directoryLayout_;
+}
+
+
+StorageScp::DuplicatePolicy StorageScp::duplicatePolicy() const {
+	return duplicatePolicy_;
+}
+
+
+bool StorageScp::duplicatesComparedByContent() const {
+	return duplicateContentCompared_;
+}
+
+
+StorageScp::Durability StorageScp::durability() const {
+	return durability_;
+}
+
+
 QString StorageScp::errorString() const {
 	return errorString_;
 }
 
 
+StorageScp::ExecutionMode StorageScp::executionMode() const {
+	return executionMode_;
+}
+
+
+int StorageScp::groupCommitInterval() const {
+	return groupCommitInterval_;
+}
+
+
 const QString & StorageScp::lastAe() const {
 	return lastAe_;
 }
@@ -123,17 +241,245 @@ const QString & StorageScp::lastCalledAe() const {
 }
 
 
+int StorageScp::listenerShards() const {
+	return associationServer().listenerShards();
+}
+
+
+int StorageScp::maxActiveAssociations() const {
+	return maxActiveAssociations_;
+}
+
+
+int StorageScp::maxAssociations() const {
+	return associationServer().maxAssociations();
+}
+
+
+int StorageScp::maxAssociationsPerAe() const {
+	return associationServer().maxAssociationsPerAe();
+}
+
+
+qint64 StorageScp::maxInFlightBytes() const {
+	return maxInFlightBytes_;
+}
+
+
+int StorageScp::maxPendingAssociations() const {
+	return maxPendingAssociations_;
+}
+
+
+int StorageScp::maxWorkerThreads() const {
+	return maxWorkerThreads_;
+}
+
+
+qint64 StorageScp::minFreeDiskSpace() const {
+	return minFreeDiskSpace_;
+}
+
+
+void StorageScp::raiseError( const QString & Description ) {
+	errorString_ = Description;
+}
+
+
+void StorageScp::setAsyncFileWrites( bool enabled ) {
+	asyncFileWrites_ = enabled;
+}
+
+
+void StorageScp::setCompression(
+	const QTransferSyntax & Syntax, int threads, int capacity
+) {
+	compressionSyntax_ = Syntax;
+	compressionThreads_ = qMax( 1, threads );
+	compressionCapacity_ = qMax( 1, capacity );
+}
+
+
+void StorageScp::setDatasetConsumer(
+	DatasetConsumer * consumer, int threads, int capacity
+) {
+	datasetConsumer_ = consumer;
+	consumerThreads_ = qMax( 1, threads );
+	consumerCapacity_ = qMax( 1, capacity );
+}
+
+
 void StorageScp::setDestination( Destination destination ) {
 	destination_ = destination;
 }
 
 
+void StorageScp::setDirectoryLayout( DirectoryLayout layout ) {
+	directoryLayout_ = layout;
+}
+
+
+void StorageScp::setDuplicatePolicy(
+	DuplicatePolicy policy, bool compareContent
+) {
+	duplicatePolicy_ = policy;
+	duplicateContentCompared_ = compareContent;
+}
+
+
+void StorageScp::setDurability( Durability durability, int interval ) {
+	durability_ = durability;
+	groupCommitInterval_ = qMax( 0, interval );
+}
+
+
+void StorageScp::setExecutionMode( ExecutionMode mode ) {
+	executionMode_ = mode;
+}
+
+
+void StorageScp::setListenerShards( int count ) {
+	associationServer().setListenerShards( count );
+}
+
+
+void StorageScp::setMaxActiveAssociations( int count ) {
+	maxActiveAssociations_ = qMax( 0, count );
+	if ( receiverPool_ ) {
+		receiverPool_->setMaxActiveSessions( maxActiveAssociations_ );
+	}
+}
+
+
+void StorageScp::setMaxAssociations( int count ) {
+	associationServer().setMaxAssociations( count );
+}
+
+
+void StorageScp::setMaxAssociationsPerAe( int count ) {
+	associationServer().setMaxAssociationsPerAe( count );
+}
+
+
+void StorageScp::setMaxInFlightBytes( qint64 bytes ) {
+	maxInFlightBytes_ = qMax( Q_INT64_C( 0 ), bytes );
+}
+
+
+void StorageScp::setMaxPendingAssociations( int count ) {
+	maxPendingAssociations_ = qMax( 0, count );
+	if ( receiverPool_ ) {
+		receiverPool_->setMaxPendingSessions( maxPendingAssociations_ );
+	}
+}
+
+
+void StorageScp::setMaxWorkerThreads( int count ) {
+	maxWorkerThreads_ = qMax( 1, count );
+	if ( receiverPool_ ) {
+		receiverPool_->setMaxWorkerThreads( maxWorkerThreads_ );
+	}
+}
+
+
+void StorageScp::setMinFreeDiskSpace( qint64 bytes ) {
+	minFreeDiskSpace_ = qMax( Q_INT64_C( 0 ), bytes );
+}
+
+
+void StorageScp::setStorageRoot( const QString & path ) {
+	storageRoot_ = path;
+}
+
+
+void StorageScp::setStreamSink( StorageStreamSink * sink ) {
+	streamSink_ = sink;
+}
+
+
 bool StorageScp::start( const ConnectionParameters & Parameters ) {
+	if ( destination() == Stream && ! streamSink() ) {
+		raiseError( "No stream sink set." );
+		qWarning( qPrintable( errorString() ) );
+		return false;
+	}
+
 	associationServer().setAbstractSyntaxes( 
 		UidList::storageSopClasses() + UidList::echoSopClass()
 	);
 	associationServer().setTransferSyntaxes( UidList::supportedTransferSyntaxes() );
 	if ( associationServer().listen( Parameters ) ) {
+		if ( destination() == Disk && duplicatePolicy() != KeepBoth ) {
+			instanceIndex_ = QSharedPointer< InstanceIndex >( new InstanceIndex(
+				duplicatePolicy(), duplicatesComparedByContent(),
+				storageRoot().isEmpty() ?
+					QString() :
+					QDir( storageRoot() ).absoluteFilePath( "instances.idx" )
+			) );
+		}
+
+		if ( destination() == Disk && compressionSyntax().isCompressed() ) {
+			compressor_ = QSharedPointer< Compressor >( new Compressor(
+				compressionSyntax(), compressionThreads_, compressionCapacity_,
+				durability() != NoSync
+			) );
+			connect(
+				compressor_.data(), SIGNAL( compressed( QString, double, int ) ),
+				SIGNAL( compressed( QString, double, int ) )
+			);
+		}
+
+		// The spool's compactor indexes and compresses the instances
+		if (
+			destination() == Disk && ! storageRoot().isEmpty() &&
+			durability() == Journaled
+		) {
+			spool_ = QSharedPointer< Spool >( new Spool(
+				QDir( storageRoot() ), directoryLayout(),
+				duplicatePolicy() == OverwriteDuplicates, groupCommitInterval(),
+				instanceIndex_, compressor_
+			) );
+			connect(
+				spool_.data(), SIGNAL( compacted( QString ) ),
+				SIGNAL( stored( QString ) )
+			);
+			connect(
+				spool_.data(), SIGNAL( failedToCompact( QString ) ),
+				SIGNAL( failedToStore( QString ) )
+			);
+		}
+		else if ( destination() == Disk && ! storageRoot().isEmpty() ) {
+			diskSink_ = QSharedPointer< DiskSink >( new DiskSink(
+				QDir( storageRoot() ), directoryLayout(),
+				durability(), groupCommitInterval(),
+				duplicatePolicy() == OverwriteDuplicates
+			) );
+		}
+
+		if ( destination() == Memory && datasetConsumer() ) {
+			consumerPool_ = QSharedPointer< ConsumerPool >( new ConsumerPool(
+				datasetConsumer(), consumerThreads_, consumerCapacity_
+			) );
+		}
+
+		const qint64 MinFreeSpace = destination() == Disk ? minFreeDiskSpace() : 0;
+		if ( maxInFlightBytes() > 0 || MinFreeSpace > 0 ) {
+			resourceMonitor_ = QSharedPointer< ResourceMonitor >(
+				new ResourceMonitor(
+					maxInFlightBytes(), MinFreeSpace,
+					storageRoot().isEmpty() ? QDir::tempPath() : storageRoot()
+				)
+			);
+		}
+
+		if ( executionMode() == WorkerPool && ! receiverPool_ ) {
+			receiverPool_ = new ReceiverPool();
+			receiverPool_->setMaxActiveSessions( maxActiveAssociations() );
+			receiverPool_->setMaxPendingSessions( maxPendingAssociations() );
+			receiverPool_->setMaxWorkerThreads( maxWorkerThreads() );
+			receiverPool_->start();
+		}
+
 		connect(
 			&associationServer(), SIGNAL( newAssociation() ),
 			SLOT( createReceiverThread() )
@@ -155,6 +501,30 @@ void StorageScp::stop() {
 	if ( associationServer().isListening() ) {
 		associationServer().close();
 	}
+
+	if ( receiverPool_ ) {
+		receiverPool_->stop();
+		delete receiverPool_;
+		receiverPool_ = 0;
+	}
+
+	// Receivers still running keep their references
+	compressor_.clear();
+	consumerPool_.clear();
+	diskSink_.clear();
+	instanceIndex_.clear();
+	resourceMonitor_.clear();
+	spool_.clear();
+}
+
+
+const QString & StorageScp::storageRoot() const {
+	return storageRoot_;
+}
+
+
+StorageStreamSink * StorageScp::streamSink() const {
+	return streamSink_;
 }
 
 }; // Namespace DICOM ends here.
@@ -8,15 +8,22 @@
 
 #include <QtCore/QDir>
 #include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
 
 #include "QtDicom/AssociationServer.hpp"
 #include "QtDicom/ConnectionParameters.hpp"
 #include "QtDicom/Dataset.hpp"
 #include "QtDicom/Globals.hpp"
+#include "QtDicom/QTransferSyntax.hpp"
+
+class QtDicomTest;
 
 
 namespace Dicom {
 
+class DatasetConsumer;
+class StorageStreamSink;
+
 /**
  * The Storage SCP object allows to receive and save DICOM datasets sent with a
  * C-STORE DIMSE command.
@@ -24,11 +31,49 @@ namespace Dicom {
  * Storage SCP object allows to choose where incoming Data Sets should be stored.
  * Either to a disk, using temporary folder, or to memory.
  *
+ * Data Sets stored to disk land in the system's temporary directory unless a
+ * \ref storageRoot() is set. Files are then named after their SOP Instance
+ * UIDs and placed according to the \ref directoryLayout(); the \ref
+ * durability() decides whether a file is flushed to the disk before its
+ * storage is confirmed to the peer. In the \ref Journaled mode Data Sets are
+ * received into a write-ahead spool in the \c spool subdirectory of the root
+ * instead, and the \ref stored() signal is emitted once they are moved into
+ * the layout.
+ *
+ * Files can also be compressed on ingest: with a \ref compressionSyntax()
+ * set, images received uncompressed are transcoded in the background, after
+ * their storage has been confirmed, and the \ref compressed() signal reports
+ * the ratio achieved.
+ *
+ * Modalities often send whole studies again. With a \ref duplicatePolicy()
+ * other than \ref KeepBoth, instances stored to disk are indexed by their SOP
+ * Instance UIDs, and duplicates can be acknowledged without being stored
+ * again. The index is persisted in the \ref storageRoot(), if set.
+ *
+ * In the \ref Memory mode Data Sets are emitted with the \ref stored() signal,
+ * unless a \ref DatasetConsumer is set; Data Sets are then handed over to it
+ * on consumer threads, without involving the event loop.
+ *
+ * In the \ref Stream mode Data Sets aren't stored at all; their raw bytes are
+ * passed to the \ref streamSink() as they arrive.
+ *
+ * Under overload the SCP sheds load instead of thrashing. Associations above
+ * \ref maxAssociations(), in total or from a single AE, are rejected as
+ * transient, while instances arriving when too many bytes are being received
+ * or the disk is nearly full are refused with an out-of-resources status.
+ *
+ * By default each association is served by its own thread. With many
+ * concurrent, mostly idle peers the \ref WorkerPool \ref executionMode() can
+ * be chosen instead; associations are then served by a bounded pool of worker
+ * threads which pick them up only when commands arrive.
+ *
  * \author Paweł Żak <pawel.zak@fluxinc.ca>
  */
 class QDICOM_DLLSPEC StorageScp : public QObject {
 	Q_OBJECT;
 
+	friend class ::QtDicomTest;
+
 	public :
 		/**
 		 * Specifies place where incoming Data Sets will be stored.
@@ -36,7 +81,49 @@ class QDICOM_DLLSPEC StorageScp : public QObject {
 		enum Destination {
 			Unknown,
 			Disk,   /*< System's temporary storage space. */
-			Memory  /*< \ref Dataset struture. */
+			Memory, /*< \ref Dataset struture. */
+			Stream  /*< \ref StorageStreamSink, as data arrives. */
+		};
+
+		/**
+		 * Specifies how files are laid out in the \ref storageRoot().
+		 */
+		enum DirectoryLayout {
+			Flat,         /*< All files directly in the root. */
+			Hashed,       /*< Two levels of directories picked by UID's hash. */
+			StudySharded  /*< A directory per study; instances without
+			                  a readable study are hashed. */
+		};
+
+		/**
+		 * Specifies what happens to instances which have been stored before.
+		 */
+		enum DuplicatePolicy {
+			KeepBoth,            /*< Duplicates are stored next to the
+			                         previous files. */
+			IgnoreDuplicates,    /*< Duplicates are acknowledged and dropped,
+			                         without being received if possible. */
+			OverwriteDuplicates  /*< Duplicates replace the previous files. */
+		};
+
+		/**
+		 * Specifies when files are flushed to the disk.
+		 */
+		enum Durability {
+			NoSync,       /*< Flushing is left to the system. */
+			FileSync,     /*< Each file is flushed before it is confirmed. */
+			GroupCommit,  /*< Files are flushed in groups, see \ref
+			                  groupCommitInterval(). */
+			Journaled     /*< Data Sets are appended to a journal flushed in
+			                  groups and moved into place in the background. */
+		};
+
+		/**
+		 * Specifies how threads are assigned to accepted associations.
+		 */
+		enum ExecutionMode {
+			ThreadPerAssociation, /*< Each association has a dedicated thread. */
+			WorkerPool            /*< Associations share a pool of workers. */
 		};
 
 	public :
@@ -67,17 +154,67 @@ class QDICOM_DLLSPEC StorageScp : public QObject {
 		 */
 		~StorageScp();
 
+		/**
+		 * Returns \c true if received files are written in the background.
+		 */
+		bool asyncFileWrites() const;
+
+		/**
+		 * Returns the syntax received images are compressed to or an invalid
+		 * syntax if compression is disabled.
+		 */
+		const QTransferSyntax & compressionSyntax() const;
+
+		/**
+		 * Returns the consumer of Data Sets received to memory or \c 0 if
+		 * none was set.
+		 */
+		DatasetConsumer * datasetConsumer() const;
+
 		/**
 		 * Returns the directory where Storage SCP will attempt to save incoming
 		 * dataset.
 		 */
 		Destination destination() const;
 
+		/**
+		 * Returns the layout of files in the \ref storageRoot().
+		 */
+		DirectoryLayout directoryLayout() const;
+
+		/**
+		 * Returns what happens to instances which have been stored before.
+		 */
+		DuplicatePolicy duplicatePolicy() const;
+
+		/**
+		 * Returns \c true if duplicates are recognized by their content in
+		 * addition to SOP Instance UIDs.
+		 */
+		bool duplicatesComparedByContent() const;
+
+		/**
+		 * Returns when received files are flushed to the disk.
+		 */
+		Durability durability() const;
+
 		/**
 		 * Returns human-readable description of the last occured error.
 		 */
 		QString errorString() const;
 
+		/**
+		 * Returns the way accepted associations are served.
+		 */
+		ExecutionMode executionMode() const;
+
+		/**
+		 * Returns the interval, in milliseconds, in which files are gathered
+		 * before being flushed together in the \ref GroupCommit and \ref
+		 * Journaled modes.
+		 */
+		int groupCommitInterval() const;
+
 		/**
 		 * Returns AE title of last-connected node.
 		 */
@@ -88,11 +225,197 @@ class QDICOM_DLLSPEC StorageScp : public QObject {
 		 */
 		const QString & lastCalledAe() const;
 
+		/**
+		 * Returns the number of sockets listening on the SCP's port.
+		 */
+		int listenerShards() const;
+
+		/**
+		 * Returns the maximum number of associations open at once; \c 0
+		 * means no limit.
+		 */
+		int maxAssociations() const;
+
+		/**
+		 * Returns the maximum number of associations open at once by a single
+		 * calling AE; \c 0 means no limit.
+		 */
+		int maxAssociationsPerAe() const;
+
+		/**
+		 * Returns the maximum number of associations served at once in the
+		 * \ref WorkerPool mode; \c 0 means no limit.
+		 */
+		int maxActiveAssociations() const;
+
+		/**
+		 * Returns the maximum number of associations waiting for the active
+		 * ones to finish in the \ref WorkerPool mode; \c 0 means no limit.
+		 */
+		int maxPendingAssociations() const;
+
+		/**
+		 * Returns the maximum number of bytes of Data Sets being received at
+		 * once; \c 0 means no limit.
+		 */
+		qint64 maxInFlightBytes() const;
+
+		/**
+		 * Returns the number of worker threads used in the \ref WorkerPool
+		 * mode.
+		 */
+		int maxWorkerThreads() const;
+
+		/**
+		 * Returns the number of bytes which has to remain free on the disk
+		 * Data Sets are stored on; \c 0 means no limit.
+		 */
+		qint64 minFreeDiskSpace() const;
+
 		/**
 		 * Sets the \a directory where Storage SCP will drop received datasets.
 		 */
+		/**
+		 * Sets whether received files are written to the disk by background
+		 * writers, so receivers keep reading from network while the disk
+		 * catches up. Disabled by default.
+		 */
+		void setAsyncFileWrites( bool enabled );
+
+		/**
+		 * Sets the lossless \a syntax, e.g. JPEG-LS Lossless or RLE, files
+		 * received in the \ref Disk mode are compressed to. Compression runs
+		 * on \a threads threads; when more than \a capacity files wait, the
+		 * following ones are left uncompressed. Invalid syntax, the default,
+		 * disables compression.
+		 *
+		 * Setting takes effect when the SCP is started.
+		 */
+		void setCompression(
+			const QTransferSyntax & syntax, int threads = 1, int capacity = 32
+		);
+
+		/**
+		 * Sets the \a consumer of Data Sets received in the \ref Memory mode.
+		 * The consumer is called from \a threads consumer threads; at most
+		 * \a capacity Data Sets wait for or are being consumed, when more
+		 * arrive receivers stop reading from their peers.
+		 *
+		 * Consumer isn't owned by the SCP and has to stay alive until it
+		 * stops. Setting takes effect when the SCP is started.
+		 */
+		void setDatasetConsumer(
+			DatasetConsumer * consumer, int threads = 1, int capacity = 64
+		);
+
 		void setDestination( Destination destination );
 
+		/**
+		 * Sets the \a layout of files in the \ref storageRoot().
+		 */
+		void setDirectoryLayout( DirectoryLayout layout );
+
+		/**
+		 * Sets the \a policy applied to instances stored to disk again.
+		 *
+		 * Without \a compareContent, instances are told apart by their SOP
+		 * Instance UIDs only; ignored duplicates are then acknowledged as
+		 * soon as their requests arrive and their data is skipped. Otherwise
+		 * data is received and hashed, and only instances identical to the
+		 * stored ones are dropped, without touching the storage. Different
+		 * ones replace the stored files only with the \ref
+		 * OverwriteDuplicates policy and are kept next to them otherwise.
+		 *
+		 * Setting takes effect when the SCP is started.
+		 */
+		void setDuplicatePolicy(
+			DuplicatePolicy policy, bool compareContent = false
+		);
+
+		/**
+		 * Sets the \a durability of received files. The \a interval is used
+		 * by the \ref GroupCommit and \ref Journaled modes. Journaling
+		 * requires the \ref storageRoot() to be set.
+		 */
+		void setDurability( Durability durability, int interval = 10 );
+
+		/**
+		 * Sets the execution \a mode. Takes effect when the Storage SCP is
+		 * started.
+		 */
+		void setExecutionMode( ExecutionMode mode );
+
+		/**
+		 * Sets the number of sockets listening on the SCP's port to \a count.
+		 * On a busy node this spreads accepting connections across cores;
+		 * see \ref AssociationServer::setListenerShards().
+		 */
+		void setListenerShards( int count );
+
+		/**
+		 * Limits the number of associations open at once to \a count.
+		 * Requests above the limit are rejected with the local limit exceeded
+		 * reason, telling requestors to retry later.
+		 */
+		void setMaxAssociations( int count );
+
+		/**
+		 * Limits the number of associations open at once by any single
+		 * calling AE to \a count.
+		 */
+		void setMaxAssociationsPerAe( int count );
+
+		/**
+		 * Limits the number of associations served at once in the \ref
+		 * WorkerPool mode to \a count. Associations accepted above the limit
+		 * wait in a queue.
+		 */
+		void setMaxActiveAssociations( int count );
+
+		/**
+		 * Limits the length of the queue of associations waiting to be served
+		 * to \a count. Associations that do not fit in are aborted.
+		 */
+		void setMaxPendingAssociations( int count );
+
+		/**
+		 * Limits the number of bytes of Data Sets being received at once by
+		 * all associations to \a bytes. Instances arriving above the limit
+		 * are refused with an out-of-resources status.
+		 *
+		 * Setting takes effect when the SCP is started.
+		 */
+		void setMaxInFlightBytes( qint64 bytes );
+
+		/**
+		 * Sets the number of worker threads used in the \ref WorkerPool mode
+		 * to \a count.
+		 */
+		void setMaxWorkerThreads( int count );
+
+		/**
+		 * Sets the number of \a bytes which has to remain free on the disk
+		 * Data Sets are stored on in the \ref Disk mode. Instances arriving
+		 * when less is available are refused with an out-of-resources status.
+		 *
+		 * Setting takes effect when the SCP is started.
+		 */
+		void setMinFreeDiskSpace( qint64 bytes );
+
+		/**
+		 * Sets the \a path of the directory received files are stored in.
+		 * Empty path stands for the system's temporary directory.
+		 *
+		 * Settings of the storage take effect when the SCP is started.
+		 */
+		void setStorageRoot( const QString & path );
+
+		/**
+		 * Sets the \a sink receiving Data Sets in the \ref Stream mode. The
+		 * sink isn't owned by the SCP and has to stay alive until it stops.
+		 */
+		void setStreamSink( StorageStreamSink * sink );
+
 		/**
 		 * Starts the Storage SCP and binds it to the TCP port number
 		 * provided in the \a parameters.
@@ -103,14 +426,62 @@ class QDICOM_DLLSPEC StorageScp : public QObject {
 		 */
 		bool start( const ConnectionParameters & parameters );
 
+		/**
+		 * Returns the path of the directory received files are stored in.
+		 */
+		const QString & storageRoot() const;
+
+		/**
+		 * Returns the sink receiving Data Sets in the \ref Stream mode.
+		 */
+		StorageStreamSink * streamSink() const;
+
 		void stop();
 
 	private :
+		/**
+		 * Forward definition of the compressor of received files.
+		 */
+		class Compressor;
+
+		/**
+		 * Forward definition of the pool feeding the \ref datasetConsumer().
+		 */
+		class ConsumerPool;
+
+		/**
+		 * Forward definition of the sink storing files in the \ref
+		 * storageRoot().
+		 */
+		class DiskSink;
+
+		/**
+		 * Forward definition of the index of stored instances.
+		 */
+		class InstanceIndex;
+
+		/**
+		 * Forward definition of the monitor of resources used by receivers.
+		 */
+		class ResourceMonitor;
+
+		/**
+		 * Forward definition of the write-ahead spool of the \ref Journaled
+		 * mode.
+		 */
+		class Spool;
+
 		/**
 		 * Forward definition of the Receiver thread.
 		 */
 		class ReceiverThread;
 
+		/**
+		 * Forward definition of the pool serving associations in the \ref
+		 * WorkerPool mode.
+		 */
+		class ReceiverPool;
+
 	private :
 		/**
 		 * Returns the associatoin server.
@@ -136,26 +507,125 @@ class QDICOM_DLLSPEC StorageScp : public QObject {
 		 */
 		AssociationServer associationServer_;
 
+		bool asyncFileWrites_;
+
+		int compressionCapacity_;
+		QTransferSyntax compressionSyntax_;
+		int compressionThreads_;
+
+		/**
+		 * The compressor; shared with receivers while the Storage SCP runs.
+		 */
+		QSharedPointer< Compressor > compressor_;
+
+		int consumerCapacity_;
+
+		/**
+		 * The consumer pool; shared with receivers while the Storage SCP runs.
+		 */
+		QSharedPointer< ConsumerPool > consumerPool_;
+
+		int consumerThreads_;
+
+		DatasetConsumer * datasetConsumer_;
+
 		/**
 		 * The destination.
 		 */
 		Destination destination_;
 
+		DirectoryLayout directoryLayout_;
+
+		bool duplicateContentCompared_;
+		DuplicatePolicy duplicatePolicy_;
+
+		/**
+		 * The disk sink; shared with receivers while the Storage SCP runs.
+		 */
+		QSharedPointer< DiskSink > diskSink_;
+
+		Durability durability_;
+
 		/**
 		 * The error string.
 		 */
 		QString errorString_;
 
+		ExecutionMode executionMode_;
+
+		int groupCommitInterval_;
+
+		/**
+		 * The index of stored instances; shared with receivers while the
+		 * Storage SCP runs.
+		 */
+		QSharedPointer< InstanceIndex > instanceIndex_;
+
 		QString lastAe_;
 		QString lastCalledAe_;
 
+		int maxActiveAssociations_;
+		qint64 maxInFlightBytes_;
+		int maxPendingAssociations_;
+		int maxWorkerThreads_;
+		qint64 minFreeDiskSpace_;
+
+		/**
+		 * The receiver pool; exists only while the Storage SCP runs in the
+		 * \ref WorkerPool mode.
+		 */
+		ReceiverPool * receiverPool_;
+
+		/**
+		 * The resource monitor; shared with receivers while the Storage SCP
+		 * runs with resource limits.
+		 */
+		QSharedPointer< ResourceMonitor > resourceMonitor_;
+
+		/**
+		 * The spool; shared with receivers while the Storage SCP runs in the
+		 * \ref Journaled mode.
+		 */
+		QSharedPointer< Spool > spool_;
+
+		QString storageRoot_;
+
+		StorageStreamSink * streamSink_;
+
 	signals :
+		/**
+		 * Signal emitted when the file in the \a path has been compressed. The
+		 * \a ratio is the original size divided by the compressed one and \a
+		 * msecs is the processor time compression took.
+		 */
+		void compressed( QString path, double ratio, int msecs );
+
 		/**
 		 * Signal emitted when the Storage SCP failed to store a file. The \a 
 		 * message parameter contains an explanation of the error.
 		 */
 		void failedToStore( QString message );
 
+		/**
+		 * Signal emitted from a receiver thread once the C-STORE request of
+		 * the \a sopInstanceUid has been responded to with the \a status,
+		 * whether the instance was stored or not. The \a path is where the
+		 * file landed in the \ref Disk mode, unless it's spooled first, and
+		 * is empty otherwise.
+		 *
+		 * Instances sent on behalf of a C-MOVE carry the \a moveOriginatorAe
+		 * and the \a moveOriginatorId, the Message ID of the C-MOVE request;
+		 * the ID is \c -1 and the AE empty for other ones. Connect with
+		 * Qt::DirectConnection to correlate them without an event loop.
+		 */
+		void instanceReceived(
+			QString sopInstanceUid,
+			QString path,
+			QString moveOriginatorAe,
+			int moveOriginatorId,
+			int status
+		);
+
 		/**
 		 * Signal emitted when the Storage SCP successfully stored a DICOM 
 		 * dataset in the \a path.
@@ -0,0 +1,207 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "Log.hpp"
+#include "StorageScpCompressor.hpp"
+#include "StorageScpCompressor.moc.inl"
+#include "StorageScpDiskSink.hpp"
+
+#include "QtDicom/Dataset.hpp"
+#include "QtDicom/QDicomImageCodec.hpp"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRunnable>
+
+#include <dcmtk/dcmdata/dcdatset.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+
+#ifdef Q_OS_WIN
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+
+namespace Dicom {
+
+/**
+ * Returns processor time, in milliseconds, consumed so far by the calling
+ * thread.
+ */
+static qint64 threadTime() {
+#ifdef Q_OS_WIN
+	FILETIME creation, exit, kernel, user;
+	if ( ! ::GetThreadTimes(
+		::GetCurrentThread(), &creation, &exit, &kernel, &user
+	) ) {
+		return 0;
+	}
+
+	// Both are expressed in 100 ns units
+	const quint64 Kernel =
+		( quint64( kernel.dwHighDateTime ) << 32 ) | kernel.dwLowDateTime
+	;
+	const quint64 User =
+		( quint64( user.dwHighDateTime ) << 32 ) | user.dwLowDateTime
+	;
+	return static_cast< qint64 >( ( Kernel + User ) / 10000 );
+#else
+	timespec time;
+	if ( ::clock_gettime( CLOCK_THREAD_CPUTIME_ID, &time ) != 0 ) {
+		return 0;
+	}
+	return qint64( time.tv_sec ) * 1000 + time.tv_nsec / 1000000;
+#endif
+}
+
+
+/**
+ * The \em Compressor::Task class compresses a single file on the pool.
+ */
+class StorageScp::Compressor::Task : public QRunnable {
+	public :
+		Task( Compressor & compressor, const QString & Path ) :
+			compressor_( compressor ),
+			path_( Path )
+		{
+		}
+
+		void run() {
+			compressor_.compress( path_ );
+			compressor_.queued_.fetchAndAddOrdered( -1 );
+		}
+
+	private :
+		Compressor & compressor_;
+		QString path_;
+};
+
+
+StorageScp::Compressor::Compressor(
+	const QTransferSyntax & Syntax,
+	int threads,
+	int capacity,
+	bool synchronized
+) :
+	capacity_( qMax( 1, capacity ) ),
+	queued_( 0 ),
+	synchronized_( synchronized ),
+	syntax_( Syntax )
+{
+	Q_ASSERT( Syntax.isCompressed() );
+
+	pool_.setMaxThreadCount( qMax( 1, threads ) );
+	QDicomImageCodec::init();
+}
+
+
+StorageScp::Compressor::~Compressor() {
+	pool_.waitForDone();
+}
+
+
+void StorageScp::Compressor::compress( const QString & Path ) {
+	const qint64 Started = threadTime();
+
+	// Received files are Part 10 ones; the syntax is read from their Meta
+	// Information, or guessed when there's none
+	DcmFileFormat file;
+	const OFCondition Result = file.loadFile(
+		QFile::encodeName( Path ).constData(), EXS_Unknown
+	);
+	if ( Result.bad() ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"failed to load %s; %s",
+			qPrintable( QDir::toNativeSeparators( Path ) ), Result.text()
+		);
+		return;
+	}
+	DcmDataset & dataSet = *file.getDataset();
+	if ( ! dataSet.tagExists( DCM_PixelData ) ) {
+		return;
+	}
+
+	const Dataset Compressed = Dataset( dataSet ).convertedToTransferSyntax(
+		syntax_
+	);
+	if ( Compressed.isEmpty() ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"failed to convert %s to %s",
+			qPrintable( QDir::toNativeSeparators( Path ) ), syntax_.name()
+		);
+		return;
+	}
+
+	// The compressed file is complete before it replaces the original in a
+	// single step, so readers see either of them and never a part or none
+	const QString Temporary = Path + ".compressing";
+	QString error;
+	if ( ! Compressed.toDicomFile( Temporary, &error ) ) {
+		QFile::remove( Temporary );
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": %s", qPrintable( error ) );
+		return;
+	}
+
+	const qint64 OriginalSize = QFileInfo( Path ).size();
+	const qint64 CompressedSize = QFileInfo( Temporary ).size();
+	if ( CompressedSize <= 0 || CompressedSize >= OriginalSize ) {
+		QFile::remove( Temporary );
+		return;
+	}
+
+	// The rename may reach the disk before the data it refers to otherwise
+	if ( synchronized_ && ! DiskSink::synchronize( Temporary ) ) {
+		QFile::remove( Temporary );
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"failed to flush %s to disk",
+			qPrintable( QDir::toNativeSeparators( Temporary ) )
+		);
+		return;
+	}
+
+	if ( ! DiskSink::replaceFile( Temporary, Path ) ) {
+		QFile::remove( Temporary );
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"failed to replace %s with its compressed version",
+			qPrintable( QDir::toNativeSeparators( Path ) )
+		);
+		return;
+	}
+
+	if ( synchronized_ && ! DiskSink::synchronize( QFileInfo( Path ).path() ) ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"failed to flush the directory of %s to disk",
+			qPrintable( QDir::toNativeSeparators( Path ) )
+		);
+	}
+
+	emit compressed(
+		Path,
+		double( OriginalSize ) / CompressedSize,
+		static_cast< int >( threadTime() - Started )
+	);
+}
+
+
+bool StorageScp::Compressor::submit(
+	const QString & Path, const QTransferSyntax & Source
+) {
+	if ( Source.isCompressed() || Source == syntax_ ) {
+		return false;
+	}
+
+	if ( queued_.fetchAndAddOrdered( 1 ) >= capacity_ ) {
+		queued_.fetchAndAddOrdered( -1 );
+		return false;
+	}
+
+	pool_.start( new Task( *this, Path ) );
+	return true;
+}
+
+}; // Namespace DICOM ends here.
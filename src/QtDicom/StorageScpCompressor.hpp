@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_STORAGESCP_COMPRESSOR_HPP
+#define DICOM_STORAGESCP_COMPRESSOR_HPP
+
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/QTransferSyntax.hpp"
+#include "QtDicom/StorageScp.hpp"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QThreadPool>
+
+namespace Dicom {
+
+/**
+ * The \em Compressor class transcodes files stored by the Storage SCP to a
+ * compressed Transfer Syntax, in the background.
+ *
+ * Files are queued after their storage has been confirmed to the peer, so
+ * compression never delays the C-STORE response. A bounded number of files
+ * waits for the pool of compressing threads; when the queue is full, files
+ * are left uncompressed rather than slowing down receivers.
+ *
+ * Only images received in an uncompressed syntax are compressed. Failures
+ * are only logged, leaving the file uncompressed. Compressed file replaces
+ * the original one, in the same path, as a DICOM Part 10 file carrying its
+ * Transfer Syntax in the meta header. When compression doesn't
+ * make the file smaller, the original is kept. Unless durability isn't
+ * required, the compressed file is flushed to the disk before it replaces the
+ * original, and its directory after, so a crash leaves either of them.
+ *
+ * Compressor is thread-safe and shared by all receivers of the Storage SCP.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC StorageScp::Compressor : public QObject {
+	Q_OBJECT;
+
+	public :
+		/**
+		 * Creates a compressor transcoding files to the \a syntax with \a
+		 * threads threads; at most \a capacity files wait for or are being
+		 * compressed. Compressed files are flushed to the disk when \a
+		 * synchronized is \c true.
+		 */
+		Compressor(
+			const QTransferSyntax & syntax,
+			int threads,
+			int capacity,
+			bool synchronized
+		);
+
+		/**
+		 * Waits for files being compressed and destroys the compressor.
+		 */
+		~Compressor();
+
+		/**
+		 * Queues the file in the \a path, received in the \a source syntax,
+		 * for compression. Returns \c false if the file has been skipped,
+		 * either because it's compressed already or the queue is full.
+		 */
+		bool submit( const QString & path, const QTransferSyntax & source );
+
+	private :
+		class Task;
+
+	private :
+		/**
+		 * Compresses the file in the \a path. Called on a pool thread.
+		 */
+		void compress( const QString & path );
+
+	private :
+		int capacity_;
+		QThreadPool pool_;
+		QAtomicInt queued_;
+		bool synchronized_;
+		QTransferSyntax syntax_;
+
+	signals :
+		/**
+		 * Signal emitted when the file in the \a path has been compressed. The
+		 * \a ratio is the original size divided by the compressed one and \a
+		 * msecs is the processor time compression took.
+		 */
+		void compressed( QString path, double ratio, int msecs );
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
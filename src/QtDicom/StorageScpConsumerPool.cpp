@@ -0,0 +1,110 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "DatasetConsumer.hpp"
+#include "MpscQueue.hpp"
+#include "StorageScpConsumerPool.hpp"
+
+#include <QtCore/QThread>
+
+
+namespace Dicom {
+
+/**
+ * The \em ConsumerPool::Worker is a consumer thread with its own queue.
+ */
+class StorageScp::ConsumerPool::Worker : public QThread {
+	public :
+		Worker( ConsumerPool & pool ) :
+			pool_( pool ),
+			stopping_( 0 )
+		{
+		}
+
+		void push( const Item & Value ) {
+			queue_.push( Value );
+			items_.release();
+		}
+
+		/**
+		 * Lets the worker finish once the items queued are consumed.
+		 */
+		void stop() {
+			stopping_ = 1;
+			items_.release();
+		}
+
+	private :
+		void run() {
+			Item item;
+
+			forever {
+				items_.acquire();
+
+				while ( ! queue_.pop( item ) ) {
+					// Either the stop request or an item still being linked
+					if ( stopping_ ) {
+						return;
+					}
+					yieldCurrentThread();
+				}
+
+				pool_.consumer_->consume( item.dataSet, item.callingAe );
+				item = Item();
+
+				pool_.capacity_.release();
+			}
+		}
+
+	private :
+		QSemaphore items_;
+		ConsumerPool & pool_;
+		MpscQueue< Item > queue_;
+		QAtomicInt stopping_;
+};
+
+
+StorageScp::ConsumerPool::ConsumerPool(
+	DatasetConsumer * consumer, int threads, int capacity
+) :
+	capacity_( qMax( 1, capacity ) ),
+	consumer_( consumer ),
+	next_( 0 )
+{
+	Q_ASSERT( consumer );
+
+	for ( int i = 0; i < qMax( 1, threads ); ++i ) {
+		Worker * worker = new Worker( *this );
+		workers_.append( worker );
+		worker->start();
+	}
+}
+
+
+StorageScp::ConsumerPool::~ConsumerPool() {
+	foreach ( Worker * worker, workers_ ) {
+		worker->stop();
+	}
+	foreach ( Worker * worker, workers_ ) {
+		worker->wait();
+		delete worker;
+	}
+}
+
+
+void StorageScp::ConsumerPool::push(
+	const Dataset & DataSet, const QString & CallingAe
+) {
+	capacity_.acquire();
+
+	Item item;
+	item.callingAe = CallingAe;
+	item.dataSet = DataSet;
+
+	const unsigned Next = static_cast< unsigned >( next_.fetchAndAddRelaxed( 1 ) );
+	workers_.at( Next % workers_.size() )->push( item );
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_STORAGESCP_CONSUMERPOOL_HPP
+#define DICOM_STORAGESCP_CONSUMERPOOL_HPP
+
+#include "QtDicom/Dataset.hpp"
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/StorageScp.hpp"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QList>
+#include <QtCore/QSemaphore>
+#include <QtCore/QString>
+
+namespace Dicom {
+
+class DatasetConsumer;
+
+/**
+ * The \em ConsumerPool class hands Data Sets received in the \ref
+ * StorageScp::Memory mode over to a \ref DatasetConsumer.
+ *
+ * Receivers \ref push() Data Sets to lock-free queues of consumer threads,
+ * picked in turns; each thread calls the consumer for the Data Sets in its
+ * queue. Only implicitly shared handles are queued, Data Sets themselves are
+ * never copied.
+ *
+ * The number of Data Sets queued and being consumed is limited by the pool's
+ * capacity; when it's reached, receivers wait.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC StorageScp::ConsumerPool {
+	public :
+		/**
+		 * Creates a pool of \a threads feeding the \a consumer with at most
+		 * \a capacity Data Sets at once.
+		 */
+		ConsumerPool( DatasetConsumer * consumer, int threads, int capacity );
+
+		/**
+		 * Waits until queued Data Sets are consumed and destroys the pool.
+		 */
+		~ConsumerPool();
+
+		/**
+		 * Queues the \a dataSet sent by the \a callingAe for consumption.
+		 * Blocks while the pool is full.
+		 */
+		void push( const Dataset & dataSet, const QString & callingAe );
+
+	private :
+		class Worker;
+
+		/**
+		 * The \em Item structure is a queued Data Set.
+		 */
+		struct Item {
+			QString callingAe;
+			Dataset dataSet;
+		};
+
+	private :
+		QSemaphore capacity_;
+		DatasetConsumer * consumer_;
+		QAtomicInt next_;
+		QList< Worker * > workers_;
+
+		Q_DISABLE_COPY( ConsumerPool );
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
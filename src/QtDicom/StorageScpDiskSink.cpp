@@ -0,0 +1,478 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "Log.hpp"
+#include "StorageScpDiskSink.hpp"
+
+#include "QtDicom/QTransferSyntax.hpp"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+
+#include <dcmtk/dcmdata/dcdatset.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcxfer.h>
+
+#ifdef Q_OS_WIN
+# include <windows.h>
+#else
+# include <errno.h>
+# include <fcntl.h>
+# include <stdio.h>
+# include <unistd.h>
+#endif
+
+
+/**
+ * Number of directories remembered to exist.
+ */
+static const int MaxKnownDirectories = 16384;
+
+
+namespace Dicom {
+
+StorageScp::DiskSink::Entry::Entry() :
+	done( false )
+{
+}
+
+
+StorageScp::DiskSink::DiskSink(
+	const QDir & Root,
+	StorageScp::DirectoryLayout layout,
+	StorageScp::Durability durability,
+	int interval,
+	bool replace
+) :
+	directories_( MaxKnownDirectories ),
+	durability_( durability ),
+	incoming_( Root.absoluteFilePath( "incoming" ) ),
+	incomingCounter_( 0 ),
+	interval_( qMax( 0, interval ) ),
+	layout_( layout ),
+	replace_( replace ),
+	root_( Root ),
+	stopping_( false )
+{
+	if ( durability_ == StorageScp::GroupCommit ) {
+		start();
+	}
+}
+
+
+StorageScp::DiskSink::~DiskSink() {
+	lock_.lock();
+	stopping_ = true;
+	pendingCondition_.wakeAll();
+	lock_.unlock();
+
+	wait();
+}
+
+
+QString StorageScp::DiskSink::availablePath( const QString & Path ) {
+	if ( ! QFileInfo( Path ).exists() ) {
+		return Path;
+	}
+
+	for ( int i = 1; ; ++i ) {
+		const QString Candidate = numberedPath( Path, i );
+		if ( ! QFileInfo( Candidate ).exists() ) {
+			return Candidate;
+		}
+	}
+}
+
+
+QString StorageScp::DiskSink::commit(
+	const QString & Path,
+	const QByteArray & SopInstanceUid,
+	const QTransferSyntax & Syntax,
+	QString * error
+) {
+	Entry entry;
+	entry.source = Path;
+	entry.target = targetPath( Path, SopInstanceUid, Syntax );
+
+	if ( durability_ == StorageScp::GroupCommit ) {
+		QMutexLocker locker( &lock_ );
+
+		pending_.append( &entry );
+		pendingCondition_.wakeOne();
+
+		while ( ! entry.done ) {
+			committedCondition_.wait( &lock_ );
+		}
+	}
+	else {
+		commitEntries(
+			QList< Entry * >() << &entry,
+			durability_ == StorageScp::FileSync
+		);
+	}
+
+	if ( entry.error.isEmpty() ) {
+		return entry.target;
+	}
+	else {
+		QFile::remove( Path );
+		if ( error ) {
+			*error = entry.error;
+		}
+		return QString();
+	}
+}
+
+
+void StorageScp::DiskSink::commitEntries(
+	const QList< Entry * > & Entries, bool synchronized
+) {
+	QSet< QString > directories;
+
+	foreach ( Entry * entry, Entries ) {
+		if ( synchronized && ! synchronize( entry->source ) ) {
+			entry->error = QString( "Failed to flush `%1' to disk." )
+				.arg( QDir::toNativeSeparators( entry->source ) )
+			;
+			continue;
+		}
+
+		const QString Directory = QFileInfo( entry->target ).path();
+		if ( ! makeDirectory( Directory ) ) {
+			entry->error = QString( "Failed to create the `%1' directory." )
+				.arg( QDir::toNativeSeparators( Directory ) )
+			;
+			continue;
+		}
+
+		// Same SOP Instance stored again replaces the previous file, unless
+		// duplicates are kept
+		const bool Moved = replace_ ?
+			replaceFile( entry->source, entry->target ) :
+			moveToAvailablePath( entry->source, entry->target )
+		;
+		if ( ! Moved ) {
+			entry->error = QString( "Failed to move `%1' to `%2'." )
+				.arg( QDir::toNativeSeparators( entry->source ) )
+				.arg( QDir::toNativeSeparators( entry->target ) )
+			;
+			continue;
+		}
+
+		directories.insert( Directory );
+	}
+
+	if ( synchronized ) {
+		foreach ( const QString & Directory, directories ) {
+			if ( ! synchronize( Directory ) ) {
+				QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+					"unable to flush directory: %s",
+					qPrintable( QDir::toNativeSeparators( Directory ) )
+				);
+			}
+		}
+	}
+}
+
+
+QString StorageScp::DiskSink::createIncomingPath( const QByteArray & SopInstanceUid ) {
+	if ( ! makeDirectory( incoming_.absolutePath() ) ) {
+		return QString();
+	}
+
+	return incoming_.absoluteFilePath(
+		QString( "%1-%2.dcm" )
+		.arg( fileName( SopInstanceUid ) )
+		.arg( incomingCounter_.fetchAndAddRelaxed( 1 ) )
+	);
+}
+
+
+QString StorageScp::DiskSink::fileName( const QByteArray & Uid ) {
+	// UIDs come from peers; anything that isn't one is not trusted as a name
+	bool safe = ! Uid.isEmpty() && Uid.size() <= 64 && Uid.at( 0 ) != '.';
+	for ( int i = 0; safe && i < Uid.size(); ++i ) {
+		const char C = Uid.at( i );
+		safe = ( C >= '0' && C <= '9' ) || C == '.';
+	}
+
+	return safe ?
+		QString::fromLatin1( Uid ) :
+		QString::fromLatin1(
+			QCryptographicHash::hash( Uid, QCryptographicHash::Md5 ).toHex()
+		)
+	;
+}
+
+
+QString StorageScp::DiskSink::hashedDirectory( const QByteArray & Uid ) {
+	const QByteArray Hash =
+		QCryptographicHash::hash( Uid, QCryptographicHash::Md5 ).toHex()
+	;
+
+	return QString( "%1/%2" )
+		.arg( QString::fromLatin1( Hash.left( 2 ) ) )
+		.arg( QString::fromLatin1( Hash.mid( 2, 2 ) ) )
+	;
+}
+
+
+bool StorageScp::DiskSink::makeDirectory( const QString & Directory ) {
+	QMutexLocker locker( &directoriesLock_ );
+
+	// Looking up refreshes the directory's position in the cache
+	if ( directories_.object( Directory ) ) {
+		return true;
+	}
+
+	if ( QDir().mkpath( Directory ) ) {
+		directories_.insert( Directory, new bool( true ) );
+		return true;
+	}
+	else {
+		return false;
+	}
+}
+
+
+bool StorageScp::DiskSink::moveFile(
+	const QString & Source, const QString & Target, bool * exists
+) {
+	if ( exists ) {
+		*exists = false;
+	}
+
+#ifdef Q_OS_WIN
+	if ( ::MoveFileExW(
+		reinterpret_cast< const wchar_t * >( QDir::toNativeSeparators( Source ).utf16() ),
+		reinterpret_cast< const wchar_t * >( QDir::toNativeSeparators( Target ).utf16() ),
+		MOVEFILE_WRITE_THROUGH
+	) ) {
+		return true;
+	}
+
+	const DWORD Error = ::GetLastError();
+	if ( exists ) {
+		*exists = Error == ERROR_ALREADY_EXISTS || Error == ERROR_FILE_EXISTS;
+	}
+	return false;
+#else
+	const QByteArray From = QFile::encodeName( Source );
+	const QByteArray To = QFile::encodeName( Target );
+
+	// Unlike rename(), link() never replaces the target
+	if ( ::link( From.constData(), To.constData() ) == 0 ) {
+		::unlink( From.constData() );
+		return true;
+	}
+	if ( errno == EEXIST ) {
+		if ( exists ) {
+			*exists = true;
+		}
+		return false;
+	}
+
+	// File systems without hard links get the name reserved with an empty
+	// file, replaced in turn
+	const int Reserved = ::open(
+		To.constData(), O_WRONLY | O_CREAT | O_EXCL, 0644
+	);
+	if ( Reserved < 0 ) {
+		if ( exists ) {
+			*exists = errno == EEXIST;
+		}
+		return false;
+	}
+	::close( Reserved );
+
+	if ( ::rename( From.constData(), To.constData() ) == 0 ) {
+		return true;
+	}
+	::unlink( To.constData() );
+	return false;
+#endif
+}
+
+
+bool StorageScp::DiskSink::moveToAvailablePath(
+	const QString & Source, QString & target
+) {
+	const QString Path = target;
+	for ( int i = 0; ; ++i ) {
+		const QString Candidate = i == 0 ? Path : numberedPath( Path, i );
+
+		bool exists;
+		if ( moveFile( Source, Candidate, &exists ) ) {
+			target = Candidate;
+			return true;
+		}
+		if ( ! exists ) {
+			return false;
+		}
+	}
+}
+
+
+QString StorageScp::DiskSink::numberedPath( const QString & Path, int number ) {
+	const QFileInfo Info( Path );
+
+	return Info.dir().absoluteFilePath(
+		QString( "%1-%2.%3" )
+		.arg( Info.completeBaseName() ).arg( number ).arg( Info.suffix() )
+	);
+}
+
+
+bool StorageScp::DiskSink::replaceFile(
+	const QString & Source, const QString & Target
+) {
+#ifdef Q_OS_WIN
+	return ::MoveFileExW(
+		reinterpret_cast< const wchar_t * >( QDir::toNativeSeparators( Source ).utf16() ),
+		reinterpret_cast< const wchar_t * >( QDir::toNativeSeparators( Target ).utf16() ),
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH
+	) != 0;
+#else
+	return ::rename(
+		QFile::encodeName( Source ).constData(),
+		QFile::encodeName( Target ).constData()
+	) == 0;
+#endif
+}
+
+
+void StorageScp::DiskSink::run() {
+	QList< Entry * > batch;
+
+	forever {
+		lock_.lock();
+		while ( pending_.isEmpty() && ! stopping_ ) {
+			pendingCondition_.wait( &lock_ );
+		}
+		if ( pending_.isEmpty() ) {
+			lock_.unlock();
+			break;
+		}
+		const bool Stopping = stopping_;
+		lock_.unlock();
+
+		// Let other receivers join the group
+		if ( ! Stopping ) {
+			msleep( interval_ );
+		}
+
+		lock_.lock();
+		batch = pending_;
+		pending_.clear();
+		lock_.unlock();
+
+		commitEntries( batch, true );
+
+		lock_.lock();
+		foreach ( Entry * entry, batch ) {
+			entry->done = true;
+		}
+		committedCondition_.wakeAll();
+		lock_.unlock();
+	}
+}
+
+
+bool StorageScp::DiskSink::synchronize( const QString & Path ) {
+#ifdef Q_OS_WIN
+	// Directory entries are flushed along with the files on NTFS
+	if ( QFileInfo( Path ).isDir() ) {
+		return true;
+	}
+
+	const HANDLE File = ::CreateFileW(
+		reinterpret_cast< const wchar_t * >( Path.utf16() ),
+		GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0
+	);
+	if ( File == INVALID_HANDLE_VALUE ) {
+		return false;
+	}
+
+	const bool Result = ::FlushFileBuffers( File ) != 0;
+	::CloseHandle( File );
+
+	return Result;
+#else
+	const int File = ::open( QFile::encodeName( Path ).constData(), O_RDONLY );
+	if ( File < 0 ) {
+		return false;
+	}
+
+	const bool Result = ::fsync( File ) == 0;
+	::close( File );
+
+	return Result;
+#endif
+}
+
+
+QString StorageScp::DiskSink::targetPath(
+	const QString & Source,
+	const QByteArray & SopInstanceUid,
+	const QTransferSyntax & Syntax
+) const {
+	const QString Name = fileName( SopInstanceUid ) + ".dcm";
+
+	switch ( layout_ ) {
+		case StorageScp::Hashed :
+			return root_.absoluteFilePath(
+				hashedDirectory( SopInstanceUid ) + '/' + Name
+			);
+
+		case StorageScp::StudySharded : {
+			// Only short values are read, leaving Pixel Data on the disk
+			static const Uint32 MaxReadLength = 256;
+
+			// The syntax given is used only if the file has no Meta
+			// Information telling its own
+			DcmFileFormat file;
+			const OFCondition Result = file.loadFile(
+				QFile::encodeName( Source ).constData(),
+				DcmXfer( Syntax.uid().constData() ).getXfer(),
+				EGL_noChange,
+				MaxReadLength
+			);
+
+			OFString study;
+			if ( Result.good() ) {
+				file.getDataset()->findAndGetOFString( DCM_StudyInstanceUID, study );
+			}
+
+			// Instances are never refused for the layout's sake
+			if ( study.empty() ) {
+				QDICOM_LOG( Storage, Warning,
+					"Unable to read Study Instance UID of %s, storing it hashed; %s",
+					qPrintable( QDir::toNativeSeparators( Source ) ),
+					Result.good() ? "attribute missing" : Result.text()
+				);
+				return root_.absoluteFilePath(
+					hashedDirectory( SopInstanceUid ) + '/' + Name
+				);
+			}
+
+			const QByteArray Study( study.c_str() );
+			return root_.absoluteFilePath(
+				QString( "%1/%2/%3" )
+				.arg( hashedDirectory( Study ).left( 2 ) )
+				.arg( fileName( Study ) )
+				.arg( Name )
+			);
+		}
+
+		default :
+			return root_.absoluteFilePath( Name );
+	}
+}
+
+}; // Namespace DICOM ends here.
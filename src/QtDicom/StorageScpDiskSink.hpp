@@ -0,0 +1,213 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_STORAGESCP_DISKSINK_HPP
+#define DICOM_STORAGESCP_DISKSINK_HPP
+
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/StorageScp.hpp"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QCache>
+#include <QtCore/QDir>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+class QTransferSyntax;
+
+namespace Dicom {
+
+/**
+ * The \em DiskSink class places Data Sets received by the Storage SCP in a
+ * storage root directory.
+ *
+ * Data Sets are received into the \c incoming subdirectory of the root and
+ * moved into place by \ref commit(), so partially received files never show
+ * up in the layout. Depending on the \ref StorageScp::DirectoryLayout, files
+ * named after their SOP Instance UIDs are placed directly in the root, in one
+ * of 65536 subdirectories picked by a hash of the UID, or in a directory of
+ * their study.
+ *
+ * A file of an instance stored again either replaces the previous one or, when
+ * duplicates are kept, is given a numbered name next to it. The name is taken
+ * in the same step the file is moved, so concurrent commits never pick the
+ * same one.
+ *
+ * Depending on the \ref StorageScp::Durability files are not synchronized
+ * with the disk at all, synchronized one by one, or in groups: receivers
+ * committing files within the same interval wait for a single thread to
+ * synchronize them all.
+ *
+ * Sink is thread-safe and shared by all receivers of the Storage SCP.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC StorageScp::DiskSink : public QThread {
+	public :
+		/**
+		 * Creates a sink placing files in the \a root directory with the \a
+		 * layout and the \a durability. The \a interval, in milliseconds, is
+		 * used by the \ref StorageScp::GroupCommit durability. Existing files
+		 * are replaced when \a replace is \c true.
+		 */
+		DiskSink(
+			const QDir & root,
+			StorageScp::DirectoryLayout layout,
+			StorageScp::Durability durability,
+			int interval,
+			bool replace
+		);
+
+		/**
+		 * Commits files waiting to be synchronized and destroys the sink.
+		 */
+		~DiskSink();
+
+		/**
+		 * Moves the file received in the \a path into place and makes it as
+		 * durable as configured. The \a sopInstanceUid names the file and the
+		 * \a syntax is the Transfer Syntax the Data Set was received in.
+		 *
+		 * Blocks until the file is committed. Returns the final path of the
+		 * file or an empty string in case of an error; the \a error then
+		 * provides an explanation.
+		 */
+		QString commit(
+			const QString & path,
+			const QByteArray & sopInstanceUid,
+			const QTransferSyntax & syntax,
+			QString * error = 0
+		);
+
+		/**
+		 * Returns the \a path, or a path next to it with a number appended to
+		 * the name, of a file which doesn't exist.
+		 */
+		static QString availablePath( const QString & path );
+
+		/**
+		 * Returns a unique path to receive a Data Set with the \a
+		 * sopInstanceUid into or an empty string if it couldn't be created.
+		 */
+		QString createIncomingPath( const QByteArray & sopInstanceUid );
+
+		/**
+		 * Returns \a uid if it is safe to use as a file name or its hash
+		 * otherwise.
+		 */
+		static QString fileName( const QByteArray & uid );
+
+		/**
+		 * Moves the \a source file to the \a target in a single step, unless
+		 * the \a target exists. Returns \c false on failure; \a exists, if
+		 * given, is then set to \c true when the \a target was in the way.
+		 */
+		static bool moveFile(
+			const QString & source, const QString & target, bool * exists = 0
+		);
+
+		/**
+		 * Moves the \a source file over the \a target in a single step, so
+		 * the \a target never goes missing; if the move fails, both files
+		 * are left untouched. Returns \c false on failure.
+		 */
+		static bool replaceFile( const QString & source, const QString & target );
+
+		/**
+		 * Flushes the file or directory in the \a path to the disk. Returns
+		 * \c false on failure.
+		 */
+		static bool synchronize( const QString & path );
+
+	private :
+		/**
+		 * The \em Entry structure describes a file being committed.
+		 */
+		struct Entry {
+			Entry();
+
+			bool done;
+			QString error;
+			QString source;
+			QString target;
+		};
+
+	private :
+		/**
+		 * Returns a path of two nested directories picked with a hash of the
+		 * \a uid.
+		 */
+		static QString hashedDirectory( const QByteArray & uid );
+
+		/**
+		 * Returns the \a path with the \a number appended to the file name.
+		 */
+		static QString numberedPath( const QString & path, int number );
+
+	private :
+		/**
+		 * Synchronizes, when \a synchronized is \c true, and moves into place
+		 * each of the \a entries.
+		 */
+		void commitEntries( const QList< Entry * > & entries, bool synchronized );
+
+		/**
+		 * Returns \c true if the \a directory exists or has been created.
+		 */
+		bool makeDirectory( const QString & directory );
+
+		/**
+		 * Moves the \a source file to the \a target or, if it exists, to the
+		 * first numbered path next to it which doesn't. The \a target
+		 * receives the path taken. Returns \c false on failure.
+		 */
+		bool moveToAvailablePath( const QString & source, QString & target );
+
+		/**
+		 * Group committer's body.
+		 */
+		void run();
+
+		/**
+		 * Returns the path the file received as the Data Set \a
+		 * sopInstanceUid in the \a syntax, stored in the \a source, belongs
+		 * to.
+		 */
+		QString targetPath(
+			const QString & source,
+			const QByteArray & sopInstanceUid,
+			const QTransferSyntax & syntax
+		) const;
+
+	private :
+		QWaitCondition committedCondition_;
+
+		/**
+		 * Directories known to exist, the most recently used ones.
+		 */
+		QCache< QString, bool > directories_;
+
+		QMutex directoriesLock_;
+		StorageScp::Durability durability_;
+		QDir incoming_;
+		QAtomicInt incomingCounter_;
+		int interval_;
+		StorageScp::DirectoryLayout layout_;
+		QMutex lock_;
+		QList< Entry * > pending_;
+		QWaitCondition pendingCondition_;
+		bool replace_;
+		QDir root_;
+		bool stopping_;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
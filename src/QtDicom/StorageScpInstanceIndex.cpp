@@ -0,0 +1,202 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "Log.hpp"
+#include "StorageScpInstanceIndex.hpp"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+
+
+namespace Dicom {
+
+StorageScp::InstanceIndex::InstanceIndex(
+	StorageScp::DuplicatePolicy policy,
+	bool compareContent,
+	const QString & Journal
+) :
+	compareContent_( compareContent ),
+	journal_( Journal ),
+	policy_( policy )
+{
+	if ( ! Journal.isEmpty() ) {
+		load();
+	}
+}
+
+
+StorageScp::InstanceIndex::~InstanceIndex() {
+	journal_.close();
+}
+
+
+bool StorageScp::InstanceIndex::comparesContent() const {
+	return compareContent_;
+}
+
+
+bool StorageScp::InstanceIndex::duplicates(
+	const Entry & Indexed, const QByteArray & Hash
+) const {
+	// Identical copy, or any one when ignored without comparison
+	return
+		( ! Hash.isEmpty() && Hash == Indexed.hash ) ||
+		( Hash.isEmpty() && policy_ == StorageScp::IgnoreDuplicates )
+	;
+}
+
+
+bool StorageScp::InstanceIndex::find(
+	const QByteArray & SopInstanceUid, Entry & entry
+) {
+	lock_.lock();
+	QHash< QByteArray, Entry >::const_iterator i = entries_.find( SopInstanceUid );
+	const bool Found = i != entries_.constEnd();
+	if ( Found ) {
+		entry = *i;
+	}
+	lock_.unlock();
+
+	if ( ! Found ) {
+		return false;
+	}
+
+	// The disk is accessed without holding up other receivers
+	if ( QFileInfo( entry.path ).exists() ) {
+		return true;
+	}
+
+	QMutexLocker locker( &lock_ );
+
+	// Unless a newer file has been stored meanwhile
+	i = entries_.find( SopInstanceUid );
+	if ( i != entries_.constEnd() && i->path == entry.path ) {
+		entries_.remove( SopInstanceUid );
+	}
+	return false;
+}
+
+
+QByteArray StorageScp::InstanceIndex::hashFile( const QString & Path ) {
+	QFile file( Path );
+	if ( ! file.open( QIODevice::ReadOnly ) ) {
+		return QByteArray();
+	}
+
+	QCryptographicHash hash( QCryptographicHash::Md5 );
+	QByteArray buffer;
+	do {
+		buffer = file.read( 256 * 1024 );
+		hash.addData( buffer );
+	} while ( ! buffer.isEmpty() );
+
+	return hash.result().toHex();
+}
+
+
+void StorageScp::InstanceIndex::insert(
+	const QByteArray & SopInstanceUid,
+	const QString & Path,
+	const QByteArray & Hash
+) {
+	Entry entry;
+	entry.hash = Hash;
+	entry.path = Path;
+
+	QMutexLocker locker( &lock_ );
+
+	entries_.insert( SopInstanceUid, entry );
+
+	if ( journal_.isOpen() ) {
+		const QByteArray Line =
+			SopInstanceUid + '\t' + Hash + '\t' + Path.toUtf8() + '\n'
+		;
+		if ( journal_.write( Line ) != Line.size() || ! journal_.flush() ) {
+			QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+				"unable to write to the journal %s; %s",
+				qPrintable( QDir::toNativeSeparators( journal_.fileName() ) ),
+				qPrintable( journal_.errorString() )
+			);
+		}
+	}
+}
+
+
+void StorageScp::InstanceIndex::load() {
+	if ( journal_.open( QIODevice::ReadOnly ) ) {
+		while ( ! journal_.atEnd() ) {
+			const QList< QByteArray > Fields =
+				journal_.readLine().trimmed().split( '\t' )
+			;
+			if ( Fields.size() != 3 ) {
+				continue;
+			}
+
+			// Later lines describe newer files of the same instance
+			Entry entry;
+			entry.hash = Fields.at( 1 );
+			entry.path = QString::fromUtf8( Fields.at( 2 ) );
+			entries_.insert( Fields.at( 0 ), entry );
+		}
+		journal_.close();
+	}
+
+	const QString Path = journal_.fileName();
+	QDir().mkpath( QFileInfo( Path ).path() );
+
+	QFile compacted( Path + ".tmp" );
+	if ( ! compacted.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"unable to rewrite the journal %s; %s",
+			qPrintable( QDir::toNativeSeparators( Path ) ),
+			qPrintable( compacted.errorString() )
+		);
+	}
+
+	QHash< QByteArray, Entry >::const_iterator i;
+	for ( i = entries_.constBegin(); i != entries_.constEnd(); ++i ) {
+		compacted.write(
+			i.key() + '\t' + i->hash + '\t' + i->path.toUtf8() + '\n'
+		);
+	}
+
+	if ( compacted.isOpen() ) {
+		compacted.close();
+		QFile::remove( Path );
+		if ( ! QFile::rename( compacted.fileName(), Path ) ) {
+			QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+				"unable to replace the journal %s",
+				qPrintable( QDir::toNativeSeparators( Path ) )
+			);
+		}
+	}
+
+	if ( ! journal_.open( QIODevice::WriteOnly | QIODevice::Append ) ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"unable to open the journal %s, index won't be persisted; %s",
+			qPrintable( QDir::toNativeSeparators( Path ) ),
+			qPrintable( journal_.errorString() )
+		);
+	}
+}
+
+
+StorageScp::DuplicatePolicy StorageScp::InstanceIndex::policy() const {
+	return policy_;
+}
+
+
+bool StorageScp::InstanceIndex::skips( const QByteArray & SopInstanceUid ) {
+	if ( policy_ != StorageScp::IgnoreDuplicates || compareContent_ ) {
+		return false;
+	}
+
+	Entry entry;
+	return find( SopInstanceUid, entry );
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,130 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_STORAGESCP_INSTANCEINDEX_HPP
+#define DICOM_STORAGESCP_INSTANCEINDEX_HPP
+
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/StorageScp.hpp"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+namespace Dicom {
+
+/**
+ * The \em InstanceIndex class remembers SOP Instances stored by the Storage
+ * SCP, so duplicates can be recognized as soon as their C-STORE requests
+ * arrive.
+ *
+ * Index is kept in memory and, when a journal path is given, persisted by
+ * appending a line per stored instance. On creation the journal is read back
+ * and compacted. Files aren't checked then, which would take a disk access
+ * per entry; instances whose files no longer exist are forgotten when they
+ * are looked up.
+ *
+ * When content comparison is enabled, an MD5 hash of each stored file is
+ * remembered, and only instances identical to the stored ones are treated as
+ * duplicates.
+ *
+ * Index is thread-safe and shared by all receivers of the Storage SCP.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC StorageScp::InstanceIndex {
+	public :
+		/**
+		 * The \em Entry structure describes an indexed instance.
+		 */
+		struct Entry {
+			QByteArray hash;
+			QString path;
+		};
+
+	public :
+		/**
+		 * Returns the MD5 hash of the file in the \a path or an empty array
+		 * if it couldn't be read.
+		 */
+		static QByteArray hashFile( const QString & path );
+
+	public :
+		/**
+		 * Creates an index applying the duplicate \a policy. Index is loaded
+		 * from and persisted in the \a journal, unless it's empty. When \a
+		 * compareContent is \c true, content hashes are remembered.
+		 */
+		InstanceIndex(
+			StorageScp::DuplicatePolicy policy,
+			bool compareContent,
+			const QString & journal
+		);
+
+		/**
+		 * Closes the journal and destroys the index.
+		 */
+		~InstanceIndex();
+
+		/**
+		 * Returns \c true if content hashes are compared.
+		 */
+		bool comparesContent() const;
+
+		/**
+		 * Returns \c true if a file with the content \a hash, empty if it
+		 * isn't compared, duplicates the \a indexed instance and should be
+		 * dropped.
+		 */
+		bool duplicates( const Entry & indexed, const QByteArray & hash ) const;
+
+		/**
+		 * Finds the instance \a sopInstanceUid and stores its description in
+		 * the \a entry. Returns \c false if it isn't indexed or its file no
+		 * longer exists; it's then forgotten.
+		 */
+		bool find( const QByteArray & sopInstanceUid, Entry & entry );
+
+		/**
+		 * Adds the instance \a sopInstanceUid stored in the \a path with the
+		 * content \a hash, replacing its previous entry.
+		 */
+		void insert(
+			const QByteArray & sopInstanceUid,
+			const QString & path,
+			const QByteArray & hash
+		);
+
+		/**
+		 * Returns the duplicate policy.
+		 */
+		StorageScp::DuplicatePolicy policy() const;
+
+		/**
+		 * Returns \c true if the C-STORE of the instance \a sopInstanceUid
+		 * can be acknowledged without receiving the Data Set: the instance is
+		 * stored already, duplicates are ignored and content isn't compared.
+		 */
+		bool skips( const QByteArray & sopInstanceUid );
+
+	private :
+		/**
+		 * Reads the journal and rewrites it with the latest entries.
+		 */
+		void load();
+
+	private :
+		bool compareContent_;
+		QHash< QByteArray, Entry > entries_;
+		QFile journal_;
+		QMutex lock_;
+		StorageScp::DuplicatePolicy policy_;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -0,0 +1,444 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "StorageScpReceiverPool.hpp"
+#include "StorageScpReceiverThread.hpp"
+
+#include "Log.hpp"
+
+#include "QtDicom/AcceptorAssociation.hpp"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+
+#include <dcmtk/dcmnet/assoc.h>
+#include <dcmtk/dcmnet/dcmtrans.h>
+#include <dcmtk/dcmnet/dul.h>
+
+#ifdef Q_OS_WIN
+# include <winsock2.h>
+#else
+# include <arpa/inet.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <netinet/in.h>
+# include <poll.h>
+# include <string.h>
+# include <sys/socket.h>
+# include <unistd.h>
+#endif
+
+namespace Dicom {
+
+/**
+ * The \em Task class processes commands of a single session in a worker
+ * thread and hands the session back to the pool afterwards.
+ */
+class StorageScp::ReceiverPool::Task : public QRunnable {
+	public :
+		Task( ReceiverPool & pool, ReceiverThread * session ) :
+			pool_( pool ),
+			session_( session )
+		{
+		}
+
+		void run() {
+			if ( session_->processCommands( false ) ) {
+				pool_.park( session_ );
+			}
+			else {
+				pool_.retire( session_ );
+			}
+		}
+
+	private :
+		ReceiverPool & pool_;
+		ReceiverThread * session_;
+};
+
+
+StorageScp::ReceiverPool::ReceiverPool( QObject * parent ) :
+	QThread( parent ),
+	activeSessions_( 0 ),
+	maxActiveSessions_( 0 ),
+	maxPendingSessions_( 0 ),
+	stopping_( false ),
+	wakeupSocket_( openWakeupSocket() )
+{
+	workers_.setMaxThreadCount( QThread::idealThreadCount() );
+
+	if ( wakeupSocket_ < 0 ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"failed to open the wakeup socket; parked sessions will be polled."
+		);
+	}
+}
+
+
+StorageScp::ReceiverPool::~ReceiverPool() {
+	stop();
+
+	if ( wakeupSocket_ >= 0 ) {
+#ifdef Q_OS_WIN
+		::closesocket( wakeupSocket_ );
+#else
+		::close( wakeupSocket_ );
+#endif
+	}
+}
+
+
+void StorageScp::ReceiverPool::dispatch( ReceiverThread * session ) {
+	workers_.start( new Task( *this, session ) );
+}
+
+
+int StorageScp::ReceiverPool::maxActiveSessions() const {
+	QMutexLocker locker( &lock_ );
+
+	return maxActiveSessions_;
+}
+
+
+int StorageScp::ReceiverPool::maxPendingSessions() const {
+	QMutexLocker locker( &lock_ );
+
+	return maxPendingSessions_;
+}
+
+
+int StorageScp::ReceiverPool::maxWaitingTime() const {
+	// Without the wakeup socket newly parked sessions are only noticed after
+	// the wait times out
+	return wakeupSocket_ >= 0 ? 1000 : 10;
+}
+
+
+int StorageScp::ReceiverPool::maxWorkerThreads() const {
+	return workers_.maxThreadCount();
+}
+
+
+int StorageScp::ReceiverPool::openWakeupSocket() {
+	// A UDP socket connected to itself; datagrams sent to it make it readable.
+	// Unlike pipes, it can be selected on Windows too
+	const int Socket = ::socket( AF_INET, SOCK_DGRAM, 0 );
+	if ( Socket < 0 ) {
+		return -1;
+	}
+
+	sockaddr_in address;
+	::memset( &address, 0, sizeof( address ) );
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	address.sin_port = 0;
+
+#ifdef Q_OS_WIN
+	int length = sizeof( address );
+	u_long On = 1;
+	const bool Opened =
+		::bind( Socket, reinterpret_cast< sockaddr * >( &address ), length ) == 0 &&
+		::getsockname( Socket, reinterpret_cast< sockaddr * >( &address ), &length ) == 0 &&
+		::connect( Socket, reinterpret_cast< sockaddr * >( &address ), length ) == 0 &&
+		::ioctlsocket( Socket, FIONBIO, &On ) == 0
+	;
+	if ( ! Opened ) {
+		::closesocket( Socket );
+		return -1;
+	}
+#else
+	socklen_t length = sizeof( address );
+	const bool Opened =
+		::bind( Socket, reinterpret_cast< sockaddr * >( &address ), length ) == 0 &&
+		::getsockname( Socket, reinterpret_cast< sockaddr * >( &address ), &length ) == 0 &&
+		::connect( Socket, reinterpret_cast< sockaddr * >( &address ), length ) == 0 &&
+		::fcntl( Socket, F_SETFL, ::fcntl( Socket, F_GETFL ) | O_NONBLOCK ) == 0
+	;
+	if ( ! Opened ) {
+		::close( Socket );
+		return -1;
+	}
+#endif
+
+	return Socket;
+}
+
+
+void StorageScp::ReceiverPool::park( ReceiverThread * session ) {
+	{
+		QMutexLocker locker( &lock_ );
+
+		QTime & parkingTime = parked_[ session ];
+		parkingTime.start();
+
+		parkedCondition_.wakeOne();
+	}
+
+	wake();
+}
+
+
+void StorageScp::ReceiverPool::retire( ReceiverThread * session ) {
+	session->deleteLater();
+
+	ReceiverThread * next = 0;
+	{
+		QMutexLocker locker( &lock_ );
+
+		--activeSessions_;
+		if ( ! stopping_ && ! pending_.isEmpty() ) {
+			next = pending_.dequeue();
+			++activeSessions_;
+		}
+	}
+
+	if ( next ) {
+		dispatch( next );
+	}
+}
+
+
+void StorageScp::ReceiverPool::run() {
+	QList< ReceiverThread * > sessions, ready, expired;
+	QVector< int > sockets;
+	QVector< bool > readable;
+	char drained[ 64 ];
+
+	forever {
+		lock_.lock();
+		while ( parked_.isEmpty() && ! stopping_ ) {
+			parkedCondition_.wait( &lock_ );
+		}
+		if ( stopping_ ) {
+			lock_.unlock();
+			break;
+		}
+		sessions = parked_.keys();
+
+		// Wake up in time to abort the first session exceeding its timeout
+		int timeout = maxWaitingTime();
+		foreach ( ReceiverThread * session, sessions ) {
+			const int Limit =
+				session->association()->connectionParameters().timeout() * 1000
+			;
+			if ( Limit > 0 ) {
+				timeout = qMin(
+					timeout, qMax( 0, Limit - parked_.value( session ).elapsed() )
+				);
+			}
+		}
+		lock_.unlock();
+
+		// The wakeup socket, if any, goes first
+		sockets.resize( 0 );
+		sockets.append( wakeupSocket_ );
+		foreach ( ReceiverThread * session, sessions ) {
+			DcmTransportConnection * connection = DUL_getTransportConnection(
+				session->association()->tAscAssociation()->DULassociation
+			);
+			sockets.append( connection ? connection->getSocket() : -1 );
+		}
+
+		if ( waitForReadable( sockets, readable, timeout ) < 0 ) {
+			QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+				"failed to wait for incoming data of parked sessions."
+			);
+			msleep( maxWaitingTime() );
+			continue;
+		}
+
+		if ( readable.at( 0 ) ) {
+			while ( ::recv( wakeupSocket_, drained, sizeof( drained ), 0 ) > 0 ) {
+			}
+		}
+
+		ready.clear();
+		expired.clear();
+
+		lock_.lock();
+		for ( int i = 0; i < sessions.size(); ++i ) {
+			ReceiverThread * session = sessions.at( i );
+			if ( readable.at( i + 1 ) || sockets.at( i + 1 ) < 0 ) {
+				// Sessions without a connection are dispatched as well, so
+				// that they fail and retire
+				parked_.remove( session );
+				ready.append( session );
+			}
+			else {
+				const int Timeout =
+					session->association()->connectionParameters().timeout()
+				;
+				if ( Timeout > 0 && parked_.value( session ).elapsed() >= Timeout * 1000 ) {
+					parked_.remove( session );
+					expired.append( session );
+				}
+			}
+		}
+		lock_.unlock();
+
+		foreach ( ReceiverThread * session, ready ) {
+			dispatch( session );
+		}
+
+		foreach ( ReceiverThread * session, expired ) {
+			session->abandon( "Association idle for too long." );
+			retire( session );
+		}
+	}
+}
+
+
+void StorageScp::ReceiverPool::setMaxActiveSessions( int count ) {
+	QMutexLocker locker( &lock_ );
+
+	maxActiveSessions_ = qMax( 0, count );
+}
+
+
+void StorageScp::ReceiverPool::setMaxPendingSessions( int count ) {
+	QMutexLocker locker( &lock_ );
+
+	maxPendingSessions_ = qMax( 0, count );
+}
+
+
+void StorageScp::ReceiverPool::setMaxWorkerThreads( int count ) {
+	workers_.setMaxThreadCount( qMax( 1, count ) );
+}
+
+
+void StorageScp::ReceiverPool::stop() {
+	lock_.lock();
+	stopping_ = true;
+	parkedCondition_.wakeAll();
+	lock_.unlock();
+
+	wake();
+	wait();
+	workers_.waitForDone();
+
+	QList< ReceiverThread * > remaining;
+
+	lock_.lock();
+	remaining = parked_.keys() + pending_;
+	parked_.clear();
+	pending_.clear();
+	activeSessions_ = 0;
+	lock_.unlock();
+
+	foreach ( ReceiverThread * session, remaining ) {
+		session->abandon( "Storage SCP stopped." );
+	}
+	qDeleteAll( remaining );
+}
+
+
+bool StorageScp::ReceiverPool::submit( ReceiverThread * session ) {
+	QMutexLocker locker( &lock_ );
+
+	if ( stopping_ ) {
+		return false;
+	}
+
+	if ( maxActiveSessions_ > 0 && activeSessions_ >= maxActiveSessions_ ) {
+		if ( maxPendingSessions_ > 0 && pending_.size() >= maxPendingSessions_ ) {
+			return false;
+		}
+		pending_.enqueue( session );
+		return true;
+	}
+
+	++activeSessions_;
+	locker.unlock();
+
+	dispatch( session );
+	return true;
+}
+
+
+
+void StorageScp::ReceiverPool::wake() {
+	if ( wakeupSocket_ >= 0 ) {
+		// Failures, e.g. a full buffer, are harmless; the pool is woken anyway
+		::send( wakeupSocket_, "", 1, 0 );
+	}
+}
+
+
+int StorageScp::ReceiverPool::waitForReadable(
+	const QVector< int > & Sockets, QVector< bool > & readable, int timeout
+) {
+	readable.fill( false, Sockets.size() );
+
+#ifdef Q_OS_WIN
+	// Winsock's fd_set is a counted array of sockets, and select() honours
+	// any count; the buffer below mimics a set of sufficient capacity, its
+	// first element (padded to a SOCKET) holding the count
+	QVector< SOCKET > buffer;
+	buffer.reserve( Sockets.size() + 1 );
+	buffer.append( 0 );
+	foreach ( int socket, Sockets ) {
+		if ( socket >= 0 ) {
+			buffer.append( static_cast< SOCKET >( socket ) );
+		}
+	}
+
+	fd_set * set = reinterpret_cast< fd_set * >( buffer.data() );
+	set->fd_count = buffer.size() - 1;
+	if ( set->fd_count == 0 ) {
+		::Sleep( timeout );
+		return 0;
+	}
+
+	timeval time;
+	time.tv_sec = timeout / 1000;
+	time.tv_usec = ( timeout % 1000 ) * 1000;
+
+	const int Result = ::select( 0, set, 0, 0, &time );
+	if ( Result == SOCKET_ERROR ) {
+		return -1;
+	}
+
+	QSet< SOCKET > ready;
+	for ( u_int i = 0; i < set->fd_count; ++i ) {
+		ready.insert( set->fd_array[ i ] );
+	}
+	for ( int i = 0; i < Sockets.size(); ++i ) {
+		readable[ i ] =
+			Sockets.at( i ) >= 0 &&
+			ready.contains( static_cast< SOCKET >( Sockets.at( i ) ) )
+		;
+	}
+
+	return Result;
+#else
+	// Negative descriptors are ignored by poll()
+	QVector< pollfd > descriptors( Sockets.size() );
+	for ( int i = 0; i < Sockets.size(); ++i ) {
+		descriptors[ i ].fd = Sockets.at( i );
+		descriptors[ i ].events = POLLIN;
+		descriptors[ i ].revents = 0;
+	}
+
+	int result;
+	do {
+		result = ::poll( descriptors.data(), descriptors.size(), timeout );
+	} while ( result < 0 && errno == EINTR );
+
+	if ( result < 0 ) {
+		return -1;
+	}
+
+	for ( int i = 0; i < Sockets.size(); ++i ) {
+		// Hang-ups and errors are reported as readable, reading fails then
+		readable[ i ] = descriptors.at( i ).revents != 0;
+	}
+
+	return result;
+#endif
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,159 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_STORAGESCP_RECEIVERPOOL_HPP
+#define DICOM_STORAGESCP_RECEIVERPOOL_HPP
+
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/StorageScp.hpp"
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTime>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
+namespace Dicom {
+
+/**
+ * The \em ReceiverPool class multiplexes Storage SCP associations over a
+ * fixed number of worker threads.
+ *
+ * Each submitted \ref ReceiverThread object is treated as a session: it is
+ * never started as a thread, instead its \ref ReceiverThread::processCommands()
+ * method is run by one of the workers whenever commands are available.
+ * Between commands sessions are \em parked; the pool's own thread blocks in
+ * \c select() (\c poll() on Unix) on sockets of parked associations and
+ * dispatches those with incoming data back to the workers. The wait is
+ * interrupted through a loopback \em wakeup socket whenever a session is
+ * parked or the pool is stopped. Sessions idle for longer than association's
+ * timeout are aborted.
+ *
+ * The number of parked sessions is not bound by \c FD_SETSIZE; note that DCMTK
+ * itself still selects on single sockets while reading with a timeout.
+ *
+ * The number of sessions served at once can be limited, sessions submitted
+ * above the limit wait in a queue of limited length.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC StorageScp::ReceiverPool : public QThread {
+	public :
+		/**
+		 * Creates a pool and sets its \a parent.
+		 */
+		ReceiverPool( QObject * parent = 0 );
+
+		/**
+		 * Stops the pool, aborting the remaining sessions.
+		 */
+		~ReceiverPool();
+
+		/**
+		 * Returns the limit of sessions served at once; \c 0 means no limit.
+		 */
+		int maxActiveSessions() const;
+
+		/**
+		 * Returns the limit of sessions waiting in a queue; \c 0 means no
+		 * limit.
+		 */
+		int maxPendingSessions() const;
+
+		/**
+		 * Returns the number of worker threads.
+		 */
+		int maxWorkerThreads() const;
+
+		void setMaxActiveSessions( int count );
+		void setMaxPendingSessions( int count );
+		void setMaxWorkerThreads( int count );
+
+		/**
+		 * Stops watching parked sessions, waits for the workers to finish and
+		 * aborts all sessions that remain, parked or pending.
+		 */
+		void stop();
+
+		/**
+		 * Hands the \a session over to the pool, which becomes its owner.
+		 *
+		 * Returns \c false if the pool is stopped or the queue of pending
+		 * sessions is full; the \a session is then left untouched.
+		 */
+		bool submit( ReceiverThread * session );
+
+	private :
+		class Task;
+
+	private :
+		/**
+		 * Queues the \a session for processing by one of the workers.
+		 */
+		void dispatch( ReceiverThread * session );
+
+		/**
+		 * Called by workers when the \a session became idle.
+		 */
+		void park( ReceiverThread * session );
+
+		/**
+		 * Returns the longest time (in milliseconds) the pool's thread waits
+		 * for incoming data before checking parked sessions for expiry.
+		 */
+		int maxWaitingTime() const;
+
+		/**
+		 * Opens the wakeup socket; returns \c -1 on failure.
+		 */
+		static int openWakeupSocket();
+
+		/**
+		 * Called by workers when the \a session has finished; disposes of it
+		 * and starts the next pending session.
+		 */
+		void retire( ReceiverThread * session );
+
+		/**
+		 * Thread's body; watches parked sessions for incoming commands.
+		 */
+		void run();
+
+		/**
+		 * Waits up to \a timeout milliseconds for any of the \a sockets to
+		 * become readable and sets the corresponding entries of \a readable.
+		 *
+		 * Returns the number of readable sockets or \c -1 on failure.
+		 */
+		static int waitForReadable(
+			const QVector< int > & sockets, QVector< bool > & readable,
+			int timeout
+		);
+
+		/**
+		 * Interrupts the wait for incoming data of the pool's thread.
+		 */
+		void wake();
+
+	private :
+		int activeSessions_;
+		mutable QMutex lock_;
+		int maxActiveSessions_;
+		int maxPendingSessions_;
+		QWaitCondition parkedCondition_;
+		QHash< ReceiverThread *, QTime > parked_;
+		QQueue< ReceiverThread * > pending_;
+		bool stopping_;
+		int wakeupSocket_;
+		QThreadPool workers_;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -3,26 +3,120 @@
  *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
  **************************************************************************/
 
+#include "Log.hpp"
+#include "StorageScpCompressor.hpp"
+#include "StorageScpConsumerPool.hpp"
+#include "StorageScpDiskSink.hpp"
+#include "StorageScpInstanceIndex.hpp"
 #include "StorageScpReceiverThread.hpp"
 #include "StorageScpReceiverThread.moc.inl"
+#include "StorageScpResourceMonitor.hpp"
+#include "StorageScpSpool.hpp"
 
 #include "QtDicom/AcceptorAssociation.hpp"
 
 #include <QtCore/QDir>
+#include <QtCore/QFile>
 #include <QtCore/QTemporaryFile>
 
+#include <dcmtk/dcmdata/dcostrma.h>
 #include <dcmtk/dcmnet/dimse.h>
 
 namespace Dicom {
 
+/**
+ * The \em ReceiverThread::SinkStream class is a DCMTK output stream passing
+ * everything written to it to a \ref StorageStreamSink, without buffering.
+ */
+class StorageScp::ReceiverThread::SinkStream : public DcmOutputStream {
+	private :
+		class Consumer : public DcmConsumer {
+			public :
+				Consumer(
+					StorageStreamSink & sink,
+					StorageStreamSink::Instance & instance
+				) :
+					instance_( instance ),
+					sink_( sink ),
+					status_( EC_Normal )
+				{
+				}
+
+				offile_off_t avail() const {
+					return good() ? 0x7fffffff : 0;
+				}
+
+				void flush() {
+				}
+
+				OFBool good() const {
+					return status_.good();
+				}
+
+				OFBool isFlushed() const {
+					return OFTrue;
+				}
+
+				OFCondition status() const {
+					return status_;
+				}
+
+				offile_off_t write( const void * buffer, offile_off_t length ) {
+					if ( status_.bad() ) {
+						return 0;
+					}
+
+					if ( ! sink_.chunk(
+						instance_, static_cast< const char * >( buffer ), length
+					) ) {
+						status_ = makeOFCondition(
+							OFM_dcmdata, 18, OF_error,
+							"Data refused by the stream sink"
+						);
+						return 0;
+					}
+
+					return length;
+				}
+
+			private :
+				StorageStreamSink::Instance & instance_;
+				StorageStreamSink & sink_;
+				OFCondition status_;
+		};
+
+	public :
+		SinkStream(
+			StorageStreamSink & sink, StorageStreamSink::Instance & instance
+		) :
+			DcmOutputStream( &consumer_ ),
+			consumer_( sink, instance )
+		{
+		}
+
+		~SinkStream() {
+			flush();
+		}
+
+	private :
+		Consumer consumer_;
+};
+
+
 StorageScp::ReceiverThread::ReceiverThread( 
 	AcceptorAssociation * association,
 	StorageScp::Destination destination, QObject * parent
 ) :
 	QThread( parent ),
 	ServiceProvider( association ),
-	destination_( destination )
+	destination_( destination ),
+	receivedBytes_( 0 ),
+	spooledInstance_( 0 ),
+	streamSink_( 0 ),
+	streamedInstance_( 0 )
 {
+	// The sink's layouts and the compressor read the Meta Information
+	setPart10Files( true );
 }
 
 
@@ -31,6 +125,14 @@ StorageScp::ReceiverThread::~ReceiverThread() {
 }
 
 
+void StorageScp::ReceiverThread::abandon( const QString & Reason ) {
+	raiseError( Reason );
+	association()->abort();
+
+	emit failedToStore( errorMessage() );
+}
+
+
 AcceptorAssociation * StorageScp::ReceiverThread::association() {
 	return reinterpret_cast< AcceptorAssociation * >(
 		ServiceProvider::association()
@@ -38,6 +140,100 @@ AcceptorAssociation * StorageScp::ReceiverThread::association() {
 }
 
 
+int StorageScp::ReceiverThread::completeCStore(
+	const T_DIMSE_C_StoreRQ & Request,
+	unsigned char presentationContextId,
+	const QString & Path,
+	int status
+) {
+	if ( streamedInstance_ ) {
+		StorageStreamSink::Instance & instance = *streamedInstance_;
+		streamedInstance_ = 0;
+
+		const bool Complete = status == STATUS_Success;
+		if ( ! streamSink_->end( instance, Complete ) && Complete ) {
+			return STATUS_STORE_Refused_OutOfResources;
+		}
+		return status;
+	}
+
+	if ( spooledInstance_ ) {
+		const quint32 Instance = spooledInstance_;
+		spooledInstance_ = 0;
+
+		if ( status != STATUS_Success ) {
+			spool_->abort( Instance );
+			return status;
+		}
+
+		QString error;
+		if ( ! spool_->commit(
+			Instance,
+			Request.AffectedSOPInstanceUID,
+			presentationContextTable().transferSyntax( presentationContextId ),
+			&error
+		) ) {
+			raiseError( error );
+			return STATUS_STORE_Refused_OutOfResources;
+		}
+
+		// Indexed and compressed by the spool, once compacted
+		return status;
+	}
+
+	if ( status != STATUS_Success ) {
+		return status;
+	}
+
+	storedPath_ = Path;
+
+	QByteArray hash;
+	StorageScp::InstanceIndex::Entry previous;
+	const bool Indexed = ! instanceIndex_.isNull() && instanceIndex_->find(
+		Request.AffectedSOPInstanceUID, previous
+	);
+	if ( ! instanceIndex_.isNull() && instanceIndex_->comparesContent() ) {
+		hash = StorageScp::InstanceIndex::hashFile( Path );
+	}
+
+	// Identical copy, or one that raced with a skipped request, is dropped
+	// before it reaches the storage
+	if ( Indexed && instanceIndex_->duplicates( previous, hash ) ) {
+		QFile::remove( Path );
+		storedPath_.clear();
+		return status;
+	}
+
+	if ( ! diskSink_.isNull() ) {
+		QString error;
+		storedPath_ = diskSink_->commit(
+			Path,
+			Request.AffectedSOPInstanceUID,
+			presentationContextTable().transferSyntax( presentationContextId ),
+			&error
+		);
+		if ( storedPath_.isEmpty() ) {
+			raiseError( error );
+			return STATUS_STORE_Refused_OutOfResources;
+		}
+	}
+
+	if ( ! instanceIndex_.isNull() ) {
+		if (
+			Indexed && instanceIndex_->policy() == OverwriteDuplicates &&
+			previous.path != storedPath_
+		) {
+			QFile::remove( previous.path );
+		}
+		instanceIndex_->insert(
+			Request.AffectedSOPInstanceUID, storedPath_, hash
+		);
+	}
+
+	return status;
+}
+
+
 QString StorageScp::ReceiverThread::createUniquePath( const QDir & Dir ) {
 	QTemporaryFile f( Dir.absoluteFilePath( "store-scp-XXXXXX.dcm" ) );
 	f.setAutoRemove( false );
@@ -60,51 +256,149 @@ StorageScp::Destination StorageScp::ReceiverThread::destination() const {
 }
 
 
-void StorageScp::ReceiverThread::run() {
+void StorageScp::ReceiverThread::handleCommand(
+	const T_DIMSE_Message & Message, unsigned char presentationContextId
+) {
+	if ( Message.CommandField == DIMSE_C_STORE_RQ ) {
+		const T_DIMSE_C_StoreRQ & Request = Message.msg.CStoreRQ;
+		QString path;
+
+		QString explanation;
+		if (
+			! resourceMonitor_.isNull() &&
+			! resourceMonitor_->admits( &explanation )
+		) {
+			skipCStore(
+				Message.msg.CStoreRQ, presentationContextId,
+				STATUS_STORE_Refused_OutOfResources
+			);
+			emit failedToStore(
+				QString( "Instance %1 refused; %2." )
+				.arg( Message.msg.CStoreRQ.AffectedSOPInstanceUID )
+				.arg( explanation )
+			);
+		}
+		else if (
+			destination() == Disk && ! instanceIndex_.isNull() &&
+			instanceIndex_->skips( Message.msg.CStoreRQ.AffectedSOPInstanceUID )
+		) {
+			// Only the network time is spent on a known duplicate
+			skipCStore(
+				Message.msg.CStoreRQ, presentationContextId, STATUS_Success
+			);
+		}
+		else if ( destination() == Disk && ! spool_.isNull() ) {
+			spoolCStore( Message.msg.CStoreRQ, presentationContextId );
+		}
+		else if ( destination() == Disk ) {
+			const QString Path = diskSink_.isNull() ?
+				createUniquePath( QDir::temp() ) :
+				diskSink_->createIncomingPath(
+					Message.msg.CStoreRQ.AffectedSOPInstanceUID
+				)
+			;
+			if ( Path.isEmpty() && ! diskSink_.isNull() ) {
+				raiseError( "Failed to create a file in the storage root." );
+			}
+
+			storedPath_.clear();
+			const bool Result = handleCStore(
+				Message.msg.CStoreRQ,
+				presentationContextId,
+				Path
+			);
+			if ( ! storedPath_.isEmpty() ) {
+				// The response is out already, compression can't delay it
+				if ( Result && ! compressor_.isNull() ) {
+					compressor_->submit(
+						storedPath_,
+						presentationContextTable().transferSyntax(
+							presentationContextId
+						)
+					);
+				}
+				emit stored( storedPath_ );
+			}
+			path = storedPath_;
+		}
+		else if ( destination() == Stream ) {
+			streamCStore( Message.msg.CStoreRQ, presentationContextId );
+		}
+		else {
+			const Dataset DataSet = handleCStore(
+				Message.msg.CStoreRQ, presentationContextId
+			);
+			if ( ! DataSet.isEmpty() ) {
+				if ( consumerPool_.isNull() ) {
+					emit stored( DataSet );
+				}
+				else {
+					consumerPool_->push(
+						DataSet, association()->callingAeTitle()
+					);
+				}
+			}
+		}
+
+		if ( receivedBytes_ > 0 ) {
+			resourceMonitor_->addInFlightBytes( -qint64( receivedBytes_ ) );
+			receivedBytes_ = 0;
+		}
+
+		if ( ! hasError() ) {
+			emit instanceReceived(
+				Request.AffectedSOPInstanceUID,
+				path,
+				( Request.opts & O_STORE_MOVEORIGINATORAETITLE ) ?
+					QString( Request.MoveOriginatorApplicationEntityTitle ).trimmed() :
+					QString(),
+				( Request.opts & O_STORE_MOVEORIGINATORID ) ?
+					Request.MoveOriginatorID : -1,
+				lastCStoreStatus()
+			);
+		}
+	}
+	else if ( Message.CommandField == DIMSE_C_ECHO_RQ ) {
+		handleCEcho( Message.msg.CEchoRQ, presentationContextId );
+	}
+	else {
+		raiseError( "Unsupported command received." );
+	}
+}
+
+
+bool StorageScp::ReceiverThread::processCommands( bool wait ) {
+	if ( presentationContextTable().isEmpty() ) {
+		setPresentationContextTable(
+			QPresentationContextTable::fromTAscAssociation(
+				association()->tAscAssociation()
+			)
+		);
+	}
+
 	try {
 
-	bool releaseRequested = false;
+	bool releaseRequested = false, timedOut = false;
 	unsigned char presentationContextId = 0;
 
 	while ( ! hasError() ) {
 		presentationContextId = 0;
 
-		const T_DIMSE_Message Message = receiveCommand( 
-			presentationContextId, &releaseRequested
-		);
+		const T_DIMSE_Message Message = wait ?
+			receiveCommand( presentationContextId, &releaseRequested ) :
+			receiveCommand( 0, presentationContextId, &releaseRequested, &timedOut )
+		;
 
 		if ( releaseRequested ) {
 			association()->confirmRelease();
-			break;
-		}
-
-		if ( Message.CommandField == DIMSE_C_STORE_RQ ) {
-			if ( destination() == Disk ) {
-				const QString Path = createUniquePath( QDir::temp() );
-				const bool Result = handleCStore(
-					Message.msg.CStoreRQ,
-					presentationContextId,
-					Path
-				);
-				if ( ! Path.isEmpty() ) {
-					emit stored( Path );
-				}
-			}
-			else {
-				const Dataset DataSet = handleCStore(
-					Message.msg.CStoreRQ, presentationContextId
-				);
-				if ( ! DataSet.isEmpty() ) {
-					emit stored( DataSet );
-				}
-			}
+			return false;
 		}
-		else if ( Message.CommandField == DIMSE_C_ECHO_RQ ) {
-			handleCEcho( Message.msg.CEchoRQ, presentationContextId );
-		}
-		else {
-			raiseError( "Unsupported command received." );
+
+		if ( timedOut ) {
+			return true;
 		}
+
+		handleCommand( Message, presentationContextId );
 	}
 
 	}
@@ -118,7 +412,124 @@ void StorageScp::ReceiverThread::run() {
 	if ( hasError() ) {
 		emit failedToStore( errorMessage() );
 	}	
+
+	return false;
+}
+
+
+void StorageScp::ReceiverThread::receivingDataset( quint64 count ) {
+	if ( ! resourceMonitor_.isNull() ) {
+		resourceMonitor_->addInFlightBytes( qint64( count - receivedBytes_ ) );
+		receivedBytes_ = count;
+	}
+}
+
+
+void StorageScp::ReceiverThread::run() {
+	processCommands( true );
+}
+
+
+void StorageScp::ReceiverThread::setCompressor(
+	const QSharedPointer< StorageScp::Compressor > & Compressor
+) {
+	compressor_ = Compressor;
+}
+
+
+void StorageScp::ReceiverThread::setConsumerPool(
+	const QSharedPointer< StorageScp::ConsumerPool > & Pool
+) {
+	consumerPool_ = Pool;
+}
+
+
+void StorageScp::ReceiverThread::setDiskSink(
+	const QSharedPointer< StorageScp::DiskSink > & Sink
+) {
+	diskSink_ = Sink;
+}
+
+
+void StorageScp::ReceiverThread::setInstanceIndex(
+	const QSharedPointer< StorageScp::InstanceIndex > & Index
+) {
+	instanceIndex_ = Index;
+}
+
+
+void StorageScp::ReceiverThread::setResourceMonitor(
+	const QSharedPointer< StorageScp::ResourceMonitor > & Monitor
+) {
+	resourceMonitor_ = Monitor;
+}
+
+
+void StorageScp::ReceiverThread::setSpool(
+	const QSharedPointer< StorageScp::Spool > & Spool
+) {
+	spool_ = Spool;
+}
+
+
+void StorageScp::ReceiverThread::setStreamSink( StorageStreamSink * sink ) {
+	streamSink_ = sink;
+}
+
+
+void StorageScp::ReceiverThread::spoolCStore(
+	const T_DIMSE_C_StoreRQ & Request, unsigned char presentationContextId
+) {
+	spooledInstance_ = spool_->begin();
+	const quint32 Instance = spooledInstance_;
+
+	// The spool holds the Part 10 file, as other durabilities write it
+	DcmOutputStream * stream = spool_->createStream( Instance );
+	const OFCondition Written = writeMetaHeader(
+		*stream, Request, presentationContextId
+	);
+	if ( Written.bad() ) {
+		QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+			"unable to spool the File Meta Information; %s", Written.text()
+		);
+		delete stream;
+		stream = 0;
+	}
+
+	handleCStore( Request, presentationContextId, stream );
+
+	// The transfer failed before the instance could be committed
+	if ( spooledInstance_ ) {
+		spooledInstance_ = 0;
+		spool_->abort( Instance );
+	}
 }
 
 
+void StorageScp::ReceiverThread::streamCStore(
+	const T_DIMSE_C_StoreRQ & Request, unsigned char presentationContextId
+) {
+	StorageStreamSink::Instance instance;
+	instance.callingAe = association()->callingAeTitle();
+	instance.sopClassUid = Request.AffectedSOPClassUID;
+	instance.sopInstanceUid = Request.AffectedSOPInstanceUID;
+	instance.syntax =
+		presentationContextTable().transferSyntax( presentationContextId )
+	;
+
+	SinkStream * stream = 0;
+	if ( streamSink_ && streamSink_->begin( instance ) ) {
+		stream = new SinkStream( *streamSink_, instance );
+		streamedInstance_ = &instance;
+	}
+
+	handleCStore( Request, presentationContextId, stream );
+
+	// The transfer failed before the instance could be completed
+	if ( streamedInstance_ ) {
+		streamedInstance_ = 0;
+		streamSink_->end( instance, false );
+	}
+}
+
 }; // Namespace DICOM ends here.
@@ -9,11 +9,15 @@
 #include "QtDicom/Globals.hpp"
 #include "QtDicom/ServiceProvider.hpp"
 #include "QtDicom/StorageScp.hpp"
+#include "QtDicom/StorageStreamSink.hpp"
 
 #include <QtCore/QThread>
 
 class QDir;
 
+struct T_DIMSE_C_StoreRQ;
+struct T_DIMSE_Message;
+
 namespace Dicom {
 
 class AcceptorAssociation;
@@ -21,6 +25,8 @@ class AcceptorAssociation;
 class QDICOM_DLLSPEC StorageScp::ReceiverThread : public QThread, public ServiceProvider {
 	Q_OBJECT;
 
+	friend class StorageScp::ReceiverPool;
+
 	public :
 		/**
 		 * Creates a receive thread object and sets its \a association and
@@ -38,26 +44,133 @@ class QDICOM_DLLSPEC StorageScp::ReceiverThread : public QThread, public Service
 		 */
 		~ReceiverThread();
 
+		/**
+		 * Gives up on the association for the \a reason: raises an error,
+		 * aborts the association and emits the \ref failedToStore() signal.
+		 */
+		void abandon( const QString & reason );
+
+		/**
+		 * Receives and handles DIMSE commands from the \ref association() in
+		 * the calling thread.
+		 *
+		 * When \a wait is \c true, method blocks waiting for commands until
+		 * the association is released or an error occurs. Otherwise only the
+		 * commands readily available are handled and method returns as soon
+		 * as the association becomes idle.
+		 *
+		 * Returns \c true when the association is idle and can be processed
+		 * further, or \c false if it has been released or failed.
+		 */
+		bool processCommands( bool wait );
+
+		/**
+		 * Sets the \a compressor files stored to the disk are queued to.
+		 */
+		void setCompressor(
+			const QSharedPointer< StorageScp::Compressor > & compressor
+		);
+
+		/**
+		 * Sets the \a sink storing received files. When no sink is set, files
+		 * are stored in the system's temporary directory.
+		 */
+		void setDiskSink( const QSharedPointer< StorageScp::DiskSink > & sink );
+
+		/**
+		 * Sets the \a index of stored instances duplicates are detected with.
+		 */
+		void setInstanceIndex(
+			const QSharedPointer< StorageScp::InstanceIndex > & index
+		);
+
+		/**
+		 * Sets the \a monitor deciding whether instances can be received.
+		 */
+		void setResourceMonitor(
+			const QSharedPointer< StorageScp::ResourceMonitor > & monitor
+		);
+
+		/**
+		 * Sets the \a spool received Data Sets are appended to. When set, it
+		 * replaces the disk sink.
+		 */
+		void setSpool( const QSharedPointer< StorageScp::Spool > & spool );
+
+		/**
+		 * Sets the \a sink receiving Data Sets in the \ref StorageScp::Stream
+		 * mode.
+		 */
+		void setStreamSink( StorageStreamSink * sink );
+
+		/**
+		 * Sets the \a pool Data Sets received to memory are pushed to. When
+		 * no pool is set, they are emitted with the \ref stored() signal.
+		 */
+		void setConsumerPool(
+			const QSharedPointer< StorageScp::ConsumerPool > & pool
+		);
+
+	private :
+		class SinkStream;
+
 	private :
 		/**
 		 * Thread's body.
 		 * 
-		 * Uses \ref association() to retrieve and handle DIMSE commands. 
-		 * Only two are supported: C-ECHO-RQ and C-STORE-RQ.
+		 * Uses \ref processCommands() to retrieve and handle DIMSE commands
+		 * until the association is released.
 		 */
 		void run();
 
 	private :
+		/**
+		 * Commits the file received in the \a path to the \ref diskSink_,
+		 * the instance appended to the \ref spool_ or ends the instance
+		 * streamed to the \ref streamSink_. Duplicates committed to the
+		 * sink are handled according to the \ref instanceIndex_, spooled
+		 * ones by the spool's compactor.
+		 */
+		int completeCStore(
+			const T_DIMSE_C_StoreRQ & request,
+			unsigned char ID,
+			const QString & path,
+			int status
+		);
+
 		/**
 		 * Returns the association.
 		 */
 		AcceptorAssociation * association();
 
+		/**
+		 * Accounts bytes received to the \ref resourceMonitor_.
+		 */
+		void receivingDataset( quint64 count );
+
 		/** 
 		 * Creates a file in the \a directory.
 		 */
 		QString createUniquePath( const QDir & directory );
 
+		/**
+		 * Handles a single DIMSE \a message received on presentation context
+		 * \a ID. Only two are supported: C-ECHO-RQ and C-STORE-RQ.
+		 */
+		void handleCommand( const T_DIMSE_Message & message, unsigned char ID );
+
+		/**
+		 * Appends the Part 10 file of the Data Set following the C-STORE \a
+		 * request to the \ref spool_.
+		 */
+		void spoolCStore( const T_DIMSE_C_StoreRQ & request, unsigned char ID );
+
+		/**
+		 * Passes the Data Set following the C-STORE \a request to the \ref
+		 * streamSink_ as it arrives.
+		 */
+		void streamCStore( const T_DIMSE_C_StoreRQ & request, unsigned char ID );
+
 		/**
 		 * Returns the destination.
 		 */
@@ -69,6 +182,51 @@ class QDICOM_DLLSPEC StorageScp::ReceiverThread : public QThread, public Service
 		 */
 		StorageScp::Destination destination_;
 
+		/**
+		 * The compressor.
+		 */
+		QSharedPointer< StorageScp::Compressor > compressor_;
+
+		/**
+		 * The consumer pool.
+		 */
+		QSharedPointer< StorageScp::ConsumerPool > consumerPool_;
+
+		/**
+		 * The disk sink.
+		 */
+		QSharedPointer< StorageScp::DiskSink > diskSink_;
+
+		/**
+		 * The index of stored instances.
+		 */
+		QSharedPointer< StorageScp::InstanceIndex > instanceIndex_;
+
+		/**
+		 * The resource monitor and the number of bytes of the Data Set being
+		 * received accounted to it.
+		 */
+		QSharedPointer< StorageScp::ResourceMonitor > resourceMonitor_;
+		quint64 receivedBytes_;
+
+		/**
+		 * The spool and the number of the instance being appended to it, if
+		 * any.
+		 */
+		QSharedPointer< StorageScp::Spool > spool_;
+		quint32 spooledInstance_;
+
+		/**
+		 * The final path of the file stored by the last C-STORE operation.
+		 */
+		QString storedPath_;
+
+		/**
+		 * The stream sink and the instance being streamed, if any.
+		 */
+		StorageStreamSink * streamSink_;
+		StorageStreamSink::Instance * streamedInstance_;
+
 	signals :
 		/**
 		 * Signal emitted when the Storage SCP thread failed to store a DICOM
@@ -76,6 +234,18 @@ class QDICOM_DLLSPEC StorageScp::ReceiverThread : public QThread, public Service
 		 */
 		void failedToStore( QString message );
 
+		/**
+		 * Signal emitted once a C-STORE request has been responded to; see
+		 * \ref StorageScp::instanceReceived().
+		 */
+		void instanceReceived(
+			QString sopInstanceUid,
+			QString path,
+			QString moveOriginatorAe,
+			int moveOriginatorId,
+			int status
+		);
+
 		/**
 		 * Signal emitted when a dataset was successfully stored in a \a path.
 		 */
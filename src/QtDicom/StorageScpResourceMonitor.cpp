@@ -0,0 +1,103 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "StorageScpResourceMonitor.hpp"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QMutexLocker>
+
+#ifdef Q_OS_WIN
+# include <windows.h>
+#else
+# include <sys/statvfs.h>
+#endif
+
+
+namespace Dicom {
+
+StorageScp::ResourceMonitor::ResourceMonitor(
+	qint64 maxInFlightBytes, qint64 minFreeSpace, const QString & Path
+) :
+	freeSpace_( -1 ),
+	inFlightBytes_( 0 ),
+	maxInFlightBytes_( qMax( Q_INT64_C( 0 ), maxInFlightBytes ) ),
+	minFreeSpace_( qMax( Q_INT64_C( 0 ), minFreeSpace ) ),
+	path_( Path )
+{
+}
+
+
+void StorageScp::ResourceMonitor::addInFlightBytes( qint64 bytes ) {
+	QMutexLocker locker( &lock_ );
+
+	inFlightBytes_ += bytes;
+}
+
+
+bool StorageScp::ResourceMonitor::admits( QString * explanation ) {
+	QMutexLocker locker( &lock_ );
+
+	if ( maxInFlightBytes_ > 0 && inFlightBytes_ >= maxInFlightBytes_ ) {
+		if ( explanation ) {
+			*explanation = QString( "%1 bytes being received already" )
+				.arg( inFlightBytes_ )
+			;
+		}
+		return false;
+	}
+
+	if ( minFreeSpace_ > 0 ) {
+		if ( freeSpaceChecked_.isNull() || freeSpaceChecked_.elapsed() > 1000 ) {
+			freeSpace_ = freeSpace( path_ );
+			freeSpaceChecked_.start();
+		}
+
+		// When free space can't be determined, the disk is given a benefit
+		// of the doubt
+		if ( freeSpace_ >= 0 && freeSpace_ < minFreeSpace_ ) {
+			if ( explanation ) {
+				*explanation = QString( "only %1 bytes free in `%2'" )
+					.arg( freeSpace_ )
+					.arg( QDir::toNativeSeparators( path_ ) )
+				;
+			}
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+qint64 StorageScp::ResourceMonitor::freeSpace( const QString & Path ) {
+#ifdef Q_OS_WIN
+	ULARGE_INTEGER available;
+	if ( ! ::GetDiskFreeSpaceExW(
+		reinterpret_cast< const wchar_t * >(
+			QDir::toNativeSeparators( Path ).utf16()
+		),
+		&available, 0, 0
+	) ) {
+		return -1;
+	}
+	return static_cast< qint64 >( available.QuadPart );
+#else
+	struct statvfs info;
+	if ( ::statvfs( QFile::encodeName( Path ).constData(), &info ) != 0 ) {
+		return -1;
+	}
+	return static_cast< qint64 >( info.f_bavail ) * info.f_frsize;
+#endif
+}
+
+
+qint64 StorageScp::ResourceMonitor::inFlightBytes() const {
+	QMutexLocker locker( &lock_ );
+
+	return inFlightBytes_;
+}
+
+}; // Namespace DICOM ends here.
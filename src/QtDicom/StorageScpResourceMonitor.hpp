@@ -0,0 +1,80 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_STORAGESCP_RESOURCEMONITOR_HPP
+#define DICOM_STORAGESCP_RESOURCEMONITOR_HPP
+
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/StorageScp.hpp"
+
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QTime>
+
+namespace Dicom {
+
+/**
+ * The \em ResourceMonitor class decides whether the Storage SCP can take
+ * another instance in.
+ *
+ * It tracks bytes of Data Sets being received by all receivers and free space
+ * of the disk instances are stored on. When either limit is crossed, new
+ * instances are refused, so load is shed at once instead of piling up in
+ * memory or filling the disk.
+ *
+ * Free space is checked at most once a second. Monitor is thread-safe and
+ * shared by all receivers of the Storage SCP.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC StorageScp::ResourceMonitor {
+	public :
+		/**
+		 * Creates a monitor refusing instances when more than \a
+		 * maxInFlightBytes are being received or less than \a minFreeSpace
+		 * bytes are available on the disk holding the \a path. Zero disables
+		 * a limit.
+		 */
+		ResourceMonitor(
+			qint64 maxInFlightBytes, qint64 minFreeSpace, const QString & path
+		);
+
+		/**
+		 * Adds the \a bytes, negative when Data Sets are done with, to bytes
+		 * being received.
+		 */
+		void addInFlightBytes( qint64 bytes );
+
+		/**
+		 * Returns \c true if another instance can be received. Otherwise the
+		 * \a explanation, if given, says which limit has been crossed.
+		 */
+		bool admits( QString * explanation = 0 );
+
+		/**
+		 * Returns the number of bytes being received.
+		 */
+		qint64 inFlightBytes() const;
+
+	private :
+		/**
+		 * Returns the number of bytes available on the disk holding the \a
+		 * path or \c -1 if it can't be determined.
+		 */
+		static qint64 freeSpace( const QString & path );
+
+	private :
+		qint64 freeSpace_;
+		QTime freeSpaceChecked_;
+		qint64 inFlightBytes_;
+		mutable QMutex lock_;
+		qint64 maxInFlightBytes_;
+		qint64 minFreeSpace_;
+		QString path_;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
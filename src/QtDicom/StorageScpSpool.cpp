@@ -0,0 +1,824 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "Log.hpp"
+#include "StorageScpCompressor.hpp"
+#include "StorageScpDiskSink.hpp"
+#include "StorageScpInstanceIndex.hpp"
+#include "StorageScpSpool.hpp"
+#include "StorageScpSpool.moc.inl"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QStringList>
+
+#include <dcmtk/config/osconfig.h>
+#include <dcmtk/dcmdata/dcostrma.h>
+
+
+namespace Dicom {
+
+/**
+ * The \em RecordHeader structure precedes each record in a segment. The
+ * checksum covers the header and the payload, so a record torn by a crash is
+ * recognized.
+ */
+struct RecordHeader {
+	quint32 magic;
+	quint32 instance;
+	quint32 size;
+	quint32 checksum;
+	quint8 type;
+	quint8 reserved[ 3 ];
+};
+
+static const quint32 RecordMagic = 0x4c415752;
+
+
+/**
+ * The \em Crc32Table class holds the lookup table of the CRC-32 polynomial
+ * used by zlib and Ethernet.
+ */
+class Crc32Table {
+	public :
+		Crc32Table() {
+			for ( quint32 i = 0; i < 256; ++i ) {
+				quint32 value = i;
+				for ( int bit = 0; bit < 8; ++bit ) {
+					value = ( value & 1 ) ? ( value >> 1 ) ^ 0xedb88320 : value >> 1;
+				}
+				values_[ i ] = value;
+			}
+		}
+
+		quint32 update( quint32 crc, const char * data, quint32 size ) const {
+			const uchar * Bytes = reinterpret_cast< const uchar * >( data );
+			crc = ~crc;
+			for ( quint32 i = 0; i < size; ++i ) {
+				crc = values_[ ( crc ^ Bytes[ i ] ) & 0xff ] ^ ( crc >> 8 );
+			}
+			return ~crc;
+		}
+
+	private :
+		quint32 values_[ 256 ];
+};
+
+// Built when the library is loaded, before any thread may use it
+static const Crc32Table Crc32;
+
+
+/**
+ * Returns the checksum of the record with the \a header and the \a size
+ * bytes of \a data.
+ */
+static quint32 recordChecksum(
+	const RecordHeader & Header, const char * data, quint32 size
+) {
+	RecordHeader header = Header;
+	header.checksum = 0;
+
+	return Crc32.update(
+		Crc32.update(
+			0, reinterpret_cast< const char * >( &header ), sizeof( header )
+		),
+		data, size
+	);
+}
+
+/**
+ * Size above which the next segment is started.
+ */
+static const qint64 SegmentSize = 64 * 1024 * 1024;
+
+
+/**
+ * The \em Spool::Compactor class moves committed instances from segments
+ * into the layout of the storage root, one at a time.
+ */
+class StorageScp::Spool::Compactor : public QThread {
+	public :
+		Compactor(
+			Spool & spool,
+			const QDir & Root,
+			StorageScp::DirectoryLayout layout,
+			bool replace
+		) :
+			sink_( Root, layout, StorageScp::FileSync, 0, replace ),
+			spool_( spool )
+		{
+		}
+
+	private :
+		/**
+		 * Moves the \a item into the layout, unless the instance index finds
+		 * it a duplicate. The \a path receives the stored file's path, left
+		 * empty for a dropped duplicate.
+		 */
+		bool compact( const Instance & Item, QString & path, QString & error ) {
+			const QString Incoming = sink_.createIncomingPath(
+				Item.sopInstanceUid
+			);
+			if ( Incoming.isEmpty() ) {
+				error = "Failed to create a file in the storage root.";
+				return false;
+			}
+			if ( ! copy( Item, Incoming, error ) ) {
+				QFile::remove( Incoming );
+				return false;
+			}
+
+			const QSharedPointer< StorageScp::InstanceIndex > & Index =
+				spool_.index_
+			;
+			QByteArray hash;
+			StorageScp::InstanceIndex::Entry previous;
+			const bool Indexed = ! Index.isNull() && Index->find(
+				Item.sopInstanceUid, previous
+			);
+			if ( ! Index.isNull() && Index->comparesContent() ) {
+				hash = StorageScp::InstanceIndex::hashFile( Incoming );
+			}
+
+			if ( Indexed && Index->duplicates( previous, hash ) ) {
+				QFile::remove( Incoming );
+				return true;
+			}
+
+			path = sink_.commit(
+				Incoming, Item.sopInstanceUid, Item.syntax, &error
+			);
+			if ( path.isEmpty() ) {
+				return false;
+			}
+
+			if ( ! Index.isNull() ) {
+				if (
+					Indexed && Index->policy() == OverwriteDuplicates &&
+					previous.path != path
+				) {
+					QFile::remove( previous.path );
+				}
+				Index->insert( Item.sopInstanceUid, path, hash );
+			}
+
+			if ( ! spool_.compressor_.isNull() ) {
+				spool_.compressor_->submit( path, Item.syntax );
+			}
+
+			return true;
+		}
+
+		/**
+		 * Copies the spooled Part 10 file of the \a instance to the \a path.
+		 */
+		bool copy( const Instance & Item, const QString & Path, QString & error ) {
+			QFile output( Path );
+			if ( ! output.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+				error = QString( "Unable to open `%1'. %2." )
+					.arg( QDir::toNativeSeparators( Path ) )
+					.arg( output.errorString() )
+				;
+				return false;
+			}
+
+			QFile input;
+			int segment = -1;
+			foreach ( const Chunk & C, Item.chunks ) {
+				if ( C.segment != segment ) {
+					input.close();
+					input.setFileName( spool_.segmentPath( C.segment ) );
+					segment = C.segment;
+					if ( ! input.open( QIODevice::ReadOnly ) ) {
+						error = QString( "Unable to open `%1'. %2." )
+							.arg( QDir::toNativeSeparators( input.fileName() ) )
+							.arg( input.errorString() )
+						;
+						return false;
+					}
+				}
+
+				const QByteArray Data = input.seek( C.offset ) ?
+					input.read( C.size ) : QByteArray()
+				;
+				if ( Data.size() != static_cast< int >( C.size ) ) {
+					error = QString( "Unable to read `%1'." )
+						.arg( QDir::toNativeSeparators( input.fileName() ) )
+					;
+					return false;
+				}
+				if ( output.write( Data ) != Data.size() ) {
+					error = QString( "Unable to write to `%1'. %2." )
+						.arg( QDir::toNativeSeparators( Path ) )
+						.arg( output.errorString() )
+					;
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		void run() {
+			forever {
+				spool_.lock_.lock();
+				while ( spool_.compactionQueue_.isEmpty() && ! spool_.stopping_ ) {
+					spool_.compactionCondition_.wait( &spool_.lock_ );
+				}
+				// Whatever is left, is compacted by the next spool
+				if ( spool_.stopping_ ) {
+					spool_.lock_.unlock();
+					break;
+				}
+				const quint32 Id = spool_.compactionQueue_.dequeue();
+				const Instance Item = spool_.instances_.value( Id );
+				spool_.lock_.unlock();
+
+				// Failed instances stay in their segments until the next spool
+				QString error;
+				QString path;
+				if ( ! compact( Item, path, error ) ) {
+					emit spool_.failedToCompact( error );
+					continue;
+				}
+
+				spool_.markCompacted( Id );
+				spool_.release( Id );
+				if ( ! path.isEmpty() ) {
+					emit spool_.compacted( path );
+				}
+			}
+		}
+
+	private :
+		StorageScp::DiskSink sink_;
+		Spool & spool_;
+};
+
+
+/**
+ * The \em Spool::Stream class is a DCMTK output stream appending data written
+ * to it to an instance in the spool, in blocks.
+ */
+class StorageScp::Spool::Stream : public DcmOutputStream {
+	private :
+		class Consumer : public DcmConsumer {
+			public :
+				Consumer( Spool & spool, quint32 instance ) :
+					instance_( instance ),
+					spool_( spool ),
+					status_( EC_Normal )
+				{
+					buffer_.reserve( BlockSize );
+				}
+
+				offile_off_t avail() const {
+					return good() ? BlockSize : 0;
+				}
+
+				void flush() {
+					if ( ! buffer_.isEmpty() && status_.good() ) {
+						if ( ! spool_.append(
+							instance_, buffer_.constData(), buffer_.size()
+						) ) {
+							status_ = makeOFCondition(
+								OFM_dcmdata, 18, OF_error,
+								"Unable to append data to the spool"
+							);
+						}
+					}
+					buffer_.clear();
+				}
+
+				OFBool good() const {
+					return status_.good();
+				}
+
+				OFBool isFlushed() const {
+					return buffer_.isEmpty();
+				}
+
+				OFCondition status() const {
+					return status_;
+				}
+
+				offile_off_t write( const void * data, offile_off_t length ) {
+					const char * Source = static_cast< const char * >( data );
+					offile_off_t written = 0;
+
+					while ( written < length && status_.good() ) {
+						const int Count = static_cast< int >( qMin< offile_off_t >(
+							length - written, BlockSize - buffer_.size()
+						) );
+						buffer_.append( Source + written, Count );
+						written += Count;
+
+						if ( buffer_.size() == BlockSize ) {
+							flush();
+						}
+					}
+
+					return status_.good() ? written : 0;
+				}
+
+			private :
+				static const int BlockSize = 256 * 1024;
+
+			private :
+				QByteArray buffer_;
+				quint32 instance_;
+				Spool & spool_;
+				OFCondition status_;
+		};
+
+	public :
+		Stream( Spool & spool, quint32 instance ) :
+			DcmOutputStream( &consumer_ ),
+			consumer_( spool, instance )
+		{
+		}
+
+		~Stream() {
+			flush();
+		}
+
+	private :
+		Consumer consumer_;
+};
+
+
+StorageScp::Spool::Spool(
+	const QDir & Root,
+	StorageScp::DirectoryLayout layout,
+	bool replace,
+	int interval,
+	const QSharedPointer< StorageScp::InstanceIndex > & Index,
+	const QSharedPointer< StorageScp::Compressor > & Compressor
+) :
+	appended_( 0 ),
+	compactor_( 0 ),
+	compressor_( Compressor ),
+	currentSegment_( 0 ),
+	directory_( Root.absoluteFilePath( "spool" ) ),
+	finished_( false ),
+	firstSegment_( 1 ),
+	index_( Index ),
+	interval_( qMax( 0, interval ) ),
+	nextInstance_( 1 ),
+	pendingCommits_( 0 ),
+	stopping_( false ),
+	synchronized_( 0 ),
+	unsynchronizedSegment_( 0 )
+{
+	recover();
+
+	compactor_ = new Compactor( *this, Root, layout, replace );
+	compactor_->start();
+	start();
+}
+
+
+StorageScp::Spool::~Spool() {
+	lock_.lock();
+	stopping_ = true;
+	compactionCondition_.wakeAll();
+	lock_.unlock();
+
+	compactor_->wait();
+	delete compactor_;
+
+	// Compaction records appended last are flushed by the group committer
+	lock_.lock();
+	finished_ = true;
+	pendingCondition_.wakeAll();
+	lock_.unlock();
+
+	wait();
+
+	segment_.close();
+}
+
+
+void StorageScp::Spool::abort( quint32 instance ) {
+	release( instance );
+}
+
+
+bool StorageScp::Spool::append(
+	quint32 instance, const char * data, quint32 size
+) {
+	QMutexLocker writer( &writeLock_ );
+
+	const qint64 Offset = appendRecord( DataRecord, instance, data, size );
+	if ( Offset < 0 ) {
+		return false;
+	}
+
+	Chunk chunk;
+	chunk.offset = Offset;
+	chunk.segment = currentSegment_;
+	chunk.size = size;
+
+	// Registered before the segment can be rotated and removed
+	QMutexLocker locker( &lock_ );
+
+	Instance & item = instances_[ instance ];
+	item.chunks.append( chunk );
+	if ( ! item.segments.contains( currentSegment_ ) ) {
+		item.segments.insert( currentSegment_ );
+		++segmentUsers_[ currentSegment_ ];
+	}
+
+	return true;
+}
+
+
+qint64 StorageScp::Spool::appendRecord(
+	RecordType type,
+	quint32 instance,
+	const char * data,
+	quint32 size,
+	quint64 * end
+) {
+	lock_.lock();
+	const bool Failed = ! error_.isEmpty();
+	lock_.unlock();
+
+	if ( Failed ) {
+		return -1;
+	}
+
+	// Segments are switched between records only
+	if ( segment_.size() >= SegmentSize && ! rotate() ) {
+		return -1;
+	}
+
+	RecordHeader header;
+	header.magic = RecordMagic;
+	header.instance = instance;
+	header.size = size;
+	header.type = static_cast< quint8 >( type );
+	header.reserved[ 0 ] = header.reserved[ 1 ] = header.reserved[ 2 ] = 0;
+	header.checksum = recordChecksum( header, data, size );
+
+	const qint64 Offset = segment_.size() + sizeof( header );
+	if (
+		segment_.write(
+			reinterpret_cast< const char * >( &header ), sizeof( header )
+		) != sizeof( header ) ||
+		segment_.write( data, size ) != size
+	) {
+		QMutexLocker locker( &lock_ );
+		error_ = QString( "Unable to append to `%1'. %2." )
+			.arg( QDir::toNativeSeparators( segment_.fileName() ) )
+			.arg( segment_.errorString() )
+		;
+		return -1;
+	}
+
+	QMutexLocker locker( &lock_ );
+	appended_ += sizeof( header ) + size;
+	if ( end ) {
+		*end = appended_;
+	}
+	return Offset;
+}
+
+
+quint32 StorageScp::Spool::begin() {
+	QMutexLocker locker( &lock_ );
+
+	return nextInstance_++;
+}
+
+
+bool StorageScp::Spool::commit(
+	quint32 instance,
+	const QByteArray & SopInstanceUid,
+	const QTransferSyntax & Syntax,
+	QString * error
+) {
+	lock_.lock();
+	quint64 size = 0;
+	foreach ( const Chunk & C, instances_.value( instance ).chunks ) {
+		size += C.size;
+	}
+	lock_.unlock();
+
+	// The size lets recovery recognize data torn in an earlier segment
+	const QByteArray Payload =
+		SopInstanceUid + '\t' + Syntax.uid() + '\t' +
+		QByteArray::number( size )
+	;
+
+	quint64 position = 0;
+	writeLock_.lock();
+	const bool Appended = appendRecord(
+		CommitRecord, instance, Payload.constData(), Payload.size(), &position
+	) >= 0;
+	writeLock_.unlock();
+
+	QMutexLocker locker( &lock_ );
+
+	bool durable = false;
+	if ( Appended ) {
+		const quint64 Position = position;
+
+		++pendingCommits_;
+		pendingCondition_.wakeOne();
+
+		while ( synchronized_ < Position && error_.isEmpty() ) {
+			committedCondition_.wait( &lock_ );
+		}
+		durable = synchronized_ >= Position;
+	}
+
+	if ( ! durable ) {
+		if ( error ) {
+			*error = error_;
+		}
+		locker.unlock();
+
+		release( instance );
+		return false;
+	}
+
+	Instance & item = instances_[ instance ];
+	item.sopInstanceUid = SopInstanceUid;
+	item.syntax = Syntax;
+
+	compactionQueue_.enqueue( instance );
+	compactionCondition_.wakeOne();
+
+	return true;
+}
+
+
+DcmOutputStream * StorageScp::Spool::createStream( quint32 instance ) {
+	return new Stream( *this, instance );
+}
+
+
+void StorageScp::Spool::markCompacted( quint32 instance ) {
+	writeLock_.lock();
+	const bool Appended = appendRecord(
+		CompactionRecord, instance, "", 0
+	) >= 0;
+	writeLock_.unlock();
+
+	// A crash before the record is flushed compacts the instance again, the
+	// compactor needn't wait for that
+	if ( Appended ) {
+		QMutexLocker locker( &lock_ );
+
+		++pendingCommits_;
+		pendingCondition_.wakeOne();
+	}
+}
+
+
+void StorageScp::Spool::recover() {
+	QDir().mkpath( directory_.absolutePath() );
+
+	QHash< quint32, Instance > found;
+	QHash< quint32, quint64 > committed;
+	QSet< quint32 > compacted;
+
+	const QStringList Names = directory_.entryList(
+		QStringList() << "segment-*.wal", QDir::Files, QDir::Name
+	);
+	foreach ( const QString & Name, Names ) {
+		const int Segment = Name.mid( 8, 8 ).toInt();
+		if ( currentSegment_ == 0 ) {
+			firstSegment_ = Segment;
+		}
+		currentSegment_ = qMax( currentSegment_, Segment );
+
+		QFile file( directory_.absoluteFilePath( Name ) );
+		if ( ! file.open( QIODevice::ReadOnly ) ) {
+			QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+				"unable to read spool segment %s; %s",
+				qPrintable( QDir::toNativeSeparators( file.fileName() ) ),
+				qPrintable( file.errorString() )
+			);
+			continue;
+		}
+
+		// Records are read up to the first one torn by a crash
+		RecordHeader header;
+		while ( file.read(
+			reinterpret_cast< char * >( &header ), sizeof( header )
+		) == sizeof( header ) && header.magic == RecordMagic ) {
+			const qint64 Offset = file.pos();
+			const QByteArray Payload = file.read( header.size );
+			if (
+				Payload.size() != static_cast< int >( header.size ) ||
+				recordChecksum(
+					header, Payload.constData(), Payload.size()
+				) != header.checksum
+			) {
+				break;
+			}
+
+			nextInstance_ = qMax( nextInstance_, header.instance + 1 );
+
+			if ( header.type == DataRecord ) {
+				Chunk chunk;
+				chunk.offset = Offset;
+				chunk.segment = Segment;
+				chunk.size = header.size;
+
+				Instance & item = found[ header.instance ];
+				item.chunks.append( chunk );
+				item.segments.insert( Segment );
+			}
+			else if ( header.type == CommitRecord ) {
+				const QList< QByteArray > Fields = Payload.split( '\t' );
+				if ( Fields.size() == 3 ) {
+					Instance & item = found[ header.instance ];
+					item.sopInstanceUid = Fields.at( 0 );
+					item.syntax = QTransferSyntax::fromUid(
+						Fields.at( 1 ).constData()
+					);
+					committed.insert(
+						header.instance, Fields.at( 2 ).toULongLong()
+					);
+				}
+			}
+			else if ( header.type == CompactionRecord ) {
+				compacted.insert( header.instance );
+			}
+		}
+	}
+
+	// Instances not committed have never been confirmed, they're dropped;
+	// compacted ones are in the layout already
+	QList< quint32 > recovered;
+	QHash< quint32, quint64 >::const_iterator i;
+	for ( i = committed.constBegin(); i != committed.constEnd(); ++i ) {
+		if ( compacted.contains( i.key() ) ) {
+			continue;
+		}
+
+		const Instance & Item = found[ i.key() ];
+		quint64 size = 0;
+		foreach ( const Chunk & C, Item.chunks ) {
+			size += C.size;
+		}
+		if ( size != i.value() ) {
+			QDICOM_LOG( Storage, Warning, __FUNCTION__": "
+				"instance %s is incomplete in the spool and has been dropped",
+				Item.sopInstanceUid.constData()
+			);
+			continue;
+		}
+
+		recovered.append( i.key() );
+	}
+
+	// Compacted in the order they have been received
+	qSort( recovered );
+	foreach ( quint32 id, recovered ) {
+		const Instance & Item = found[ id ];
+		instances_.insert( id, Item );
+		foreach ( int segment, Item.segments ) {
+			++segmentUsers_[ segment ];
+		}
+		compactionQueue_.enqueue( id );
+	}
+
+	if ( ! recovered.isEmpty() ) {
+		QDICOM_LOG( Storage, Debug, __FUNCTION__": "
+			"%d instance(s) recovered from the spool", recovered.size()
+		);
+	}
+
+	if ( currentSegment_ == 0 ) {
+		firstSegment_ = 1;
+	}
+
+	QMutexLocker writer( &writeLock_ );
+	rotate();
+	unsynchronizedSegment_ = currentSegment_;
+	DiskSink::synchronize( directory_.absolutePath() );
+}
+
+
+void StorageScp::Spool::release( quint32 instance ) {
+	QMutexLocker locker( &lock_ );
+
+	const Instance Released = instances_.take( instance );
+	foreach ( int segment, Released.segments ) {
+		if ( --segmentUsers_[ segment ] <= 0 ) {
+			segmentUsers_.remove( segment );
+		}
+	}
+	removeUnusedSegments();
+}
+
+
+void StorageScp::Spool::removeUnusedSegments() {
+	// Later segments may hold compaction records of instances in the earlier
+	// ones, so they can't go first
+	while (
+		firstSegment_ < currentSegment_ &&
+		! segmentUsers_.contains( firstSegment_ )
+	) {
+		QFile::remove( segmentPath( firstSegment_ ) );
+		++firstSegment_;
+	}
+}
+
+
+bool StorageScp::Spool::rotate() {
+	segment_.close();
+
+	const int Next = currentSegment_ + 1;
+	segment_.setFileName( segmentPath( Next ) );
+	if ( ! segment_.open(
+		QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered
+	) ) {
+		QMutexLocker locker( &lock_ );
+		error_ = QString( "Unable to create `%1'. %2." )
+			.arg( QDir::toNativeSeparators( segment_.fileName() ) )
+			.arg( segment_.errorString() )
+		;
+		return false;
+	}
+
+	// The closed segment is flushed by the group committer, together with
+	// the new one and its directory entry
+	QMutexLocker locker( &lock_ );
+	currentSegment_ = Next;
+	removeUnusedSegments();
+
+	return true;
+}
+
+
+void StorageScp::Spool::run() {
+	forever {
+		lock_.lock();
+		while ( pendingCommits_ == 0 && ! finished_ ) {
+			pendingCondition_.wait( &lock_ );
+		}
+		if ( pendingCommits_ == 0 ) {
+			lock_.unlock();
+			break;
+		}
+		const bool Stopping = stopping_;
+		lock_.unlock();
+
+		// Let other receivers join the group
+		if ( ! Stopping ) {
+			msleep( interval_ );
+		}
+
+		lock_.lock();
+		const quint64 Target = appended_;
+		const int First = qMax( unsynchronizedSegment_, firstSegment_ );
+		const int Last = currentSegment_;
+		const bool Created = Last > unsynchronizedSegment_;
+		pendingCommits_ = 0;
+		lock_.unlock();
+
+		// Records of earlier segments are flushed before the ones following
+		// them; segments removed meanwhile needn't be
+		QString failed;
+		for ( int segment = First; segment <= Last && failed.isEmpty(); ++segment ) {
+			const QString Path = segmentPath( segment );
+			if ( ! DiskSink::synchronize( Path ) && QFile::exists( Path ) ) {
+				failed = Path;
+			}
+		}
+		if (
+			failed.isEmpty() && Created &&
+			! DiskSink::synchronize( directory_.absolutePath() )
+		) {
+			failed = directory_.absolutePath();
+		}
+
+		lock_.lock();
+		if ( failed.isEmpty() ) {
+			synchronized_ = qMax( synchronized_, Target );
+			unsynchronizedSegment_ = qMax( unsynchronizedSegment_, Last );
+		}
+		else {
+			error_ = QString( "Failed to flush `%1' to disk." )
+				.arg( QDir::toNativeSeparators( failed ) )
+			;
+		}
+		committedCondition_.wakeAll();
+		lock_.unlock();
+	}
+}
+
+
+QString StorageScp::Spool::segmentPath( int segment ) const {
+	return directory_.absoluteFilePath(
+		QString( "segment-%1.wal" ).arg( segment, 8, 10, QChar( '0' ) )
+	);
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,268 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_STORAGESCP_SPOOL_HPP
+#define DICOM_STORAGESCP_SPOOL_HPP
+
+#include "QtDicom/Globals.hpp"
+#include "QtDicom/QTransferSyntax.hpp"
+#include "QtDicom/StorageScp.hpp"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+class DcmOutputStream;
+
+namespace Dicom {
+
+/**
+ * The \em Spool class is a write-ahead journal Data Sets received by the
+ * Storage SCP are appended to before their storage is confirmed.
+ *
+ * Part 10 files of all instances being received are appended, in blocks, to
+ * a single segment file in the \c spool subdirectory of the storage root;
+ * once a Data Set is complete, a commit record with its SOP Instance UID,
+ * Transfer Syntax and size follows. Every record is protected by a CRC-32.
+ * Receivers committing within the same interval wait for a single flush of
+ * the segments written to, so durability costs one sequential write and one
+ * flush per group rather than a flush per file.
+ *
+ * Committed instances are then copied into the layout of the storage root by
+ * a background compactor. Duplicates are resolved with the instance index,
+ * if any, the stored files are submitted to the compressor, if any, and the
+ * \ref compacted() signal is emitted for each. A compaction record is then
+ * appended to the journal. Segments are removed oldest first, once all
+ * instances they and the preceding segments hold have been compacted, so the
+ * compaction records outlive the commit records they refer to.
+ *
+ * After a crash the spool is recovered when created: committed instances
+ * without compaction records are compacted again, incomplete ones, never
+ * confirmed to peers, are dropped.
+ *
+ * Data is written under a lock of its own, so the group committer, the
+ * compactor and receivers waiting for their commits aren't held up by writes
+ * or flushes.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC StorageScp::Spool : public QThread {
+	Q_OBJECT;
+
+	public :
+		/**
+		 * Creates a spool in the \a root directory, recovering instances left
+		 * by a previous one. Instances are compacted into the \a layout,
+		 * replacing existing files when \a replace is \c true, recorded in
+		 * the \a index and submitted to the \a compressor; either may be
+		 * null. Commits are gathered for \a interval milliseconds.
+		 */
+		Spool(
+			const QDir & root,
+			StorageScp::DirectoryLayout layout,
+			bool replace,
+			int interval,
+			const QSharedPointer< StorageScp::InstanceIndex > & index,
+			const QSharedPointer< StorageScp::Compressor > & compressor
+		);
+
+		/**
+		 * Waits for pending commits and destroys the spool. Committed
+		 * instances not compacted yet are left for the next spool.
+		 */
+		~Spool();
+
+		/**
+		 * Drops the \a instance being received.
+		 */
+		void abort( quint32 instance );
+
+		/**
+		 * Starts a new instance and returns its number.
+		 */
+		quint32 begin();
+
+		/**
+		 * Marks the \a instance complete as the Data Set \a sopInstanceUid
+		 * encoded in the \a syntax and waits until it is durable. Returns \c
+		 * false in case of an error; the \a error then provides an
+		 * explanation.
+		 */
+		bool commit(
+			quint32 instance,
+			const QByteArray & sopInstanceUid,
+			const QTransferSyntax & syntax,
+			QString * error = 0
+		);
+
+		/**
+		 * Returns a DCMTK stream appending data written to it to the \a
+		 * instance. The stream is owned by the caller.
+		 */
+		DcmOutputStream * createStream( quint32 instance );
+
+	private :
+		class Compactor;
+		class Stream;
+
+		/**
+		 * The \em Chunk structure locates a piece of an instance's data.
+		 */
+		struct Chunk {
+			qint64 offset;
+			int segment;
+			quint32 size;
+		};
+
+		/**
+		 * The \em Instance structure describes an instance in the spool.
+		 */
+		struct Instance {
+			QList< Chunk > chunks;
+			QSet< int > segments;
+			QByteArray sopInstanceUid;
+			QTransferSyntax syntax;
+		};
+
+		/**
+		 * Types of records.
+		 */
+		enum RecordType {
+			DataRecord = 1,
+			CommitRecord,
+			CompactionRecord
+		};
+
+	private :
+		/**
+		 * Appends the \a size bytes of \a data to the \a instance. Returns \c
+		 * false in case of an error.
+		 */
+		bool append( quint32 instance, const char * data, quint32 size );
+
+		/**
+		 * Writes a record of the \a type with the \a size bytes of \a data.
+		 * Returns the position of the payload in the current segment or \c -1
+		 * in case of an error; the \a end, if given, receives the number of
+		 * bytes appended to the spool up to the record's end. Requires the
+		 * \ref writeLock_ to be held.
+		 */
+		qint64 appendRecord(
+			RecordType type,
+			quint32 instance,
+			const char * data,
+			quint32 size,
+			quint64 * end = 0
+		);
+
+		/**
+		 * Called by the compactor once the \a instance has been moved into
+		 * the layout or dropped as a duplicate. Appends the compaction record
+		 * and schedules its flush.
+		 */
+		void markCompacted( quint32 instance );
+
+		/**
+		 * Called once the \a instance has been compacted or aborted.
+		 */
+		void release( quint32 instance );
+
+		/**
+		 * Reads segments left in the spool directory.
+		 */
+		void recover();
+
+		/**
+		 * Removes the oldest segments no instance refers to. Requires the
+		 * \ref lock_ to be held.
+		 */
+		void removeUnusedSegments();
+
+		/**
+		 * Closes the current segment and opens the next one. The closed one
+		 * is flushed by the group committer. Requires the \ref writeLock_ to
+		 * be held.
+		 */
+		bool rotate();
+
+		/**
+		 * Group committer's body.
+		 */
+		void run();
+
+		/**
+		 * Returns the path of the \a segment file.
+		 */
+		QString segmentPath( int segment ) const;
+
+	private :
+		quint64 appended_;
+		QWaitCondition committedCondition_;
+		QQueue< quint32 > compactionQueue_;
+		QWaitCondition compactionCondition_;
+		Compactor * compactor_;
+		QSharedPointer< StorageScp::Compressor > compressor_;
+
+		/**
+		 * Modified with both the \ref lock_ and the \ref writeLock_ held,
+		 * so it can be read with either.
+		 */
+		int currentSegment_;
+
+		QDir directory_;
+		QString error_;
+		bool finished_;
+		int firstSegment_;
+		QSharedPointer< StorageScp::InstanceIndex > index_;
+		QHash< quint32, Instance > instances_;
+		int interval_;
+
+		/**
+		 * Guards everything but the \ref segment_. Never waited for while
+		 * the \ref writeLock_ is being acquired.
+		 */
+		QMutex lock_;
+
+		quint32 nextInstance_;
+		int pendingCommits_;
+		QWaitCondition pendingCondition_;
+		QFile segment_;
+		QMap< int, int > segmentUsers_;
+		bool stopping_;
+		quint64 synchronized_;
+		int unsynchronizedSegment_;
+
+		/**
+		 * Guards the \ref segment_; acquired before the \ref lock_.
+		 */
+		QMutex writeLock_;
+
+	signals :
+		/**
+		 * Signal emitted when an instance has been moved from the spool to
+		 * the \a path.
+		 */
+		void compacted( QString path );
+
+		/**
+		 * Signal emitted when an instance couldn't be moved from the spool.
+		 * The \a message contains an explanation of the error.
+		 */
+		void failedToCompact( QString message );
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
@@ -0,0 +1,20 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#include "StorageStreamSink.hpp"
+
+
+namespace Dicom {
+
+StorageStreamSink::Instance::Instance() :
+	context( 0 )
+{
+}
+
+
+StorageStreamSink::~StorageStreamSink() {
+}
+
+}; // Namespace DICOM ends here.
@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright © 2013 by Flux Inc.                                         *
+ *   Author: Paweł Żak <pawel.zak@fluxinc.ca>                              *
+ **************************************************************************/
+
+#ifndef DICOM_STORAGESTREAMSINK_HPP
+#define DICOM_STORAGESTREAMSINK_HPP
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+#include <QtDicom/Globals.hpp>
+#include <QtDicom/QTransferSyntax>
+
+namespace Dicom {
+
+/**
+ * The \em StorageStreamSink class is an interface of objects receiving Data
+ * Sets from the \ref StorageScp in the \ref StorageScp::Stream mode.
+ *
+ * Data Set is never assembled nor written to a file; instead, raw bytes of
+ * the Data Set, encoded in the negotiated Transfer Syntax, are passed to the
+ * \ref chunk() method as they arrive from network. Each instance is
+ * announced with \ref begin(), before any data, and closed with \ref end().
+ *
+ * The sink is shared by all associations of the Storage SCP, so its methods
+ * are called from multiple threads at once; state of each transfer should be
+ * kept in the \ref Instance::context.
+ *
+ * \author Paweł Żak <pawel.zak@fluxinc.ca>
+ */
+class QDICOM_DLLSPEC StorageStreamSink {
+	public :
+		/**
+		 * The \em Instance structure describes a transferred SOP Instance,
+		 * as read from the C-STORE request.
+		 */
+		struct Instance {
+			Instance();
+
+			/**
+			 * AE title of the peer sending the instance.
+			 */
+			QString callingAe;
+
+			/**
+			 * A value left for the sink to use; \c 0 initially.
+			 */
+			void * context;
+
+			QByteArray sopClassUid;
+			QByteArray sopInstanceUid;
+
+			/**
+			 * Transfer Syntax of the bytes passed to \ref chunk().
+			 */
+			QTransferSyntax syntax;
+		};
+
+	public :
+		virtual ~StorageStreamSink();
+
+		/**
+		 * Called before the Data Set of the \a instance is received. When the
+		 * sink returns \c false, the Data Set is skipped and the storage
+		 * refused.
+		 */
+		virtual bool begin( Instance & instance ) = 0;
+
+		/**
+		 * Called with each received portion of the \a instance's Data Set:
+		 * the \a size bytes pointed by \a data. When the sink returns \c false,
+		 * the transfer fails and the association is aborted.
+		 */
+		virtual bool chunk( Instance & instance, const char * data, qint64 size ) = 0;
+
+		/**
+		 * Called after the \a instance's Data Set was received, \a complete,
+		 * or when its transfer has failed. When a \a complete Data Set cannot
+		 * be stored, the sink should return \c false and the storage is
+		 * refused.
+		 */
+		virtual bool end( Instance & instance, bool complete ) = 0;
+};
+
+}; // Namespace DICOM ends here.
+
+#endif
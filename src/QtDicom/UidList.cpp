@@ -60,6 +60,8 @@ UidList UidList::queryRetrieveSopClasses() {
 	else {
 		theList.append( UID_FINDPatientRootQueryRetrieveInformationModel );
 		theList.append( UID_FINDStudyRootQueryRetrieveInformationModel );
+		theList.append( UID_MOVEPatientRootQueryRetrieveInformationModel );
+		theList.append( UID_MOVEStudyRootQueryRetrieveInformationModel );
 		return theList;
 	}
 }
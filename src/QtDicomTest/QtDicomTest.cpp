@@ -6,8 +6,720 @@
 #include "QtDicomTest.hpp"
 #include "QtDicomTest.moc.inl"
 
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+
+#include <QtDicom/AbstractService.hpp>
+#include <QtDicom/DataSource.hpp>
+#include <QtDicom/QueryScp.hpp>
+#include <QtDicom/QueryScpCache.hpp>
+#include <QtDicom/QueryScpReceiverThread.hpp>
 #include <QtDicom/RequestorAssociation.hpp>
+#include <QtDicom/ServiceUser.hpp>
+#include <QtDicom/StorageScpDiskSink.hpp>
+#include <QtDicom/StorageScpSpool.hpp>
+
+#include <QtTest/QTest>
+
+#include <dcmtk/config/osconfig.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcostrma.h>
+#include <dcmtk/dcmdata/dcostrmf.h>
+#include <dcmtk/dcmdata/dcuid.h>
+#include <dcmtk/dcmnet/assoc.h>
+#include <dcmtk/dcmnet/dimse.h>
+
+using namespace Dicom;
+
+
+/**
+ * The \em CommitThread class commits a file with the given contents to a
+ * disk sink.
+ */
+class CommitThread : public QThread {
+	public :
+		CommitThread(
+			StorageScp::DiskSink & sink,
+			const QByteArray & SopInstanceUid,
+			const QByteArray & Data
+		) :
+			data_( Data ),
+			sink_( sink ),
+			sopInstanceUid_( SopInstanceUid )
+		{
+		}
+
+		const QString & path() const {
+			return path_;
+		}
+
+	private :
+		void run() {
+			const QString Incoming = sink_.createIncomingPath( sopInstanceUid_ );
+
+			QFile file( Incoming );
+			if ( file.open( QIODevice::WriteOnly ) && file.write( data_ ) == data_.size() ) {
+				file.close();
+				path_ = sink_.commit(
+					Incoming, sopInstanceUid_,
+					QTransferSyntax( QTransferSyntax::LittleEndian )
+				);
+			}
+		}
+
+	private :
+		QByteArray data_;
+		QString path_;
+		StorageScp::DiskSink & sink_;
+		QByteArray sopInstanceUid_;
+};
+
+
+/**
+ * The \em Pdv structure is a PDV item read back from P-DATA-TF PDUs.
+ */
+struct Pdv {
+	QByteArray data;
+	quint8 header;
+	quint8 id;
+	int pdu;
+};
+
+
+/**
+ * The \em TestDataSource class provides a number of instances of a single
+ * series and counts its refreshes. Each refresh changes the source.
+ */
+class TestDataSource : public DataSource {
+	public :
+		TestDataSource( int size ) :
+			DataSource( typeName() ),
+			refreshes_( 0 ),
+			size_( size )
+		{
+		}
+
+		void refresh() {
+			++refreshes_;
+			DataSource::refresh();
+		}
+
+		int refreshes() const {
+			return refreshes_;
+		}
+
+		int size() const {
+			return size_;
+		}
+
+	protected :
+		Dataset readDataset( int n ) const {
+			Dataset dataset;
+
+			DcmDataset & dcmDataset = dataset.dcmDataset();
+			dcmDataset.putAndInsertString( DCM_PatientID, "QTDICOMTEST" );
+			dcmDataset.putAndInsertString(
+				DCM_StudyInstanceUID, "1.2.826.0.1.3680043.2.1143.10"
+			);
+			dcmDataset.putAndInsertString(
+				DCM_SeriesInstanceUID, "1.2.826.0.1.3680043.2.1143.11"
+			);
+			const QByteArray Uid =
+				"1.2.826.0.1.3680043.2.1143.12." + QByteArray::number( n )
+			;
+			dcmDataset.putAndInsertString( DCM_SOPInstanceUID, Uid.constData() );
+			return dataset;
+		}
+
+	private :
+		static const QString & typeName() {
+			static const QString Name( "Test" );
+			return Name;
+		}
+
+	private :
+		int refreshes_;
+		int size_;
+};
+
+
+/**
+ * Returns a C-FIND mask matching all instances at the \c IMAGE level.
+ */
+static Dataset imageMask() {
+	Dataset mask;
+
+	mask.dcmDataset().putAndInsertString( DCM_QueryRetrieveLevel, "IMAGE" );
+	mask.dcmDataset().putAndInsertString( DCM_SOPInstanceUID, "" );
+
+	return mask;
+}
+
+
+/**
+ * Returns the contents of the file in the \a path.
+ */
+static QByteArray readFile( const QString & Path ) {
+	QFile file( Path );
+
+	return file.open( QIODevice::ReadOnly ) ? file.readAll() : QByteArray();
+}
+
+
+/**
+ * Returns the big endian 32-bit value at the \a offset of the \a buffer.
+ */
+static quint32 readUint32( const QByteArray & Buffer, int offset ) {
+	const uchar * Bytes =
+		reinterpret_cast< const uchar * >( Buffer.constData() ) + offset
+	;
+
+	return
+		( quint32( Bytes[ 0 ] ) << 24 ) | ( quint32( Bytes[ 1 ] ) << 16 ) |
+		( quint32( Bytes[ 2 ] ) << 8 ) | quint32( Bytes[ 3 ] )
+	;
+}
+
+
+/**
+ * Reads PDV items of the P-DATA-TF PDUs making up the \a stream into \a
+ * pdvs. Returns \c false if the PDUs are malformed or any is longer than
+ * \a maxPdu.
+ */
+static bool readPdvs(
+	const QByteArray & Stream, quint32 maxPdu, QList< Pdv > & pdvs
+) {
+	int offset = 0;
+	for ( int pdu = 0; offset < Stream.size(); ++pdu ) {
+		if (
+			Stream.size() - offset < 6 ||
+			Stream.at( offset ) != '\x04' || Stream.at( offset + 1 ) != '\0'
+		) {
+			return false;
+		}
+
+		const quint32 Length = readUint32( Stream, offset + 2 );
+		const int End = offset + 6 + static_cast< int >( Length );
+		if ( Length > maxPdu || End > Stream.size() ) {
+			return false;
+		}
+
+		for ( int item = offset + 6; item < End; ) {
+			if ( End - item < 6 ) {
+				return false;
+			}
+			const int ItemLength = static_cast< int >( readUint32( Stream, item ) );
+			if ( ItemLength < 2 || item + 4 + ItemLength > End ) {
+				return false;
+			}
+
+			Pdv pdv;
+			pdv.data = Stream.mid( item + 6, ItemLength - 2 );
+			pdv.header = static_cast< quint8 >( Stream.at( item + 5 ) );
+			pdv.id = static_cast< quint8 >( Stream.at( item + 4 ) );
+			pdv.pdu = pdu;
+			pdvs.append( pdv );
+
+			item += 4 + ItemLength;
+		}
+		offset = End;
+	}
+	return true;
+}
+
+
+/**
+ * Removes the \a path with all of its contents.
+ */
+static void removeDirectory( const QString & Path ) {
+	const QDir Directory( Path );
+
+	foreach ( const QFileInfo & Entry, Directory.entryInfoList(
+		QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot
+	) ) {
+		if ( Entry.isDir() && ! Entry.isSymLink() ) {
+			removeDirectory( Entry.absoluteFilePath() );
+		}
+		else {
+			QFile::remove( Entry.absoluteFilePath() );
+		}
+	}
+	QDir().rmdir( Path );
+}
+
+
+/**
+ * Returns an empty directory of the test called \a name in the system's
+ * temporary directory.
+ */
+static QDir temporaryDirectory( const QString & Name ) {
+	const QString Path = QDir::temp().absoluteFilePath(
+		QString( "QtDicomTest-%1-%2" )
+		.arg( Name ).arg( QCoreApplication::applicationPid() )
+	);
+
+	removeDirectory( Path );
+	QDir().mkpath( Path );
+
+	return QDir( Path );
+}
+
+
+/**
+ * Waits up to 5 seconds for the file in the \a path to appear. Returns \c
+ * false if it doesn't.
+ */
+static bool waitForFile( const QString & Path ) {
+	QElapsedTimer timer;
+	timer.start();
+
+	while ( ! QFile::exists( Path ) ) {
+		if ( timer.elapsed() > 5000 ) {
+			return false;
+		}
+		QTest::qWait( 10 );
+	}
+	return true;
+}
+
+
+/**
+ * Writes the \a data to a new instance of the \a spool, and commits it as
+ * the \a sopInstanceUid when \a committed is \c true.
+ */
+static bool spoolInstance(
+	StorageScp::Spool & spool, const QByteArray & SopInstanceUid,
+	const QByteArray & Data, bool committed
+) {
+	const quint32 Instance = spool.begin();
+
+	DcmOutputStream * stream = spool.createStream( Instance );
+	stream->write( Data.constData(), Data.size() );
+	stream->flush();
+	const bool Written = stream->good() == OFTrue;
+	delete stream;
+
+	return Written && ( ! committed || spool.commit(
+		Instance, SopInstanceUid,
+		QTransferSyntax( QTransferSyntax::LittleEndian )
+	) );
+}
+
+
+void QtDicomTest::testCGetFiles() {
+	const QDir Root = temporaryDirectory( "cget" );
+	const char * const Uid = "1.2.826.0.1.3680043.2.1143.20";
+
+	// An association with a context accepted for the SCU in the SCP role
+	T_ASC_Parameters * parameters = 0;
+	QVERIFY( ASC_createAssociationParameters(
+		&parameters, ASC_DEFAULTMAXPDU
+	).good() );
+	ASC_setAPTitles( parameters, "QTDICOMTEST", "GETSCP", 0 );
+
+	const char * Syntaxes[] = { UID_LittleEndianExplicitTransferSyntax };
+	QVERIFY( ASC_addPresentationContext(
+		parameters, 1, UID_CTImageStorage, Syntaxes, 1, ASC_SC_ROLE_SCP
+	).good() );
+	QVERIFY( ASC_acceptPresentationContext(
+		parameters, 1, UID_LittleEndianExplicitTransferSyntax, ASC_SC_ROLE_SCP
+	).good() );
+
+	T_ASC_Association association;
+	memset( &association, 0, sizeof( association ) );
+	association.params = parameters;
+
+	T_DIMSE_C_StoreRQ request;
+	memset( &request, 0, sizeof( request ) );
+	request.MessageID = 1;
+	request.DataSetType = DIMSE_DATASET_PRESENT;
+	strcpy( request.AffectedSOPClassUID, UID_CTImageStorage );
+	strcpy( request.AffectedSOPInstanceUID, Uid );
+
+	DcmDataset dataset;
+	dataset.putAndInsertString( DCM_SOPClassUID, UID_CTImageStorage );
+	dataset.putAndInsertString( DCM_SOPInstanceUID, Uid );
+
+	// The instance is received twice, the second file is kept next to the
+	// first one
+	QStringList paths;
+	for ( int i = 0; i < 2; ++i ) {
+		QString path;
+		DcmOutputFileStream * stream = ServiceUser::createCGetFile(
+			request, &association, 1, Root.absolutePath(), path
+		);
+		QVERIFY( stream );
+
+		dataset.transferInit();
+		const OFCondition Written = dataset.write(
+			*stream, EXS_LittleEndianExplicit, EET_ExplicitLength, 0
+		);
+		dataset.transferEnd();
+		delete stream;
+		QVERIFY( Written.good() );
+
+		paths.append( path );
+	}
+	QCOMPARE( paths.at( 0 ), Root.absoluteFilePath( QString( Uid ) + ".dcm" ) );
+	QCOMPARE( paths.at( 1 ), Root.absoluteFilePath( QString( Uid ) + "-1.dcm" ) );
+
+	foreach ( const QString & Path, paths ) {
+		DcmFileFormat file;
+		QVERIFY( file.loadFile(
+			QFile::encodeName( Path ).constData(), EXS_Unknown, EGL_noChange,
+			DCM_MaxReadLength, ERM_fileOnly
+		).good() );
+
+		OFString value;
+		DcmMetaInfo & meta = *file.getMetaInfo();
+		QVERIFY( meta.findAndGetOFString( DCM_MediaStorageSOPClassUID, value ).good() );
+		QCOMPARE( QString( value.c_str() ), QString( UID_CTImageStorage ) );
+		QVERIFY( meta.findAndGetOFString( DCM_MediaStorageSOPInstanceUID, value ).good() );
+		QCOMPARE( QString( value.c_str() ), QString( Uid ) );
+		QVERIFY( meta.findAndGetOFString( DCM_TransferSyntaxUID, value ).good() );
+		QCOMPARE(
+			QString( value.c_str() ),
+			QString( UID_LittleEndianExplicitTransferSyntax )
+		);
+		QVERIFY( file.getDataset()->findAndGetOFString( DCM_SOPInstanceUID, value ).good() );
+		QCOMPARE( QString( value.c_str() ), QString( Uid ) );
+	}
+
+	// UIDs which aren't safe to use as names are replaced with hashes
+	strcpy( request.AffectedSOPInstanceUID, "../1.2" );
+
+	QString path;
+	DcmOutputFileStream * stream = ServiceUser::createCGetFile(
+		request, &association, 1, Root.absolutePath(), path
+	);
+	QVERIFY( stream );
+	delete stream;
+	QCOMPARE( QFileInfo( path ).absolutePath(), Root.absolutePath() );
+	QCOMPARE( QFileInfo( path ).completeBaseName().size(), 32 );
+
+	ASC_destroyAssociationParameters( &parameters );
+	removeDirectory( Root.absolutePath() );
+}
+
+
+void QtDicomTest::testKeepBothNaming() {
+	const QDir Root = temporaryDirectory( "keepboth" );
+	const QByteArray Uid = "1.2.826.0.1.3680043.2.1143.3";
+	const QString Path = Root.absoluteFilePath( Uid + ".dcm" );
+
+	StorageScp::DiskSink sink( Root, StorageScp::Flat, StorageScp::NoSync, 0, false );
+
+	// Committed one after another, duplicates take consecutive numbers
+	for ( int i = 0; i < 3; ++i ) {
+		CommitThread thread( sink, Uid, QByteArray::number( i ) );
+		thread.start();
+		thread.wait();
+
+		QCOMPARE(
+			thread.path(),
+			i == 0 ? Path : Root.absoluteFilePath(
+				QString( "%1-%2.dcm" ).arg( QString( Uid ) ).arg( i )
+			)
+		);
+		QCOMPARE( readFile( thread.path() ), QByteArray::number( i ) );
+	}
+
+	// Committed at once, each takes a name of its own
+	QList< CommitThread * > threads;
+	for ( int i = 3; i < 11; ++i ) {
+		threads.append( new CommitThread( sink, Uid, QByteArray::number( i ) ) );
+	}
+	foreach ( CommitThread * thread, threads ) {
+		thread->start();
+	}
+	QSet< QString > paths;
+	foreach ( CommitThread * thread, threads ) {
+		thread->wait();
+		QVERIFY( ! thread->path().isEmpty() );
+		paths.insert( thread->path() );
+	}
+	QCOMPARE( paths.size(), threads.size() );
+	for ( int i = 0; i < threads.size(); ++i ) {
+		QCOMPARE( readFile( threads.at( i )->path() ), QByteArray::number( i + 3 ) );
+	}
+	qDeleteAll( threads );
+
+	QCOMPARE(
+		Root.entryList( QStringList() << "*.dcm", QDir::Files ).size(), 11
+	);
+	QCOMPARE(
+		QDir( Root.absoluteFilePath( "incoming" ) ).entryList( QDir::Files ).size(),
+		0
+	);
+
+	// A target in the way is never replaced
+	const QString Source = Root.absoluteFilePath( "source.dcm" );
+	QFile source( Source );
+	QVERIFY( source.open( QIODevice::WriteOnly ) );
+	source.write( "source" );
+	source.close();
+
+	bool exists = false;
+	QVERIFY( ! StorageScp::DiskSink::moveFile( Source, Path, &exists ) );
+	QVERIFY( exists );
+	QCOMPARE( readFile( Path ), QByteArray( "0" ) );
+	QCOMPARE( readFile( Source ), QByteArray( "source" ) );
+
+	removeDirectory( Root.absolutePath() );
+}
+
+
+void QtDicomTest::testPdvPacking() {
+	static const quint32 MaxPdu = 64;
+	static const unsigned char Id = 3;
+
+	// Each PDV item takes 6 bytes besides its data
+	static const int Room = MaxPdu - 6;
+
+	// A single fragment of no data, of as much as fits, one byte more, and
+	// several full PDUs
+	const int Sizes[] = { 0, Room, Room + 1, 3 * Room };
+	for ( int n = 0; n < 4; ++n ) {
+		const int Size = Sizes[ n ];
+		QByteArray data( Size, '\0' );
+		for ( int i = 0; i < Size; ++i ) {
+			data[ i ] = static_cast< char >( i );
+		}
+
+		QByteArray stream;
+		int pdu = -1;
+		AbstractService::appendPdvs( stream, pdu, MaxPdu, data, Id, false );
+		AbstractService::closePdu( stream, pdu );
+		QCOMPARE( pdu, -1 );
+
+		QList< Pdv > pdvs;
+		QVERIFY( readPdvs( stream, MaxPdu, pdvs ) );
+		QCOMPARE( pdvs.size(), qMax( 1, ( Size + Room - 1 ) / Room ) );
+
+		QByteArray received;
+		for ( int i = 0; i < pdvs.size(); ++i ) {
+			const Pdv & Item = pdvs.at( i );
+			QCOMPARE( Item.pdu, i );
+			QCOMPARE( Item.id, quint8( Id ) );
+			QCOMPARE( Item.header, quint8( i == pdvs.size() - 1 ? 0x02 : 0x00 ) );
+			received += Item.data;
+		}
+		QCOMPARE( received, data );
+	}
+
+	// Responses share PDUs and Data Sets are split where one is full; a
+	// command filling a PDU up moves its Data Set to the next one, without
+	// an empty fragment in between
+	const QByteArray Command( 10, 'c' );
+	const QByteArray FullCommand( Room, 'f' );
+	const QByteArray Identifier( 14, 'i' );
+
+	QByteArray stream;
+	int pdu = -1;
+	AbstractService::appendPdvs( stream, pdu, MaxPdu, Command, Id, true );
+	AbstractService::appendPdvs( stream, pdu, MaxPdu, Identifier, Id, false );
+	AbstractService::appendPdvs( stream, pdu, MaxPdu, Command, Id, true );
+	AbstractService::appendPdvs( stream, pdu, MaxPdu, Identifier, Id, false );
+	AbstractService::closePdu( stream, pdu );
+	AbstractService::appendPdvs( stream, pdu, MaxPdu, FullCommand, Id, true );
+	AbstractService::appendPdvs( stream, pdu, MaxPdu, Identifier, Id, false );
+	AbstractService::closePdu( stream, pdu );
+
+	QList< Pdv > pdvs;
+	QVERIFY( readPdvs( stream, MaxPdu, pdvs ) );
+	QCOMPARE( pdvs.size(), 7 );
+
+	// Items of 16, 20 and 16 bytes leave room for 6 bytes of the second
+	// Data Set in the first PDU
+	const int Pdus[] = { 0, 0, 0, 0, 1, 2, 3 };
+	const quint8 Headers[] = { 0x03, 0x02, 0x03, 0x00, 0x02, 0x03, 0x02 };
+	for ( int i = 0; i < pdvs.size(); ++i ) {
+		QCOMPARE( pdvs.at( i ).pdu, Pdus[ i ] );
+		QCOMPARE( pdvs.at( i ).header, Headers[ i ] );
+	}
+	QCOMPARE( readUint32( stream, 2 ), MaxPdu );
+	QCOMPARE( pdvs.at( 3 ).data.size(), 6 );
+	QCOMPARE( pdvs.at( 3 ).data + pdvs.at( 4 ).data, Identifier );
+	QCOMPARE( pdvs.at( 5 ).data, FullCommand );
+	QCOMPARE( pdvs.at( 6 ).data, Identifier );
+}
+
+
+void QtDicomTest::testQueryCacheInvalidation() {
+	TestDataSource source( 3 );
+	QueryScp scp( &source );
+	QueryScp::ReceiverThread thread( 0 );
+	const Dataset Mask = imageMask();
+
+	// Within the refresh interval queries don't refresh the source, so the
+	// second one is answered from the cache
+	for ( int query = 1; query <= 2; ++query ) {
+		thread.state_ = QueryScp::ReceiverThread::QueryInProgress;
+		thread.query_ = query;
+		thread.queue_.clear();
+
+		scp.match( Mask, query, &thread );
+		QCOMPARE( thread.queue_.size(), 3 );
+		QCOMPARE( thread.status_, int( STATUS_Success ) );
+	}
+	QCOMPARE( scp.cache_->hits(), quint64( 1 ) );
+	QCOMPARE( source.refreshes(), 0 );
+
+	// The source is refreshed in the background instead, and a refresh
+	// changing it bumps its generation
+	const quint64 Generation = source.generation();
+	scp.setRefreshInterval( 10 );
+	scp.startRefreshTimer();
+	QTest::qWait( 100 );
+	scp.refreshTimer_.stop();
+	QVERIFY( source.refreshes() > 0 );
+	QVERIFY( source.generation() > Generation );
+
+	// Results cached at the previous generation are stale
+	thread.state_ = QueryScp::ReceiverThread::QueryInProgress;
+	thread.query_ = 3;
+	thread.queue_.clear();
+
+	scp.match( Mask, 3, &thread );
+	QCOMPARE( thread.queue_.size(), 3 );
+	QCOMPARE( scp.cache_->hits(), quint64( 1 ) );
+	QCOMPARE( scp.cache_->misses(), quint64( 2 ) );
+}
+
+
+void QtDicomTest::testQueryCancellationAndLimits() {
+	TestDataSource source( 5 );
+	QueryScp scp( &source );
+	QueryScp::ReceiverThread thread( 0 );
+	const Dataset Mask = imageMask();
+
+	// Exactly as many matches as allowed aren't refused
+	scp.setMaxResults( 5 );
+	thread.state_ = QueryScp::ReceiverThread::QueryInProgress;
+	thread.query_ = 1;
+
+	scp.match( Mask, 1, &thread );
+	QCOMPARE( thread.state_, QueryScp::ReceiverThread::QueryFinishing );
+	QCOMPARE( thread.status_, int( STATUS_Success ) );
+	QCOMPARE( thread.queue_.size(), 5 );
+
+	// More are refused, both from the cache and when matched, after the
+	// allowed ones are queued
+	scp.setMaxResults( 3 );
+	for ( int query = 2; query <= 3; ++query ) {
+		if ( query == 3 ) {
+			scp.setCacheCapacity( 0 );
+		}
+		thread.state_ = QueryScp::ReceiverThread::QueryInProgress;
+		thread.query_ = query;
+		thread.queue_.clear();
+
+		scp.match( Mask, query, &thread );
+		QCOMPARE( thread.status_, int( STATUS_FIND_Refused_OutOfResources ) );
+		QCOMPARE( thread.queue_.size(), 3 );
+	}
+	QCOMPARE( scp.cache_->hits(), quint64( 1 ) );
+
+	// A query cancelled before it's matched queues nothing, is left to the
+	// receiver to answer, and isn't cached
+	scp.setCacheCapacity( 64 );
+	scp.setMaxResults( 0 );
+	thread.state_ = QueryScp::ReceiverThread::ReceivingCommands;
+	thread.query_ = 4;
+	thread.status_ = -1;
+	thread.queue_.clear();
+
+	scp.match( Mask, 4, &thread );
+	QCOMPARE( thread.state_, QueryScp::ReceiverThread::ReceivingCommands );
+	QCOMPARE( thread.status_, -1 );
+	QCOMPARE( thread.queue_.size(), 0 );
+
+	const quint64 Misses = scp.cache_->misses();
+	thread.state_ = QueryScp::ReceiverThread::QueryInProgress;
+	thread.query_ = 5;
+
+	scp.match( Mask, 5, &thread );
+	QCOMPARE( scp.cache_->misses(), Misses + 1 );
+	QCOMPARE( thread.queue_.size(), 5 );
+
+	// Late identifiers and responses of an earlier query are ignored
+	thread.state_ = QueryScp::ReceiverThread::QueryInProgress;
+	thread.query_ = 6;
+	thread.queue_.clear();
+
+	thread.queueIdentifier( 5, Dataset() );
+	thread.finish( 5, STATUS_Success );
+	QCOMPARE( thread.state_, QueryScp::ReceiverThread::QueryInProgress );
+	QCOMPARE( thread.queue_.size(), 0 );
+}
 
 
 void QtDicomTest::testRequestorAssociation() {
-}
\ No newline at end of file
+}
+
+
+void QtDicomTest::testSpoolRecovery() {
+	const QDir Root = temporaryDirectory( "spool" );
+	const QByteArray Committed = "1.2.826.0.1.3680043.2.1143.1";
+	const QByteArray Uncommitted = "1.2.826.0.1.3680043.2.1143.2";
+	const QByteArray Data( 300 * 1024, 'c' );
+	const QString Path = Root.absoluteFilePath( Committed + ".dcm" );
+
+	// A file in place of the incoming directory makes compaction fail, so
+	// the committed instance is left in the spool, as after a crash
+	const QString Blocker = Root.absoluteFilePath( "incoming" );
+	QFile blocker( Blocker );
+	QVERIFY( blocker.open( QIODevice::WriteOnly ) );
+	blocker.close();
+
+	{
+		StorageScp::Spool spool(
+			Root, StorageScp::Flat, false, 0,
+			QSharedPointer< StorageScp::InstanceIndex >(),
+			QSharedPointer< StorageScp::Compressor >()
+		);
+		QVERIFY( spoolInstance( spool, Committed, Data, true ) );
+		QVERIFY( spoolInstance( spool, Uncommitted, "torn", false ) );
+	}
+	QVERIFY( ! QFile::exists( Path ) );
+	QVERIFY( QFile::remove( Blocker ) );
+
+	// The next spool replays the commit record
+	{
+		StorageScp::Spool spool(
+			Root, StorageScp::Flat, false, 0,
+			QSharedPointer< StorageScp::InstanceIndex >(),
+			QSharedPointer< StorageScp::Compressor >()
+		);
+		QVERIFY( waitForFile( Path ) );
+	}
+	QCOMPARE( readFile( Path ), Data );
+	QVERIFY( ! QFile::exists( Root.absoluteFilePath( Uncommitted + ".dcm" ) ) );
+
+	// The compaction record keeps the instance from being compacted again,
+	// which would store a numbered copy next to the first one
+	{
+		StorageScp::Spool spool(
+			Root, StorageScp::Flat, false, 0,
+			QSharedPointer< StorageScp::InstanceIndex >(),
+			QSharedPointer< StorageScp::Compressor >()
+		);
+		QTest::qWait( 500 );
+	}
+	QVERIFY( ! QFile::exists( Root.absoluteFilePath( Committed + "-1.dcm" ) ) );
+	QCOMPARE(
+		QDir( Root.absoluteFilePath( "spool" ) ).entryList(
+			QStringList() << "segment-*.wal", QDir::Files
+		).size(), 1
+	);
+
+	removeDirectory( Root.absolutePath() );
+}
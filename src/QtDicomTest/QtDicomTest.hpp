@@ -15,6 +15,47 @@ class QtDicomTest : public QObject {
 	public :
 	public slots :
 		void testRequestorAssociation();
+
+	private slots :
+		/**
+		 * Files of instances received through C-GET are Part 10 files with
+		 * File Meta Information, named after sanitized SOP Instance UIDs,
+		 * never overwriting each other.
+		 */
+		void testCGetFiles();
+
+		/**
+		 * Duplicates kept by the disk sink, also when committed at once,
+		 * are stored under numbered names and never replace each other.
+		 */
+		void testKeepBothNaming();
+
+		/**
+		 * PDV items are packed into as few P-DATA-TF PDUs as they fit in,
+		 * none of them longer than the peer's maximum, and split only at
+		 * PDU boundaries.
+		 */
+		void testPdvPacking();
+
+		/**
+		 * Queries are answered from the cache without refreshing the data
+		 * source, which is refreshed in the background; a refresh changing
+		 * the source invalidates cached results.
+		 */
+		void testQueryCacheInvalidation();
+
+		/**
+		 * Queries producing more identifiers than allowed are refused once
+		 * the allowed ones are queued; cancelled queries stop matching and
+		 * aren't answered nor cached.
+		 */
+		void testQueryCancellationAndLimits();
+
+		/**
+		 * Committed instances left by a spool are compacted by the next
+		 * one, exactly once; those never committed are dropped.
+		 */
+		void testSpoolRecovery();
 };
 
 #endif